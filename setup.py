@@ -72,6 +72,14 @@ else:
     with open(fn_version, 'w') as fh:
         fh.write(version_template.format(__version__))
 
+# The C extension uses OpenMP for some of the low-level routines. Set the
+# environment variable YAFF_NO_OPENMP to compile without it, e.g. when the
+# compiler does not support OpenMP.
+if os.environ.get('YAFF_NO_OPENMP') is None:
+    openmp_flags = ['-fopenmp']
+else:
+    openmp_flags = []
+
 
 setup(
     name='yaff',
@@ -98,7 +106,8 @@ setup(
                      'yaff/pes/pair_pot.c', 'yaff/pes/ewald.c',
                      'yaff/pes/dlist.c', 'yaff/pes/grid.c', 'yaff/pes/iclist.c',
                      'yaff/pes/vlist.c', 'yaff/pes/cell.c',
-                     'yaff/pes/truncation.c', 'yaff/pes/slater.c'],
+                     'yaff/pes/truncation.c', 'yaff/pes/slater.c',
+                     'yaff/pes/tree.c'],
             depends=['yaff/pes/nlist.h', 'yaff/pes/nlist.pxd',
                      'yaff/pes/pair_pot.h', 'yaff/pes/pair_pot.pxd',
                      'yaff/pes/ewald.h', 'yaff/pes/ewald.pxd',
@@ -109,8 +118,11 @@ setup(
                      'yaff/pes/cell.h', 'yaff/pes/cell.pxd',
                      'yaff/pes/truncation.h', 'yaff/pes/truncation.pxd',
                      'yaff/pes/slater.h', 'yaff/pes/slater.pxd',
+                     'yaff/pes/tree.h', 'yaff/pes/tree.pxd',
                      'yaff/pes/constants.h'],
             include_dirs=[np.get_include()],
+            extra_compile_args=openmp_flags,
+            extra_link_args=openmp_flags,
         ),
     ],
     classifiers=[
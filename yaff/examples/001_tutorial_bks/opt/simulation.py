@@ -82,8 +82,9 @@ system = System.from_file('../init/init.chk')
 #   The skim parameter
 #
 # reci_ewald
-#   Method for the computation of the reciprocal term in the Ewald sum. For now,
-#   only 'ewald' and 'ignore' are supported.
+#   Method for the computation of the reciprocal term in the Ewald sum. This is
+#   one of 'ewald', 'pme' (smooth particle mesh Ewald), 'dsf' (damped shifted
+#   force), 'fmm' (tree code, 0D only) or 'ignore'.
 ff = ForceField.generate(system, '../bks.pot', rcut=20*angstrom, alpha_scale=4.0,
                          gcut_scale=2.0, smooth_ei=True, reci_ei='ewald')
 
@@ -29,21 +29,412 @@
 #include "cell.h"
 #include <stdio.h>
 
-double compute_ewald_reci(double *pos, long natom, double *charges,
-                          cell_type* cell, double alpha, long *gmax, double
-                          gcut, double dielectric, double *gpos, double *work,
-                          double* vtens) {
-  long g0, g1, g2, i;
-  double energy, k[3], ksq, cosfac, sinfac, x, c, s, fac1, fac2, dielectric_factor;
-  double kvecs[9];
-  for (i=0; i<9; i++) {
-    kvecs[i] = M_TWO_PI*(*cell).gvecs[i];
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// The minimal number of atoms times rows of k-vectors per chunk, such that
+// small systems are not split over threads.
+#define EWALD_CHUNK_MIN 4096
+
+
+// Tables with the phase factors exp(i*2*pi*g*gvecs[d].r) of all atoms for
+// g=0..gmax[d] along each reciprocal cell vector d. The phase factor of any
+// k-vector is a product of three table entries, such that the loops over the
+// atoms do not need to call cos or sin.
+typedef struct {
+  long natom;
+  double *table[3];  // for each d: cos and sin, indexed by [g][atom]
+} ewald_phases_type;
+
+
+static void ewald_phases_free(ewald_phases_type *phases) {
+  free((*phases).table[0]);
+}
+
+
+static int ewald_phases_init(ewald_phases_type *phases, double *pos, long natom,
+                             cell_type *cell, long *gmax) {
+  // Returns 0 on success and -1 when memory allocation failed.
+  long d, g, i, size;
+  double x, c, s, *row, *prev, *first;
+  size = 0;
+  for (d=0; d<3; d++) {
+    size += 2*natom*(gmax[d]+1);
   }
+  (*phases).natom = natom;
+  (*phases).table[0] = malloc(size*sizeof(double));
+  if ((*phases).table[0] == NULL) return -1;
+  (*phases).table[1] = (*phases).table[0] + 2*natom*(gmax[0]+1);
+  (*phases).table[2] = (*phases).table[1] + 2*natom*(gmax[1]+1);
+  for (d=0; d<3; d++) {
+    row = (*phases).table[d];
+    for (i=0; i<natom; i++) {
+      row[2*i] = 1.0;
+      row[2*i+1] = 0.0;
+    }
+    if (gmax[d] < 1) continue;
+    first = row + 2*natom;
+    for (i=0; i<natom; i++) {
+      x = M_TWO_PI*((*cell).gvecs[3*d]*pos[3*i] + (*cell).gvecs[3*d+1]*pos[3*i+1] +
+                    (*cell).gvecs[3*d+2]*pos[3*i+2]);
+      first[2*i] = cos(x);
+      first[2*i+1] = sin(x);
+    }
+    // Higher multiples follow from the recurrence exp(i*g*x) = exp(i*(g-1)*x)*exp(i*x).
+    for (g=2; g<=gmax[d]; g++) {
+      prev = (*phases).table[d] + 2*natom*(g-1);
+      row = prev + 2*natom;
+      for (i=0; i<natom; i++) {
+        c = prev[2*i];
+        s = prev[2*i+1];
+        row[2*i] = c*first[2*i] - s*first[2*i+1];
+        row[2*i+1] = c*first[2*i+1] + s*first[2*i];
+      }
+    }
+  }
+  return 0;
+}
+
+
+static void ewald_phases_select(ewald_phases_type *phases, long g0, long g1,
+                                double *phase01) {
+  // Stores the products of the phase factors along the first two reciprocal
+  // cell vectors in phase01. Negative multiples are the complex conjugates.
+  long i, natom;
+  double c0, s0, c1, s1, sign0, sign1, *row0, *row1;
+  natom = (*phases).natom;
+  row0 = (*phases).table[0] + 2*natom*labs(g0);
+  row1 = (*phases).table[1] + 2*natom*labs(g1);
+  sign0 = (g0 < 0) ? -1.0 : 1.0;
+  sign1 = (g1 < 0) ? -1.0 : 1.0;
+  for (i=0; i<natom; i++) {
+    c0 = row0[2*i];
+    s0 = sign0*row0[2*i+1];
+    c1 = row1[2*i];
+    s1 = sign1*row1[2*i+1];
+    phase01[2*i] = c0*c1 - s0*s1;
+    phase01[2*i+1] = c0*s1 + s0*c1;
+  }
+}
+
+
+static inline void ewald_phase(ewald_phases_type *phases, double *phase01,
+                               long g2, long i, double *c, double *s) {
+  // Sets c and s to the cosine and sine of k.r for atom i, where k is the
+  // k-vector for the g0 and g1 selected in phase01, and the given g2 >= 0.
+  double *p01, *p2;
+  p01 = phase01 + 2*i;
+  p2 = (*phases).table[2] + 2*((*phases).natom*g2 + i);
+  *c = p01[0]*p2[0] - p01[1]*p2[1];
+  *s = p01[0]*p2[1] + p01[1]*p2[0];
+}
+
+
+// The arguments shared by all threads in the reciprocal Ewald sums.
+typedef struct {
+  long natom;
+  double *charges;
+  double *dipoles;
+  ewald_kvec_type *kvecs;
+  long nrow;
+  long *row_start;  // the first k-vector of each row (one extra at the end)
+  ewald_phases_type phases;
+} ewald_args_type;
+
+
+// Computes the contributions of every nchunk-th row of k-vectors, starting at
+// row ichunk, where a row consists of all k-vectors with the same g0 and g1.
+// The buffers phase01 and work must each hold 2*natom doubles.
+typedef double (*ewald_range_fn_type)(ewald_args_type *args, long ichunk,
+                                      long nchunk, double *phase01,
+                                      double *work, double *gpos,
+                                      double *vtens);
+
+
+static double ewald_reci_range(ewald_args_type *args, long ichunk, long nchunk,
+                               double *phase01, double *work, double *gpos,
+                               double *vtens) {
+  long irow, j, i, natom;
+  double energy, k[3], cosfac, sinfac, x, c, s;
+  double *charges;
+  ewald_kvec_type *kvec;
+  natom = (*args).natom;
+  charges = (*args).charges;
   energy = 0.0;
+  for (irow=ichunk; irow<(*args).nrow; irow+=nchunk) {
+    kvec = (*args).kvecs + (*args).row_start[irow];
+    ewald_phases_select(&(*args).phases, (*kvec).g0, (*kvec).g1, phase01);
+    for (j=(*args).row_start[irow]; j<(*args).row_start[irow+1]; j++) {
+      kvec = (*args).kvecs + j;
+      k[0] = (*kvec).k0;
+      k[1] = (*kvec).k1;
+      k[2] = (*kvec).k2;
+      cosfac = 0.0;
+      sinfac = 0.0;
+      for (i=0; i<natom; i++) {
+        ewald_phase(&(*args).phases, phase01, (*kvec).g2, i, &c, &s);
+        c *= charges[i];
+        s *= charges[i];
+        cosfac += c;
+        sinfac += s;
+        if (gpos != NULL) {
+          work[2*i] = c;
+          work[2*i+1] = -s;
+        }
+      }
+      c = (*kvec).prefac;
+      s = (cosfac*cosfac+sinfac*sinfac);
+      energy += c*s;
+      if (gpos != NULL) {
+        x = 2.0*c;
+        cosfac *= x;
+        sinfac *= x;
+        for (i=0; i<natom; i++) {
+          x = cosfac*work[2*i+1] + sinfac*work[2*i];
+          gpos[3*i] += k[0]*x;
+          gpos[3*i+1] += k[1]*x;
+          gpos[3*i+2] += k[2]*x;
+        }
+      }
+      if (vtens != NULL) {
+        c *= (*kvec).vfac*s;
+        vtens[0] += c*k[0]*k[0];
+        vtens[4] += c*k[1]*k[1];
+        vtens[8] += c*k[2]*k[2];
+        x = c*k[1]*k[0];
+        vtens[1] += x;
+        vtens[3] += x;
+        x = c*k[2]*k[0];
+        vtens[2] += x;
+        vtens[6] += x;
+        x = c*k[2]*k[1];
+        vtens[5] += x;
+        vtens[7] += x;
+      }
+    }
+  }
+  return energy;
+}
+
+
+static double ewald_reci_dd_range(ewald_args_type *args, long ichunk,
+                                  long nchunk, double *phase01, double *work,
+                                  double *gpos, double *vtens) {
+  long irow, j, i, natom;
+  double energy, k[3], cosfac_dd[3], sinfac_dd[3], x, c, s;
+  double cosfac, sinfac, cx, sx, kdip;
+  double *charges, *dipoles;
+  ewald_kvec_type *kvec;
+  natom = (*args).natom;
+  charges = (*args).charges;
+  dipoles = (*args).dipoles;
+  energy = 0.0;
+  for (irow=ichunk; irow<(*args).nrow; irow+=nchunk) {
+    kvec = (*args).kvecs + (*args).row_start[irow];
+    ewald_phases_select(&(*args).phases, (*kvec).g0, (*kvec).g1, phase01);
+    for (j=(*args).row_start[irow]; j<(*args).row_start[irow+1]; j++) {
+      kvec = (*args).kvecs + j;
+      k[0] = (*kvec).k0;
+      k[1] = (*kvec).k1;
+      k[2] = (*kvec).k2;
+      cosfac_dd[0] = 0.0;
+      cosfac_dd[1] = 0.0;
+      cosfac_dd[2] = 0.0;
+      sinfac_dd[0] = 0.0;
+      sinfac_dd[1] = 0.0;
+      sinfac_dd[2] = 0.0;
+      cosfac = 0.0;
+      sinfac = 0.0;
+      for (i=0; i<natom; i++) {
+        ewald_phase(&(*args).phases, phase01, (*kvec).g2, i, &cx, &sx);
+        kdip = k[0]*dipoles[3*i+0] + k[1]*dipoles[3*i+1] + k[2]*dipoles[3*i+2];
+        c = charges[i]*cx + kdip*sx;
+        s = charges[i]*sx - kdip*cx;
+        cosfac += c;
+        sinfac += s;
+        if (gpos != NULL) {
+          work[2*i+0] = c;
+          work[2*i+1] = -s;
+        }
+        if (vtens != NULL){
+            cosfac_dd[0] +=-dipoles[3*i+0]*sx;
+            cosfac_dd[1] +=-dipoles[3*i+1]*sx;
+            cosfac_dd[2] +=-dipoles[3*i+2]*sx;
+            sinfac_dd[0] += dipoles[3*i+0]*cx;
+            sinfac_dd[1] += dipoles[3*i+1]*cx;
+            sinfac_dd[2] += dipoles[3*i+2]*cx;
+        }
+      }
+      c = (*kvec).prefac;
+      s = (cosfac*cosfac+sinfac*sinfac);
+      energy += c*s;
+      if (gpos != NULL) {
+        x = 2.0*c;
+        cosfac *= x;
+        sinfac *= x;
+        for (i=0; i<natom; i++) {
+          x = cosfac*work[2*i+1] + sinfac*work[2*i];
+          gpos[3*i+0] += k[0]*x;
+          gpos[3*i+1] += k[1]*x;
+          gpos[3*i+2] += k[2]*x;
+        }
+      }
+      if (vtens != NULL) {
+        c *= (*kvec).vfac*s;
+        vtens[0] += c*k[0]*k[0] + cosfac_dd[0]*k[0]*cosfac + sinfac_dd[0]*k[0]*sinfac;
+        vtens[4] += c*k[1]*k[1] + cosfac_dd[1]*k[1]*cosfac + sinfac_dd[1]*k[1]*sinfac;
+        vtens[8] += c*k[2]*k[2] + cosfac_dd[2]*k[2]*cosfac + sinfac_dd[2]*k[2]*sinfac;
+        x = c*k[1]*k[0];
+        vtens[1] += x + cosfac_dd[0]*k[1]*cosfac + sinfac_dd[0]*k[1]*sinfac;
+        vtens[3] += x + cosfac_dd[1]*k[0]*cosfac + sinfac_dd[1]*k[0]*sinfac;
+        x = c*k[2]*k[0];
+        vtens[2] += x + cosfac_dd[0]*k[2]*cosfac + sinfac_dd[0]*k[2]*sinfac;
+        vtens[6] += x + cosfac_dd[2]*k[0]*cosfac + sinfac_dd[2]*k[0]*sinfac;
+        x = c*k[2]*k[1];
+        vtens[5] += x + cosfac_dd[1]*k[2]*cosfac + sinfac_dd[1]*k[2]*sinfac;
+        vtens[7] += x + cosfac_dd[2]*k[1]*cosfac + sinfac_dd[2]*k[1]*sinfac;
+      }
+    }
+  }
+  return energy;
+}
+
+
+static void ewald_args_free(ewald_args_type *args) {
+  free((*args).row_start);
+  ewald_phases_free(&(*args).phases);
+}
+
+
+static int ewald_args_init(ewald_args_type *args, double *pos, long natom,
+                           double *charges, double *dipoles, cell_type *cell,
+                           ewald_kvec_type *kvecs, long nkvec) {
+  // Splits the k-vectors in rows and prepares the tables with phase factors
+  // up to the largest multiples of the reciprocal cell vectors in kvecs.
+  // Returns 0 on success and -1 when memory allocation failed.
+  long j, irow, gmax[3];
+  (*args).natom = natom;
+  (*args).charges = charges;
+  (*args).dipoles = dipoles;
+  (*args).kvecs = kvecs;
+  (*args).nrow = 0;
+  gmax[0] = 0;
+  gmax[1] = 0;
+  gmax[2] = 0;
+  for (j=0; j<nkvec; j++) {
+    if ((j == 0) || (kvecs[j].g0 != kvecs[j-1].g0) || (kvecs[j].g1 != kvecs[j-1].g1)) {
+      (*args).nrow++;
+    }
+    if (labs(kvecs[j].g0) > gmax[0]) gmax[0] = labs(kvecs[j].g0);
+    if (labs(kvecs[j].g1) > gmax[1]) gmax[1] = labs(kvecs[j].g1);
+    if (kvecs[j].g2 > gmax[2]) gmax[2] = kvecs[j].g2;
+  }
+  (*args).row_start = malloc(((*args).nrow+1)*sizeof(long));
+  if ((*args).row_start == NULL) return -1;
+  irow = 0;
+  for (j=0; j<nkvec; j++) {
+    if ((j == 0) || (kvecs[j].g0 != kvecs[j-1].g0) || (kvecs[j].g1 != kvecs[j-1].g1)) {
+      (*args).row_start[irow] = j;
+      irow++;
+    }
+  }
+  (*args).row_start[(*args).nrow] = nkvec;
+  if (ewald_phases_init(&(*args).phases, pos, natom, cell, gmax) != 0) {
+    free((*args).row_start);
+    return -1;
+  }
+  return 0;
+}
+
+
+static double ewald_parallel(ewald_range_fn_type range_fn, ewald_args_type *args,
+                             double *gpos, double *work, double *vtens) {
+  // Distributes the rows of k-vectors in a round-robin fashion over chunks,
+  // which are computed in parallel. Each chunk has its own buffers and its
+  // own energy, gpos and vtens accumulators, which are added in the order of
+  // the chunks afterwards. As in pair_pot_parallel, the results only depend
+  // on the number of chunks, not on the order in which the threads finish.
+  // When memory allocation fails, or when the system is small, everything is
+  // computed in a single chunk with the work array of the caller. Returns
+  // NaN when even that is impossible.
+  long i, ichunk, nchunk, natom, nrow, chunk_size;
+  double energy, *chunk_energies, *chunk_buffers, *chunk_gpos, *chunk_vtens;
+  double *phase01;
+  natom = (*args).natom;
+  nrow = (*args).nrow;
+#ifdef _OPENMP
+  nchunk = omp_get_max_threads();
+#else
+  nchunk = 1;
+#endif
+  if (nchunk > (nrow*natom)/EWALD_CHUNK_MIN) nchunk = (nrow*natom)/EWALD_CHUNK_MIN;
+  if (nchunk > 1) {
+    chunk_size = 4*natom;
+    chunk_energies = calloc(nchunk, sizeof(double));
+    chunk_buffers = malloc(nchunk*chunk_size*sizeof(double));
+    chunk_gpos = NULL;
+    if (gpos != NULL) chunk_gpos = calloc(nchunk*3*natom, sizeof(double));
+    chunk_vtens = NULL;
+    if (vtens != NULL) chunk_vtens = calloc(nchunk*9, sizeof(double));
+    if ((chunk_energies != NULL) && (chunk_buffers != NULL) &&
+        ((gpos == NULL) || (chunk_gpos != NULL)) &&
+        ((vtens == NULL) || (chunk_vtens != NULL))) {
+      #pragma omp parallel for schedule(static, 1)
+      for (ichunk=0; ichunk<nchunk; ichunk++) {
+        chunk_energies[ichunk] = range_fn(args, ichunk, nchunk,
+          chunk_buffers + chunk_size*ichunk,
+          chunk_buffers + chunk_size*ichunk + 2*natom,
+          (gpos == NULL) ? NULL : chunk_gpos + 3*natom*ichunk,
+          (vtens == NULL) ? NULL : chunk_vtens + 9*ichunk);
+      }
+      // Reduction in a fixed order.
+      energy = 0.0;
+      for (ichunk=0; ichunk<nchunk; ichunk++) energy += chunk_energies[ichunk];
+      if (gpos != NULL) {
+        #pragma omp parallel for private(ichunk)
+        for (i=0; i<3*natom; i++) {
+          for (ichunk=0; ichunk<nchunk; ichunk++) gpos[i] += chunk_gpos[3*natom*ichunk+i];
+        }
+      }
+      if (vtens != NULL) {
+        for (ichunk=0; ichunk<nchunk; ichunk++) {
+          for (i=0; i<9; i++) vtens[i] += chunk_vtens[9*ichunk+i];
+        }
+      }
+      free(chunk_energies);
+      free(chunk_buffers);
+      free(chunk_gpos);
+      free(chunk_vtens);
+      return energy;
+    }
+    free(chunk_energies);
+    free(chunk_buffers);
+    free(chunk_gpos);
+    free(chunk_vtens);
+  }
+  phase01 = malloc(2*natom*sizeof(double));
+  if (phase01 == NULL) return NAN;
+  energy = range_fn(args, 0, 1, phase01, work, gpos, vtens);
+  free(phase01);
+  return energy;
+}
+
+
+long compute_ewald_kvecs(cell_type *cell, double alpha, long *gmax,
+                         double gcut, ewald_kvec_type *kvecs) {
+  long g0, g1, g2, i, nkvec;
+  double k[3], ksq, fac1, fac2;
+  double kvecs0[9];
+  for (i=0; i<9; i++) {
+    kvecs0[i] = M_TWO_PI*(*cell).gvecs[i];
+  }
   fac1 = M_FOUR_PI/(*cell).volume;
   fac2 = 0.25/alpha/alpha;
   gcut *= M_TWO_PI;
   gcut *= gcut;
+  nkvec = 0;
   for (g0=-gmax[0]; g0 <= gmax[0]; g0++) {
     for (g1=-gmax[1]; g1 <= gmax[1]; g1++) {
       for (g2=0; g2 <= gmax[2]; g2++) {
@@ -51,56 +442,36 @@ double compute_ewald_reci(double *pos, long natom, double *charges,
           if (g1<0) continue;
           if ((g1==0)&&(g0<=0)) continue;
         }
-        k[0] = (g0*kvecs[0] + g1*kvecs[3] + g2*kvecs[6]);
-        k[1] = (g0*kvecs[1] + g1*kvecs[4] + g2*kvecs[7]);
-        k[2] = (g0*kvecs[2] + g1*kvecs[5] + g2*kvecs[8]);
+        k[0] = (g0*kvecs0[0] + g1*kvecs0[3] + g2*kvecs0[6]);
+        k[1] = (g0*kvecs0[1] + g1*kvecs0[4] + g2*kvecs0[7]);
+        k[2] = (g0*kvecs0[2] + g1*kvecs0[5] + g2*kvecs0[8]);
         ksq = k[0]*k[0] + k[1]*k[1] + k[2]*k[2];
         if (ksq > gcut) continue;
-        cosfac = 0.0;
-        sinfac = 0.0;
-        for (i=0; i<natom; i++) {
-          x = k[0]*pos[3*i] + k[1]*pos[3*i+1] + k[2]*pos[3*i+2];
-          c = charges[i]*cos(x);
-          s = charges[i]*sin(x);
-          cosfac += c;
-          sinfac += s;
-          if (gpos != NULL) {
-            work[2*i] = c;
-            work[2*i+1] = -s;
-          }
-        }
-        c = fac1*exp(-ksq*fac2)/ksq;
-        s = (cosfac*cosfac+sinfac*sinfac);
-        energy += c*s;
-        if (gpos != NULL) {
-          x = 2.0*c;
-          cosfac *= x;
-          sinfac *= x;
-          for (i=0; i<natom; i++) {
-            x = cosfac*work[2*i+1] + sinfac*work[2*i];
-            gpos[3*i] += k[0]*x;
-            gpos[3*i+1] += k[1]*x;
-            gpos[3*i+2] += k[2]*x;
-          }
-        }
-        if (vtens != NULL) {
-          c *= 2.0*(1.0/ksq+fac2)*s;
-          vtens[0] += c*k[0]*k[0];
-          vtens[4] += c*k[1]*k[1];
-          vtens[8] += c*k[2]*k[2];
-          x = c*k[1]*k[0];
-          vtens[1] += x;
-          vtens[3] += x;
-          x = c*k[2]*k[0];
-          vtens[2] += x;
-          vtens[6] += x;
-          x = c*k[2]*k[1];
-          vtens[5] += x;
-          vtens[7] += x;
-        }
+        kvecs[nkvec].g0 = g0;
+        kvecs[nkvec].g1 = g1;
+        kvecs[nkvec].g2 = g2;
+        kvecs[nkvec].k0 = k[0];
+        kvecs[nkvec].k1 = k[1];
+        kvecs[nkvec].k2 = k[2];
+        kvecs[nkvec].prefac = fac1*exp(-ksq*fac2)/ksq;
+        kvecs[nkvec].vfac = 2.0*(1.0/ksq+fac2);
+        nkvec++;
       }
     }
   }
+  return nkvec;
+}
+
+double compute_ewald_reci(double *pos, long natom, double *charges,
+                          cell_type* cell, ewald_kvec_type *kvecs, long nkvec,
+                          double dielectric, double *gpos, double *work,
+                          double* vtens) {
+  long i;
+  double energy, dielectric_factor;
+  ewald_args_type args;
+  if (ewald_args_init(&args, pos, natom, charges, NULL, cell, kvecs, nkvec) != 0) return NAN;
+  energy = ewald_parallel(ewald_reci_range, &args, gpos, work, vtens);
+  ewald_args_free(&args);
   if (vtens != NULL) {
     vtens[0] -= energy;
     vtens[4] -= energy;
@@ -127,92 +498,13 @@ double compute_ewald_reci(double *pos, long natom, double *charges,
 //If it turns out that adding zero dipoles does not increase computational cost, this separate
 //code should become the main.
 double compute_ewald_reci_dd(double *pos, long natom, double *charges, double *dipoles,
-                          cell_type* cell, double alpha, long *gmax,
-                          double gcut, double *gpos, double *work,
-                          double* vtens) {
-  long g0, g1, g2, i;
-  double energy, k[3], ksq, cosfac_dd[3], sinfac_dd[3], x, c, s, fac1, fac2;
-  double cosfac, sinfac;
-  double kvecs[9];
-  for (i=0; i<9; i++) {
-    kvecs[i] = M_TWO_PI*(*cell).gvecs[i];
-  }
-  energy = 0.0;
-  fac1 = M_FOUR_PI/(*cell).volume;
-  fac2 = 0.25/alpha/alpha;
-  gcut *= M_TWO_PI;
-  gcut *= gcut;
-  for (g0=-gmax[0]; g0 <= gmax[0]; g0++) {
-    for (g1=-gmax[1]; g1 <= gmax[1]; g1++) {
-      for (g2=0; g2 <= gmax[2]; g2++) {
-        if (g2==0) {
-          if (g1<0) continue;
-          if ((g1==0)&&(g0<=0)) continue;
-        }
-        k[0] = (g0*kvecs[0] + g1*kvecs[3] + g2*kvecs[6]);
-        k[1] = (g0*kvecs[1] + g1*kvecs[4] + g2*kvecs[7]);
-        k[2] = (g0*kvecs[2] + g1*kvecs[5] + g2*kvecs[8]);
-        ksq = k[0]*k[0] + k[1]*k[1] + k[2]*k[2];
-        if (ksq > gcut) continue;
-        cosfac_dd[0] = 0.0;
-        cosfac_dd[1] = 0.0;
-        cosfac_dd[2] = 0.0;
-        sinfac_dd[0] = 0.0;
-        sinfac_dd[1] = 0.0;
-        sinfac_dd[2] = 0.0;
-        cosfac = 0.0;
-        sinfac = 0.0;
-        for (i=0; i<natom; i++) {
-          x = k[0]*pos[3*i] + k[1]*pos[3*i+1] + k[2]*pos[3*i+2];
-          c = charges[i]*cos(x) + (k[0]*dipoles[3*i+0] + k[1]*dipoles[3*i+1] + k[2]*dipoles[3*i+2])*sin(x);
-          s = charges[i]*sin(x) - (k[0]*dipoles[3*i+0] + k[1]*dipoles[3*i+1] + k[2]*dipoles[3*i+2])*cos(x);
-          cosfac += c;
-          sinfac += s;
-          if (gpos != NULL) {
-            work[2*i+0] = charges[i]*cos(x) + (k[0]*dipoles[3*i+0] + k[1]*dipoles[3*i+1] + k[2]*dipoles[3*i+2])*sin(x);
-            work[2*i+1] =-charges[i]*sin(x) + (k[0]*dipoles[3*i+0] + k[1]*dipoles[3*i+1] + k[2]*dipoles[3*i+2])*cos(x);
-          }
-          if (vtens != NULL){
-              cosfac_dd[0] +=-dipoles[3*i+0]*sin(x);
-              cosfac_dd[1] +=-dipoles[3*i+1]*sin(x);
-              cosfac_dd[2] +=-dipoles[3*i+2]*sin(x);
-              sinfac_dd[0] += dipoles[3*i+0]*cos(x);
-              sinfac_dd[1] += dipoles[3*i+1]*cos(x);
-              sinfac_dd[2] += dipoles[3*i+2]*cos(x);
-          }
-        }
-        c = fac1*exp(-ksq*fac2)/ksq;
-        s = (cosfac*cosfac+sinfac*sinfac);
-        energy += c*s;
-        if (gpos != NULL) {
-          x = 2.0*c;
-          cosfac *= x;
-          sinfac *= x;
-          for (i=0; i<natom; i++) {
-            x = cosfac*work[2*i+1] + sinfac*work[2*i];
-            gpos[3*i+0] += k[0]*x;
-            gpos[3*i+1] += k[1]*x;
-            gpos[3*i+2] += k[2]*x;
-          }
-        }
-        if (vtens != NULL) {
-          c *= 2.0*(1.0/ksq+fac2)*s;
-          vtens[0] += c*k[0]*k[0] + cosfac_dd[0]*k[0]*cosfac + sinfac_dd[0]*k[0]*sinfac;
-          vtens[4] += c*k[1]*k[1] + cosfac_dd[1]*k[1]*cosfac + sinfac_dd[1]*k[1]*sinfac;
-          vtens[8] += c*k[2]*k[2] + cosfac_dd[2]*k[2]*cosfac + sinfac_dd[2]*k[2]*sinfac;
-          x = c*k[1]*k[0];
-          vtens[1] += x + cosfac_dd[0]*k[1]*cosfac + sinfac_dd[0]*k[1]*sinfac;
-          vtens[3] += x + cosfac_dd[1]*k[0]*cosfac + sinfac_dd[1]*k[0]*sinfac;
-          x = c*k[2]*k[0];
-          vtens[2] += x + cosfac_dd[0]*k[2]*cosfac + sinfac_dd[0]*k[2]*sinfac;
-          vtens[6] += x + cosfac_dd[2]*k[0]*cosfac + sinfac_dd[2]*k[0]*sinfac;
-          x = c*k[2]*k[1];
-          vtens[5] += x + cosfac_dd[1]*k[2]*cosfac + sinfac_dd[1]*k[2]*sinfac;
-          vtens[7] += x + cosfac_dd[2]*k[1]*cosfac + sinfac_dd[2]*k[1]*sinfac;
-        }
-      }
-    }
-  }
+                          cell_type* cell, ewald_kvec_type *kvecs, long nkvec,
+                          double *gpos, double *work, double* vtens) {
+  double energy;
+  ewald_args_type args;
+  if (ewald_args_init(&args, pos, natom, charges, dipoles, cell, kvecs, nkvec) != 0) return NAN;
+  energy = ewald_parallel(ewald_reci_dd_range, &args, gpos, work, vtens);
+  ewald_args_free(&args);
   if (vtens != NULL) {
     vtens[0] -= energy;
     vtens[4] -= energy;
@@ -292,6 +584,67 @@ double compute_ewald_corr(double *pos, double *charges,
   return energy;
 }
 
+double compute_dsf_corr(double *pos, double *charges, cell_type *unitcell,
+                       double alpha, double rcut, scaling_row_type *stab,
+                       long nstab, double dielectric, double *gpos,
+                       double *vtens, long natom) {
+  long i, center_index, other_index;
+  double energy, delta[3], d, x, g, pot, fac, eshift, fshift;
+  x = alpha*rcut;
+  eshift = erfc(x)/rcut;
+  fshift = (eshift + M_TWO_DIV_SQRT_PI*alpha*exp(-x*x))/rcut;
+  energy = 0.0;
+  // Self-interaction correction (no gpos or vtens contribution)
+  x = 0.5*eshift + alpha/M_SQRT_PI;
+  for (i = 0; i < natom; i++) {
+    energy -= x*charges[i]*charges[i];
+  }
+  // Scaling corrections: only the bare Coulomb interaction is scaled, as for
+  // the Ewald summation, such that the damped and shifted remainder is kept.
+  for (i = 0; i < nstab; i++) {
+    center_index = stab[i].a;
+    other_index = stab[i].b;
+    delta[0] = pos[3*other_index    ] - pos[3*center_index    ];
+    delta[1] = pos[3*other_index + 1] - pos[3*center_index + 1];
+    delta[2] = pos[3*other_index + 2] - pos[3*center_index + 2];
+    cell_mic(delta, unitcell);
+    d = sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]);
+    if (d >= rcut) continue;
+    x = alpha*d;
+    pot = -erf(x)/d - eshift + fshift*(d - rcut);
+    fac = (1-stab[i].scale)*charges[other_index]*charges[center_index];
+    energy += fac*pot;
+    if ((gpos == NULL) && (vtens == NULL)) continue;
+    g = fac*(erf(x)/d/d - M_TWO_DIV_SQRT_PI*alpha*exp(-x*x)/d + fshift)/d/dielectric;
+    if (gpos != NULL) {
+      x = delta[0]*g;
+      gpos[3*other_index  ] += x;
+      gpos[3*center_index   ] -= x;
+      x = delta[1]*g;
+      gpos[3*other_index+1] += x;
+      gpos[3*center_index +1] -= x;
+      x = delta[2]*g;
+      gpos[3*other_index+2] += x;
+      gpos[3*center_index +2] -= x;
+    }
+    if (vtens != NULL) {
+      vtens[0] += delta[0]*delta[0]*g;
+      vtens[4] += delta[1]*delta[1]*g;
+      vtens[8] += delta[2]*delta[2]*g;
+      x = delta[1]*delta[0]*g;
+      vtens[1] += x;
+      vtens[3] += x;
+      x = delta[2]*delta[0]*g;
+      vtens[2] += x;
+      vtens[6] += x;
+      x = delta[2]*delta[1]*g;
+      vtens[5] += x;
+      vtens[7] += x;
+    }
+  }
+  return energy/dielectric;
+}
+
 double compute_ewald_corr_dd(double *pos, double *charges, double *dipoles,
                           cell_type *unitcell, double alpha,
                           scaling_row_type *stab, long nstab,
@@ -379,3 +732,140 @@ double compute_ewald_corr_dd(double *pos, double *charges, double *dipoles,
   }
   return energy;
 }
+
+// Smooth particle mesh Ewald (SPME)
+//
+// The charges are spread on a regular grid in fractional coordinates with
+// cardinal B-splines. The convolution with the reciprocal-space kernel is
+// carried out with FFTs in Python. See U. Essmann et al., J. Chem. Phys. 103,
+// 8577 (1995).
+
+static void pme_bspline(double w, long order, double *theta, double *dtheta) {
+  // Compute theta[j] = M_order(w + j) and its derivative for j=0..order-1,
+  // where M_order is the cardinal B-spline and 0 <= w < 1.
+  long p, j;
+  theta[0] = w;
+  theta[1] = 1.0 - w;
+  for (p=3; p<=order; p++) {
+    if (p == order) {
+      dtheta[0] = theta[0];
+      for (j=1; j<p-1; j++) dtheta[j] = theta[j] - theta[j-1];
+      dtheta[p-1] = -theta[p-2];
+    }
+    theta[p-1] = (p - w - (p-1))*theta[p-2]/(p-1);
+    for (j=p-2; j>0; j--) {
+      theta[j] = ((w + j)*theta[j] + (p - w - j)*theta[j-1])/(p-1);
+    }
+    theta[0] = w*theta[0]/(p-1);
+  }
+}
+
+static void pme_splines(double *pos, cell_type *cell, long order, long *ngrid, long *base, double *theta, double *dtheta) {
+  // Compute the spline weights along the three cell vectors for one atom.
+  // Grid point base[c] - j (modulo ngrid[c]) gets the weight theta[c*order+j].
+  long c;
+  double u;
+  for (c=0; c<3; c++) {
+    u = ngrid[c]*((*cell).gvecs[3*c]*pos[0] + (*cell).gvecs[3*c+1]*pos[1] + (*cell).gvecs[3*c+2]*pos[2]);
+    base[c] = (long)floor(u);
+    pme_bspline(u - base[c], order, theta + c*order, dtheta + c*order);
+    base[c] %= ngrid[c];
+    if (base[c] < 0) base[c] += ngrid[c];
+  }
+}
+
+void compute_pme_spread(double *pos, long natom, double *charges,
+                        cell_type *cell, long order, long *ngrid,
+                        double *grid) {
+  long i, j0, j1, j2, k0, k1, k2;
+  long base[3];
+  double theta[3*PME_MAX_ORDER], dtheta[3*PME_MAX_ORDER];
+  double q0, q1;
+  for (i=0; i<natom; i++) {
+    pme_splines(pos + 3*i, cell, order, ngrid, base, theta, dtheta);
+    k0 = base[0];
+    for (j0=0; j0<order; j0++) {
+      q0 = charges[i]*theta[j0];
+      k1 = base[1];
+      for (j1=0; j1<order; j1++) {
+        q1 = q0*theta[order+j1];
+        k2 = base[2];
+        for (j2=0; j2<order; j2++) {
+          grid[(k0*ngrid[1] + k1)*ngrid[2] + k2] += q1*theta[2*order+j2];
+          k2 = (k2 == 0) ? ngrid[2] - 1 : k2 - 1;
+        }
+        k1 = (k1 == 0) ? ngrid[1] - 1 : k1 - 1;
+      }
+      k0 = (k0 == 0) ? ngrid[0] - 1 : k0 - 1;
+    }
+  }
+}
+
+void compute_pme_gather(double *pos, long natom, double *charges,
+                        cell_type *cell, long order, long *ngrid,
+                        double *potential, double *gpos) {
+  long i, j0, j1, j2, k0, k1, k2;
+  long base[3];
+  double theta[3*PME_MAX_ORDER], dtheta[3*PME_MAX_ORDER];
+  double f[3], p, t1, dt1, t01, dt01, t0dt1;
+  for (i=0; i<natom; i++) {
+    pme_splines(pos + 3*i, cell, order, ngrid, base, theta, dtheta);
+    // Derivatives towards the fractional coordinates, times ngrid
+    f[0] = 0.0;
+    f[1] = 0.0;
+    f[2] = 0.0;
+    k0 = base[0];
+    for (j0=0; j0<order; j0++) {
+      k1 = base[1];
+      for (j1=0; j1<order; j1++) {
+        t1 = theta[order+j1];
+        dt1 = dtheta[order+j1];
+        t01 = theta[j0]*t1;
+        dt01 = dtheta[j0]*t1;
+        t0dt1 = theta[j0]*dt1;
+        k2 = base[2];
+        for (j2=0; j2<order; j2++) {
+          p = potential[(k0*ngrid[1] + k1)*ngrid[2] + k2];
+          f[0] += p*dt01*theta[2*order+j2];
+          f[1] += p*t0dt1*theta[2*order+j2];
+          f[2] += p*t01*dtheta[2*order+j2];
+          k2 = (k2 == 0) ? ngrid[2] - 1 : k2 - 1;
+        }
+        k1 = (k1 == 0) ? ngrid[1] - 1 : k1 - 1;
+      }
+      k0 = (k0 == 0) ? ngrid[0] - 1 : k0 - 1;
+    }
+    f[0] *= charges[i]*ngrid[0];
+    f[1] *= charges[i]*ngrid[1];
+    f[2] *= charges[i]*ngrid[2];
+    gpos[3*i  ] += f[0]*(*cell).gvecs[0] + f[1]*(*cell).gvecs[3] + f[2]*(*cell).gvecs[6];
+    gpos[3*i+1] += f[0]*(*cell).gvecs[1] + f[1]*(*cell).gvecs[4] + f[2]*(*cell).gvecs[7];
+    gpos[3*i+2] += f[0]*(*cell).gvecs[2] + f[1]*(*cell).gvecs[5] + f[2]*(*cell).gvecs[8];
+  }
+}
+
+void compute_pme_moduli(long order, long n, double *moduli) {
+  // The squared moduli |b(m)|^2 of the Euler exponential splines, for
+  // m=0..n-1.
+  long m, k;
+  double theta[PME_MAX_ORDER], dtheta[PME_MAX_ORDER];
+  double c, s, x;
+  // M_order(k+1) for k=0..order-2
+  pme_bspline(0.0, order, theta, dtheta);
+  for (m=0; m<n; m++) {
+    c = 0.0;
+    s = 0.0;
+    for (k=0; k<order-1; k++) {
+      x = M_TWO_PI*m*k/n;
+      c += theta[k+1]*cos(x);
+      s += theta[k+1]*sin(x);
+    }
+    moduli[m] = c*c + s*s;
+  }
+  // For odd orders, the denominator vanishes at m=n/2. It is replaced by the
+  // average of its neighbors.
+  for (m=0; m<n; m++) {
+    if (moduli[m] < 1e-7) moduli[m] = 0.5*(moduli[(m+n-1)%n] + moduli[(m+1)%n]);
+  }
+  for (m=0; m<n; m++) moduli[m] = 1.0/moduli[m];
+}
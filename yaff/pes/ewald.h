@@ -28,21 +28,47 @@
 #include "pair_pot.h"
 #include "cell.h"
 
+// A k-vector in the reciprocal Ewald sum with the factors that only depend on
+// the cell, alpha and gcut.
+typedef struct {
+  long g0, g1, g2;         // multiples of the reciprocal cell vectors, g2 >= 0
+  double k0, k1, k2;       // the Cartesian k-vector, including the factor 2*pi
+  double prefac;           // 4*pi/V*exp(-k^2/(4*alpha^2))/k^2
+  double vfac;             // 2*(1/k^2 + 1/(4*alpha^2)), needed for the virial
+} ewald_kvec_type;
+
+long compute_ewald_kvecs(cell_type *unitcell, double alpha, long *gmax,
+                         double gcut, ewald_kvec_type *kvecs);
 double compute_ewald_reci(double *pos, long natom, double *charges,
-                          cell_type* unitcell, double alpha, long *gmax, double
-                          gcut, double dielectric, double *gpos, double *work,
-                          double* vtens);
+                          cell_type* unitcell, ewald_kvec_type *kvecs,
+                          long nkvec, double dielectric, double *gpos,
+                          double *work, double* vtens);
 double compute_ewald_reci_dd(double *pos, long natom, double *charges, double *dipoles,
-                          cell_type* unitcell, double alpha, long *gmax,
-                          double gcut, double *gpos, double *work,
+                          cell_type* unitcell, ewald_kvec_type *kvecs,
+                          long nkvec, double *gpos, double *work,
                           double* vtens);
 double compute_ewald_corr(double *pos, double *charges,
                           cell_type *unitcell, double alpha,
                           scaling_row_type *stab, long stab_size,
                           double dielectric, double *gpos, double *vtens,
                           long natom);
+double compute_dsf_corr(double *pos, double *charges, cell_type *unitcell,
+                       double alpha, double rcut, scaling_row_type *stab,
+                       long stab_size, double dielectric, double *gpos,
+                       double *vtens, long natom);
 double compute_ewald_corr_dd(double *pos, double *charges, double *dipoles,
                           cell_type *unitcell, double alpha,
                           scaling_row_type *stab, long stab_size,
                           double *gpos, double *vtens, long natom);
+
+// The largest order of the B-splines in the smooth particle mesh Ewald method
+#define PME_MAX_ORDER 16
+
+void compute_pme_spread(double *pos, long natom, double *charges,
+                        cell_type *cell, long order, long *ngrid,
+                        double *grid);
+void compute_pme_gather(double *pos, long natom, double *charges,
+                        cell_type *cell, long order, long *ngrid,
+                        double *potential, double *gpos);
+void compute_pme_moduli(long order, long n, double *moduli);
 #endif
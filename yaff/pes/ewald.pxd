@@ -27,15 +27,26 @@ cimport pair_pot
 cimport cell
 
 cdef extern from "ewald.h":
+    long PME_MAX_ORDER
+
+    ctypedef struct ewald_kvec_type:
+        long g0, g1, g2
+        double k0, k1, k2
+        double prefac
+        double vfac
+
+    long compute_ewald_kvecs(cell.cell_type *unitcell, double alpha,
+                             long *gmax, double gcut, ewald_kvec_type *kvecs)
+
     double compute_ewald_reci(double *pos, long natom, double *charges,
-                              cell.cell_type *unitcell, double alpha,
-                              long *gmax, double gcut, double dielectric,
-                              double *gpos, double *work, double* vtens)
+                              cell.cell_type *unitcell, ewald_kvec_type *kvecs,
+                              long nkvec, double dielectric, double *gpos,
+                              double *work, double* vtens) nogil
 
     double compute_ewald_reci_dd(double *pos, long natom, double *charges, double *dipoles,
-                              cell.cell_type *unitcell, double alpha,
-                              long *gmax, double gcut, double *gpos,
-                              double *work, double* vtens)
+                              cell.cell_type *unitcell, ewald_kvec_type *kvecs,
+                              long nkvec, double *gpos, double *work,
+                              double* vtens) nogil
 
     double compute_ewald_corr(double *pos, double *charges,
                               cell.cell_type *unitcell, double alpha,
@@ -43,8 +54,24 @@ cdef extern from "ewald.h":
                               double dielectric, double *gpos, double *vtens,
                               long natom)
 
+    double compute_dsf_corr(double *pos, double *charges,
+                            cell.cell_type *unitcell, double alpha,
+                            double rcut, pair_pot.scaling_row_type *stab,
+                            long stab_size, double dielectric, double *gpos,
+                            double *vtens, long natom)
+
     double compute_ewald_corr_dd(double *pos, double *charges, double *dipoles,
                               cell.cell_type *unitcell, double alpha,
                               pair_pot.scaling_row_type *stab,
                               long stab_size, double *gpos, double *vtens,
                               long natom)
+
+    void compute_pme_spread(double *pos, long natom, double *charges,
+                            cell.cell_type *cell, long order, long *ngrid,
+                            double *grid)
+
+    void compute_pme_gather(double *pos, long natom, double *charges,
+                            cell.cell_type *cell, long order, long *ngrid,
+                            double *potential, double *gpos)
+
+    void compute_pme_moduli(long order, long n, double *moduli)
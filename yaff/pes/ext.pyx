@@ -34,6 +34,7 @@ from __future__ import division
 
 import numpy as np
 cimport numpy as np
+from libc.stdlib cimport malloc, free
 cimport cell
 cimport nlist
 cimport pair_pot
@@ -43,21 +44,31 @@ cimport iclist
 cimport vlist
 cimport truncation
 cimport grid
+cimport slater
+cimport tree
 
 from yaff.log import log
 
 
 __all__ = [
     'Cell',
-    'neigh_dtype', 'nlist_status_init', 'nlist_build', 'nlist_status_finish',
-    'nlist_recompute', 'nlist_inc_r',
+    'neigh_dtype', 'neigh_compact_dtype', 'neigh_tile_dtype', 'nlist_cluster_size',
+    'nlist_status_init', 'nlist_build', 'nlist_status_finish',
+    'nlist_build_binned', 'nlist_build_tiles', 'nlist_recompute', 'nlist_partition',
+    'nlist_displacement', 'nlist_images',
+    'nlist_inc_r',
     'Hammer', 'Switch3',
-    'scaling_dtype', 'PairPot', 'PairPotLJ', 'PairPotMM3', 'PairPotGrimme',
+    'scaling_dtype', 'PairPot', 'pair_pot_compute_fused',
+    'pair_pot_compute_lambdas', 'PairPotLJ', 'PairPotMM3', 'PairPotGrimme',
     'PairPotExpRep', 'PairPotQMDFFRep', 'PairPotLJCross', 'PairPotDampDisp',
-    'PairPotDisp68BJDamp', 'PairPotEI', 'PairPotEIDip', 'PairPotEiSlater1s1sCorr',
+    'PairPotDisp68BJDamp', 'PairPotEI', 'PairPotDSF', 'PairPotEIDip', 'PairPotEiSlater1s1sCorr',
     'PairPotEiSlater1sp1spCorr', 'PairPotOlpSlater1s1s','PairPotChargeTransferSlater1s1s',
-    'compute_ewald_reci', 'compute_ewald_reci_dd',  'compute_ewald_corr_dd',
-    'compute_ewald_corr',
+    'PairPotTabulated',
+    'ewald_kvec_dtype', 'compute_ewald_kvecs', 'compute_ewald_reci',
+    'compute_ewald_reci_dd',  'compute_ewald_corr_dd',
+    'compute_ewald_corr', 'compute_dsf_corr', 'pme_max_order', 'compute_pme_spread',
+    'compute_pme_gather', 'compute_pme_moduli', 'tree_max_order',
+    'compute_ei_tree',
     'delta_dtype', 'dlist_forward', 'dlist_back',
     'iclist_dtype', 'iclist_forward', 'iclist_back',
     'vlist_dtype', 'vlist_forward', 'vlist_back',
@@ -351,6 +362,13 @@ cdef class Cell:
 
 cdef nlist.neigh_row_type _neigh_row_tmp
 neigh_dtype = np.asarray(<nlist.neigh_row_type[:1]>(&_neigh_row_tmp)).dtype
+cdef nlist.neigh_compact_row_type _neigh_compact_row_tmp
+neigh_compact_dtype = np.asarray(<nlist.neigh_compact_row_type[:1]>(&_neigh_compact_row_tmp)).dtype
+cdef nlist.neigh_tile_type _neigh_tile_tmp
+neigh_tile_dtype = np.asarray(<nlist.neigh_tile_type[:1]>(&_neigh_tile_tmp)).dtype
+
+#: The number of atoms in a cluster of the tiled neighbor list.
+nlist_cluster_size = nlist.NLIST_CLUSTER_SIZE
 
 
 def nlist_status_init(rmax):
@@ -375,7 +393,8 @@ def nlist_status_init(rmax):
 def nlist_build(np.ndarray[double, ndim=2] pos, double rcut,
                 np.ndarray[long, ndim=1] rmax,
                 Cell unitcell, np.ndarray[long, ndim=1] status,
-                np.ndarray[nlist.neigh_row_type, ndim=1] neighs):
+                np.ndarray[nlist.neigh_row_type, ndim=1] neighs,
+                np.ndarray[long, ndim=2] images=None):
     '''Scan the system for all pairs that have a distance smaller than rcut until the neighs array is filled or all pairs are considered
 
        **Arguments:**
@@ -402,6 +421,14 @@ def nlist_build(np.ndarray[double, ndim=2] pos, double rcut,
             The neighbor list array. One element is of the datatype
             nlist.neigh_row_type.
 
+       **Optional arguments:**
+
+       images
+            The table of periodic images to visit, as returned by
+            ``nlist_images``. When not given, it is computed from ``rcut`` and
+            ``rmax``. The same table must be used in all calls that build one
+            neighbor list.
+
        **Returns:**
 
        ``True`` if the neighbor list is complete. ``False`` otherwise
@@ -415,8 +442,12 @@ def nlist_build(np.ndarray[double, ndim=2] pos, double rcut,
     assert status.flags['C_CONTIGUOUS']
     assert neighs.flags['C_CONTIGUOUS']
     assert rmax.shape[0] == unitcell.nvec
+    if images is None:
+        images = nlist_images(unitcell, rcut, rmax)
+    assert images.shape[1] == 3
+    assert images.flags['C_CONTIGUOUS']
     return nlist.nlist_build_low(
-        <double*>pos.data, rcut, <long*>rmax.data,
+        <double*>pos.data, rcut, <long*>images.data, len(images),
         unitcell._c_cell, <long*>status.data,
         <nlist.neigh_row_type*>neighs.data, len(pos), len(neighs)
     )
@@ -432,6 +463,231 @@ def nlist_status_finish(status):
     return status[-1]
 
 
+def nlist_build_binned(np.ndarray[double, ndim=2] pos, double rcut,
+                       np.ndarray[long, ndim=1] rmax, Cell unitcell,
+                       np.ndarray neighs, np.ndarray[long, ndim=2] topo=None):
+    '''Scan the system for all pairs that have a distance smaller than rcut, using a cell list
+
+       **Arguments:**
+
+       pos
+            The numpy array with the atomic positions, shape (natom, 3)
+
+       rcut
+            The cutoff radius
+
+       rmax
+            The number of periodic images to visit along each cell vector, shape
+            (nrvec,)
+
+       unitcell
+            An instance of the UnitCell class, describing the periodic boundary
+            conditions.
+
+       neighs
+            The neighbor list array. One element is of the datatype
+            nlist.neigh_row_type (``neigh_dtype``) or
+            nlist.neigh_compact_row_type (``neigh_compact_dtype``). The
+            datatype of this array determines the format of the neighbor list.
+
+       **Optional arguments:**
+
+       topo
+            A topology table with shape (ntopo, 3). Each row contains two atom
+            indexes a > b and a code. The rows must be sorted by a and b. For
+            pairs in the central image, the code is stored in the nbond field
+            of the neighbor list. Pairs with a negative code are left out.
+
+       **Returns:** a tuple ``(neighs, nneigh)``. The first item is the
+       neighbor list array, which is newly allocated (with some margin for
+       future rebuilds) when the given array is too small. The second item is
+       the number of rows in the neighbor list.
+
+       **Description:**
+
+       The atoms are sorted into bins in fractional coordinates, such that only
+       pairs of atoms in nearby bins are considered. The cost of this routine
+       scales linearly with the number of atoms. The resulting rows are the
+       same as those generated by ``nlist_build``, except for the order of
+       the rows involving periodic images. The pairs in the central image are
+       sorted in the same way.
+
+       When Yaff is compiled with OpenMP support, the atoms are distributed
+       over several threads, which collect their rows in separate buffers.
+       These are merged into one array at the end. The order of the rows does
+       not depend on the number of threads.
+
+       The compact format only stores the atom indexes, the image shifts
+       relative to the raw atomic positions and a flag for pairs in the central
+       image. The relative vectors and distances are computed by the pair
+       potentials, which avoids a recomputation of the neighbor list at every
+       step and reduces the memory traffic. Rows in the compact format take
+       16 bytes instead of 64 bytes.
+    '''
+    cdef nlist.nlist_blocks_type* blocks
+    cdef void* my_neighs
+    cdef double* my_pos
+    cdef long* my_rmax
+    cdef long* my_topo
+    cdef long natom, nneigh, ntopo
+    cdef bint compact
+    compact = (neighs.dtype == neigh_compact_dtype)
+    assert compact or neighs.dtype == neigh_dtype
+    assert neighs.ndim == 1
+    assert pos.shape[1] == 3
+    assert pos.flags['C_CONTIGUOUS']
+    assert rcut > 0
+    assert rmax.shape[0] <= 3
+    assert rmax.flags['C_CONTIGUOUS']
+    assert neighs.flags['C_CONTIGUOUS']
+    assert rmax.shape[0] == unitcell.nvec
+    if topo is None:
+        my_topo = NULL
+        ntopo = 0
+    else:
+        assert topo.shape[1] == 3
+        assert topo.flags['C_CONTIGUOUS']
+        assert (topo[:,0] > topo[:,1]).all()
+        assert (topo[:,0] < len(pos)).all()
+        my_topo = <long*>topo.data
+        ntopo = len(topo)
+    if compact:
+        assert len(pos) < 2**31
+        if unitcell.nvec > 0 and len(pos) > 0:
+            # The image shifts must fit in a short integer.
+            if abs(np.dot(pos, unitcell.gvecs.T)).max() + rmax.max() + 2 > 2**15:
+                raise ValueError('Atoms are too far from the origin for a compact neighbor list.')
+    blocks = nlist.nlist_blocks_new()
+    if blocks is NULL:
+        raise MemoryError()
+    try:
+        my_pos = <double*>pos.data
+        my_rmax = <long*>rmax.data
+        natom = len(pos)
+        with nogil:
+            nneigh = nlist.nlist_build_binned_low(
+                my_pos, rcut, my_rmax, unitcell._c_cell, natom, compact,
+                my_topo, ntopo, blocks
+            )
+        if nneigh < 0:
+            raise MemoryError()
+        if nneigh > len(neighs):
+            neighs = np.empty((nneigh*3)//2, dtype=neighs.dtype)
+        my_neighs = <void*>neighs.data
+        with nogil:
+            nlist.nlist_blocks_merge(blocks, my_neighs)
+    finally:
+        nlist.nlist_blocks_free(blocks)
+    return neighs, nneigh
+
+
+def nlist_build_tiles(np.ndarray[double, ndim=2] pos, double rcut,
+                      Cell unitcell, np.ndarray neighs,
+                      np.ndarray[long, ndim=2] clusters,
+                      np.ndarray[long, ndim=2] wrap,
+                      np.ndarray[long, ndim=2] topo=None):
+    '''Build a neighbor list in the tiled format, using a cell list of clusters
+
+       **Arguments:**
+
+       pos
+            The numpy array with the atomic positions, shape (natom, 3)
+
+       rcut
+            The cutoff radius
+
+       unitcell
+            An instance of the UnitCell class, describing the periodic boundary
+            conditions.
+
+       neighs
+            The neighbor list array with datatype ``neigh_tile_dtype``.
+
+       clusters
+            Output array for the atom indexes in each cluster, shape
+            (ncluster, nlist_cluster_size) with ``ncluster = (natom +
+            nlist_cluster_size - 1)//nlist_cluster_size``. The last
+            cluster is padded with -1.
+
+       wrap
+            Output array for the cell vectors that wrap each atom into the
+            central cell, shape (natom, 3).
+
+       **Optional arguments:**
+
+       topo
+            A topology table, see ``nlist_build_binned``.
+
+       **Returns:** a tuple ``(neighs, ntile)``, with the same meaning as the
+       return value of ``nlist_build_binned``.
+
+       **Description:**
+
+       The atoms are sorted along a Morton curve and consecutive atoms are
+       grouped into clusters of four. Each row (tile) of the neighbor list
+       contains a pair of clusters, a shift of the second cluster by cell
+       vectors and a mask of the 4x4 atom pairs that must be computed. Pairs
+       beyond the cutoff, excluded pairs, padding and pairs that are already
+       present in another tile are masked out. Together, the tiles contain
+       exactly the same pairs as the other formats. The pair potentials
+       evaluate a tile as a dense block, which is a suitable layout for
+       vectorization.
+    '''
+    cdef nlist.nlist_blocks_type* blocks
+    cdef void* my_neighs
+    cdef double* my_pos
+    cdef long* my_topo
+    cdef long* my_clusters
+    cdef long* my_wrap
+    cdef long natom, ntile, ntopo
+    assert neighs.dtype == neigh_tile_dtype
+    assert neighs.ndim == 1
+    assert neighs.flags['C_CONTIGUOUS']
+    assert pos.shape[1] == 3
+    assert pos.flags['C_CONTIGUOUS']
+    assert rcut > 0
+    assert clusters.shape[0] == (len(pos) + nlist_cluster_size - 1)//nlist_cluster_size
+    assert clusters.shape[1] == nlist_cluster_size
+    assert clusters.flags['C_CONTIGUOUS']
+    assert wrap.shape[0] == len(pos)
+    assert wrap.shape[1] == 3
+    assert wrap.flags['C_CONTIGUOUS']
+    assert len(pos) < 2**31
+    if topo is None:
+        my_topo = NULL
+        ntopo = 0
+    else:
+        assert topo.shape[1] == 3
+        assert topo.flags['C_CONTIGUOUS']
+        assert (topo[:,0] > topo[:,1]).all()
+        assert (topo[:,0] < len(pos)).all()
+        my_topo = <long*>topo.data
+        ntopo = len(topo)
+    blocks = nlist.nlist_blocks_new()
+    if blocks is NULL:
+        raise MemoryError()
+    try:
+        my_pos = <double*>pos.data
+        my_clusters = <long*>clusters.data
+        my_wrap = <long*>wrap.data
+        natom = len(pos)
+        with nogil:
+            ntile = nlist.nlist_build_tiles_low(
+                my_pos, rcut, unitcell._c_cell, natom, my_topo, ntopo,
+                my_clusters, my_wrap, blocks
+            )
+        if ntile < 0:
+            raise MemoryError()
+        if ntile > len(neighs):
+            neighs = np.empty((ntile*3)//2, dtype=neighs.dtype)
+        my_neighs = <void*>neighs.data
+        with nogil:
+            nlist.nlist_blocks_merge(blocks, my_neighs)
+    finally:
+        nlist.nlist_blocks_free(blocks)
+    return neighs, ntile
+
+
 def nlist_recompute(np.ndarray[double, ndim=2] pos,
                     np.ndarray[double, ndim=2] pos_old,
                     Cell unitcell,
@@ -468,6 +724,114 @@ def nlist_recompute(np.ndarray[double, ndim=2] pos,
     )
 
 
+def nlist_partition(np.ndarray neighs, np.ndarray[double, ndim=2] pos,
+                    Cell unitcell, np.ndarray[double, ndim=1] shells):
+    '''Reorder the rows of a neighbor list into distance shells
+
+       **Arguments:**
+
+       neighs
+            The neighbor list array, either with datatype ``neigh_dtype`` or
+            ``neigh_compact_dtype``. Only the rows in use must be given.
+
+       pos
+            The numpy array with the atomic positions, shape (natom, 3). (Only
+            used for the compact format.)
+
+       unitcell
+            An instance of the UnitCell class, describing the periodic boundary
+            conditions.
+
+       shells
+            The outer radii of the shells, in increasing order. Rows beyond
+            the last radius are put in the last shell.
+
+       **Returns:** an array with the number of rows in the first ``i+1``
+       shells, for each shell ``i``.
+
+       The reordering is stable, such that the pairs in the central image
+       remain sorted within each shell.
+    '''
+    cdef np.ndarray[long, ndim=1] ends
+    cdef bint compact
+    compact = (neighs.dtype == neigh_compact_dtype)
+    assert compact or neighs.dtype == neigh_dtype
+    assert neighs.ndim == 1
+    assert neighs.flags['C_CONTIGUOUS']
+    assert pos.shape[1] == 3
+    assert pos.flags['C_CONTIGUOUS']
+    assert shells.flags['C_CONTIGUOUS']
+    assert len(shells) > 0
+    assert (shells[1:] >= shells[:-1]).all()
+    ends = np.zeros(len(shells), int)
+    if nlist.nlist_partition_low(
+        <void*>neighs.data, len(neighs), compact, <double*>pos.data,
+        unitcell._c_cell, <double*>shells.data, len(shells), <long*>ends.data
+    ) != 0:
+        raise MemoryError()
+    return ends
+
+
+def nlist_displacement(np.ndarray[double, ndim=2] pos,
+                       np.ndarray[double, ndim=2] pos_old):
+    '''Compute the sum of the two largest atomic displacements
+
+       **Arguments:**
+
+       pos
+            The numpy array with the atomic positions, shape (natom, 3)
+
+       pos_old
+            The positions used during the last neighbor list rebuild.
+
+       **Returns:** an upper bound for the change of any interatomic distance
+       since the last rebuild. As long as this is smaller than the skin, the
+       neighbor list does not have to be rebuilt.
+    '''
+    assert pos.shape[1] == 3
+    assert pos.flags['C_CONTIGUOUS']
+    assert pos_old.shape[1] == 3
+    assert pos_old.flags['C_CONTIGUOUS']
+    assert pos.shape[0] == pos_old.shape[0]
+    return nlist.nlist_displacement_low(
+        <double*>pos.data, <double*>pos_old.data, len(pos)
+    )
+
+
+def nlist_images(Cell unitcell, double rcut, np.ndarray[long, ndim=1] rmax):
+    '''Returns the periodic images that can contain pairs closer than rcut
+
+       **Arguments:**
+
+       unitcell
+            An instance of the UnitCell class, describing the periodic boundary
+            conditions.
+
+       rcut
+            The cutoff radius
+
+       rmax
+            The number of periodic images to visit along each cell vector, shape
+            (nrvec,)
+
+       **Returns:** an integer array with shape (nimage, 3). The first row is
+       the central image. The other rows are the images visited by
+       ``nlist_inc_r``, in the same order, for which the shortest relative
+       vector between an atom in the central cell and an atom in the image
+       (after applying the minimum image convention) is shorter than rcut.
+       In strongly skewed cells, many images in the range set by ``rmax`` can
+       be pruned this way.
+    '''
+    cdef np.ndarray[long, ndim=2] images
+    cdef long nimage
+    assert rmax.shape[0] <= 3
+    assert rmax.flags['C_CONTIGUOUS']
+    assert rmax.shape[0] == unitcell.nvec
+    images = np.zeros(((np.prod(2*rmax+1) + 1)//2, 3), int)
+    nimage = nlist.nlist_images_low(unitcell._c_cell, rcut, <long*>rmax.data, <long*>images.data)
+    return images[:nimage].copy()
+
+
 def nlist_inc_r(Cell unitcell, np.ndarray[long, ndim=1] r, np.ndarray[long, ndim=1] rmax):
     '''Increment the vector ``r`` to the location of the `next` periodic image.
 
@@ -633,6 +997,41 @@ cdef class PairPot:
 
     rcut = property(_get_rcut)
 
+    def _get_batched(self):
+        '''True when the pairs are computed in batches by a vectorized kernel'''
+        return pair_pot.pair_pot_batched(self._c_pair_pot)
+
+    batched = property(_get_batched)
+
+    def _get_specialized(self):
+        '''True when a kernel specialized for this pair potential and its
+           truncation scheme is used with the standard neighbor list'''
+        return pair_pot.pair_pot_specialized(self._c_pair_pot)
+
+    specialized = property(_get_specialized)
+
+    def _get_mixed(self):
+        '''True when the batch kernel works in single precision'''
+        return pair_pot.pair_pot_get_mixed(self._c_pair_pot)
+
+    mixed = property(_get_mixed)
+
+    def set_mixed(self, bint mixed):
+        '''Switch between double and mixed precision
+
+           **Arguments:**
+
+           mixed
+                When True, the arithmetic in the batch kernel is carried out
+                in single precision. Energies, gradients and virials are
+                still accumulated in double precision.
+
+           **Returns:** True when mixed precision is used afterwards. Pair
+           potentials without a mixed precision kernel stay in double
+           precision.
+        '''
+        return pair_pot.pair_pot_set_mixed(self._c_pair_pot, mixed)
+
     cdef set_truncation(self, Truncation tr):
         '''Set the truncation scheme'''
         self.tr = tr
@@ -645,17 +1044,23 @@ cdef class PairPot:
         '''Returns the current truncation scheme'''
         return self.tr
 
-    def compute(self, np.ndarray[nlist.neigh_row_type, ndim=1] neighs,
+    def compute(self, np.ndarray neighs,
                 np.ndarray[pair_pot.scaling_row_type, ndim=1] stab,
                 np.ndarray[double, ndim=2] gpos,
-                np.ndarray[double, ndim=2] vtens, long nneigh):
+                np.ndarray[double, ndim=2] vtens, long nneigh,
+                np.ndarray[double, ndim=2] pos=None, Cell unitcell=None,
+                np.ndarray[double, ndim=1] scales=None,
+                np.ndarray[long, ndim=2] clusters=None,
+                np.ndarray[long, ndim=2] wrap=None):
         '''Compute the pairwise interactions
 
            **Arguments:**
 
            neighs
                 The neighbor list array. One element is of the datatype
-                nlist.neigh_row_type.
+                nlist.neigh_row_type, nlist.neigh_compact_row_type or
+                nlist.neigh_tile_type. In the last case, nneigh is the number
+                of tiles.
 
            stab
                 The array with short-range scalings. Each element is of the
@@ -672,21 +1077,63 @@ cdef class PairPot:
            nneigh
                 The number of records to consider in the neighbor list.
 
+           **Optional arguments:**
+
+           pos, unitcell
+                The atomic positions and the unit cell. These are only used
+                (and required) for a neighbor list in the compact or the tiled
+                format.
+
+           scales
+                An array with five scaling factors, for unbonded pairs and for
+                1-2, 1-3, 1-4 and 1-5 pairs, respectively. When given, the
+                scaling of each pair is selected with the nbond field in the
+                neighbor list instead of searching stab. This is only correct
+                when the neighbor list was built with a topology table that
+                includes all pairs in stab.
+
+           clusters, wrap
+                The clusters and the wrapping of the atoms, as computed by
+                ``nlist_build_tiles``. These are only used (and required) for a
+                neighbor list in the tiled format.
+
+           The neighbor list is divided over the OpenMP threads, each with
+           their own gpos and vtens, which are added in a fixed order. The
+           results are therefore reproducible for a given number of threads.
+           The GIL is released during the computation.
+
            **Returns:** the energy.
         '''
         cdef double *my_gpos
         cdef double *my_vtens
+        cdef double *my_scales
+        cdef double *my_pos
+        cdef long *my_clusters
+        cdef long *my_wrap
+        cdef long natom, nstab
+        cdef void *my_neighs
+        cdef pair_pot.scaling_row_type *my_stab
+        cdef cell.cell_type *my_unitcell
+        cdef pair_pot.pair_pot_type *my_pair_pot
+        cdef double energy
 
         assert pair_pot.pair_pot_ready(self._c_pair_pot)
+        assert neighs.ndim == 1
         assert neighs.flags['C_CONTIGUOUS']
         assert stab.flags['C_CONTIGUOUS']
+        my_neighs = <void*>neighs.data
+        my_stab = <pair_pot.scaling_row_type*>stab.data
+        nstab = len(stab)
+        my_pair_pot = self._c_pair_pot
 
         if gpos is None:
             my_gpos = NULL
+            natom = 0
         else:
             assert gpos.flags['C_CONTIGUOUS']
             assert gpos.shape[1] == 3
             my_gpos = <double*>gpos.data
+            natom = gpos.shape[0]
 
         if vtens is None:
             my_vtens = NULL
@@ -696,11 +1143,386 @@ cdef class PairPot:
             assert vtens.shape[1] == 3
             my_vtens = <double*>vtens.data
 
-        return pair_pot.pair_pot_compute(
-            <nlist.neigh_row_type*>neighs.data, nneigh,
-            <pair_pot.scaling_row_type*>stab.data, len(stab),
-            self._c_pair_pot, my_gpos, my_vtens
+        if scales is None:
+            my_scales = NULL
+        else:
+            assert scales.flags['C_CONTIGUOUS']
+            assert scales.shape[0] == 5
+            my_scales = <double*>scales.data
+
+        if neighs.dtype == neigh_compact_dtype:
+            assert pos is not None and unitcell is not None
+            assert pos.flags['C_CONTIGUOUS']
+            assert pos.shape[1] == 3
+            my_pos = <double*>pos.data
+            my_unitcell = unitcell._c_cell
+            with nogil:
+                energy = pair_pot.pair_pot_compute_compact(
+                    <nlist.neigh_compact_row_type*>my_neighs, nneigh, my_pos,
+                    my_unitcell, my_stab, nstab, my_scales, my_pair_pot,
+                    natom, my_gpos, my_vtens
+                )
+            return energy
+
+        if neighs.dtype == neigh_tile_dtype:
+            assert pos is not None and unitcell is not None
+            assert clusters is not None and wrap is not None
+            assert pos.flags['C_CONTIGUOUS']
+            assert pos.shape[1] == 3
+            assert clusters.flags['C_CONTIGUOUS']
+            assert clusters.shape[1] == nlist_cluster_size
+            assert wrap.flags['C_CONTIGUOUS']
+            assert wrap.shape[0] == pos.shape[0]
+            my_pos = <double*>pos.data
+            my_unitcell = unitcell._c_cell
+            my_clusters = <long*>clusters.data
+            my_wrap = <long*>wrap.data
+            with nogil:
+                energy = pair_pot.pair_pot_compute_tiles(
+                    <nlist.neigh_tile_type*>my_neighs, nneigh, my_clusters,
+                    my_wrap, my_pos, my_unitcell, my_stab, nstab, my_scales,
+                    my_pair_pot, natom, my_gpos, my_vtens
+                )
+            return energy
+
+        assert neighs.dtype == neigh_dtype
+        with nogil:
+            energy = pair_pot.pair_pot_compute(
+                <nlist.neigh_row_type*>my_neighs, nneigh, my_stab, nstab,
+                my_scales, my_pair_pot, natom, my_gpos, my_vtens
+            )
+        return energy
+
+    def sample(self, np.ndarray[long, ndim=1] centers,
+               np.ndarray[long, ndim=1] others,
+               np.ndarray[double, ndim=1] distances):
+        '''Evaluate the pair potential for a list of pairs at given distances
+
+           **Arguments:**
+
+           centers, others
+                Arrays with the indexes of the two atoms in each pair.
+
+           distances
+                An array with the distance for each pair.
+
+           The truncation scheme is included. Terms that depend on the
+           direction of the relative vector, e.g. in ``PairPotEIDip``, are not
+           correctly accounted for.
+
+           **Returns:** two arrays with the energy and with its derivative
+           towards the distance for each pair.
+        '''
+        cdef long n = distances.shape[0]
+        cdef np.ndarray[double, ndim=1] energies
+        cdef np.ndarray[double, ndim=1] derivatives
+        assert pair_pot.pair_pot_ready(self._c_pair_pot)
+        assert centers.flags['C_CONTIGUOUS']
+        assert others.flags['C_CONTIGUOUS']
+        assert distances.flags['C_CONTIGUOUS']
+        assert centers.shape[0] == n
+        assert others.shape[0] == n
+        energies = np.zeros(n, float)
+        derivatives = np.zeros(n, float)
+        pair_pot.pair_pot_sample(
+            self._c_pair_pot, <long*>centers.data, <long*>others.data,
+            <double*>distances.data, n, <double*>energies.data,
+            <double*>derivatives.data
+        )
+        return energies, derivatives
+
+
+def pair_pot_compute_fused(pair_pots, np.ndarray neighs,
+                           np.ndarray[double, ndim=2] gpos,
+                           np.ndarray[double, ndim=2] vtens, long nneigh,
+                           np.ndarray[double, ndim=2] scales,
+                           np.ndarray[double, ndim=1] energies,
+                           np.ndarray[double, ndim=2] pos=None,
+                           Cell unitcell=None,
+                           np.ndarray[long, ndim=2] clusters=None,
+                           np.ndarray[long, ndim=2] wrap=None):
+    '''Compute several pair potentials in a single loop over the neighbor list
+
+       **Arguments:**
+
+       pair_pots
+            A list of ``PairPot`` instances.
+
+       neighs
+            The neighbor list array, in any of the formats supported by
+            ``PairPot.compute``. The neighbor list must be built with a
+            topology table, such that the nbond field can be used to select
+            the scalings.
+
+       gpos, vtens
+            The output arrays for the derivatives of the energy towards the
+            atomic positions and the virial tensor. The contributions of all
+            pair potentials are added. Each can be None.
+
+       nneigh
+            The number of records to consider in the neighbor list. It must
+            include all pairs within the largest cutoff.
+
+       scales
+            An array with shape (npot, 5). Each row contains the scaling
+            factors of one pair potential, as in ``PairPot.compute``.
+
+       energies
+            An output array with shape (npot,), for the energy of each pair
+            potential.
+
+       **Optional arguments:**
+
+       pos, unitcell, clusters, wrap
+            See ``PairPot.compute``.
+
+       **Returns:** the total energy.
+    '''
+    cdef pair_pot.pair_pot_type** my_pair_pots
+    cdef double *my_gpos
+    cdef double *my_vtens
+    cdef double *my_pos
+    cdef cell.cell_type *my_unitcell
+    cdef long *my_clusters
+    cdef long *my_wrap
+    cdef long npot, i, natom
+    cdef int format
+    cdef void *my_neighs
+    cdef double *my_scales
+    cdef double *my_energies
+    cdef double energy
+
+    npot = len(pair_pots)
+    assert scales.shape[0] == npot
+    assert scales.shape[1] == 5
+    assert scales.flags['C_CONTIGUOUS']
+    assert energies.shape[0] == npot
+    assert energies.flags['C_CONTIGUOUS']
+    assert neighs.ndim == 1
+    assert neighs.flags['C_CONTIGUOUS']
+
+    my_neighs = <void*>neighs.data
+    my_scales = <double*>scales.data
+    my_energies = <double*>energies.data
+
+    if gpos is None:
+        my_gpos = NULL
+        natom = 0
+    else:
+        assert gpos.flags['C_CONTIGUOUS']
+        assert gpos.shape[1] == 3
+        my_gpos = <double*>gpos.data
+        natom = gpos.shape[0]
+
+    if vtens is None:
+        my_vtens = NULL
+    else:
+        assert vtens.flags['C_CONTIGUOUS']
+        assert vtens.shape[0] == 3
+        assert vtens.shape[1] == 3
+        my_vtens = <double*>vtens.data
+
+    my_pos = NULL
+    my_unitcell = NULL
+    my_clusters = NULL
+    my_wrap = NULL
+    if neighs.dtype == neigh_dtype:
+        format = 0
+    else:
+        assert pos is not None and unitcell is not None
+        assert pos.flags['C_CONTIGUOUS']
+        assert pos.shape[1] == 3
+        my_pos = <double*>pos.data
+        my_unitcell = unitcell._c_cell
+        if neighs.dtype == neigh_compact_dtype:
+            format = 1
+        else:
+            assert neighs.dtype == neigh_tile_dtype
+            assert clusters is not None and wrap is not None
+            assert clusters.flags['C_CONTIGUOUS']
+            assert clusters.shape[1] == nlist_cluster_size
+            assert wrap.flags['C_CONTIGUOUS']
+            assert wrap.shape[0] == pos.shape[0]
+            my_clusters = <long*>clusters.data
+            my_wrap = <long*>wrap.data
+            format = 2
+
+    my_pair_pots = <pair_pot.pair_pot_type**>malloc(npot*sizeof(pair_pot.pair_pot_type*))
+    if my_pair_pots is NULL:
+        raise MemoryError()
+    try:
+        for i in range(npot):
+            assert pair_pot.pair_pot_ready((<PairPot?>pair_pots[i])._c_pair_pot)
+            my_pair_pots[i] = (<PairPot>pair_pots[i])._c_pair_pot
+        with nogil:
+            energy = pair_pot.pair_pot_compute_fused(
+                my_neighs, nneigh, format, my_pos, my_unitcell, my_clusters,
+                my_wrap, my_pair_pots, npot, my_scales, my_energies, natom,
+                my_gpos, my_vtens
+            )
+    finally:
+        free(my_pair_pots)
+    return energy
+
+
+def pair_pot_compute_lambdas(PairPot pot, np.ndarray neighs,
+                             np.ndarray[pair_pot.scaling_row_type, ndim=1] stab,
+                             np.ndarray[double, ndim=2] gpos,
+                             np.ndarray[double, ndim=2] vtens, long nneigh,
+                             np.ndarray[double, ndim=1] scales,
+                             np.ndarray[long, ndim=1] group not None,
+                             double lam,
+                             np.ndarray[double, ndim=1] lambdas not None,
+                             double sc_alpha, double sc_sigma,
+                             np.ndarray[double, ndim=1] energies not None):
+    '''Compute a pair potential with soft-core coupling of an atom group
+
+       **Arguments:**
+
+       pot
+            A ``PairPot`` instance, whose energy only depends on the distance.
+
+       neighs, stab, gpos, vtens, nneigh, scales
+            See ``PairPot.compute``. Only the standard neighbor list format
+            is supported.
+
+       group
+            An integer array with shape (natom,). Pairs of atoms with
+            different values are coupled through the soft-core potential.
+
+       lam
+            The coupling parameter for the energy, gpos and vtens. It is one
+            for full coupling and zero for no coupling.
+
+       lambdas
+            An array with coupling parameters for which only the energy is
+            computed.
+
+       sc_alpha, sc_sigma
+            The parameters of the soft-core potential. The pair potential is
+            evaluated at a distance r given by r**6 = sc_alpha*sc_sigma**6*(1
+            - lam) + d**6 and is multiplied by lam.
+
+       energies
+            An output array with shape (len(lambdas),), for the energies at
+            each value in lambdas.
+
+       **Returns:** the energy for lam.
+    '''
+    cdef double *my_gpos
+    cdef double *my_vtens
+    cdef double *my_scales
+    cdef pair_pot.scaling_row_type *my_stab
+    cdef long nstab, natom, nlambda
+    cdef np.ndarray[double, ndim=1] my_energies
+
+    assert pair_pot.pair_pot_ready(pot._c_pair_pot)
+    assert neighs.dtype == neigh_dtype
+    assert neighs.flags['C_CONTIGUOUS']
+    assert stab.flags['C_CONTIGUOUS']
+    assert group.flags['C_CONTIGUOUS']
+    assert lambdas.flags['C_CONTIGUOUS']
+    nlambda = lambdas.shape[0]
+    assert energies.shape[0] == nlambda
+
+    if gpos is None:
+        my_gpos = NULL
+        natom = 0
+    else:
+        assert gpos.flags['C_CONTIGUOUS']
+        assert gpos.shape[1] == 3
+        my_gpos = <double*>gpos.data
+        natom = gpos.shape[0]
+        assert group.shape[0] == natom
+
+    if vtens is None:
+        my_vtens = NULL
+    else:
+        assert vtens.flags['C_CONTIGUOUS']
+        assert vtens.shape[0] == 3
+        assert vtens.shape[1] == 3
+        my_vtens = <double*>vtens.data
+
+    if scales is None:
+        my_scales = NULL
+    else:
+        assert scales.flags['C_CONTIGUOUS']
+        assert scales.shape[0] == 5
+        my_scales = <double*>scales.data
+
+    my_stab = <pair_pot.scaling_row_type*>stab.data
+    nstab = len(stab)
+    my_energies = np.zeros(nlambda+1)
+    with nogil:
+        pair_pot.pair_pot_compute_lambdas(
+            <nlist.neigh_row_type*>neighs.data, nneigh, my_stab, nstab,
+            my_scales, pot._c_pair_pot, <long*>group.data, lam, nlambda,
+            <double*>lambdas.data, sc_alpha, sc_sigma,
+            <double*>my_energies.data, natom, my_gpos, my_vtens
         )
+    energies[:] = my_energies[1:]
+    return my_energies[0]
+
+
+#: The largest number of parameter classes for which the mixed parameters of
+#: per-atom pair potentials are tabulated.
+_max_mixing_classes = 256
+
+
+def _parameter_classes(*arrays):
+    '''Group atoms with identical parameters into classes
+
+       **Arguments:**
+
+       arrays
+            Arrays with per-atom parameters, each with shape (natom,)
+
+       **Returns:** ``(nclass, class_ids)`` or ``(0, None)`` when there are
+       more than ``_max_mixing_classes`` classes.
+    '''
+    pars = np.array(arrays, dtype=float).T
+    if pars.shape[0] == 0:
+        return 0, None
+    unique, class_ids = np.unique(pars, axis=0, return_inverse=True)
+    if unique.shape[0] > _max_mixing_classes:
+        return 0, None
+    return unique.shape[0], np.ascontiguousarray(class_ids.ravel(), dtype=int)
+
+
+def _interleave(*arrays):
+    '''Interleave arrays with the same shape along a new last axis'''
+    return np.ascontiguousarray(np.moveaxis(np.array(arrays, dtype=float), 0, -1))
+
+
+#: The largest number of distinct Slater widths for which the width-dependent
+#: coefficients of the Slater pair potentials are tabulated.
+_max_slater_classes = 64
+
+
+def _slater_classes(*widths):
+    '''Group Slater sites with identical widths into classes
+
+       **Arguments:**
+
+       widths
+            Arrays with Slater widths, which share the same classes.
+
+       **Returns:** ``(nclass, class_widths, class_ids)``, where ``class_ids``
+       is a list with one flattened array of class indexes for each argument.
+       When there are more than ``_max_slater_classes`` classes, ``(0, None,
+       None)`` is returned.
+    '''
+    sizes = [w.size for w in widths]
+    class_widths, class_ids = np.unique(np.concatenate([w.ravel() for w in widths]), return_inverse=True)
+    if class_widths.shape[0] == 0 or class_widths.shape[0] > _max_slater_classes:
+        return 0, None, None
+    class_ids = np.ascontiguousarray(class_ids.ravel(), dtype=int)
+    return class_widths.shape[0], class_widths, np.split(class_ids, np.cumsum(sizes)[:-1])
+
+
+def _slater_table(long ntable):
+    '''Allocate memory for ntable sets of Slater coefficients'''
+    return np.zeros(ntable*sizeof(slater.slater_coeffs_type), np.uint8)
 
 
 cdef class PairPotLJ(PairPot):
@@ -740,6 +1562,8 @@ cdef class PairPotLJ(PairPot):
     '''
     cdef np.ndarray _c_sigmas
     cdef np.ndarray _c_epsilons
+    cdef np.ndarray _c_class_ids
+    cdef np.ndarray _c_table
     name = 'lj'
 
     def __cinit__(self, np.ndarray[double, ndim=1] sigmas,
@@ -748,9 +1572,26 @@ cdef class PairPotLJ(PairPot):
         assert sigmas.flags['C_CONTIGUOUS']
         assert epsilons.flags['C_CONTIGUOUS']
         assert sigmas.shape[0] == epsilons.shape[0]
+        # Keep private copies, such that the mixing table cannot go stale.
+        sigmas = np.array(sigmas, copy=True)
+        epsilons = np.array(epsilons, copy=True)
         pair_pot.pair_pot_set_rcut(self._c_pair_pot, rcut)
         self.set_truncation(tr)
-        pair_pot.pair_data_lj_init(self._c_pair_pot, <double*>sigmas.data, <double*>epsilons.data)
+        nclass, self._c_class_ids = _parameter_classes(sigmas, epsilons)
+        if nclass > 0:
+            sigma_class = np.zeros(nclass)
+            epsilon_class = np.zeros(nclass)
+            sigma_class[self._c_class_ids] = sigmas
+            epsilon_class[self._c_class_ids] = epsilons
+            self._c_table = _interleave(
+                0.5*np.add.outer(sigma_class, sigma_class),
+                np.sqrt(np.multiply.outer(epsilon_class, epsilon_class)),
+            )
+            pair_pot.pair_data_lj_init(self._c_pair_pot, <double*>sigmas.data, <double*>epsilons.data,
+                                       nclass, <long*>self._c_class_ids.data, <double*>self._c_table.data)
+        else:
+            pair_pot.pair_data_lj_init(self._c_pair_pot, <double*>sigmas.data, <double*>epsilons.data,
+                                       0, NULL, NULL)
         if not pair_pot.pair_pot_ready(self._c_pair_pot):
             raise MemoryError()
         self._c_sigmas = sigmas
@@ -766,14 +1607,18 @@ cdef class PairPotLJ(PairPot):
                 log('%7i %s %s' % (i, log.length(self._c_sigmas[i]), log.energy(self._c_epsilons[i])))
 
     def _get_sigmas(self):
-        '''The array with sigma parameters'''
-        return self._c_sigmas.view()
+        '''The array with sigma parameters (read-only)'''
+        result = self._c_sigmas.view()
+        result.flags.writeable = False
+        return result
 
     sigmas = property(_get_sigmas)
 
     def _get_epsilons(self):
-        '''The array with epsilon parameters'''
-        return self._c_epsilons.view()
+        '''The array with epsilon parameters (read-only)'''
+        result = self._c_epsilons.view()
+        result.flags.writeable = False
+        return result
 
     epsilons = property(_get_epsilons)
 
@@ -819,6 +1664,8 @@ cdef class PairPotMM3(PairPot):
     cdef np.ndarray _c_sigmas
     cdef np.ndarray _c_epsilons
     cdef np.ndarray _c_onlypaulis
+    cdef np.ndarray _c_class_ids
+    cdef np.ndarray _c_table
     name = 'mm3'
 
     def __cinit__(self, np.ndarray[double, ndim=1] sigmas,
@@ -830,9 +1677,30 @@ cdef class PairPotMM3(PairPot):
         assert onlypaulis.flags['C_CONTIGUOUS']
         assert sigmas.shape[0] == epsilons.shape[0]
         assert sigmas.shape[0] == onlypaulis.shape[0]
+        # Keep private copies, such that the mixing table cannot go stale.
+        sigmas = np.array(sigmas, copy=True)
+        epsilons = np.array(epsilons, copy=True)
+        onlypaulis = np.array(onlypaulis, copy=True)
         pair_pot.pair_pot_set_rcut(self._c_pair_pot, rcut)
         self.set_truncation(tr)
-        pair_pot.pair_data_mm3_init(self._c_pair_pot, <double*>sigmas.data, <double*>epsilons.data, <int*>onlypaulis.data)
+        nclass, self._c_class_ids = _parameter_classes(sigmas, epsilons, onlypaulis)
+        if nclass > 0:
+            sigma_class = np.zeros(nclass)
+            epsilon_class = np.zeros(nclass)
+            onlypauli_class = np.zeros(nclass)
+            sigma_class[self._c_class_ids] = sigmas
+            epsilon_class[self._c_class_ids] = epsilons
+            onlypauli_class[self._c_class_ids] = onlypaulis
+            self._c_table = _interleave(
+                np.add.outer(sigma_class, sigma_class),
+                np.sqrt(np.multiply.outer(epsilon_class, epsilon_class)),
+                np.add.outer(onlypauli_class, onlypauli_class),
+            )
+            pair_pot.pair_data_mm3_init(self._c_pair_pot, <double*>sigmas.data, <double*>epsilons.data, <int*>onlypaulis.data,
+                                        nclass, <long*>self._c_class_ids.data, <double*>self._c_table.data)
+        else:
+            pair_pot.pair_data_mm3_init(self._c_pair_pot, <double*>sigmas.data, <double*>epsilons.data, <int*>onlypaulis.data,
+                                        0, NULL, NULL)
         if not pair_pot.pair_pot_ready(self._c_pair_pot):
             raise MemoryError()
         self._c_sigmas = sigmas
@@ -849,20 +1717,26 @@ cdef class PairPotMM3(PairPot):
                 log('%7i %s %s            %i' % (i, log.length(self._c_sigmas[i]), log.energy(self._c_epsilons[i]), self._c_onlypaulis[i]))
 
     def _get_sigmas(self):
-        '''The array with sigma parameters'''
-        return self._c_sigmas.view()
+        '''The array with sigma parameters (read-only)'''
+        result = self._c_sigmas.view()
+        result.flags.writeable = False
+        return result
 
     sigmas = property(_get_sigmas)
 
     def _get_epsilons(self):
-        '''The array with epsilon parameters'''
-        return self._c_epsilons.view()
+        '''The array with epsilon parameters (read-only)'''
+        result = self._c_epsilons.view()
+        result.flags.writeable = False
+        return result
 
     epsilons = property(_get_epsilons)
 
     def _get_onlypaulis(self):
-        '''The array with the only-Pauli flag'''
-        return self._c_onlypaulis.view()
+        '''The array with the only-Pauli flag (read-only)'''
+        result = self._c_onlypaulis.view()
+        result.flags.writeable = False
+        return result
 
     onlypaulis = property(_get_onlypaulis)
 
@@ -870,6 +1744,8 @@ cdef class PairPotMM3(PairPot):
 cdef class PairPotGrimme(PairPot):
     cdef np.ndarray _c_r0
     cdef np.ndarray _c_c6
+    cdef np.ndarray _c_class_ids
+    cdef np.ndarray _c_table
     name = 'grimme'
 
     def __cinit__(self, np.ndarray[double, ndim=1] r0,
@@ -878,9 +1754,26 @@ cdef class PairPotGrimme(PairPot):
         assert r0.flags['C_CONTIGUOUS']
         assert c6.flags['C_CONTIGUOUS']
         assert r0.shape[0] == c6.shape[0]
+        # Keep private copies, such that the mixing table cannot go stale.
+        r0 = np.array(r0, copy=True)
+        c6 = np.array(c6, copy=True)
         pair_pot.pair_pot_set_rcut(self._c_pair_pot, rcut)
         self.set_truncation(tr)
-        pair_pot.pair_data_grimme_init(self._c_pair_pot, <double*>r0.data, <double*>c6.data)
+        nclass, self._c_class_ids = _parameter_classes(r0, c6)
+        if nclass > 0:
+            r0_class = np.zeros(nclass)
+            c6_class = np.zeros(nclass)
+            r0_class[self._c_class_ids] = r0
+            c6_class[self._c_class_ids] = c6
+            self._c_table = _interleave(
+                np.add.outer(r0_class, r0_class),
+                np.sqrt(np.multiply.outer(c6_class, c6_class)),
+            )
+            pair_pot.pair_data_grimme_init(self._c_pair_pot, <double*>r0.data, <double*>c6.data,
+                                           nclass, <long*>self._c_class_ids.data, <double*>self._c_table.data)
+        else:
+            pair_pot.pair_data_grimme_init(self._c_pair_pot, <double*>r0.data, <double*>c6.data,
+                                           0, NULL, NULL)
         if not pair_pot.pair_pot_ready(self._c_pair_pot):
             raise MemoryError()
         self._c_r0 = r0
@@ -895,12 +1788,16 @@ cdef class PairPotGrimme(PairPot):
                 log('%7i %s %s' % (i, log.length(self._c_r0[i]), log.c6(self._c_c6[i])))
 
     def _get_r0(self):
-        return self._c_r0.view()
+        result = self._c_r0.view()
+        result.flags.writeable = False
+        return result
 
     r0 = property(_get_r0)
 
     def _get_c6(self):
-        return self._c_c6.view()
+        result = self._c_c6.view()
+        result.flags.writeable = False
+        return result
 
     c6 = property(_get_c6)
 
@@ -972,6 +1869,7 @@ cdef class PairPotExpRep(PairPot):
     cdef np.ndarray _c_ffatype_ids
     cdef np.ndarray _c_amp_cross
     cdef np.ndarray _c_b_cross
+    cdef np.ndarray _c_cross
     name = 'exprep'
 
     def __cinit__(self, np.ndarray[long, ndim=1] ffatype_ids not None,
@@ -1003,15 +1901,16 @@ cdef class PairPotExpRep(PairPot):
         assert (b_cross == b_cross.T).all()
         pair_pot.pair_pot_set_rcut(self._c_pair_pot, rcut)
         self.set_truncation(tr)
+        self._c_cross = _interleave(amp_cross, b_cross)
         pair_pot.pair_data_exprep_init(
             self._c_pair_pot, nffatype, <long*> ffatype_ids.data,
-            <double*> amp_cross.data, <double*> b_cross.data
+            <double*> self._c_cross.data
         )
         if not pair_pot.pair_pot_ready(self._c_pair_pot):
             raise MemoryError()
         self._c_nffatype = nffatype
-        self._c_amp_cross = amp_cross
-        self._c_b_cross = b_cross
+        self._c_amp_cross = self._c_cross[:,:,0]
+        self._c_b_cross = self._c_cross[:,:,1]
 
     def _init_amp_cross(self, nffatype, amp_cross, amps, amp_mix, amp_mix_coeff):
         for i0 in range(nffatype):
@@ -1131,6 +2030,7 @@ cdef class PairPotQMDFFRep(PairPot):
     cdef np.ndarray _c_ffatype_ids
     cdef np.ndarray _c_amp_cross
     cdef np.ndarray _c_b_cross
+    cdef np.ndarray _c_cross
     name = 'qmdffrep'
 
     def __cinit__(self, np.ndarray[long, ndim=1] ffatype_ids not None,
@@ -1162,15 +2062,16 @@ cdef class PairPotQMDFFRep(PairPot):
         assert (b_cross == b_cross.T).all()
         pair_pot.pair_pot_set_rcut(self._c_pair_pot, rcut)
         self.set_truncation(tr)
+        self._c_cross = _interleave(amp_cross, b_cross)
         pair_pot.pair_data_qmdffrep_init(
             self._c_pair_pot, nffatype, <long*> ffatype_ids.data,
-            <double*> amp_cross.data, <double*> b_cross.data
+            <double*> self._c_cross.data
         )
         if not pair_pot.pair_pot_ready(self._c_pair_pot):
             raise MemoryError()
         self._c_nffatype = nffatype
-        self._c_amp_cross = amp_cross
-        self._c_b_cross = b_cross
+        self._c_amp_cross = self._c_cross[:,:,0]
+        self._c_b_cross = self._c_cross[:,:,1]
 
     def _init_amp_cross(self, nffatype, amp_cross, amps, amp_mix, amp_mix_coeff):
         for i0 in range(nffatype):
@@ -1263,6 +2164,7 @@ cdef class PairPotLJCross(PairPot):
     cdef long _c_nffatype
     cdef np.ndarray _c_eps_cross
     cdef np.ndarray _c_sig_cross
+    cdef np.ndarray _c_cross
     name = 'ljcross'
 
     def __cinit__(self, np.ndarray[long, ndim=1] ffatype_ids not None,
@@ -1280,15 +2182,16 @@ cdef class PairPotLJCross(PairPot):
         assert sig_cross.shape[1] == nffatype
         pair_pot.pair_pot_set_rcut(self._c_pair_pot, rcut)
         self.set_truncation(tr)
+        self._c_cross = _interleave(eps_cross, sig_cross)
         pair_pot.pair_data_ljcross_init(
             self._c_pair_pot, nffatype, <long*> ffatype_ids.data,
-            <double*> eps_cross.data, <double*> sig_cross.data,
+            <double*> self._c_cross.data,
         )
         if not pair_pot.pair_pot_ready(self._c_pair_pot):
             raise MemoryError()
         self._c_nffatype = nffatype
-        self._c_eps_cross = eps_cross
-        self._c_sig_cross = sig_cross
+        self._c_eps_cross = self._c_cross[:,:,0]
+        self._c_sig_cross = self._c_cross[:,:,1]
 
     def log(self):
         '''Print suitable initialization info on screen.'''
@@ -1379,6 +2282,7 @@ cdef class PairPotDampDisp(PairPot):
     cdef long _c_power
     cdef np.ndarray _c_cn_cross
     cdef np.ndarray _c_b_cross
+    cdef np.ndarray _c_cross
     name = 'dampdisp'
 
     def __cinit__(self, np.ndarray[long, ndim=1] ffatype_ids not None,
@@ -1411,16 +2315,17 @@ cdef class PairPotDampDisp(PairPot):
             self._init_b_cross(nffatype, b_cross, bs)
         pair_pot.pair_pot_set_rcut(self._c_pair_pot, rcut)
         self.set_truncation(tr)
+        self._c_cross = _interleave(cn_cross, b_cross)
         pair_pot.pair_data_dampdisp_init(
             self._c_pair_pot, nffatype, power, <long*> ffatype_ids.data,
-            <double*> cn_cross.data, <double*> b_cross.data,
+            <double*> self._c_cross.data,
         )
         if not pair_pot.pair_pot_ready(self._c_pair_pot):
             raise MemoryError()
         self._c_nffatype = nffatype
         self._c_power = power
-        self._c_cn_cross = cn_cross
-        self._c_b_cross = b_cross
+        self._c_cn_cross = self._c_cross[:,:,0]
+        self._c_b_cross = self._c_cross[:,:,1]
 
     def _init_cn_cross(self, nffatype, cn_cross, cns, vols):
         for i0 in range(nffatype):
@@ -1519,6 +2424,7 @@ cdef class PairPotDisp68BJDamp(PairPot):
     cdef np.ndarray _c_c6_cross
     cdef np.ndarray _c_c8_cross
     cdef np.ndarray _c_R_cross
+    cdef np.ndarray _c_cross
     name = 'disp68bjdamp'
 
     def __cinit__(self, np.ndarray[long, ndim=1] ffatype_ids not None,
@@ -1561,17 +2467,17 @@ cdef class PairPotDisp68BJDamp(PairPot):
             R_cross[mask] = np.sqrt(c8_cross[mask]/c6_cross[mask])
         pair_pot.pair_pot_set_rcut(self._c_pair_pot, rcut)
         self.set_truncation(tr)
+        self._c_cross = _interleave(c6_cross, c8_cross, R_cross)
         pair_pot.pair_data_disp68bjdamp_init(
             self._c_pair_pot, nffatype, <long*> ffatype_ids.data,
-            <double*> c6_cross.data, <double*> c8_cross.data,
-            <double*> R_cross.data, c6_scale, c8_scale, bj_a, bj_b,
+            <double*> self._c_cross.data, c6_scale, c8_scale, bj_a, bj_b,
         )
         if not pair_pot.pair_pot_ready(self._c_pair_pot):
             raise MemoryError()
         self._c_nffatype = nffatype
-        self._c_c6_cross = c6_cross
-        self._c_c8_cross = c8_cross
-        self._c_R_cross = R_cross
+        self._c_c6_cross = self._c_cross[:,:,0]
+        self._c_c8_cross = self._c_cross[:,:,1]
+        self._c_R_cross = self._c_cross[:,:,2]
 
     def log(self):
         '''Print suitable initialization info on screen.'''
@@ -1727,8 +2633,86 @@ cdef class PairPotEI(PairPot):
     dielectric = property(_get_dielectric)
 
 
-cdef class PairPotEIDip(PairPot):
-    r'''Short-range contribution to the electrostatic interaction between point charges
+cdef class PairPotDSF(PairPot):
+    r'''Damped shifted-force electrostatic interaction between point charges
+
+        **Arguments:**
+
+        charges
+            An array of atomic charges, shape = (natom,)
+
+        alpha
+            The damping parameter. When set to zero, this becomes the shifted
+            force Coulomb interaction.
+
+        rcut
+            The cutoff radius
+
+        **Optional arguments:**
+
+        dielectric
+            A relative dielectric permitivity that just scales the Coulomb
+            interaction.
+
+        The pair potential of Fennell and Gezelter, J. Chem. Phys. 124,
+        234104 (2006), is:
+
+        .. math::
+            V(d) = q_i q_j\left[\frac{\text{erfc}(\alpha d)}{d} -
+                   \frac{\text{erfc}(\alpha r_c)}{r_c} +
+                   \left(\frac{\text{erfc}(\alpha r_c)}{r_c^2} +
+                   \frac{2\alpha}{\sqrt{\pi}}\frac{\exp(-\alpha^2 r_c^2)}{r_c}
+                   \right)(d - r_c)\right]
+
+        Both the energy and the force go to zero at the cutoff, so no
+        truncation scheme is needed. It must be combined with
+        ``ForcePartDSFCorrection`` for the self-interaction terms.
+    '''
+    cdef np.ndarray _c_charges
+    name = 'dsf'
+
+    def __cinit__(self, np.ndarray[double, ndim=1] charges, double alpha,
+                  double rcut, double dielectric=1.0):
+        assert charges.flags['C_CONTIGUOUS']
+        assert alpha >= 0
+        pair_pot.pair_pot_set_rcut(self._c_pair_pot, rcut)
+        pair_pot.pair_data_dsf_init(self._c_pair_pot, <double*>charges.data, alpha, dielectric)
+        if not pair_pot.pair_pot_ready(self._c_pair_pot):
+            raise MemoryError()
+        self._c_charges = charges
+
+    def log(self):
+        '''Print suitable initialization info on screen.'''
+        if log.do_medium:
+            log('  alpha:                 %s' % log.invlength(self.alpha))
+            log('  relative permittivity: %5.3f' % self.dielectric)
+        if log.do_high:
+            log.hline()
+            log('   Atom     Charge')
+            log.hline()
+            for i in range(self._c_charges.shape[0]):
+                log('%7i %s' % (i, log.charge(self._c_charges[i])))
+
+    def _get_charges(self):
+        '''The atomic charges'''
+        return self._c_charges.view()
+
+    charges = property(_get_charges)
+
+    def _get_alpha(self):
+        '''The damping parameter'''
+        return pair_pot.pair_data_dsf_get_alpha(self._c_pair_pot)
+
+    alpha = property(_get_alpha)
+
+    def _get_dielectric(self):
+        '''The scalar relative permittivity'''
+        return pair_pot.pair_data_dsf_get_dielectric(self._c_pair_pot)
+
+    dielectric = property(_get_dielectric)
+
+cdef class PairPotEIDip(PairPot):
+    r'''Short-range contribution to the electrostatic interaction between point charges
         and point dipoles. Only works for non-periodic systems and without truncation scheme
 
         **Arguments:**
@@ -1783,14 +2767,18 @@ cdef class PairPotEIDip(PairPot):
         for i in range(np.shape(poltens_i)[0]//3):
             self.poltens_i[3*i:3*(i+1) , 3*i:3*(i+1)] = poltens_i[3*i:3*(i+1),:]
 
-    def compute(self, np.ndarray[nlist.neigh_row_type, ndim=1] neighs,
+    def compute(self, np.ndarray neighs,
                 np.ndarray[pair_pot.scaling_row_type, ndim=1] stab,
                 np.ndarray[double, ndim=2] gpos,
-                np.ndarray[double, ndim=2] vtens, long nneigh):
+                np.ndarray[double, ndim=2] vtens, long nneigh,
+                np.ndarray[double, ndim=2] pos=None, Cell unitcell=None,
+                np.ndarray[double, ndim=1] scales=None,
+                np.ndarray[long, ndim=2] clusters=None,
+                np.ndarray[long, ndim=2] wrap=None):
         #Override parents method to add dipole creation energy
         #TODO: Does this contribute to gpos or vtens?
         log("Computing PairPotEIDip energy and gradient")
-        E = PairPot.compute(self, neighs, stab, gpos, vtens, nneigh)
+        E = PairPot.compute(self, neighs, stab, gpos, vtens, nneigh, pos, unitcell, scales, clusters, wrap)
         E += 0.5*np.dot( np.transpose(np.reshape( self._c_dipoles, (-1,) )) , np.dot( self.poltens_i, np.reshape( self._c_dipoles, (-1,) ) ) )
         return E
 
@@ -1859,6 +2847,8 @@ cdef class PairPotEiSlater1s1sCorr(PairPot):
     cdef np.ndarray _c_slater1s_widths
     cdef np.ndarray _c_slater1s_N
     cdef np.ndarray _c_slater1s_Z
+    cdef np.ndarray _c_class_ids
+    cdef np.ndarray _c_table
     name = 'eislater1s1scorr'
 
     def __cinit__(self, np.ndarray[double, ndim=1] slater1s_widths,
@@ -1867,10 +2857,18 @@ cdef class PairPotEiSlater1s1sCorr(PairPot):
         assert slater1s_widths.flags['C_CONTIGUOUS']
         assert slater1s_N.flags['C_CONTIGUOUS']
         assert slater1s_Z.flags['C_CONTIGUOUS']
-        # Precompute some factors here???
         pair_pot.pair_pot_set_rcut(self._c_pair_pot, rcut)
         self.set_truncation(tr)
-        pair_pot.pair_data_eislater1s1scorr_init(self._c_pair_pot, <double*>slater1s_widths.data,  <double*>slater1s_N.data,  <double*>slater1s_Z.data)
+        nclass, class_widths, class_ids = _slater_classes(slater1s_widths)
+        if nclass > 0:
+            self._c_class_ids, = class_ids
+            self._c_table = _slater_table(nclass*nclass)
+            pair_pot.pair_data_eislater1s1scorr_init(self._c_pair_pot, <double*>slater1s_widths.data,  <double*>slater1s_N.data,  <double*>slater1s_Z.data,
+                                                     nclass, <long*>self._c_class_ids.data, <double*>(<np.ndarray>class_widths).data,
+                                                     <slater.slater_coeffs_type*>self._c_table.data)
+        else:
+            pair_pot.pair_data_eislater1s1scorr_init(self._c_pair_pot, <double*>slater1s_widths.data,  <double*>slater1s_N.data,  <double*>slater1s_Z.data,
+                                                     0, NULL, NULL, NULL)
         if not pair_pot.pair_pot_ready(self._c_pair_pot):
             raise MemoryError()
         self._c_slater1s_widths = slater1s_widths
@@ -1947,6 +2945,9 @@ cdef class PairPotEiSlater1sp1spCorr(PairPot):
     cdef np.ndarray _c_slater1p_widths
     cdef np.ndarray _c_slater1p_N
     cdef np.ndarray _c_slater1p_Z
+    cdef np.ndarray _c_class_ids_s
+    cdef np.ndarray _c_class_ids_p
+    cdef np.ndarray _c_table
     name = 'eislater1sp1spcorr'
 
     def __cinit__(self, np.ndarray[double, ndim=1] slater1s_widths,
@@ -1959,11 +2960,20 @@ cdef class PairPotEiSlater1sp1spCorr(PairPot):
         assert slater1p_widths.flags['C_CONTIGUOUS']
         assert slater1p_N.flags['C_CONTIGUOUS']
         assert slater1p_Z.flags['C_CONTIGUOUS']
-        # Precompute some factors here???
         pair_pot.pair_pot_set_rcut(self._c_pair_pot, rcut)
         self.set_truncation(tr)
-        pair_pot.pair_data_eislater1sp1spcorr_init(self._c_pair_pot, <double*>slater1s_widths.data,  <double*>slater1s_N.data,  <double*>slater1s_Z.data,
-                                                   <double*>slater1p_widths.data, <double*>slater1p_N.data, <double*>slater1p_Z.data)
+        nclass, class_widths, class_ids = _slater_classes(slater1s_widths, slater1p_widths)
+        if nclass > 0:
+            self._c_class_ids_s, self._c_class_ids_p = class_ids
+            self._c_table = _slater_table(4*nclass*nclass)
+            pair_pot.pair_data_eislater1sp1spcorr_init(self._c_pair_pot, <double*>slater1s_widths.data,  <double*>slater1s_N.data,  <double*>slater1s_Z.data,
+                                                       <double*>slater1p_widths.data, <double*>slater1p_N.data, <double*>slater1p_Z.data,
+                                                       nclass, <long*>self._c_class_ids_s.data, <long*>self._c_class_ids_p.data,
+                                                       <double*>(<np.ndarray>class_widths).data, <slater.slater_coeffs_type*>self._c_table.data)
+        else:
+            pair_pot.pair_data_eislater1sp1spcorr_init(self._c_pair_pot, <double*>slater1s_widths.data,  <double*>slater1s_N.data,  <double*>slater1s_Z.data,
+                                                       <double*>slater1p_widths.data, <double*>slater1p_N.data, <double*>slater1p_Z.data,
+                                                       0, NULL, NULL, NULL, NULL)
         if not pair_pot.pair_pot_ready(self._c_pair_pot):
             raise MemoryError()
         self._c_slater1s_widths = slater1s_widths
@@ -2059,6 +3069,8 @@ cdef class PairPotOlpSlater1s1s(PairPot):
     '''
     cdef np.ndarray _c_slater1s_widths
     cdef np.ndarray _c_slater1s_N
+    cdef np.ndarray _c_class_ids
+    cdef np.ndarray _c_table
     name = 'olpslater1s1s'
 
     def __cinit__(self, np.ndarray[double, ndim=1] slater1s_widths,
@@ -2067,10 +3079,18 @@ cdef class PairPotOlpSlater1s1s(PairPot):
                   double corr_b=0.0, double corr_c=0.0):
         assert slater1s_widths.flags['C_CONTIGUOUS']
         assert slater1s_N.flags['C_CONTIGUOUS']
-        # Precompute some factors here???
         pair_pot.pair_pot_set_rcut(self._c_pair_pot, rcut)
         self.set_truncation(tr)
-        pair_pot.pair_data_olpslater1s1s_init(self._c_pair_pot, <double*>slater1s_widths.data,  <double*>slater1s_N.data,  ex_scale, corr_a, corr_b, corr_c)
+        nclass, class_widths, class_ids = _slater_classes(slater1s_widths)
+        if nclass > 0:
+            self._c_class_ids, = class_ids
+            self._c_table = _slater_table(nclass*nclass)
+            pair_pot.pair_data_olpslater1s1s_init(self._c_pair_pot, <double*>slater1s_widths.data,  <double*>slater1s_N.data,  ex_scale, corr_a, corr_b, corr_c,
+                                                  nclass, <long*>self._c_class_ids.data, <double*>(<np.ndarray>class_widths).data,
+                                                  <slater.slater_coeffs_type*>self._c_table.data)
+        else:
+            pair_pot.pair_data_olpslater1s1s_init(self._c_pair_pot, <double*>slater1s_widths.data,  <double*>slater1s_N.data,  ex_scale, corr_a, corr_b, corr_c,
+                                                  0, NULL, NULL, NULL)
         if not pair_pot.pair_pot_ready(self._c_pair_pot):
             raise MemoryError()
         self._c_slater1s_widths = slater1s_widths
@@ -2159,6 +3179,8 @@ cdef class PairPotChargeTransferSlater1s1s(PairPot):
     '''
     cdef np.ndarray _c_slater1s_widths
     cdef np.ndarray _c_slater1s_N
+    cdef np.ndarray _c_class_ids
+    cdef np.ndarray _c_table
     name = 'chargetransferslater1s1s'
 
     def __cinit__(self, np.ndarray[double, ndim=1] slater1s_widths,
@@ -2166,10 +3188,18 @@ cdef class PairPotChargeTransferSlater1s1s(PairPot):
                   double rcut, Truncation tr=None, double width_power=3.0):
         assert slater1s_widths.flags['C_CONTIGUOUS']
         assert slater1s_N.flags['C_CONTIGUOUS']
-        # Precompute some factors here???
         pair_pot.pair_pot_set_rcut(self._c_pair_pot, rcut)
         self.set_truncation(tr)
-        pair_pot.pair_data_chargetransferslater1s1s_init(self._c_pair_pot, <double*>slater1s_widths.data,  <double*>slater1s_N.data, ct_scale, width_power)
+        nclass, class_widths, class_ids = _slater_classes(slater1s_widths)
+        if nclass > 0:
+            self._c_class_ids, = class_ids
+            self._c_table = _slater_table(nclass*nclass)
+            pair_pot.pair_data_chargetransferslater1s1s_init(self._c_pair_pot, <double*>slater1s_widths.data,  <double*>slater1s_N.data, ct_scale, width_power,
+                                                             nclass, <long*>self._c_class_ids.data, <double*>(<np.ndarray>class_widths).data,
+                                                             <slater.slater_coeffs_type*>self._c_table.data)
+        else:
+            pair_pot.pair_data_chargetransferslater1s1s_init(self._c_pair_pot, <double*>slater1s_widths.data,  <double*>slater1s_N.data, ct_scale, width_power,
+                                                             0, NULL, NULL, NULL)
         if not pair_pot.pair_pot_ready(self._c_pair_pot):
             raise MemoryError()
         self._c_slater1s_widths = slater1s_widths
@@ -2212,29 +3242,188 @@ cdef class PairPotChargeTransferSlater1s1s(PairPot):
     width_power = property(_get_width_power)
 
 
+cdef class PairPotTabulated(PairPot):
+    r'''Tabulated version of another pair potential
+
+       The energy of the original pair potential, including its truncation,
+       and its derivative towards the distance are sampled on an equidistant
+       grid between rmin and the cutoff, for each pair of atom types. They are
+       interpolated with cubic Hermite splines. The grid is refined until the
+       error on the energy and on its derivative is below the given tolerance,
+       at the midpoints and the quarter points of the grid intervals. Below
+       rmin, the original pair potential is evaluated.
+
+       **Arguments:**
+
+       source
+            The original pair potential, an instance of a subclass of
+            ``PairPot``. Its parameters may only depend on the atom types.
+            Potentials that depend on the direction of the relative vector,
+            i.e. ``PairPotEIDip``, are not supported.
+
+       ffatype_ids
+            An array with the atom type index of each atom, shape=(natom,)
+
+       **Optional arguments:**
+
+       tolerance
+            The allowed error on the interpolated energy and derivative. It
+            is an absolute error for small values and a relative error for
+            values larger than one, in atomic units.
+
+       rmin
+            The shortest tabulated distance.
+
+       npoint_max
+            The maximum number of grid points for each pair of atom types.
+            A ValueError is raised when the tolerance can not be reached with
+            this number of points.
+    '''
+    cdef PairPot _source
+    cdef np.ndarray _c_ffatype_ids
+    cdef np.ndarray _c_table_index
+    cdef np.ndarray _c_tables
+    cdef readonly object name
+    cdef readonly double tolerance
+
+    def __cinit__(self, PairPot source not None,
+                  np.ndarray[long, ndim=1] ffatype_ids not None,
+                  double tolerance=1e-8, double rmin=1.0,
+                  long npoint_max=65537):
+        cdef long nffatype, ntable, npoint, i0, i1
+        cdef double rcut
+        cdef np.ndarray table_index
+        cdef np.ndarray tables
+        if isinstance(source, PairPotEIDip):
+            raise TypeError('Pair potentials that depend on the direction of the relative vector can not be tabulated.')
+        assert pair_pot.pair_pot_ready(source._c_pair_pot)
+        assert ffatype_ids.flags['C_CONTIGUOUS']
+        assert ffatype_ids.min() >= 0
+        rcut = source.rcut
+        if rmin <= 0 or rmin >= rcut:
+            raise ValueError('The parameter rmin must be positive and smaller than the cutoff.')
+        self._source = source
+        self.name = source.name
+        self.tolerance = tolerance
+        pair_pot.pair_pot_set_rcut(self._c_pair_pot, rcut)
+        self.set_truncation(None)
+
+        # Select one representative atom for each atom type and check that
+        # the potential does not depend on anything else than the types.
+        nffatype = ffatype_ids.max() + 1
+        reps = -np.ones(nffatype, int)
+        reps[ffatype_ids[::-1]] = np.arange(len(ffatype_ids))[::-1]
+        present = (reps >= 0).nonzero()[0]
+        centers = np.repeat(np.arange(len(ffatype_ids)), len(present))
+        others = np.tile(reps[present], len(ffatype_ids))
+        for d in np.linspace(rmin, rcut, 3):
+            distances = np.zeros(len(centers)) + d
+            e, g = source.sample(centers, others, distances)
+            e_rep, g_rep = source.sample(reps[ffatype_ids[centers]], others, distances)
+            if not (_tabulated_close(e, e_rep, 1e-10) and _tabulated_close(g, g_rep, 1e-10)):
+                raise ValueError('The parameters of the pair potential do not only depend on the atom types.')
+
+        # Assign one table to each unordered pair of atom types.
+        table_index = -np.ones((nffatype, nffatype), int)
+        table_reps = []
+        for i0 in present:
+            for i1 in present:
+                if i1 < i0:
+                    continue
+                table_index[i0, i1] = len(table_reps)
+                table_index[i1, i0] = len(table_reps)
+                table_reps.append((reps[i0], reps[i1]))
+        table_reps = np.array(table_reps, int)
+        ntable = len(table_reps)
+        self._c_ffatype_ids = ffatype_ids
+        self._c_table_index = table_index
+
+        # Refine the grid until the tolerance is reached.
+        npoint = 17
+        while True:
+            grid = np.linspace(rmin, rcut, npoint)
+            e, g = source.sample(
+                np.repeat(table_reps[:,0], npoint),
+                np.repeat(table_reps[:,1], npoint), np.tile(grid, ntable)
+            )
+            tables = np.array([e, g]).T.reshape(ntable, npoint, 2).copy()
+            if pair_pot.pair_pot_ready(self._c_pair_pot):
+                pair_pot.pair_data_free(self._c_pair_pot)
+            pair_pot.pair_data_tabulated_init(
+                self._c_pair_pot, source._c_pair_pot, nffatype,
+                <long*>ffatype_ids.data, <long*>table_index.data, npoint,
+                rmin, <double*>tables.data
+            )
+            if not pair_pot.pair_pot_ready(self._c_pair_pot):
+                raise MemoryError()
+            self._c_tables = tables
+            # Test at the midpoints and the quarter points.
+            h = grid[1] - grid[0]
+            test = np.concatenate([grid[:-1] + 0.25*h, grid[:-1] + 0.5*h, grid[:-1] + 0.75*h])
+            centers = np.repeat(table_reps[:,0], len(test))
+            others = np.repeat(table_reps[:,1], len(test))
+            distances = np.tile(test, ntable)
+            e, g = source.sample(centers, others, distances)
+            e_tab, g_tab = self.sample(centers, others, distances)
+            if _tabulated_close(e_tab, e, tolerance) and _tabulated_close(g_tab, g, tolerance):
+                break
+            npoint = 2*npoint - 1
+            if npoint > npoint_max:
+                raise ValueError('The tolerance can not be reached with %i grid points.' % npoint_max)
+
+    def log(self):
+        '''Write some suitable post-initialization screen log'''
+        if log.do_medium:
+            log('  tabulated:          %i tables with %i points' % (self._c_tables.shape[0], self.npoint))
+            log('  shortest distance:  %s' % log.length(self.rmin))
+        self._source.log()
+
+    def get_truncation(self):
+        '''Returns the truncation scheme of the original pair potential
+
+           This truncation is included in the tables.
+        '''
+        return self._source.get_truncation()
+
+    def _get_source(self):
+        '''The original pair potential'''
+        return self._source
+
+    source = property(_get_source)
+
+    def _get_npoint(self):
+        '''The number of grid points in each table'''
+        return pair_pot.pair_data_tabulated_get_npoint(self._c_pair_pot)
+
+    npoint = property(_get_npoint)
+
+    def _get_rmin(self):
+        '''The shortest tabulated distance'''
+        return pair_pot.pair_data_tabulated_get_rmin(self._c_pair_pot)
+
+    rmin = property(_get_rmin)
+
+
+def _tabulated_close(a, b, tolerance):
+    '''Test if a and b agree within the tolerance of PairPotTabulated'''
+    return (abs(a - b) <= tolerance*np.maximum(1.0, abs(b))).all()
+
+
 
 #
 # Ewald summation stuff
 #
 
 
-def compute_ewald_reci(np.ndarray[double, ndim=2] pos,
-                       np.ndarray[double, ndim=1] charges,
-                       Cell unitcell, double alpha,
-                       np.ndarray[long, ndim=1] gmax,
-                       double gcut, double dielectric,
-                       np.ndarray[double, ndim=2] gpos,
-                       np.ndarray[double, ndim=1] work,
-                       np.ndarray[double, ndim=2] vtens):
-    '''Compute the reciprocal interaction term in the Ewald summation scheme
+cdef ewald.ewald_kvec_type _ewald_kvec_tmp
+ewald_kvec_dtype = np.asarray(<ewald.ewald_kvec_type[:1]>(&_ewald_kvec_tmp)).dtype
 
-       **Arguments:**
 
-       pos
-            The atomic positions. numpy array with shape (natom,3).
+def compute_ewald_kvecs(Cell unitcell, double alpha,
+                        np.ndarray[long, ndim=1] gmax, double gcut):
+    '''Make the table of k-vectors for the reciprocal Ewald sum
 
-       charges
-            The atomic charges. numpy array with shape (natom,).
+       **Arguments:**
 
        unitcell
             An instance of the ``Cell`` class that describes the periodic
@@ -2254,6 +3443,49 @@ def compute_ewald_reci(np.ndarray[double, ndim=2] pos,
             The cutoff in reciprocal space. The caller is responsible for the
             compatibility of ``gcut`` with ``gmax``.
 
+       **Returns:** an array with dtype ``ewald_kvec_dtype``, containing one
+       k-vector of each pair k, -k within the cutoff, together with the
+       prefactors that only depend on the cell, alpha and gcut. The k-vectors
+       with the same g0 and g1 are consecutive. The table remains valid as
+       long as the cell vectors, alpha and gcut do not change.
+    '''
+    cdef np.ndarray kvecs
+    cdef long nkvec
+    assert unitcell.nvec == 3
+    assert alpha > 0
+    assert gmax.flags['C_CONTIGUOUS']
+    assert gmax.shape[0] == 3
+    kvecs = np.zeros((2*gmax[0]+1)*(2*gmax[1]+1)*(gmax[2]+1), ewald_kvec_dtype)
+    nkvec = ewald.compute_ewald_kvecs(unitcell._c_cell, alpha,
+                                      <long*>gmax.data, gcut,
+                                      <ewald.ewald_kvec_type*>kvecs.data)
+    return kvecs[:nkvec].copy()
+
+
+def compute_ewald_reci(np.ndarray[double, ndim=2] pos,
+                       np.ndarray[double, ndim=1] charges,
+                       Cell unitcell, np.ndarray kvecs, double dielectric,
+                       np.ndarray[double, ndim=2] gpos,
+                       np.ndarray[double, ndim=1] work,
+                       np.ndarray[double, ndim=2] vtens):
+    '''Compute the reciprocal interaction term in the Ewald summation scheme
+
+       **Arguments:**
+
+       pos
+            The atomic positions. numpy array with shape (natom,3).
+
+       charges
+            The atomic charges. numpy array with shape (natom,).
+
+       unitcell
+            An instance of the ``Cell`` class that describes the periodic
+            boundary conditions.
+
+       kvecs
+            The table of k-vectors, as returned by ``compute_ewald_kvecs`` for
+            the current cell vectors.
+
        dielectric
             The scalar relative permittivity of the system.
 
@@ -2269,19 +3501,25 @@ def compute_ewald_reci(np.ndarray[double, ndim=2] pos,
             If not set to None, the virial tensor is computed and stored in
             this array. numpy array with shape (3, 3).
     '''
+    cdef double *my_pos
+    cdef long natom
+    cdef double *my_charges
+    cdef cell.cell_type *my_unitcell
+    cdef ewald.ewald_kvec_type *my_kvecs
+    cdef long nkvec
     cdef double *my_gpos
     cdef double *my_work
     cdef double *my_vtens
+    cdef double energy
 
     assert pos.flags['C_CONTIGUOUS']
     assert pos.shape[1] == 3
     assert charges.flags['C_CONTIGUOUS']
     assert charges.shape[0] == pos.shape[0]
     assert unitcell.nvec == 3
-    assert alpha > 0
+    assert kvecs.dtype == ewald_kvec_dtype
+    assert kvecs.flags['C_CONTIGUOUS']
     assert dielectric >= 1.0
-    assert gmax.flags['C_CONTIGUOUS']
-    assert gmax.shape[0] == 3
 
     if gpos is None:
         my_gpos = NULL
@@ -2303,18 +3541,27 @@ def compute_ewald_reci(np.ndarray[double, ndim=2] pos,
         assert vtens.shape[1] == 3
         my_vtens = <double*>vtens.data
 
-    return ewald.compute_ewald_reci(<double*>pos.data, len(pos),
-                                    <double*>charges.data,
-                                    unitcell._c_cell, alpha, <long*>gmax.data,
-                                    gcut, dielectric, my_gpos, my_work,
-                                    my_vtens)
+    my_pos = <double*>pos.data
+    natom = len(pos)
+    my_charges = <double*>charges.data
+    my_unitcell = unitcell._c_cell
+    my_kvecs = <ewald.ewald_kvec_type*>kvecs.data
+    nkvec = len(kvecs)
+    with nogil:
+        energy = ewald.compute_ewald_reci(my_pos, natom, my_charges,
+                                          my_unitcell, my_kvecs, nkvec,
+                                          dielectric, my_gpos, my_work,
+                                          my_vtens)
+    if np.isnan(energy):
+        # The tables with phase factors could not be allocated.
+        raise MemoryError()
+    return energy
 
 
 def compute_ewald_reci_dd(np.ndarray[double, ndim=2] pos,
                        np.ndarray[double, ndim=1] charges,
                        np.ndarray[double, ndim=2] dipoles,
-                       Cell unitcell, double alpha,
-                       np.ndarray[long, ndim=1] gmax, double gcut,
+                       Cell unitcell, np.ndarray kvecs,
                        np.ndarray[double, ndim=2] gpos,
                        np.ndarray[double, ndim=1] work,
                        np.ndarray[double, ndim=2] vtens):
@@ -2335,19 +3582,9 @@ def compute_ewald_reci_dd(np.ndarray[double, ndim=2] pos,
             An instance of the ``Cell`` class that describes the periodic
             boundary conditions.
 
-       alpha
-            The :math:`\\alpha` parameter from the Ewald summation scheme.
-
-       gmax
-            The maximum range of periodic images in reciprocal space to be
-            considered for the Ewald sum. integer numpy array with shape (3,).
-            Each element gives the range along the corresponding reciprocal
-            cell vector. The range along each axis goes from -gmax[0] to
-            gmax[0] (inclusive).
-
-       gcut
-            The cutoff in reciprocal space. The caller is responsible for the
-            compatibility of ``gcut`` with ``gmax``.
+       kvecs
+            The table of k-vectors, as returned by ``compute_ewald_kvecs`` for
+            the current cell vectors.
 
        gpos
             If not set to None, the Cartesian gradient of the energy is
@@ -2361,9 +3598,17 @@ def compute_ewald_reci_dd(np.ndarray[double, ndim=2] pos,
             If not set to None, the virial tensor is computed and stored in
             this array. numpy array with shape (3, 3).
     '''
+    cdef double *my_pos
+    cdef long natom
+    cdef double *my_charges
+    cdef double *my_dipoles
+    cdef cell.cell_type *my_unitcell
+    cdef ewald.ewald_kvec_type *my_kvecs
+    cdef long nkvec
     cdef double *my_gpos
     cdef double *my_work
     cdef double *my_vtens
+    cdef double energy
 
     assert pos.flags['C_CONTIGUOUS']
     assert pos.shape[1] == 3
@@ -2372,9 +3617,8 @@ def compute_ewald_reci_dd(np.ndarray[double, ndim=2] pos,
     assert dipoles.flags['C_CONTIGUOUS']
     assert dipoles.shape[0] == pos.shape[0]
     assert unitcell.nvec == 3
-    assert alpha > 0
-    assert gmax.flags['C_CONTIGUOUS']
-    assert gmax.shape[0] == 3
+    assert kvecs.dtype == ewald_kvec_dtype
+    assert kvecs.flags['C_CONTIGUOUS']
 
     if gpos is None:
         my_gpos = NULL
@@ -2396,12 +3640,21 @@ def compute_ewald_reci_dd(np.ndarray[double, ndim=2] pos,
         assert vtens.shape[1] == 3
         my_vtens = <double*>vtens.data
 
-    return ewald.compute_ewald_reci_dd(<double*>pos.data, len(pos),
-                                    <double*>charges.data,
-                                    <double*>dipoles.data,
-                                    unitcell._c_cell, alpha,
-                                    <long*>gmax.data, gcut, my_gpos, my_work,
-                                    my_vtens)
+    my_pos = <double*>pos.data
+    natom = len(pos)
+    my_charges = <double*>charges.data
+    my_dipoles = <double*>dipoles.data
+    my_unitcell = unitcell._c_cell
+    my_kvecs = <ewald.ewald_kvec_type*>kvecs.data
+    nkvec = len(kvecs)
+    with nogil:
+        energy = ewald.compute_ewald_reci_dd(my_pos, natom, my_charges,
+                                             my_dipoles, my_unitcell, my_kvecs,
+                                             nkvec, my_gpos, my_work, my_vtens)
+    if np.isnan(energy):
+        # The tables with phase factors could not be allocated.
+        raise MemoryError()
+    return energy
 
 
 def compute_ewald_corr(np.ndarray[double, ndim=2] pos,
@@ -2479,6 +3732,86 @@ def compute_ewald_corr(np.ndarray[double, ndim=2] pos,
         my_gpos, my_vtens, len(pos)
     )
 
+def compute_dsf_corr(np.ndarray[double, ndim=2] pos,
+                     np.ndarray[double, ndim=1] charges,
+                     Cell unitcell, double alpha, double rcut,
+                     np.ndarray[pair_pot.scaling_row_type, ndim=1] stab,
+                     double dielectric,
+                     np.ndarray[double, ndim=2] gpos,
+                     np.ndarray[double, ndim=2] vtens):
+    '''Compute the self-interaction and scaling corrections for the damped
+       shifted-force electrostatics.
+
+       **Arguments:**
+
+       pos
+            The atomic positions. numpy array with shape (natom,3).
+
+       charges
+            The atomic charges. numpy array with shape (natom,).
+
+       unitcell
+            An instance of the ``Cell`` class that describes the periodic
+            boundary conditions.
+
+       alpha
+            The damping parameter of ``PairPotDSF``.
+
+       rcut
+            The cutoff of ``PairPotDSF``.
+
+       stab
+            The table with (sorted) pairs of atoms whose electrostatic
+            interactions are scaled. Each record corresponds to one pair
+            and contains the corresponding amount of scaling. See
+            ``pair_pot.scaling_row_type``
+
+       dielectric
+            The scalar relative permittivity of the system.
+
+       gpos
+            If not set to None, the Cartesian gradient of the energy is
+            added to this array. numpy array with shape (natom, 3).
+
+       vtens
+            If not set to None, the virial tensor is added to this array.
+            numpy array with shape (3, 3).
+    '''
+
+    cdef double *my_gpos
+    cdef double *my_vtens
+
+    assert pos.flags['C_CONTIGUOUS']
+    assert pos.shape[1] == 3
+    assert charges.flags['C_CONTIGUOUS']
+    assert charges.shape[0] == pos.shape[0]
+    assert alpha >= 0
+    assert rcut > 0
+    assert stab.flags['C_CONTIGUOUS']
+
+    if gpos is None:
+        my_gpos = NULL
+    else:
+        assert gpos.flags['C_CONTIGUOUS']
+        assert gpos.shape[1] == 3
+        assert gpos.shape[0] == pos.shape[0]
+        my_gpos = <double*>gpos.data
+
+    if vtens is None:
+        my_vtens = NULL
+    else:
+        assert vtens.flags['C_CONTIGUOUS']
+        assert vtens.shape[0] == 3
+        assert vtens.shape[1] == 3
+        my_vtens = <double*>vtens.data
+
+    return ewald.compute_dsf_corr(
+        <double*>pos.data, <double*>charges.data, unitcell._c_cell, alpha,
+        rcut, <pair_pot.scaling_row_type*>stab.data, len(stab), dielectric,
+        my_gpos, my_vtens, len(pos)
+    )
+
+
 def compute_ewald_corr_dd(np.ndarray[double, ndim=2] pos,
                        np.ndarray[double, ndim=1] charges,
                        np.ndarray[double, ndim=2] dipoles,
@@ -2553,6 +3886,212 @@ def compute_ewald_corr_dd(np.ndarray[double, ndim=2] pos,
     )
 
 
+#: The largest order of the B-splines in the smooth particle mesh Ewald method.
+pme_max_order = ewald.PME_MAX_ORDER
+
+
+def compute_pme_spread(np.ndarray[double, ndim=2] pos,
+                       np.ndarray[double, ndim=1] charges,
+                       Cell unitcell, long order,
+                       np.ndarray[double, ndim=3] grid):
+    '''Spread the charges on a grid with B-splines (smooth particle mesh Ewald)
+
+       **Arguments:**
+
+       pos
+            The atomic positions. numpy array with shape (natom,3).
+
+       charges
+            The atomic charges. numpy array with shape (natom,).
+
+       unitcell
+            An instance of the ``Cell`` class that describes the periodic
+            boundary conditions.
+
+       order
+            The order of the B-splines, at least 3 and at most
+            ``pme_max_order``.
+
+       grid
+            The charges are added to this array, whose shape (K0, K1, K2)
+            defines the number of grid points along each cell vector.
+    '''
+    cdef np.ndarray[long, ndim=1] ngrid
+
+    assert pos.flags['C_CONTIGUOUS']
+    assert pos.shape[1] == 3
+    assert charges.flags['C_CONTIGUOUS']
+    assert charges.shape[0] == pos.shape[0]
+    assert unitcell.nvec == 3
+    assert order >= 3 and order <= ewald.PME_MAX_ORDER
+    assert grid.flags['C_CONTIGUOUS']
+    ngrid = np.array([grid.shape[0], grid.shape[1], grid.shape[2]])
+    assert (ngrid >= order).all()
+
+    ewald.compute_pme_spread(<double*>pos.data, len(pos), <double*>charges.data,
+                             unitcell._c_cell, order, <long*>ngrid.data,
+                             <double*>grid.data)
+
+
+def compute_pme_gather(np.ndarray[double, ndim=2] pos,
+                       np.ndarray[double, ndim=1] charges,
+                       Cell unitcell, long order,
+                       np.ndarray[double, ndim=3] potential,
+                       np.ndarray[double, ndim=2] gpos):
+    '''Interpolate the gradient from a potential on a grid (smooth particle mesh Ewald)
+
+       **Arguments:**
+
+       pos, charges, unitcell, order
+            See ``compute_pme_spread``.
+
+       potential
+            The convolution of the spread charges with the reciprocal-space
+            kernel, on the same grid as in ``compute_pme_spread``.
+
+       gpos
+            The Cartesian gradient of the energy is added to this array.
+            numpy array with shape (natom, 3).
+    '''
+    cdef np.ndarray[long, ndim=1] ngrid
+
+    assert pos.flags['C_CONTIGUOUS']
+    assert pos.shape[1] == 3
+    assert charges.flags['C_CONTIGUOUS']
+    assert charges.shape[0] == pos.shape[0]
+    assert unitcell.nvec == 3
+    assert order >= 3 and order <= ewald.PME_MAX_ORDER
+    assert potential.flags['C_CONTIGUOUS']
+    ngrid = np.array([potential.shape[0], potential.shape[1], potential.shape[2]])
+    assert (ngrid >= order).all()
+    assert gpos.flags['C_CONTIGUOUS']
+    assert gpos.shape[1] == 3
+    assert gpos.shape[0] == pos.shape[0]
+
+    ewald.compute_pme_gather(<double*>pos.data, len(pos), <double*>charges.data,
+                             unitcell._c_cell, order, <long*>ngrid.data,
+                             <double*>potential.data, <double*>gpos.data)
+
+
+def compute_pme_moduli(long order, long n):
+    '''Compute the squared moduli of the Euler exponential splines
+
+       **Arguments:**
+
+       order
+            The order of the B-splines.
+
+       n
+            The number of grid points along one cell vector.
+
+       **Returns:** an array with |b(m)|^2 for m=0..n-1.
+    '''
+    cdef np.ndarray[double, ndim=1] moduli
+    assert order >= 3 and order <= ewald.PME_MAX_ORDER
+    assert n >= order
+    moduli = np.zeros(n)
+    ewald.compute_pme_moduli(order, n, <double*>moduli.data)
+    return moduli
+
+
+#
+# Tree code
+#
+
+#: The highest order of the multipole expansions in the tree code.
+tree_max_order = tree.TREE_MAX_ORDER
+
+
+def compute_ei_tree(np.ndarray[double, ndim=2] pos,
+                    np.ndarray[double, ndim=1] charges,
+                    np.ndarray[pair_pot.scaling_row_type, ndim=1] stab,
+                    long order, double theta, double dielectric,
+                    np.ndarray[double, ndim=2] gpos,
+                    np.ndarray[double, ndim=2] vtens):
+    '''Compute the electrostatic interaction of point charges in a
+       non-periodic system with a Barnes-Hut tree code.
+
+       **Arguments:**
+
+       pos
+            The atomic positions. numpy array with shape (natom,3).
+
+       charges
+            The atomic charges. numpy array with shape (natom,).
+
+       stab
+            The table with (sorted) pairs of atoms whose electrostatic
+            interactions are scaled. Each record corresponds to one pair
+            and contains the corresponding amount of scaling. See
+            ``pair_pot.scaling_row_type``
+
+       order
+            The order of the multipole expansions of the tree nodes, at most
+            ``tree_max_order``, e.g. 0 (monopole) or 2 (quadrupole).
+
+       theta
+            The opening angle. A node is replaced by its multipole expansion
+            when its radius is smaller than theta times its distance to an
+            atom. Must be larger than zero and smaller than one.
+
+       dielectric
+            The scalar relative permittivity of the system.
+
+       gpos
+            If not set to None, the Cartesian gradient of the energy is
+            stored in this array. numpy array with shape (natom, 3).
+
+       vtens
+            If not set to None, the virial tensor is computed and stored in
+            this array. numpy array with shape (3, 3).
+    '''
+    cdef double *my_pos
+    cdef double *my_charges
+    cdef pair_pot.scaling_row_type *my_stab
+    cdef double *my_gpos
+    cdef double *my_vtens
+    cdef long natom, stab_size
+    cdef double energy
+
+    assert pos.flags['C_CONTIGUOUS']
+    assert pos.shape[1] == 3
+    assert charges.flags['C_CONTIGUOUS']
+    assert charges.shape[0] == pos.shape[0]
+    assert stab.flags['C_CONTIGUOUS']
+    assert order >= 0 and order <= tree.TREE_MAX_ORDER
+    assert theta > 0 and theta < 1
+
+    if gpos is None:
+        my_gpos = NULL
+    else:
+        assert gpos.flags['C_CONTIGUOUS']
+        assert gpos.shape[1] == 3
+        assert gpos.shape[0] == pos.shape[0]
+        my_gpos = <double*>gpos.data
+
+    if vtens is None:
+        my_vtens = NULL
+    else:
+        assert vtens.flags['C_CONTIGUOUS']
+        assert vtens.shape[0] == 3
+        assert vtens.shape[1] == 3
+        my_vtens = <double*>vtens.data
+
+    my_pos = <double*>pos.data
+    my_charges = <double*>charges.data
+    my_stab = <pair_pot.scaling_row_type*>stab.data
+    natom = len(pos)
+    stab_size = len(stab)
+    with nogil:
+        energy = tree.compute_ei_tree(my_pos, my_charges, natom, my_stab,
+                                      stab_size, order, theta, dielectric,
+                                      my_gpos, my_vtens)
+    if np.isnan(energy):
+        # The tree could not be allocated.
+        raise MemoryError()
+    return energy
+
+
 #
 # Delta list
 #
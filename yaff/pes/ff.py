@@ -42,22 +42,96 @@ from __future__ import division
 
 import numpy as np
 
+from molmod.units import angstrom
+
 from yaff.log import log, timer
-from yaff.pes.ext import compute_ewald_reci, compute_ewald_reci_dd, compute_ewald_corr, \
-    compute_ewald_corr_dd, PairPotEI, PairPotLJ, PairPotMM3, PairPotGrimme, compute_grid3d
+from yaff.pes.ext import compute_ewald_kvecs, compute_ewald_reci, compute_ewald_reci_dd, \
+    compute_ewald_corr, compute_dsf_corr, \
+    compute_ewald_corr_dd, PairPotEI, PairPotEIDip, PairPotLJ, PairPotMM3, PairPotGrimme, \
+    compute_grid3d, pair_pot_compute_fused, pair_pot_compute_lambdas, \
+    compute_pme_spread, compute_pme_gather, compute_pme_moduli, compute_ei_tree, \
+    tree_max_order
 from yaff.pes.dlist import DeltaList
 from yaff.pes.iclist import InternalCoordinateList
 from yaff.pes.vlist import ValenceList
 
 
 __all__ = [
-    'ForcePart', 'ForceField', 'ForcePartPair', 'ForcePartEwaldReciprocal',
+    'get_morton_order', 'compare_mixed_precision', 'ForcePart', 'ForceField',
+    'ForcePartPair',
+    'ForcePartPairLambda', 'ForcePartPairComposite', 'ForcePartEwaldReciprocal',
+    'ForcePartPME',
     'ForcePartEwaldReciprocalDD', 'ForcePartEwaldCorrectionDD',
     'ForcePartEwaldCorrection', 'ForcePartEwaldNeutralizing',
-    'ForcePartValence', 'ForcePartPressure', 'ForcePartGrid',
+    'ForcePartDSFCorrection', 'ForcePartEIFMM', 'ForcePartValence', 'ForcePartPressure', 'ForcePartGrid',
 ]
 
 
+def compare_mixed_precision(ff, frames=None):
+    '''Compare the mixed and double precision evaluation of a force field
+
+       **Arguments:**
+
+       ff
+            A ``ForceField`` object.
+
+       **Optional arguments:**
+
+       frames
+            An array with atomic positions, shape (nframe, natom, 3), e.g.
+            taken from a trajectory. When not given, only the current
+            positions are used.
+
+       **Returns:** a dictionary with arrays, one element per frame:
+
+       * ``energy``: the energy in double precision
+       * ``energy_error``: the mixed minus the double precision energy
+       * ``force_rms``: the root-mean-square norm of the atomic forces
+       * ``force_rmsd``: the root-mean-square norm of the error on the forces
+       * ``force_maxerr``: the largest norm of the error on an atomic force
+       * ``vtens_maxerr``: the largest error on an element of the virial
+         tensor (zero for non-periodic systems)
+
+       The positions and the precision of the pair potentials are restored
+       afterwards.
+    '''
+    pos_backup = ff.system.pos.copy()
+    if frames is None:
+        frames = [pos_backup]
+    parts_pair = list(ff.iter_parts_pair())
+    mixed_backup = [part.pair_pot.mixed for part in parts_pair]
+    with_vtens = ff.system.cell.nvec > 0
+    result = dict((key, np.zeros(len(frames))) for key in [
+        'energy', 'energy_error', 'force_rms', 'force_rmsd', 'force_maxerr',
+        'vtens_maxerr'])
+    try:
+        for iframe, pos in enumerate(frames):
+            ff.update_pos(pos)
+            outputs = []
+            for mixed in False, True:
+                for part in parts_pair:
+                    part.pair_pot.set_mixed(mixed)
+                ff.clear()
+                gpos = np.zeros(ff.system.pos.shape, float)
+                vtens = np.zeros((3, 3), float) if with_vtens else None
+                energy = ff.compute(gpos, vtens)
+                outputs.append((energy, gpos, vtens))
+            (energy0, gpos0, vtens0), (energy1, gpos1, vtens1) = outputs
+            errors = np.sqrt(((gpos1 - gpos0)**2).sum(axis=1))
+            result['energy'][iframe] = energy0
+            result['energy_error'][iframe] = energy1 - energy0
+            result['force_rms'][iframe] = np.sqrt((gpos0**2).sum(axis=1).mean())
+            result['force_rmsd'][iframe] = np.sqrt((errors**2).mean())
+            result['force_maxerr'][iframe] = errors.max()
+            if with_vtens:
+                result['vtens_maxerr'][iframe] = abs(vtens1 - vtens0).max()
+    finally:
+        for part, mixed in zip(parts_pair, mixed_backup):
+            part.pair_pot.set_mixed(mixed)
+        ff.update_pos(pos_backup)
+    return result
+
+
 class ForcePart(object):
     '''Base class for anything that can compute energies (and optionally gradient
        and virial) for a ``System`` object.
@@ -168,9 +242,43 @@ class ForcePart(object):
         raise NotImplementedError
 
 
+def get_morton_order(system, nbit=16):
+    '''Return a permutation that sorts the atoms along a Morton (Z-order) curve
+
+       **Arguments:**
+
+       system
+            An instance of the ``System`` class.
+
+       **Optional arguments:**
+
+       nbit
+            The number of bits used to discretize each (fractional) coordinate.
+
+       Atoms that are close in space are mostly also close in the Morton order.
+       Along periodic directions, the wrapped fractional coordinates are used.
+       Along the other directions, the coordinates are scaled to the range of
+       the atomic positions.
+    '''
+    frac = np.dot(system.pos, system.cell._get_gvecs(full=True).T)
+    nvec = system.cell.nvec
+    frac[:,:nvec] -= np.floor(frac[:,:nvec])
+    if nvec < 3 and system.natom > 0:
+        low = frac[:,nvec:].min(axis=0)
+        high = frac[:,nvec:].max(axis=0)
+        frac[:,nvec:] = (frac[:,nvec:] - low)/np.maximum(high - low, 1e-10)
+    ints = np.clip((frac*2**nbit).astype(int), 0, 2**nbit - 1)
+    # Interleave the bits of the three integer coordinates.
+    codes = np.zeros(system.natom, int)
+    for ibit in range(nbit):
+        for k in range(3):
+            codes |= ((ints[:,k] >> ibit) & 1) << (3*ibit + k)
+    return np.argsort(codes, kind='mergesort')
+
+
 class ForceField(ForcePart):
     '''A complete force field model.'''
-    def __init__(self, system, parts, nlist=None):
+    def __init__(self, system, parts, nlist=None, internal_system=None, permutation=None):
         """
            **Arguments:**
 
@@ -187,12 +295,27 @@ class ForceField(ForcePart):
            nlist
                 A ``NeighborList`` instance. This is required if some items in the
                 parts list use this nlist object.
+
+           internal_system, permutation
+                When given, the parts are constructed for internal_system, in
+                which the atoms are a permutation of those in system, i.e.
+                ``internal_system.pos == system.pos[permutation]``. The public
+                interface of the force field (update_pos, compute, ...) still
+                uses the atom order of system. This is used to improve the
+                memory locality in the parts for large systems. (See
+                ``ForceField.generate``.)
         """
         ForcePart.__init__(self, 'all', system)
         self.system = system
         self.parts = []
         self.nlist = nlist
         self.needs_nlist_update = nlist is not None
+        if (internal_system is None) != (permutation is None):
+            raise TypeError('internal_system and permutation must be given together.')
+        self.internal_system = internal_system
+        self.permutation = permutation
+        if permutation is not None:
+            self._internal_gpos = np.zeros((system.natom, 3), float)
         for part in parts:
             self.add_part(part)
         if log.do_medium:
@@ -201,6 +324,7 @@ class ForceField(ForcePart):
                     len(self.parts), ', '.join(part.name for part in self.parts)
                 ))
                 log('Neighborlist present: %s' % (self.nlist is not None))
+                log('Internal atom order: %s' % (self.permutation is not None))
 
     def add_part(self, part):
         self.parts.append(part)
@@ -209,6 +333,50 @@ class ForceField(ForcePart):
         if name in self.__dict__:
             raise ValueError('The part %s occurs twice in the force field.' % name)
         self.__dict__[name] = part
+        # The parts in a composite part remain accessible as attributes.
+        if isinstance(part, ForcePartPairComposite):
+            for sub_part in part.parts:
+                name = 'part_%s' % sub_part.name
+                if name in self.__dict__:
+                    raise ValueError('The part %s occurs twice in the force field.' % name)
+                self.__dict__[name] = sub_part
+
+    def iter_parts_pair(self):
+        '''Iterate over all ForcePartPair objects, also those in a composite'''
+        for part in self.parts:
+            if isinstance(part, ForcePartPairComposite):
+                for sub_part in part.parts:
+                    yield sub_part
+            elif isinstance(part, ForcePartPair):
+                yield part
+
+    def set_mixed_precision(self, mixed=True):
+        '''Switch the pair potentials between double and mixed precision
+
+           **Optional arguments:**
+
+           mixed
+                When True, the pair potentials that support it are evaluated
+                in single precision, while energies, gradients and virials are
+                still accumulated in double precision. See
+                :func:`compare_mixed_precision` to check the impact on a
+                given system.
+
+           **Returns:** the list of names of the parts that use mixed
+           precision afterwards.
+        '''
+        names = []
+        for part in self.iter_parts_pair():
+            if part.pair_pot.set_mixed(mixed):
+                names.append(part.name)
+        self.clear()
+        if log.do_medium:
+            with log.section('FFINIT'):
+                if len(names) > 0:
+                    log('Mixed precision parts: %s' % ', '.join(names))
+                else:
+                    log('No parts in mixed precision.')
+        return names
 
     @classmethod
     def generate(cls, system, parameters, **kwargs):
@@ -243,13 +411,35 @@ class ForceField(ForcePart):
             if not isinstance(parameters, Parameters):
                 parameters = Parameters.from_file(parameters)
             ff_args = FFArgs(**kwargs)
-            apply_generators(system, parameters, ff_args)
-            return ForceField(system, ff_args.parts, ff_args.nlist)
+            if ff_args.atom_order is None:
+                apply_generators(system, parameters, ff_args)
+                ff = ForceField(system, ff_args.parts, ff_args.nlist)
+                if ff_args.mixed_precision:
+                    ff.set_mixed_precision()
+                return ff
+            # The force field parts are constructed for a copy of the system
+            # in which the atoms are reordered along a space-filling curve.
+            permutation = get_morton_order(system)
+            internal_system = system.subsystem(permutation)
+            apply_generators(internal_system, parameters, ff_args)
+            # Some generators assign atomic charges and radii to the system.
+            for name in 'charges', 'radii':
+                internal = getattr(internal_system, name)
+                if internal is not None:
+                    public = np.zeros(internal.shape, internal.dtype)
+                    public[permutation] = internal
+                    setattr(system, name, public)
+            ff = ForceField(system, ff_args.parts, ff_args.nlist, internal_system, permutation)
+            if ff_args.mixed_precision:
+                ff.set_mixed_precision()
+            return ff
 
     def update_rvecs(self, rvecs):
         '''See :meth:`yaff.pes.ff.ForcePart.update_rvecs`'''
         ForcePart.update_rvecs(self, rvecs)
         self.system.cell.update_rvecs(rvecs)
+        if self.internal_system is not None:
+            self.internal_system.cell.update_rvecs(rvecs)
         if self.nlist is not None:
             self.nlist.update_rmax()
             self.needs_nlist_update = True
@@ -258,6 +448,8 @@ class ForceField(ForcePart):
         '''See :meth:`yaff.pes.ff.ForcePart.update_pos`'''
         ForcePart.update_pos(self, pos)
         self.system.pos[:] = pos
+        if self.internal_system is not None:
+            self.internal_system.pos[:] = pos[self.permutation]
         if self.nlist is not None:
             self.needs_nlist_update = True
 
@@ -265,7 +457,18 @@ class ForceField(ForcePart):
         if self.needs_nlist_update:
             self.nlist.update()
             self.needs_nlist_update = False
-        result = sum([part.compute(gpos, vtens) for part in self.parts])
+        if self.permutation is None:
+            result = sum([part.compute(gpos, vtens) for part in self.parts])
+        else:
+            # The parts work with the internal atom order.
+            if gpos is None:
+                my_gpos = None
+            else:
+                my_gpos = self._internal_gpos
+                my_gpos[:] = 0.0
+            result = sum([part.compute(my_gpos, vtens) for part in self.parts])
+            if gpos is not None:
+                gpos[self.permutation] += my_gpos
         return result
 
 
@@ -273,11 +476,11 @@ class ForcePartPair(ForcePart):
     '''A pairwise (short-range) non-bonding interaction term.
 
        This part can be used for the short-range electrostatics, Van der Waals
-       terms, etc. Currently, one has to use multiple ``ForcePartPair``
-       objects in a ``ForceField`` in order to combine different types of pairwise
-       energy terms, e.g. to combine an electrostatic term with a Van der
-       Waals term. (This may be changed in future to improve the computational
-       efficiency.)
+       terms, etc. One has to use multiple ``ForcePartPair`` objects in order
+       to combine different types of pairwise energy terms, e.g. to combine an
+       electrostatic term with a Van der Waals term. These can be computed in a
+       single loop over the neighbor list by grouping them in a
+       ``ForcePartPairComposite``.
     '''
     def __init__(self, system, nlist, scalings, pair_pot):
         '''
@@ -304,7 +507,13 @@ class ForcePartPair(ForcePart):
         self.nlist = nlist
         self.scalings = scalings
         self.pair_pot = pair_pot
+        # Scaling factors indexed by the number of bonds between two atoms.
+        self.scales = np.array([
+            1.0, scalings.scale1, scalings.scale2, scalings.scale3,
+            scalings.scale4
+        ])
         self.nlist.request_rcut(pair_pot.rcut)
+        self.nlist.request_scalings(scalings)
         if log.do_medium:
             with log.section('FPINIT'):
                 log('Force part: %s' % self.name)
@@ -321,7 +530,188 @@ class ForcePartPair(ForcePart):
 
     def _internal_compute(self, gpos, vtens):
         with timer.section('PP %s' % self.pair_pot.name):
-            return self.pair_pot.compute(self.nlist.neighs, self.scalings.stab, gpos, vtens, self.nlist.nneigh)
+            if self.nlist.topology is None:
+                # The scalings have to be looked up in the scaling table.
+                scales = None
+            else:
+                scales = self.scales
+            return self.pair_pot.compute(
+                self.nlist.neighs, self.scalings.stab, gpos, vtens,
+                self.nlist.get_nneigh(self.pair_pot.rcut),
+                self.nlist.system.pos, self.nlist.system.cell, scales,
+                self.nlist.clusters, self.nlist.wrap
+            )
+
+
+class ForcePartPairLambda(ForcePartPair):
+    r'''A pairwise interaction term in which the interactions of an atom group
+       with the rest of the system are coupled with a parameter lambda.
+
+       The interactions between an atom in the group and an atom outside the
+       group are replaced by a soft-core potential:
+
+       .. math:: E_{ij}(\lambda) = \lambda V(r_{ij}) t(d_{ij})
+
+       with
+
+       .. math:: r_{ij}^6 = \alpha \sigma^6 (1-\lambda) + d_{ij}^6
+
+       where :math:`V` is the pair potential and :math:`t` is its truncation
+       function. The other interactions are not affected. The energy, gradient
+       and virial are computed for the current value of lambda. In the same
+       loop over the neighbor list, the energies for a list of lambda values
+       are computed, which are stored in the attribute ``lambda_energies``.
+       (See ``EPotLambdasStateItem``.) This part cannot be used with compact
+       or tiled neighbor lists.
+    '''
+    def __init__(self, system, nlist, scalings, pair_pot, group, lambdas,
+                 lam=1.0, sc_alpha=0.5, sc_sigma=3*angstrom):
+        '''
+           **Arguments:**
+
+           system, nlist, scalings, pair_pot
+                See ``ForcePartPair``. The pair potential must only depend on
+                the distance, e.g. ``PairPotLJ``, ``PairPotMM3`` or
+                ``PairPotEI``. For the latter, alpha must be zero: the
+                reciprocal and correction terms of an Ewald sum would keep
+                the group coupled to the rest of the system at every lambda.
+
+           group
+                An array with the indexes of the atoms in the group.
+
+           lambdas
+                An array with values of lambda for which the energy is
+                computed.
+
+           **Optional arguments:**
+
+           lam
+                The current value of lambda. One for full coupling and zero
+                for no coupling.
+
+           sc_alpha, sc_sigma
+                The parameters of the soft-core potential.
+        '''
+        if isinstance(pair_pot, PairPotEIDip):
+            raise TypeError('The soft-core coupling does not support point dipoles.')
+        if isinstance(pair_pot, PairPotEI) and pair_pot.alpha != 0.0:
+            raise ValueError('The soft-core coupling does not support Ewald summation, alpha must be zero.')
+        if nlist.compact or nlist.tiled:
+            raise ValueError('The soft-core coupling requires a standard neighbor list.')
+        ForcePartPair.__init__(self, system, nlist, scalings, pair_pot)
+        self.group = np.zeros(system.natom, int)
+        self.group[group] = 1
+        self.lambdas = np.array(lambdas, float)
+        self.lam = lam
+        self.sc_alpha = sc_alpha
+        self.sc_sigma = sc_sigma
+        self.lambda_energies = np.zeros(len(self.lambdas))
+        if log.do_medium:
+            with log.section('FPINIT'):
+                log('  group size:        %i' % self.group.sum())
+                log('  lambda:            %.5f' % self.lam)
+                log('  number of lambdas: %i' % len(self.lambdas))
+                log('  soft-core alpha:   %.5f' % self.sc_alpha)
+                log('  soft-core sigma:   %s' % log.length(self.sc_sigma))
+                log.hline()
+
+    def clear(self):
+        ForcePart.clear(self)
+        if hasattr(self, 'lambda_energies'):
+            self.lambda_energies[:] = np.nan
+
+    def set_lambda(self, lam):
+        '''Change the current value of lambda'''
+        self.lam = lam
+        self.clear()
+
+    def _internal_compute(self, gpos, vtens):
+        with timer.section('PP %s' % self.pair_pot.name):
+            if self.nlist.topology is None:
+                scales = None
+            else:
+                scales = self.scales
+            return pair_pot_compute_lambdas(
+                self.pair_pot, self.nlist.neighs, self.scalings.stab, gpos,
+                vtens, self.nlist.get_nneigh(self.pair_pot.rcut), scales,
+                self.group, self.lam, self.lambdas, self.sc_alpha,
+                self.sc_sigma, self.lambda_energies
+            )
+
+
+class ForcePartPairComposite(ForcePart):
+    '''A group of pairwise interaction terms, computed in a single loop over
+       the neighbor list.
+
+       Each row of the neighbor list is loaded once and passed to all pair
+       potentials, whose contributions are added to the same gradient and
+       virial. The energy of each ``ForcePartPair`` in the group is still
+       available as its ``energy`` attribute, e.g. for the
+       ``EPotContribStateItem``. Their cached gradients and virials are not
+       computed separately.
+    '''
+    def __init__(self, system, nlist, parts):
+        '''
+           **Arguments:**
+
+           system
+                The system to which the pairwise interactions apply.
+
+           nlist
+                A ``NeighborList`` object. This has to be the same as the one
+                passed to the ForceField object that contains this part.
+
+           parts
+                A list of ``ForcePartPair`` objects that use nlist. These must
+                not be included separately in the force field.
+        '''
+        ForcePart.__init__(self, 'pair_composite', system)
+        for part in parts:
+            if not isinstance(part, ForcePartPair):
+                raise TypeError('A composite part can only contain ForcePartPair objects.')
+            if part.nlist is not nlist:
+                raise ValueError('All parts must use the same neighbor list.')
+        self.nlist = nlist
+        self.parts = list(parts)
+        # PairPotEIDip adds an energy term outside the loop over the neighbor
+        # list, and ForcePartPairLambda uses its own loop. Such parts are
+        # computed separately.
+        self.fused_parts = [part for part in self.parts if not self._is_separate(part)]
+        self.other_parts = [part for part in self.parts if self._is_separate(part)]
+        self._pair_pots = [part.pair_pot for part in self.fused_parts]
+        self._scales = np.array([part.scales for part in self.fused_parts]).reshape(-1, 5)
+        self._energies = np.zeros(len(self.fused_parts))
+        self._rcut = max([0.0] + [pair_pot.rcut for pair_pot in self._pair_pots])
+        if log.do_medium:
+            with log.section('FPINIT'):
+                log('Force part: %s' % self.name)
+                log.hline()
+                log('  parts: %s' % ', '.join(part.name for part in self.parts))
+                log.hline()
+
+    @staticmethod
+    def _is_separate(part):
+        return isinstance(part.pair_pot, PairPotEIDip) or isinstance(part, ForcePartPairLambda)
+
+    def _internal_compute(self, gpos, vtens):
+        with timer.section('PP composite'):
+            if self.nlist.topology is None or len(self.fused_parts) == 0:
+                # The scalings have to be looked up in the scaling tables,
+                # which is done for each pair potential separately.
+                energy = sum([part.compute(gpos, vtens) for part in self.fused_parts])
+            else:
+                energy = pair_pot_compute_fused(
+                    self._pair_pots, self.nlist.neighs, gpos, vtens,
+                    self.nlist.get_nneigh(self._rcut), self._scales,
+                    self._energies, self.nlist.system.pos,
+                    self.nlist.system.cell, self.nlist.clusters,
+                    self.nlist.wrap
+                )
+                for part, part_energy in zip(self.fused_parts, self._energies):
+                    part.clear()
+                    part.energy = part_energy
+            energy += sum([part.compute(gpos, vtens) for part in self.other_parts])
+        return energy
 
 
 class ForcePartEwaldReciprocal(ForcePart):
@@ -373,6 +763,19 @@ class ForcePartEwaldReciprocal(ForcePart):
         if log.do_debug:
             with log.section('EWALD'):
                 log('gmax a,b,c   = %i,%i,%i' % tuple(self.gmax))
+        self.update_kvecs()
+
+    def update_kvecs(self):
+        '''Update the table of k-vectors within the cutoff.
+
+           Changes of the cell vectors and of the attributes alpha and gcut
+           are detected automatically.
+        '''
+        cell = self.system.cell
+        self.kvecs = compute_ewald_kvecs(cell, self.alpha, self.gmax, self.gcut)
+        self._kvecs_rvecs = cell.rvecs.copy()
+        self._kvecs_alpha = self.alpha
+        self._kvecs_gcut = self.gcut
 
     def update_rvecs(self, rvecs):
         '''See :meth:`yaff.pes.ff.ForcePart.update_rvecs`'''
@@ -381,12 +784,153 @@ class ForcePartEwaldReciprocal(ForcePart):
 
     def _internal_compute(self, gpos, vtens):
         with timer.section('Ewald reci.'):
+            if self.gcut != self._kvecs_gcut:
+                self.update_gmax()
+            elif self.alpha != self._kvecs_alpha or (self.system.cell.rvecs != self._kvecs_rvecs).any():
+                self.update_kvecs()
             return compute_ewald_reci(
-                self.system.pos, self.system.charges, self.system.cell, self.alpha,
-                self.gmax, self.gcut, self.dielectric, gpos, self.work, vtens
+                self.system.pos, self.system.charges, self.system.cell,
+                self.kvecs, self.dielectric, gpos, self.work, vtens
             )
 
 
+def _fft_size(n):
+    '''The smallest integer not below n without prime factors larger than 5'''
+    while True:
+        m = n
+        for p in 2, 3, 5:
+            while m % p == 0:
+                m //= p
+        if m == 1:
+            return n
+        n += 1
+
+
+class ForcePartPME(ForcePart):
+    '''The long-range contribution to the electrostatic interaction in 3D
+       periodic systems, computed with the smooth particle mesh Ewald method.
+
+       This is a drop-in replacement for ``ForcePartEwaldReciprocal``. The
+       charges are spread on a grid with B-splines, such that the structure
+       factors can be computed with FFTs. The cost scales as O(N log N)
+       instead of O(N*K) for the direct sum over K k-vectors.
+    '''
+    def __init__(self, system, alpha, gcut=0.35, dielectric=1.0, order=6):
+        '''
+           **Arguments:**
+
+           system
+                The system to which this interaction applies.
+
+           alpha
+                The alpha parameter in the Ewald summation method.
+
+           **Optional arguments:**
+
+           gcut
+                The cutoff in reciprocal space. The grid is fine enough to
+                represent all k-vectors up to this cutoff, as in
+                ``ForcePartEwaldReciprocal``.
+
+           dielectric
+                The scalar relative permittivity of the system.
+
+           order
+                The order of the B-splines, i.e. the number of grid points
+                along each cell vector to which a charge is spread.
+        '''
+        ForcePart.__init__(self, 'ewald_reci', system)
+        if not system.cell.nvec == 3:
+            raise TypeError('The system must have a 3D periodic cell.')
+        if system.charges is None:
+            raise ValueError('The system does not have charges.')
+        self.system = system
+        self.alpha = alpha
+        self.gcut = gcut
+        self.dielectric = dielectric
+        self.order = order
+        self.update_grid()
+        if log.do_medium:
+            with log.section('FPINIT'):
+                log('Force part: %s' % self.name)
+                log.hline()
+                log('  alpha:                 %s' % log.invlength(self.alpha))
+                log('  gcut:                  %s' % log.invlength(self.gcut))
+                log('  relative permittivity: %5.3f' % self.dielectric)
+                log('  spline order:          %i' % self.order)
+                log('  grid:                  %i x %i x %i' % tuple(self.ngrid))
+                log.hline()
+
+    def update_grid(self):
+        '''Update the grid size for the current cell vectors.
+
+           This routine must be called after any of the attributes gcut or
+           order are modified. The grid is not resized when the cell vectors
+           change, such that the energy remains a smooth function of the cell
+           vectors. It may be called again after large changes of the cell.
+        '''
+        cell = self.system.cell
+        gmax = np.ceil(self.gcut/cell.gspacings-0.5).astype(int)
+        self.ngrid = np.array([_fft_size(max(2*g+1, 2*self.order)) for g in gmax])
+        moduli = [compute_pme_moduli(self.order, n) for n in self.ngrid]
+        self.moduli = (moduli[0][:,None,None]*moduli[1][None,:,None]*
+                       moduli[2][None,None,:self.ngrid[2]//2+1])
+        # Each k-vector in the last half-dimension of the real-to-complex FFT
+        # represents itself and its inverse, except for the first and, for an
+        # even grid, the last.
+        self.weights = np.full(self.ngrid[2]//2+1, 2.0)
+        self.weights[0] = 1.0
+        if self.ngrid[2] % 2 == 0:
+            self.weights[-1] = 1.0
+        if log.do_debug:
+            with log.section('PME'):
+                log('grid a,b,c   = %i,%i,%i' % tuple(self.ngrid))
+        self.update_kernel()
+
+    def update_kernel(self):
+        '''Update the kernel in reciprocal space.
+
+           This routine must be called after any of the attributes alpha or
+           dielectric are modified. Changes of the cell vectors are detected
+           automatically.
+        '''
+        cell = self.system.cell
+        ngrid = self.ngrid
+        self._kernel_rvecs = cell.rvecs.copy()
+        # The reciprocal lattice vectors in the grid, without factor 2*pi.
+        m0 = np.fft.fftfreq(ngrid[0], 1.0/ngrid[0])
+        m1 = np.fft.fftfreq(ngrid[1], 1.0/ngrid[1])
+        m2 = np.arange(ngrid[2]//2+1)
+        gvecs = cell.gvecs
+        self.mvecs = (m0[:,None,None,None]*gvecs[0] + m1[None,:,None,None]*gvecs[1] +
+                      m2[None,None,:,None]*gvecs[2])
+        msq = (self.mvecs**2).sum(axis=3)
+        msq[0,0,0] = 1.0
+        fac = np.pi**2/self.alpha**2
+        self.kernel = self.moduli*np.exp(-fac*msq)/msq/(np.pi*cell.volume*self.dielectric)
+        self.kernel[0,0,0] = 0.0
+        # Factor for the virial
+        self.vfac = 2.0*(1.0/msq + fac)
+
+    def _internal_compute(self, gpos, vtens):
+        with timer.section('PME reci.'):
+            if (self.system.cell.rvecs != self._kernel_rvecs).any():
+                self.update_kernel()
+            grid = np.zeros(self.ngrid)
+            compute_pme_spread(self.system.pos, self.system.charges, self.system.cell, self.order, grid)
+            fgrid = np.fft.rfftn(grid)
+            energies = 0.5*self.weights*self.kernel*(fgrid.real**2 + fgrid.imag**2)
+            energy = energies.sum()
+            if gpos is not None:
+                potential = np.fft.irfftn(fgrid*self.kernel, grid.shape)*grid.size
+                compute_pme_gather(self.system.pos, self.system.charges, self.system.cell, self.order, potential, gpos)
+            if vtens is not None:
+                energies *= self.vfac
+                vtens += np.einsum('abc,abci,abcj->ij', energies, self.mvecs, self.mvecs)
+                vtens -= energy*np.identity(3)
+            return energy
+
+
 class ForcePartEwaldReciprocalDD(ForcePart):
     '''The long-range contribution to the dipole-dipole
        electrostatic interaction in 3D periodic systems.
@@ -431,6 +975,19 @@ class ForcePartEwaldReciprocalDD(ForcePart):
         if log.do_debug:
             with log.section('EWALD'):
                 log('gmax a,b,c   = %i,%i,%i' % tuple(self.gmax))
+        self.update_kvecs()
+
+    def update_kvecs(self):
+        '''Update the table of k-vectors within the cutoff.
+
+           Changes of the cell vectors and of the attributes alpha and gcut
+           are detected automatically.
+        '''
+        cell = self.system.cell
+        self.kvecs = compute_ewald_kvecs(cell, self.alpha, self.gmax, self.gcut)
+        self._kvecs_rvecs = cell.rvecs.copy()
+        self._kvecs_alpha = self.alpha
+        self._kvecs_gcut = self.gcut
 
     def update_rvecs(self, rvecs):
         '''See :meth:`yaff.pes.ff.ForcePart.update_rvecs`'''
@@ -439,9 +996,13 @@ class ForcePartEwaldReciprocalDD(ForcePart):
 
     def _internal_compute(self, gpos, vtens):
         with timer.section('Ewald reci.'):
+            if self.gcut != self._kvecs_gcut:
+                self.update_gmax()
+            elif self.alpha != self._kvecs_alpha or (self.system.cell.rvecs != self._kvecs_rvecs).any():
+                self.update_kvecs()
             return compute_ewald_reci_dd(
-                self.system.pos, self.system.charges, self.system.dipoles, self.system.cell, self.alpha,
-                self.gmax, self.gcut, gpos, self.work, vtens
+                self.system.pos, self.system.charges, self.system.dipoles, self.system.cell,
+                self.kvecs, gpos, self.work, vtens
             )
 
 
@@ -591,6 +1152,139 @@ class ForcePartEwaldNeutralizing(ForcePart):
             return fac
 
 
+class ForcePartDSFCorrection(ForcePart):
+    '''Self-interaction and scaling corrections for the damped shifted-force
+       electrostatics.
+
+       This term must be combined with a ``ForcePartPair`` with a
+       ``PairPotDSF`` pair potential, using the same alpha and rcut. It works
+       for 0D and 3D periodic systems and has no reciprocal space part.
+    '''
+    def __init__(self, system, alpha, rcut, scalings, dielectric=1.0):
+        '''
+           **Arguments:**
+
+           system
+                The system to which this interaction applies.
+
+           alpha
+                The damping parameter of the pair potential.
+
+           rcut
+                The cutoff of the pair potential.
+
+           scalings
+                A ``Scalings`` object. This object contains all the information
+                about the energy scaling of pairwise contributions that are
+                involved in covalent interactions. See
+                :class:`yaff.pes.scalings.Scalings` for more details.
+
+           **Optional arguments:**
+
+           dielectric
+                The scalar relative permittivity of the system.
+        '''
+        ForcePart.__init__(self, 'dsf_cor', system)
+        if system.charges is None:
+            raise ValueError('The system does not have charges.')
+        self.system = system
+        self.alpha = alpha
+        self.rcut = rcut
+        self.dielectric = dielectric
+        self.scalings = scalings
+        if log.do_medium:
+            with log.section('FPINIT'):
+                log('Force part: %s' % self.name)
+                log.hline()
+                log('  alpha:             %s' % log.invlength(self.alpha))
+                log('  rcut:              %s' % log.length(self.rcut))
+                log('  relative permittivity   %5.3f' % self.dielectric)
+                log('  scalings:          %5.3f %5.3f %5.3f' % (scalings.scale1, scalings.scale2, scalings.scale3))
+                log.hline()
+
+    def _internal_compute(self, gpos, vtens):
+        with timer.section('DSF corr.'):
+            return compute_dsf_corr(
+                self.system.pos, self.system.charges, self.system.cell,
+                self.alpha, self.rcut, self.scalings.stab, self.dielectric,
+                gpos, vtens
+            )
+
+
+class ForcePartEIFMM(ForcePart):
+    '''The electrostatic interaction of point charges in a non-periodic system,
+       computed with a Barnes-Hut tree code.
+
+       The atoms are sorted in an octree. The interaction of an atom with a
+       node of the tree is computed with the Cartesian multipole expansion of
+       the node when the node is small compared to its distance to the atom.
+       All other interactions, including all scaled pairs, are computed
+       directly. The computational cost scales as N log(N) with the number of
+       atoms and there is no cutoff. This part replaces a ``ForcePartPair``
+       with a ``PairPotEI`` pair potential. With the default settings, the
+       relative RMS error on the forces is about 1e-3 for liquid water.
+    '''
+    def __init__(self, system, scalings, order=6, theta=0.5, dielectric=1.0):
+        '''
+           **Arguments:**
+
+           system
+                The system to which this interaction applies.
+
+           scalings
+                A ``Scalings`` object. This object contains all the information
+                about the energy scaling of pairwise contributions that are
+                involved in covalent interactions. See
+                :class:`yaff.pes.scalings.Scalings` for more details.
+
+           **Optional arguments:**
+
+           order
+                The order of the multipole expansions of the tree nodes, at
+                most ``tree_max_order``. Higher orders are more accurate and
+                more expensive.
+
+           theta
+                The opening angle. A node is replaced by its multipole
+                expansion when its radius is smaller than theta times its
+                distance to an atom. Smaller values are more accurate and
+                more expensive. Must be larger than zero and smaller than one.
+
+           dielectric
+                The scalar relative permittivity of the system.
+        '''
+        ForcePart.__init__(self, 'ei_fmm', system)
+        if system.cell.nvec != 0:
+            raise TypeError('The system must not be periodic.')
+        if system.charges is None:
+            raise ValueError('The system does not have charges.')
+        if order < 0 or order > tree_max_order:
+            raise ValueError('The order must be in the range [0, %i].' % tree_max_order)
+        if theta <= 0 or theta >= 1:
+            raise ValueError('The opening angle must be larger than zero and smaller than one.')
+        self.system = system
+        self.scalings = scalings
+        self.order = order
+        self.theta = theta
+        self.dielectric = dielectric
+        if log.do_medium:
+            with log.section('FPINIT'):
+                log('Force part: %s' % self.name)
+                log.hline()
+                log('  multipole order:   %i' % self.order)
+                log('  opening angle:     %5.3f' % self.theta)
+                log('  relative permittivity   %5.3f' % self.dielectric)
+                log('  scalings:          %5.3f %5.3f %5.3f' % (scalings.scale1, scalings.scale2, scalings.scale3))
+                log.hline()
+
+    def _internal_compute(self, gpos, vtens):
+        with timer.section('EI tree'):
+            return compute_ei_tree(
+                self.system.pos, self.system.charges, self.scalings.stab,
+                self.order, self.theta, self.dielectric, gpos, vtens
+            )
+
+
 class ForcePartValence(ForcePart):
     '''The covalent part of a force-field model.
 
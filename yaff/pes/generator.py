@@ -32,16 +32,18 @@ from __future__ import division
 
 import numpy as np
 
-from molmod.units import parse_unit
+from molmod.units import parse_unit, angstrom
 
 from itertools import permutations
+from timeit import default_timer
 
 from yaff.log import log
 from yaff.pes.ext import PairPotEI, PairPotLJ, PairPotMM3, PairPotExpRep, \
-    PairPotQMDFFRep, PairPotDampDisp, PairPotDisp68BJDamp, Switch3
-from yaff.pes.ff import ForcePartPair, ForcePartValence, \
-    ForcePartEwaldReciprocal, ForcePartEwaldCorrection, \
-    ForcePartEwaldNeutralizing
+    PairPotQMDFFRep, PairPotDampDisp, PairPotDisp68BJDamp, PairPotEIDip, \
+    PairPotTabulated, PairPotDSF, Switch3
+from yaff.pes.ff import ForcePartPair, ForcePartPairComposite, ForcePartValence, \
+    ForcePartEwaldReciprocal, ForcePartPME, ForcePartEwaldCorrection, \
+    ForcePartEwaldNeutralizing, ForcePartDSFCorrection, ForcePartEIFMM
 from yaff.pes.iclist import Bond, BendAngle, BendCos, \
     UreyBradley, DihedAngle, DihedCos, OopAngle, OopMeanAngle, OopCos, \
     OopMeanCos, OopDist, SqOopDist
@@ -53,7 +55,7 @@ from yaff.pes.vlist import Harmonic, PolyFour, Fues, Cross, Cosine, \
 
 
 __all__ = [
-    'FFArgs', 'Generator',
+    'FFArgs', 'estimate_ewald_errors', 'tune_ewald', 'Generator',
 
     'ValenceGenerator', 'BondGenerator', 'BondHarmGenerator', 'BondDoubleWellGenerator',
     'BondDoubleWell2Generator', 'BondFuesGenerator', 'MM3QuarticGenerator',
@@ -79,7 +81,10 @@ class FFArgs(object):
     '''
     def __init__(self, rcut=18.89726133921252, tr=Switch3(7.558904535685008),
                  alpha_scale=3.5, gcut_scale=1.1, skin=0, smooth_ei=False,
-                 reci_ei='ewald'):
+                 reci_ei='ewald', compact_nlist=False, auto_skin=False,
+                 atom_order=None, tiled_nlist=False, fused_pair=False,
+                 tabulate_pair=None, mixed_precision=False, fmm_order=6,
+                 fmm_theta=0.5):
         """
            **Optional arguments:**
 
@@ -108,25 +113,82 @@ class FFArgs(object):
            skin
                 The skin parameter for the neighborlist.
 
+           auto_skin
+                When True, the skin of the neighborlist is tuned automatically
+                during the simulation. The skin argument is then the initial
+                value.
+
            smooth_ei
                 Flag for smooth truncations for the electrostatic interactions.
 
            reci_ei
                 The method to be used for the reciprocal contribution to the
                 electrostatic interactions in the case of periodic systems. This
-                must be one of 'ignore' or 'ewald'. The 'ewald' option is only
-                supported for 3D periodic systems.
+                must be one of 'ignore', 'ewald', 'pme' or 'dsf'. The 'ewald'
+                and 'pme' options are only supported for 3D periodic systems.
+                With 'pme', the smooth particle mesh Ewald method is used, whose
+                grid is fine enough to represent all k-vectors up to the same
+                reciprocal cutoff as with 'ewald'. With 'dsf', the damped
+                shifted-force method is used instead of the Ewald summation,
+                for 0D and 3D systems. It is purely pairwise, with
+                alpha = alpha_scale/rcut as damping parameter, and treats
+                all charges as point charges. With 'fmm', the electrostatic
+                interactions in 0D systems are computed without cutoff by the
+                tree code in ``ForcePartEIFMM``, which also treats all charges
+                as point charges.
+
+           fmm_order, fmm_theta
+                The multipole order and the opening angle of the tree code
+                when reci_ei is 'fmm'. See ``ForcePartEIFMM``.
+
+           compact_nlist
+                When True, the neighbor list only stores atom indexes and image
+                shifts. The relative vectors and distances are then computed
+                in the pair potentials.
+
+           tiled_nlist
+                When True, the neighbor list is stored as pairs of clusters of
+                four atoms, which the pair potentials evaluate as dense 4x4
+                tiles. This cannot be combined with compact_nlist.
+
+           fused_pair
+                When True, all pairwise terms are grouped in a single
+                ``ForcePartPairComposite``, which computes them in one loop
+                over the neighbor list.
+
+           tabulate_pair
+                When set to a tolerance, all pairwise terms, except those with
+                point dipoles, are replaced by a ``PairPotTabulated`` version
+                that interpolates the original pair potential with splines
+                within the given tolerance.
+
+           mixed_precision
+                When True, the pair potentials that support it (LJ, MM3,
+                ExpRep and EI) are evaluated in single precision, while the
+                energy, gradient and virial are accumulated in double
+                precision. Use ``compare_mixed_precision`` to check the errors
+                for a given system.
+
+           atom_order
+                When set to 'morton', the force field internally works with
+                a copy of the system in which the atoms are sorted along a
+                Morton curve. This improves the memory locality for large
+                systems, e.g. those constructed with ``System.supercell``.
+                The atom order of the system passed to ``ForceField.generate``
+                is not affected.
 
            The actual value of gcut, which depends on both gcut_scale and
            alpha_scale, determines the computational cost of the reciprocal term
            in the Ewald summation. The default values are just examples. An
            optimal trade-off between accuracy and computational cost requires
-           some tuning. Dimensionless scaling parameters are used to make sure
-           that the numerical errors do not depend too much on the real space
-           cutoff and the system size.
+           some tuning, which can be done with ``tune_ewald``. Dimensionless
+           scaling parameters are used to make sure that the numerical errors
+           do not depend too much on the real space cutoff and the system size.
         """
-        if reci_ei not in ['ignore', 'ewald']:
-            raise ValueError('The reci_ei option must be one of \'ignore\' or \'ewald\'.')
+        if reci_ei not in ['ignore', 'ewald', 'pme', 'dsf', 'fmm']:
+            raise ValueError('The reci_ei option must be one of \'ignore\', \'ewald\', \'pme\', \'dsf\' or \'fmm\'.')
+        if atom_order not in [None, 'morton']:
+            raise ValueError('The atom_order option must be None or \'morton\'.')
         self.rcut = rcut
         self.tr = tr
         self.alpha_scale = alpha_scale
@@ -134,13 +196,24 @@ class FFArgs(object):
         self.skin = skin
         self.smooth_ei = smooth_ei
         self.reci_ei = reci_ei
+        self.fmm_order = fmm_order
+        self.fmm_theta = fmm_theta
+        self.compact_nlist = compact_nlist
+        self.tiled_nlist = tiled_nlist
+        self.fused_pair = fused_pair
+        self.tabulate_pair = tabulate_pair
+        self.mixed_precision = mixed_precision
+        self.auto_skin = auto_skin
+        self.atom_order = atom_order
         # arguments for the ForceField constructor
         self.parts = []
         self.nlist = None
 
     def get_nlist(self, system):
         if self.nlist is None:
-            self.nlist = NeighborList(system, self.skin)
+            self.nlist = NeighborList(system, self.skin, compact=self.compact_nlist,
+                                      auto_skin=self.auto_skin,
+                                      tiled=self.tiled_nlist)
         return self.nlist
 
     def get_part(self, ForcePartClass):
@@ -150,9 +223,36 @@ class FFArgs(object):
 
     def get_part_pair(self, PairPotClass):
         for part in self.parts:
-            if isinstance(part, ForcePartPair) and isinstance(part.pair_pot, PairPotClass):
+            if not isinstance(part, ForcePartPair):
+                continue
+            pair_pot = part.pair_pot
+            if isinstance(pair_pot, PairPotTabulated):
+                # Tabulated potentials are found by their original class.
+                pair_pot = pair_pot.source
+            if isinstance(pair_pot, PairPotClass):
                 return part
 
+    def tabulate_pair_parts(self, system):
+        '''Replace the pair potentials by tabulated versions
+
+           This is called by ``apply_generators`` after all generators have
+           run. The original pair potential remains available as the
+           ``source`` attribute of the tabulated one, such that
+           ``get_part_pair`` still finds the part by its original class.
+        '''
+        for part in self.parts:
+            if isinstance(part, ForcePartPair) and not isinstance(part.pair_pot, PairPotEIDip):
+                part.pair_pot = PairPotTabulated(part.pair_pot, system.ffatype_ids, self.tabulate_pair)
+
+    def fuse_pair_parts(self, system):
+        '''Replace all ForcePartPair objects by one ForcePartPairComposite'''
+        parts_pair = [part for part in self.parts if isinstance(part, ForcePartPair)]
+        if len(parts_pair) < 2:
+            return
+        index = self.parts.index(parts_pair[0])
+        self.parts = [part for part in self.parts if not isinstance(part, ForcePartPair)]
+        self.parts.insert(index, ForcePartPairComposite(system, self.nlist, parts_pair))
+
     def get_part_valence(self, system):
         part_valence = self.get_part(ForcePartValence)
         if part_valence is None:
@@ -163,7 +263,31 @@ class FFArgs(object):
     def add_electrostatic_parts(self, system, scalings, dielectric):
         if self.get_part_pair(PairPotEI) is not None:
             return
+        if self.get_part_pair(PairPotDSF) is not None:
+            return
+        if self.get_part(ForcePartEIFMM) is not None:
+            return
+        if self.reci_ei == 'fmm':
+            if system.cell.nvec != 0:
+                raise NotImplementedError('The tree code is only available for 0D systems.')
+            if system.radii is not None and (system.radii != 0).any():
+                log.warn('The tree code ignores the atomic radii.')
+            part_ei_fmm = ForcePartEIFMM(system, scalings, self.fmm_order, self.fmm_theta, dielectric)
+            self.parts.append(part_ei_fmm)
+            return
         nlist = self.get_nlist(system)
+        if self.reci_ei == 'dsf':
+            if system.cell.nvec not in (0, 3):
+                raise NotImplementedError('Only zero- and three-dimensional electrostatics are supported.')
+            if system.radii is not None and (system.radii != 0).any():
+                log.warn('The DSF electrostatics ignore the atomic radii.')
+            alpha = self.alpha_scale/self.rcut
+            pair_pot_dsf = PairPotDSF(system.charges, alpha, self.rcut, dielectric)
+            part_pair_dsf = ForcePartPair(system, nlist, scalings, pair_pot_dsf)
+            self.parts.append(part_pair_dsf)
+            part_dsf_corr = ForcePartDSFCorrection(system, alpha, self.rcut, scalings, dielectric)
+            self.parts.append(part_dsf_corr)
+            return
         if system.cell.nvec == 0:
             alpha = 0.0
         elif system.cell.nvec == 3:
@@ -182,10 +306,13 @@ class FFArgs(object):
         if self.reci_ei == 'ignore':
             # Nothing to do
             pass
-        elif self.reci_ei == 'ewald':
+        elif self.reci_ei in ('ewald', 'pme'):
             if system.cell.nvec == 3:
                 # Reciprocal-space electrostatics
-                part_ewald_reci = ForcePartEwaldReciprocal(system, alpha, self.gcut_scale*alpha, dielectric)
+                if self.reci_ei == 'ewald':
+                    part_ewald_reci = ForcePartEwaldReciprocal(system, alpha, self.gcut_scale*alpha, dielectric)
+                else:
+                    part_ewald_reci = ForcePartPME(system, alpha, self.gcut_scale*alpha, dielectric)
                 self.parts.append(part_ewald_reci)
                 # Ewald corrections
                 part_ewald_corr = ForcePartEwaldCorrection(system, alpha, scalings, dielectric)
@@ -194,11 +321,145 @@ class FFArgs(object):
                 part_ewald_neut = ForcePartEwaldNeutralizing(system, alpha, dielectric)
                 self.parts.append(part_ewald_neut)
             elif system.cell.nvec != 0:
-                raise NotImplementedError('The ewald summation is only available for 3D periodic systems.')
+                raise NotImplementedError('The ewald summation and PME are only available for 3D periodic systems.')
         else:
             raise NotImplementedError
 
 
+def estimate_ewald_errors(system, alpha, rcut, gcut):
+    '''Estimate the RMS errors on the forces due to the Ewald summation
+
+       **Arguments:**
+
+       system
+            A 3D periodic system with charges.
+
+       alpha
+            The alpha parameter in the Ewald summation method.
+
+       rcut
+            The real space cutoff.
+
+       gcut
+            The reciprocal space cutoff, without the factor 2*pi.
+
+       **Returns:** the estimates of the real and the reciprocal space
+       contributions to the RMS error on the forces, as derived by Kolafa and
+       Perram, Mol. Sim. 9, 351-368 (1992), for random point charges. The
+       reciprocal space estimate uses the average cell length, so it is less
+       reliable for very anisotropic cells.
+    '''
+    q2 = (system.charges**2).sum()
+    volume = system.cell.volume
+    length = volume**(1.0/3.0)
+    kmax = max(gcut*length, 1.0)
+    error_real = 2*q2/np.sqrt(system.natom*rcut*volume)*np.exp(-(alpha*rcut)**2)
+    error_reci = 2*q2*alpha/length/np.sqrt(np.pi*kmax*system.natom)* \
+        np.exp(-(np.pi*gcut/alpha)**2)
+    return error_real, error_reci
+
+
+def _solve_ewald_parameters(system, rcut, error):
+    '''Find alpha and gcut such that both estimated errors are equal to error'''
+    q2 = (system.charges**2).sum()
+    volume = system.cell.volume
+    length = volume**(1.0/3.0)
+    # real space, solved analytically
+    arg = 2*q2/np.sqrt(system.natom*rcut*volume)/error
+    alpha = np.sqrt(np.log(max(arg, np.e)))/rcut
+    # reciprocal space, the weak dependence of the prefactor on gcut is
+    # handled by fixed-point iterations
+    gcut = alpha
+    for irep in range(10):
+        kmax = max(gcut*length, 1.0)
+        arg = 2*q2*alpha/length/np.sqrt(np.pi*kmax*system.natom)/error
+        gcut = alpha/np.pi*np.sqrt(np.log(max(arg, np.e)))
+    return alpha, gcut
+
+
+def tune_ewald(system, force_error, rcuts=None, nrep=3, **kwargs):
+    '''Choose the Ewald parameters with the lowest cost for a given accuracy
+
+       **Arguments:**
+
+       system
+            A 3D periodic system with charges, e.g. loaded from a CHK file
+            written after ``ForceField.generate``.
+
+       force_error
+            The target RMS error on the forces due to the Ewald summation.
+
+       **Optional arguments:**
+
+       rcuts
+            The real space cutoffs to consider. By default, cutoffs from 8 to
+            16 angstrom are tried. Note that the selected cutoff also applies
+            to the other pair potentials.
+
+       nrep
+            The number of timed force evaluations for each combination.
+
+       Any other keyword arguments are passed on to the ``FFArgs``
+       constructor, except rcut, alpha_scale and gcut_scale.
+
+       For each cutoff, alpha and gcut are chosen such that the estimates of
+       the real and reciprocal space errors, see ``estimate_ewald_errors``,
+       are both equal to force_error/sqrt(2). The cost of the real space part,
+       including a rebuild of the neighbor list, and of the reciprocal space
+       part is then measured with a few force evaluations. The estimates
+       assume point charges without scaling of short-range interactions, so
+       they should be validated for production runs.
+
+       **Returns:** an ``FFArgs`` instance with the cheapest combination, e.g.
+       to be used as follows::
+
+            ff_args = tune_ewald(system, 1e-4)
+            apply_generators(system, parameters, ff_args)
+            ff = ForceField(system, ff_args.parts, ff_args.nlist)
+    '''
+    if system.cell.nvec != 3:
+        raise ValueError('Ewald parameters can only be tuned for 3D periodic systems.')
+    if system.charges is None:
+        raise ValueError('The system does not have charges.')
+    if rcuts is None:
+        rcuts = np.array([8.0, 9.0, 10.0, 11.0, 12.0, 14.0, 16.0])*angstrom
+    scalings = Scalings(system, 1.0, 1.0, 1.0, 1.0)
+    gpos = np.zeros(system.pos.shape)
+    vtens = np.zeros((3, 3))
+    best = None
+    with log.section('TUNE'):
+        if log.do_medium:
+            log.hline()
+            log('    Rcut       Alpha        Gcut  Real time  Reci time')
+            log.hline()
+        for rcut in rcuts:
+            alpha, gcut = _solve_ewald_parameters(system, rcut, force_error/np.sqrt(2))
+            nlist = NeighborList(system)
+            part_pair = ForcePartPair(system, nlist, scalings, PairPotEI(system.charges, alpha, rcut))
+            part_reci = ForcePartEwaldReciprocal(system, alpha, gcut)
+            time0 = default_timer()
+            for irep in range(nrep):
+                nlist.update()
+                part_pair.compute(gpos, vtens)
+            time1 = default_timer()
+            for irep in range(nrep):
+                part_reci.compute(gpos, vtens)
+            time2 = default_timer()
+            time_real = (time1 - time0)/nrep
+            time_reci = (time2 - time1)/nrep
+            if log.do_medium:
+                log('%s %s %s %10.5f %10.5f' % (
+                    log.length(rcut), log.invlength(alpha), log.invlength(gcut),
+                    time_real, time_reci))
+            if best is None or time_real + time_reci < best[0]:
+                best = (time_real + time_reci, rcut, alpha, gcut)
+        if log.do_medium:
+            log.hline()
+            log('Selected rcut: %s' % log.length(best[1]))
+    cost, rcut, alpha, gcut = best
+    return FFArgs(rcut=rcut, alpha_scale=alpha*rcut, gcut_scale=gcut/alpha, **kwargs)
+
+
 class Generator(object):
     """Creates (part of a) ForceField object automatically.
 
@@ -1615,6 +1876,11 @@ def apply_generators(system, parameters, ff_args):
         else:
             generator(system, section, ff_args)
 
+    if ff_args.tabulate_pair is not None:
+        ff_args.tabulate_pair_parts(system)
+    if ff_args.fused_pair:
+        ff_args.fuse_pair_parts(system)
+
     part_valence = ff_args.get_part(ForcePartValence)
     if part_valence is not None and log.do_warning:
         # Basic check for missing terms
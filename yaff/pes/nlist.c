@@ -23,15 +23,22 @@
 
 
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "nlist.h"
 #include "cell.h"
 
 
-int nlist_build_low(double *pos, double rcut, long *rmax,
+int nlist_build_low(double *pos, double rcut, long *images, long nimage,
                     cell_type *unitcell, long *status,
                     neigh_row_type *neighs, long natom, long nneigh) {
+  // Only the periodic images in the table images are visited. The table has
+  // nimage rows, the first being the central image. (See nlist_images_low.)
 
-  long a, b, row;
+  long a, b, row, iimage;
   long *r;
   int update_delta0, image, sign;
   double delta0[3], delta[3], d;
@@ -40,6 +47,10 @@ int nlist_build_low(double *pos, double rcut, long *rmax,
   a = status[3];
   b = status[4];
   sign = status[5];
+  // Locate the current image in the table.
+  for (iimage=0; iimage<nimage-1; iimage++) {
+    if ((images[3*iimage] == r[0]) && (images[3*iimage+1] == r[1]) && (images[3*iimage+2] == r[2])) break;
+  }
 
   update_delta0 = 1;
   image = (r[0] != 0) || (r[1] != 0) || (r[2] != 0);
@@ -88,6 +99,7 @@ int nlist_build_low(double *pos, double rcut, long *rmax,
         (*neighs).r0 = r[0];
         (*neighs).r1 = r[1];
         (*neighs).r2 = r[2];
+        (*neighs).nbond = 0;
         neighs++;
         row++;
       }
@@ -97,7 +109,12 @@ int nlist_build_low(double *pos, double rcut, long *rmax,
       // Change sign of the relative vector for non-self interactions with
       // periodic images.
       sign = -1;
-    } else if (!nlist_inc_r(unitcell, r, rmax)) {
+    } else if (iimage >= nimage-1) {
+      // All images are visited. Back to the central image.
+      iimage = 0;
+      r[0] = 0;
+      r[1] = 0;
+      r[2] = 0;
       sign = 1;
       update_delta0 = 1;
       image = 0;
@@ -107,6 +124,10 @@ int nlist_build_low(double *pos, double rcut, long *rmax,
         a++;
       }
     } else {
+      iimage++;
+      r[0] = images[3*iimage];
+      r[1] = images[3*iimage+1];
+      r[2] = images[3*iimage+2];
       image = 1;
       sign = 1;
     }
@@ -170,11 +191,121 @@ endloop:
 }
 
 
+static double nlist_image_distance(cell_type *unitcell, long *r) {
+  // Returns the shortest relative vector that can be found in the periodic
+  // image r, i.e. the minimum of |(f + r).R| where the fractional coordinates
+  // f of the minimum image lie in [-0.5, 0.5]. This convex quadratic problem
+  // is solved exactly by trying all combinations of free variables and
+  // variables fixed at a bound, of which the feasible ones are compared.
+  int nvec, i, j, k, m, p, ncombo, icombo, code;
+  int state[3], free[3];
+  double gram[9], x[3], mat[9], rhs[3], factor, norm2, result;
+
+  nvec = (*unitcell).nvec;
+  for (i=0; i<nvec; i++) {
+    for (j=0; j<nvec; j++) {
+      gram[3*i+j] = (*unitcell).rvecs[3*i  ]*(*unitcell).rvecs[3*j  ] +
+                    (*unitcell).rvecs[3*i+1]*(*unitcell).rvecs[3*j+1] +
+                    (*unitcell).rvecs[3*i+2]*(*unitcell).rvecs[3*j+2];
+    }
+  }
+  ncombo = 1;
+  for (i=0; i<nvec; i++) ncombo *= 3;
+  result = -1.0;
+  for (icombo=0; icombo<ncombo; icombo++) {
+    // Each variable is free (0), at its lower bound (1) or at its upper
+    // bound (2).
+    code = icombo;
+    m = 0;
+    for (i=0; i<nvec; i++) {
+      state[i] = code%3;
+      if (state[i] == 0) {
+        free[m] = i;
+        m++;
+      } else if (state[i] == 1) {
+        x[i] = r[i] - 0.5;
+      } else {
+        x[i] = r[i] + 0.5;
+      }
+      code /= 3;
+    }
+    // Solve the linear equations for the free variables, with Gaussian
+    // elimination. The Gram matrix is positive definite, so no pivoting is
+    // needed.
+    for (j=0; j<m; j++) {
+      rhs[j] = 0.0;
+      for (i=0; i<nvec; i++) {
+        if (state[i] == 0) continue;
+        rhs[j] -= gram[3*free[j]+i]*x[i];
+      }
+      for (k=0; k<m; k++) {
+        mat[3*j+k] = gram[3*free[j]+free[k]];
+      }
+    }
+    for (p=0; p<m; p++) {
+      for (j=p+1; j<m; j++) {
+        factor = mat[3*j+p]/mat[3*p+p];
+        for (k=p; k<m; k++) mat[3*j+k] -= factor*mat[3*p+k];
+        rhs[j] -= factor*rhs[p];
+      }
+    }
+    for (p=m-1; p>=0; p--) {
+      for (k=p+1; k<m; k++) rhs[p] -= mat[3*p+k]*rhs[k];
+      rhs[p] /= mat[3*p+p];
+    }
+    // Discard infeasible solutions.
+    for (j=0; j<m; j++) {
+      x[free[j]] = rhs[j];
+      if ((rhs[j] < r[free[j]] - 0.5) || (rhs[j] > r[free[j]] + 0.5)) break;
+    }
+    if (j < m) continue;
+    norm2 = 0.0;
+    for (i=0; i<nvec; i++) {
+      for (j=0; j<nvec; j++) {
+        norm2 += x[i]*gram[3*i+j]*x[j];
+      }
+    }
+    if ((result < 0) || (norm2 < result)) result = norm2;
+  }
+  if (result < 0) result = 0.0;
+  return sqrt(result);
+}
+
+
+long nlist_images_low(cell_type *unitcell, double rcut, long *rmax,
+                      long *images) {
+  // Fills the table images with the periodic images visited by nlist_inc_r
+  // (the central image first and then half of the neighboring images) that
+  // may contain relative vectors shorter than rcut. All other images are
+  // pruned. The table must be large enough to hold all images visited by
+  // nlist_inc_r. Returns the number of images in the table.
+  long r[3], nimage;
+  r[0] = 0;
+  r[1] = 0;
+  r[2] = 0;
+  images[0] = 0;
+  images[1] = 0;
+  images[2] = 0;
+  nimage = 1;
+  while (nlist_inc_r(unitcell, r, rmax)) {
+    // A small margin makes sure that no images are lost due to rounding
+    // errors in the minimum image convention.
+    if (nlist_image_distance(unitcell, r) < rcut*(1.0 + 1e-8)) {
+      images[3*nimage  ] = r[0];
+      images[3*nimage+1] = r[1];
+      images[3*nimage+2] = r[2];
+      nimage++;
+    }
+  }
+  return nimage;
+}
+
+
 void nlist_recompute_low(double *pos, double *pos_old, cell_type* unitcell,
                          neigh_row_type *neighs, long nneigh) {
   long i, a, b;
   int update_delta0;
-  long center[3];
+  long center[3], r[3];
   double delta0[3], delta[3], d;
 
   update_delta0 = 1;
@@ -209,7 +340,10 @@ void nlist_recompute_low(double *pos, double *pos_old, cell_type* unitcell,
     delta[0] = delta0[0];
     delta[1] = delta0[1];
     delta[2] = delta0[2];
-    cell_add_vec(delta, unitcell, &((*neighs).r0));
+    r[0] = (*neighs).r0;
+    r[1] = (*neighs).r1;
+    r[2] = (*neighs).r2;
+    cell_add_vec(delta, unitcell, r);
     // Compute the distance and store the record if distance is below the rcut.
     d = sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]);
     // Store the new results;
@@ -220,3 +354,1012 @@ void nlist_recompute_low(double *pos, double *pos_old, cell_type* unitcell,
     neighs++;
   }
 }
+
+
+double nlist_displacement_low(double *pos, double *pos_old, long natom) {
+  // Returns the sum of the two largest atomic displacements since the last
+  // rebuild. No distance between two atoms can have changed by more than this
+  // amount, because the image shifts of the pairs are kept fixed.
+  long i;
+  double d, d1, d2, t1, t2;
+  d1 = 0.0;
+  d2 = 0.0;
+  #pragma omp parallel private(i, d, t1, t2)
+  {
+    // The two largest squared displacements seen by this thread.
+    t1 = 0.0;
+    t2 = 0.0;
+    #pragma omp for
+    for (i=0; i<natom; i++) {
+      d = (pos[3*i  ] - pos_old[3*i  ])*(pos[3*i  ] - pos_old[3*i  ]) +
+          (pos[3*i+1] - pos_old[3*i+1])*(pos[3*i+1] - pos_old[3*i+1]) +
+          (pos[3*i+2] - pos_old[3*i+2])*(pos[3*i+2] - pos_old[3*i+2]);
+      if (d > t1) {
+        t2 = t1;
+        t1 = d;
+      } else if (d > t2) {
+        t2 = d;
+      }
+    }
+    #pragma omp critical
+    {
+      if (t1 > d1) {
+        d2 = (d1 > t2) ? d1 : t2;
+        d1 = t1;
+      } else if (t1 > d2) {
+        d2 = t1;
+      }
+    }
+  }
+  return sqrt(d1) + sqrt(d2);
+}
+
+
+typedef struct {
+  long nbin[3];      // number of bins along each fractional axis
+  long nstencil[3];  // number of neighboring bins to scan on each side
+  double origin[3];  // fractional coordinate of the first bin boundary
+  double width[3];   // width of a bin in fractional coordinates
+  long *bin_start;   // first row in bin_atoms for each bin (one extra at the end)
+  long *bin_atoms;   // atom indices, sorted by bin
+  long *atom_bin;    // the bin of each atom, three integers per atom
+  double *wpos;      // the atomic positions wrapped into the central cell
+} nlist_bins_type;
+
+
+static void nlist_bins_free(nlist_bins_type *bins) {
+  free((*bins).bin_start);
+  free((*bins).bin_atoms);
+  free((*bins).atom_bin);
+  free((*bins).wpos);
+}
+
+
+static int nlist_bins_init(nlist_bins_type *bins, double *pos, double rcut,
+                           cell_type *unitcell, long natom) {
+  // Assigns all atoms to bins in fractional coordinates. Along periodic
+  // directions, the bins tile the unit cell. Along the remaining directions,
+  // the bins cover the range of the fractional coordinates of the atoms, which
+  // are just Cartesian coordinates because the corresponding gvecs have unit
+  // length. Returns 0 on success and -1 when memory allocation failed.
+  long i, c, ibin, nbin_total;
+  long shift[3];
+  int k, kmax, nvec;
+  double frac[3], fmin[3], fmax[3];
+
+  nvec = (*unitcell).nvec;
+  (*bins).bin_start = NULL;
+  (*bins).bin_atoms = malloc(natom*sizeof(long));
+  (*bins).atom_bin = malloc(3*natom*sizeof(long));
+  (*bins).wpos = malloc(3*natom*sizeof(double));
+  if (((*bins).bin_atoms == NULL) || ((*bins).atom_bin == NULL) || ((*bins).wpos == NULL)) {
+    nlist_bins_free(bins);
+    return -1;
+  }
+
+  // Wrap the atoms into the central cell and find the range of the fractional
+  // coordinates along the non-periodic directions.
+  for (k=0; k<3; k++) {
+    fmin[k] = 0.0;
+    fmax[k] = 0.0;
+    shift[k] = 0;
+  }
+  for (i=0; i<natom; i++) {
+    cell_to_frac(unitcell, pos + 3*i, frac);
+    for (k=0; k<3; k++) {
+      if (k < nvec) {
+        shift[k] = -floor(frac[k]);
+      } else if ((i == 0) || (frac[k] < fmin[k])) {
+        fmin[k] = frac[k];
+      }
+      if ((k >= nvec) && ((i == 0) || (frac[k] > fmax[k]))) {
+        fmax[k] = frac[k];
+      }
+    }
+    (*bins).wpos[3*i  ] = pos[3*i  ];
+    (*bins).wpos[3*i+1] = pos[3*i+1];
+    (*bins).wpos[3*i+2] = pos[3*i+2];
+    cell_add_vec((*bins).wpos + 3*i, unitcell, shift);
+  }
+
+  // Bins are (at least) half the cutoff wide. The total number of bins is
+  // kept proportional to the number of atoms to avoid wasting time on empty
+  // bins in dilute systems.
+  for (k=0; k<3; k++) {
+    if (k < nvec) {
+      (*bins).nbin[k] = floor(2.0*(*unitcell).rspacings[k]/rcut);
+      if ((*bins).nbin[k] < 1) (*bins).nbin[k] = 1;
+      (*bins).width[k] = 1.0/(*bins).nbin[k];
+      (*bins).origin[k] = 0.0;
+    } else {
+      (*bins).width[k] = 0.5*rcut;
+      (*bins).nbin[k] = floor((fmax[k] - fmin[k])/(*bins).width[k]) + 1;
+      (*bins).origin[k] = fmin[k];
+    }
+  }
+  while ((*bins).nbin[0]*(*bins).nbin[1]*(*bins).nbin[2] > 2*natom + 8) {
+    kmax = 0;
+    for (k=1; k<3; k++) {
+      if ((*bins).nbin[k] > (*bins).nbin[kmax]) kmax = k;
+    }
+    if (kmax < nvec) {
+      (*bins).nbin[kmax] = ((*bins).nbin[kmax] + 1)/2;
+      (*bins).width[kmax] = 1.0/(*bins).nbin[kmax];
+    } else {
+      (*bins).width[kmax] *= 2;
+      (*bins).nbin[kmax] = floor((fmax[kmax] - fmin[kmax])/(*bins).width[kmax]) + 1;
+    }
+  }
+  for (k=0; k<3; k++) {
+    // The rspacings of the non-periodic directions are equal to one. A small
+    // margin is added to the cutoff, consistent with nlist_scan_atom.
+    (*bins).nstencil[k] = ceil(rcut*(1.0 + 1e-8)/((*bins).width[k]*(*unitcell).rspacings[k]));
+    if ((k >= nvec) && ((*bins).nstencil[k] >= (*bins).nbin[k])) {
+      (*bins).nstencil[k] = (*bins).nbin[k] - 1;
+    }
+  }
+  nbin_total = (*bins).nbin[0]*(*bins).nbin[1]*(*bins).nbin[2];
+
+  // Assign the atoms to bins and sort them with a counting sort.
+  (*bins).bin_start = calloc(nbin_total + 1, sizeof(long));
+  if ((*bins).bin_start == NULL) {
+    nlist_bins_free(bins);
+    return -1;
+  }
+  for (i=0; i<natom; i++) {
+    cell_to_frac(unitcell, (*bins).wpos + 3*i, frac);
+    for (k=0; k<3; k++) {
+      c = floor((frac[k] - (*bins).origin[k])/(*bins).width[k]);
+      if (c < 0) c = 0;
+      if (c >= (*bins).nbin[k]) c = (*bins).nbin[k] - 1;
+      (*bins).atom_bin[3*i+k] = c;
+    }
+    ibin = (*bins).atom_bin[3*i] + (*bins).nbin[0]*(
+      (*bins).atom_bin[3*i+1] + (*bins).nbin[1]*(*bins).atom_bin[3*i+2]);
+    (*bins).bin_start[ibin+1]++;
+  }
+  for (ibin=0; ibin<nbin_total; ibin++) {
+    (*bins).bin_start[ibin+1] += (*bins).bin_start[ibin];
+  }
+  for (i=0; i<natom; i++) {
+    ibin = (*bins).atom_bin[3*i] + (*bins).nbin[0]*(
+      (*bins).atom_bin[3*i+1] + (*bins).nbin[1]*(*bins).atom_bin[3*i+2]);
+    // bin_start is temporarily used as a counter and restored below.
+    (*bins).bin_atoms[(*bins).bin_start[ibin]] = i;
+    (*bins).bin_start[ibin]++;
+  }
+  for (ibin=nbin_total; ibin>0; ibin--) {
+    (*bins).bin_start[ibin] = (*bins).bin_start[ibin-1];
+  }
+  (*bins).bin_start[0] = 0;
+  return 0;
+}
+
+
+static int nlist_in_half(long *r, int nvec) {
+  // Returns 1 if r is one of the (non-central) images visited by nlist_inc_r.
+  int k;
+  for (k=nvec-1; k>=0; k--) {
+    if (r[k] > 0) return 1;
+    if (r[k] < 0) return 0;
+  }
+  return 0;
+}
+
+
+static int nlist_compare_rows(const void *p0, const void *p1) {
+  // Order of the rows with the same first atom in the binned neighbor list.
+  const neigh_row_type *row0 = p0;
+  const neigh_row_type *row1 = p1;
+  if ((*row0).b != (*row1).b) return ((*row0).b < (*row1).b)?-1:1;
+  if ((*row0).r2 != (*row1).r2) return ((*row0).r2 < (*row1).r2)?-1:1;
+  if ((*row0).r1 != (*row1).r1) return ((*row0).r1 < (*row1).r1)?-1:1;
+  if ((*row0).r0 != (*row1).r0) return ((*row0).r0 < (*row1).r0)?-1:1;
+  return 0;
+}
+
+
+static long* nlist_topology_start(long *topo, long ntopo, long natom) {
+  // Returns a newly allocated array with the first row of each atom in the
+  // topology table, or NULL when memory allocation failed.
+  long i, a;
+  long *topo_start;
+  topo_start = calloc(natom+1, sizeof(long));
+  if (topo_start == NULL) return NULL;
+  for (i=0; i<ntopo; i++) {
+    topo_start[topo[3*i]+1]++;
+  }
+  for (a=0; a<natom; a++) {
+    topo_start[a+1] += topo_start[a];
+  }
+  return topo_start;
+}
+
+
+static long nlist_topology_lookup(long *topo, long *topo_start, long a, long b) {
+  // Returns the code of the pair (a, b) in the topology table, or zero when
+  // the pair is not present. The rows of atom a are sorted by b.
+  long lo, hi, mid;
+  lo = topo_start[a];
+  hi = topo_start[a+1];
+  while (lo < hi) {
+    mid = (lo + hi)/2;
+    if (topo[3*mid+1] < b) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if ((lo < topo_start[a+1]) && (topo[3*lo+1] == b)) return topo[3*lo+2];
+  return 0;
+}
+
+
+static long nlist_scan_atom(double *pos, double rcut, long *rmax,
+                            cell_type *unitcell, nlist_bins_type *bins,
+                            long *topo, long *topo_start, long a,
+                            neigh_row_type **block, long *block_size) {
+  // Collects all rows in the neighbor list whose first atom is a. These are
+  // exactly the rows that nlist_build_low would generate, i.e. the relative
+  // vector is always constructed by adding cell vectors to the minimum image
+  // of the relative vector. When a topology table is given, the bond codes of
+  // the pairs in the central image are filled in and pairs with a negative
+  // code are left out. Returns the number of rows, or -1 when memory
+  // allocation failed. The block of rows is reallocated when needed.
+  long b, i, k, ibin, nrow, nbond;
+  long u[3], o[3], n[3], r[3];
+  int nvec, sign;
+  double rcut_scan, frac;
+  double shift[3], delta0[3], delta[3], d;
+  neigh_row_type *new_block;
+
+  nvec = (*unitcell).nvec;
+  // The scan uses a slightly larger cutoff to make sure that no pairs are
+  // lost due to rounding errors in the wrapped positions.
+  rcut_scan = rcut*(1.0 + 1e-8);
+  nrow = 0;
+  for (o[2]=-(*bins).nstencil[2]; o[2]<=(*bins).nstencil[2]; o[2]++) {
+    for (o[1]=-(*bins).nstencil[1]; o[1]<=(*bins).nstencil[1]; o[1]++) {
+      for (o[0]=-(*bins).nstencil[0]; o[0]<=(*bins).nstencil[0]; o[0]++) {
+        // Locate the neighboring bin and the periodic image it belongs to.
+        for (k=0; k<3; k++) {
+          u[k] = (*bins).atom_bin[3*a+k] + o[k];
+          n[k] = 0;
+          if (k < nvec) {
+            n[k] = floor((double)u[k]/(*bins).nbin[k]);
+            u[k] -= n[k]*(*bins).nbin[k];
+          } else if ((u[k] < 0) || (u[k] >= (*bins).nbin[k])) {
+            break;
+          }
+        }
+        if (k < 3) continue;
+        shift[0] = 0.0;
+        shift[1] = 0.0;
+        shift[2] = 0.0;
+        cell_add_vec(shift, unitcell, n);
+        ibin = u[0] + (*bins).nbin[0]*(u[1] + (*bins).nbin[1]*u[2]);
+        for (i=(*bins).bin_start[ibin]; i<(*bins).bin_start[ibin+1]; i++) {
+          b = (*bins).bin_atoms[i];
+          delta[0] = (*bins).wpos[3*b  ] + shift[0] - (*bins).wpos[3*a  ];
+          delta[1] = (*bins).wpos[3*b+1] + shift[1] - (*bins).wpos[3*a+1];
+          delta[2] = (*bins).wpos[3*b+2] + shift[2] - (*bins).wpos[3*a+2];
+          if (delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2] >= rcut_scan*rcut_scan) continue;
+          // Reconstruct the row as it appears in nlist_build_low: the minimum
+          // image of the relative vector from the atom with the highest index
+          // to the other, plus an image in the half set.
+          if (b <= a) {
+            sign = 1;
+            delta0[0] = pos[3*b  ] - pos[3*a  ];
+            delta0[1] = pos[3*b+1] - pos[3*a+1];
+            delta0[2] = pos[3*b+2] - pos[3*a+2];
+          } else {
+            sign = -1;
+            delta0[0] = pos[3*a  ] - pos[3*b  ];
+            delta0[1] = pos[3*a+1] - pos[3*b+1];
+            delta0[2] = pos[3*a+2] - pos[3*b+2];
+          }
+          cell_mic(delta0, unitcell);
+          r[0] = 0;
+          r[1] = 0;
+          r[2] = 0;
+          for (k=0; k<nvec; k++) {
+            frac = (*unitcell).gvecs[3*k  ]*(delta[0] - sign*delta0[0]) +
+                   (*unitcell).gvecs[3*k+1]*(delta[1] - sign*delta0[1]) +
+                   (*unitcell).gvecs[3*k+2]*(delta[2] - sign*delta0[2]);
+            r[k] = floor(frac + 0.5);
+            if ((r[k] > rmax[k]) || (r[k] < -rmax[k])) break;
+          }
+          if (k < nvec) continue;
+          // Each pair is encountered twice. Only one of both is kept.
+          if (!(((b < a) && (r[0] == 0) && (r[1] == 0) && (r[2] == 0)) || nlist_in_half(r, nvec))) continue;
+          delta[0] = sign*delta0[0];
+          delta[1] = sign*delta0[1];
+          delta[2] = sign*delta0[2];
+          cell_add_vec(delta, unitcell, r);
+          d = sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]);
+          if (d >= rcut) continue;
+          nbond = 0;
+          if ((topo != NULL) && (b < a) && (r[0] == 0) && (r[1] == 0) && (r[2] == 0)) {
+            nbond = nlist_topology_lookup(topo, topo_start, a, b);
+            if (nbond < 0) continue;
+          }
+          if (nrow >= *block_size) {
+            new_block = realloc(*block, 2*(*block_size)*sizeof(neigh_row_type));
+            if (new_block == NULL) return -1;
+            *block = new_block;
+            *block_size *= 2;
+          }
+          (*block)[nrow].a = a;
+          (*block)[nrow].b = b;
+          (*block)[nrow].d = d;
+          (*block)[nrow].dx = delta[0];
+          (*block)[nrow].dy = delta[1];
+          (*block)[nrow].dz = delta[2];
+          (*block)[nrow].r0 = r[0];
+          (*block)[nrow].r1 = r[1];
+          (*block)[nrow].r2 = r[2];
+          (*block)[nrow].nbond = nbond;
+          nrow++;
+        }
+      }
+    }
+  }
+  // Sort the rows such that the pairs in the central image are ordered in the
+  // same way as the scaling table.
+  qsort(*block, nrow, sizeof(neigh_row_type), nlist_compare_rows);
+  return nrow;
+}
+
+
+static void nlist_compact_rows(double *pos, cell_type *unitcell,
+                               neigh_row_type *rows, long nrow,
+                               neigh_compact_row_type *compact) {
+  // Converts rows to the compact format. The image shifts are taken relative
+  // to the raw atomic positions, such that the relative vector can be
+  // reconstructed as pos[b] - pos[a] + s0*R0 + s1*R1 + s2*R2.
+  long i, k;
+  double delta[3];
+  double frac;
+  long s[3];
+  for (i=0; i<nrow; i++) {
+    delta[0] = rows[i].dx - (pos[3*rows[i].b  ] - pos[3*rows[i].a  ]);
+    delta[1] = rows[i].dy - (pos[3*rows[i].b+1] - pos[3*rows[i].a+1]);
+    delta[2] = rows[i].dz - (pos[3*rows[i].b+2] - pos[3*rows[i].a+2]);
+    for (k=0; k<3; k++) {
+      if (k < (*unitcell).nvec) {
+        frac = (*unitcell).gvecs[3*k  ]*delta[0] +
+               (*unitcell).gvecs[3*k+1]*delta[1] +
+               (*unitcell).gvecs[3*k+2]*delta[2];
+        s[k] = floor(frac + 0.5);
+      } else {
+        s[k] = 0;
+      }
+    }
+    compact[i].a = rows[i].a;
+    compact[i].b = rows[i].b;
+    compact[i].s0 = s[0];
+    compact[i].s1 = s[1];
+    compact[i].s2 = s[2];
+    compact[i].central = (rows[i].r0 == 0) && (rows[i].r1 == 0) && (rows[i].r2 == 0);
+    compact[i].nbond = rows[i].nbond;
+  }
+}
+
+
+nlist_blocks_type* nlist_blocks_new(void) {
+  nlist_blocks_type* result;
+  result = malloc(sizeof(nlist_blocks_type));
+  if (result != NULL) {
+    (*result).nblock = 0;
+    (*result).row_size = sizeof(neigh_row_type);
+    (*result).nrow = NULL;
+    (*result).rows = NULL;
+  }
+  return result;
+}
+
+
+void nlist_blocks_free(nlist_blocks_type *blocks) {
+  long iblock;
+  if ((*blocks).rows != NULL) {
+    for (iblock=0; iblock<(*blocks).nblock; iblock++) {
+      free((*blocks).rows[iblock]);
+    }
+  }
+  free((*blocks).rows);
+  free((*blocks).nrow);
+  free(blocks);
+}
+
+
+long nlist_build_binned_low(double *pos, double rcut, long *rmax,
+                            cell_type *unitcell, long natom, int compact,
+                            long *topo, long ntopo,
+                            nlist_blocks_type *blocks) {
+  // The atoms are divided into consecutive ranges. The rows for each range
+  // are collected in a separate block, such that the blocks can be filled by
+  // different threads. Concatenating the blocks gives a neighbor list that
+  // does not depend on the number of threads. When compact is non-zero, the
+  // rows are stored as neigh_compact_row_type.
+  //
+  // The optional topology table (topo, may be NULL) contains triples
+  // (a, b, code), sorted by a and b, with a > b. The code is stored in the
+  // nbond field of the corresponding rows in the central image. Pairs with a
+  // negative code are excluded from the neighbor list.
+  //
+  // Returns the total number of rows or -1 when memory allocation failed.
+  long a, iblock, nblock, nrow, total, block_size, scratch_size, row_size;
+  int nthread;
+  neigh_row_type *scratch;
+  char *rows, *new_rows;
+  long *topo_start;
+  nlist_bins_type bins;
+
+  topo_start = NULL;
+  if (topo != NULL) {
+    topo_start = nlist_topology_start(topo, ntopo, natom);
+    if (topo_start == NULL) return -1;
+  }
+  if (nlist_bins_init(&bins, pos, rcut, unitcell, natom) != 0) {
+    free(topo_start);
+    return -1;
+  }
+#ifdef _OPENMP
+  nthread = omp_get_max_threads();
+#else
+  nthread = 1;
+#endif
+  // A few blocks per thread improves the load balancing.
+  nblock = 8*nthread;
+  if (nblock > natom) nblock = natom;
+  if (nblock < 1) nblock = 1;
+  if (compact) {
+    row_size = sizeof(neigh_compact_row_type);
+  } else {
+    row_size = sizeof(neigh_row_type);
+  }
+  (*blocks).nblock = nblock;
+  (*blocks).row_size = row_size;
+  (*blocks).nrow = calloc(nblock, sizeof(long));
+  (*blocks).rows = calloc(nblock, sizeof(char*));
+  if (((*blocks).nrow == NULL) || ((*blocks).rows == NULL)) {
+    nlist_bins_free(&bins);
+    free(topo_start);
+    return -1;
+  }
+
+  #pragma omp parallel private(a, iblock, nrow, block_size, scratch, scratch_size, rows, new_rows)
+  {
+    // Each thread has its own scratch space for the rows of a single atom.
+    scratch_size = 64;
+    scratch = malloc(scratch_size*sizeof(neigh_row_type));
+    #pragma omp for schedule(dynamic, 1)
+    for (iblock=0; iblock<nblock; iblock++) {
+      if (scratch == NULL) {
+        (*blocks).nrow[iblock] = -1;
+        continue;
+      }
+      block_size = 0;
+      rows = NULL;
+      for (a=(natom*iblock)/nblock; a<(natom*(iblock+1))/nblock; a++) {
+        nrow = nlist_scan_atom(pos, rcut, rmax, unitcell, &bins, topo, topo_start, a, &scratch, &scratch_size);
+        if (nrow < 0) {
+          (*blocks).nrow[iblock] = -1;
+          break;
+        }
+        if ((*blocks).nrow[iblock] + nrow > block_size) {
+          block_size = 2*block_size + nrow;
+          new_rows = realloc(rows, block_size*row_size);
+          if (new_rows == NULL) {
+            (*blocks).nrow[iblock] = -1;
+            break;
+          }
+          rows = new_rows;
+        }
+        if (compact) {
+          nlist_compact_rows(pos, unitcell, scratch, nrow,
+            (neigh_compact_row_type*)(rows + (*blocks).nrow[iblock]*row_size));
+        } else {
+          memcpy(rows + (*blocks).nrow[iblock]*row_size, scratch, nrow*row_size);
+        }
+        (*blocks).nrow[iblock] += nrow;
+      }
+      (*blocks).rows[iblock] = rows;
+    }
+    free(scratch);
+  }
+  nlist_bins_free(&bins);
+  free(topo_start);
+
+  total = 0;
+  for (iblock=0; iblock<nblock; iblock++) {
+    if ((*blocks).nrow[iblock] < 0) return -1;
+    total += (*blocks).nrow[iblock];
+  }
+  return total;
+}
+
+
+void nlist_blocks_merge(nlist_blocks_type *blocks, void *neighs) {
+  // Copies all blocks into one neighbor list. The neighs array must be large
+  // enough to hold all rows and its rows must have the same format as the
+  // blocks.
+  long iblock, jblock, offset;
+  #pragma omp parallel for private(jblock, offset) schedule(dynamic, 1)
+  for (iblock=0; iblock<(*blocks).nblock; iblock++) {
+    offset = 0;
+    for (jblock=0; jblock<iblock; jblock++) {
+      offset += (*blocks).nrow[jblock];
+    }
+    if ((*blocks).nrow[iblock] > 0) {
+      memcpy((char*)neighs + offset*(*blocks).row_size, (*blocks).rows[iblock], (*blocks).nrow[iblock]*(*blocks).row_size);
+    }
+  }
+}
+
+
+typedef struct {
+  long code;
+  long index;
+} nlist_morton_type;
+
+
+static int nlist_compare_morton(const void *p0, const void *p1) {
+  const nlist_morton_type *m0 = p0;
+  const nlist_morton_type *m1 = p1;
+  if ((*m0).code != (*m1).code) return ((*m0).code < (*m1).code)?-1:1;
+  if ((*m0).index != (*m1).index) return ((*m0).index < (*m1).index)?-1:1;
+  return 0;
+}
+
+
+static int nlist_clusters_init(double *pos, cell_type *unitcell, long natom,
+                               long *clusters, long *wrap, double *wpos) {
+  // Wraps the atoms into the central cell and groups them into clusters of
+  // NLIST_CLUSTER_SIZE consecutive atoms along a Morton (Z-order) curve in
+  // fractional coordinates. The last cluster is padded with -1. Returns 0 on
+  // success and -1 when memory allocation failed.
+  long i, bit;
+  long u[3];
+  int k, nvec;
+  double frac[3], fmin[3], fmax[3];
+  nlist_morton_type *order;
+
+  nvec = (*unitcell).nvec;
+  order = malloc(natom*sizeof(nlist_morton_type));
+  if (order == NULL) return -1;
+  // Wrap the atoms and find the range of the fractional coordinates along
+  // the non-periodic directions.
+  for (k=0; k<3; k++) {
+    fmin[k] = 0.0;
+    fmax[k] = 1.0;
+  }
+  for (i=0; i<natom; i++) {
+    cell_to_frac(unitcell, pos + 3*i, frac);
+    for (k=0; k<3; k++) {
+      if (k < nvec) {
+        wrap[3*i+k] = -floor(frac[k]);
+      } else {
+        wrap[3*i+k] = 0;
+        if ((i == 0) || (frac[k] < fmin[k])) fmin[k] = frac[k];
+        if ((i == 0) || (frac[k] > fmax[k])) fmax[k] = frac[k];
+      }
+    }
+    wpos[3*i  ] = pos[3*i  ];
+    wpos[3*i+1] = pos[3*i+1];
+    wpos[3*i+2] = pos[3*i+2];
+    cell_add_vec(wpos + 3*i, unitcell, wrap + 3*i);
+  }
+  // Interleave the bits of the scaled fractional coordinates.
+  for (i=0; i<natom; i++) {
+    cell_to_frac(unitcell, wpos + 3*i, frac);
+    for (k=0; k<3; k++) {
+      u[k] = 0;
+      if (fmax[k] > fmin[k]) u[k] = floor(1024*(frac[k] - fmin[k])/(fmax[k] - fmin[k]));
+      if (u[k] < 0) u[k] = 0;
+      if (u[k] > 1023) u[k] = 1023;
+    }
+    order[i].code = 0;
+    order[i].index = i;
+    for (bit=9; bit>=0; bit--) {
+      for (k=0; k<3; k++) {
+        order[i].code = (order[i].code << 1) | ((u[k] >> bit) & 1);
+      }
+    }
+  }
+  qsort(order, natom, sizeof(nlist_morton_type), nlist_compare_morton);
+  for (i=0; i<NLIST_CLUSTER_SIZE*((natom + NLIST_CLUSTER_SIZE - 1)/NLIST_CLUSTER_SIZE); i++) {
+    if (i < natom) {
+      clusters[i] = order[i].index;
+    } else {
+      clusters[i] = -1;
+    }
+  }
+  free(order);
+  return 0;
+}
+
+
+static int nlist_fill_tile(double *pos, double *wpos, double rcut,
+                           cell_type *unitcell, long *clusters,
+                           long *topo, long *topo_start, long ci, long cj,
+                           long *t, neigh_tile_type *tile) {
+  // Fills in a tile for the pair of clusters ci and cj, where cluster cj is
+  // shifted by the cell vectors t. Only pairs closer than rcut are included.
+  // Returns the number of included pairs.
+  long a, b, nbond;
+  long r[3];
+  int i, j, k, bit, npair, nvec, self;
+  double shift[3], delta0[3], delta[3], frac;
+
+  nvec = (*unitcell).nvec;
+  self = (ci == cj) && (t[0] == 0) && (t[1] == 0) && (t[2] == 0);
+  shift[0] = 0.0;
+  shift[1] = 0.0;
+  shift[2] = 0.0;
+  cell_add_vec(shift, unitcell, t);
+  (*tile).ci = ci;
+  (*tile).cj = cj;
+  (*tile).s0 = t[0];
+  (*tile).s1 = t[1];
+  (*tile).s2 = t[2];
+  (*tile).mask = 0;
+  (*tile).central = 0;
+  npair = 0;
+  for (i=0; i<NLIST_CLUSTER_SIZE; i++) {
+    a = clusters[NLIST_CLUSTER_SIZE*ci+i];
+    for (j=0; j<NLIST_CLUSTER_SIZE; j++) {
+      bit = NLIST_CLUSTER_SIZE*i+j;
+      (*tile).nbond[bit] = 0;
+      b = clusters[NLIST_CLUSTER_SIZE*cj+j];
+      if ((a < 0) || (b < 0)) continue;
+      // Within a single cluster in the central image, each pair is only
+      // included once.
+      if (self && (j >= i)) continue;
+      delta[0] = wpos[3*b  ] + shift[0] - wpos[3*a  ];
+      delta[1] = wpos[3*b+1] + shift[1] - wpos[3*a+1];
+      delta[2] = wpos[3*b+2] + shift[2] - wpos[3*a+2];
+      if (delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2] >= rcut*rcut) continue;
+      // The pair is in the central image when the relative vector is the
+      // minimum image from the atom with the highest index to the other, as
+      // in nlist_scan_atom.
+      nbond = 0;
+      if (a != b) {
+        if (b < a) {
+          delta0[0] = pos[3*b  ] - pos[3*a  ];
+          delta0[1] = pos[3*b+1] - pos[3*a+1];
+          delta0[2] = pos[3*b+2] - pos[3*a+2];
+          cell_mic(delta0, unitcell);
+        } else {
+          delta0[0] = pos[3*a  ] - pos[3*b  ];
+          delta0[1] = pos[3*a+1] - pos[3*b+1];
+          delta0[2] = pos[3*a+2] - pos[3*b+2];
+          cell_mic(delta0, unitcell);
+          delta0[0] = -delta0[0];
+          delta0[1] = -delta0[1];
+          delta0[2] = -delta0[2];
+        }
+        for (k=0; k<nvec; k++) {
+          frac = (*unitcell).gvecs[3*k  ]*(delta[0] - delta0[0]) +
+                 (*unitcell).gvecs[3*k+1]*(delta[1] - delta0[1]) +
+                 (*unitcell).gvecs[3*k+2]*(delta[2] - delta0[2]);
+          r[k] = floor(frac + 0.5);
+          if (r[k] != 0) break;
+        }
+        if (k == nvec) {
+          if (topo != NULL) {
+            if (a > b) {
+              nbond = nlist_topology_lookup(topo, topo_start, a, b);
+            } else {
+              nbond = nlist_topology_lookup(topo, topo_start, b, a);
+            }
+            if (nbond < 0) continue;
+          }
+          (*tile).central |= 1 << bit;
+        }
+      }
+      (*tile).nbond[bit] = nbond;
+      (*tile).mask |= 1 << bit;
+      npair++;
+    }
+  }
+  return npair;
+}
+
+
+static long nlist_scan_cluster(double *pos, double *wpos, double rcut,
+                               cell_type *unitcell, nlist_bins_type *bins,
+                               double *cpos, double *crad, long *clusters,
+                               long *topo, long *topo_start, long ci,
+                               neigh_tile_type **block, long *block_size) {
+  // Collects all tiles whose first cluster is ci, in the same way as
+  // nlist_scan_atom, using the bins of the cluster centers. Each pair of
+  // clusters is only included once, i.e. when ci > cj or, for ci == cj, when
+  // the shift is zero or in the half set of images. Returns the number of
+  // tiles, or -1 when memory allocation failed.
+  long cj, i, k, ibin, ntile;
+  long u[3], o[3], n[3], t[3], wi[3], wj[3];
+  int nvec;
+  double rcut_scan;
+  double shift[3], delta[3];
+  neigh_tile_type *new_block;
+
+  nvec = (*unitcell).nvec;
+  rcut_scan = rcut*(1.0 + 1e-8);
+  // The bins contain the cluster centers wrapped into the central cell.
+  for (k=0; k<3; k++) {
+    delta[k] = (*bins).wpos[3*ci+k] - cpos[3*ci+k];
+  }
+  for (k=0; k<3; k++) {
+    wi[k] = 0;
+    if (k < nvec) {
+      wi[k] = floor((*unitcell).gvecs[3*k]*delta[0] + (*unitcell).gvecs[3*k+1]*delta[1] + (*unitcell).gvecs[3*k+2]*delta[2] + 0.5);
+    }
+  }
+  ntile = 0;
+  for (o[2]=-(*bins).nstencil[2]; o[2]<=(*bins).nstencil[2]; o[2]++) {
+    for (o[1]=-(*bins).nstencil[1]; o[1]<=(*bins).nstencil[1]; o[1]++) {
+      for (o[0]=-(*bins).nstencil[0]; o[0]<=(*bins).nstencil[0]; o[0]++) {
+        // Locate the neighboring bin and the periodic image it belongs to.
+        for (k=0; k<3; k++) {
+          u[k] = (*bins).atom_bin[3*ci+k] + o[k];
+          n[k] = 0;
+          if (k < nvec) {
+            n[k] = floor((double)u[k]/(*bins).nbin[k]);
+            u[k] -= n[k]*(*bins).nbin[k];
+          } else if ((u[k] < 0) || (u[k] >= (*bins).nbin[k])) {
+            break;
+          }
+        }
+        if (k < 3) continue;
+        shift[0] = 0.0;
+        shift[1] = 0.0;
+        shift[2] = 0.0;
+        cell_add_vec(shift, unitcell, n);
+        ibin = u[0] + (*bins).nbin[0]*(u[1] + (*bins).nbin[1]*u[2]);
+        for (i=(*bins).bin_start[ibin]; i<(*bins).bin_start[ibin+1]; i++) {
+          cj = (*bins).bin_atoms[i];
+          if (cj > ci) continue;
+          delta[0] = (*bins).wpos[3*cj  ] + shift[0] - (*bins).wpos[3*ci  ];
+          delta[1] = (*bins).wpos[3*cj+1] + shift[1] - (*bins).wpos[3*ci+1];
+          delta[2] = (*bins).wpos[3*cj+2] + shift[2] - (*bins).wpos[3*ci+2];
+          if (sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]) >= rcut_scan + crad[ci] + crad[cj]) continue;
+          // The shift between the clusters, without the wrapping of the
+          // cluster centers in the bins.
+          for (k=0; k<3; k++) {
+            delta[k] = (*bins).wpos[3*cj+k] - cpos[3*cj+k];
+          }
+          for (k=0; k<3; k++) {
+            t[k] = 0;
+            if (k < nvec) {
+              wj[k] = floor((*unitcell).gvecs[3*k]*delta[0] + (*unitcell).gvecs[3*k+1]*delta[1] + (*unitcell).gvecs[3*k+2]*delta[2] + 0.5);
+              t[k] = n[k] + wj[k] - wi[k];
+            }
+          }
+          if ((cj == ci) && !(((t[0] == 0) && (t[1] == 0) && (t[2] == 0)) || nlist_in_half(t, nvec))) continue;
+          if (ntile >= *block_size) {
+            new_block = realloc(*block, 2*(*block_size)*sizeof(neigh_tile_type));
+            if (new_block == NULL) return -1;
+            *block = new_block;
+            *block_size *= 2;
+          }
+          if (nlist_fill_tile(pos, wpos, rcut, unitcell, clusters, topo, topo_start, ci, cj, t, (*block) + ntile) > 0) {
+            ntile++;
+          }
+        }
+      }
+    }
+  }
+  return ntile;
+}
+
+
+long nlist_build_tiles_low(double *pos, double rcut, cell_type *unitcell,
+                           long natom, long *topo, long ntopo,
+                           long *clusters, long *wrap,
+                           nlist_blocks_type *blocks) {
+  // Builds a neighbor list in the tiled format. The clusters array receives
+  // the atom indexes of each cluster (NLIST_CLUSTER_SIZE per cluster, padded
+  // with -1) and the wrap array the cell vectors that were added to each atom
+  // to wrap it into the central cell (three per atom). The tiles are
+  // collected in blocks as in nlist_build_binned_low. The topology table has
+  // the same meaning as in nlist_build_binned_low.
+  //
+  // Returns the total number of tiles or -1 when memory allocation failed.
+  long a, c, i, k, iblock, nblock, ncluster, ntile, total, block_size, scratch_size;
+  int nthread;
+  double rcmax, d;
+  double *wpos, *cpos, *crad;
+  neigh_tile_type *scratch;
+  char *rows, *new_rows;
+  long *topo_start;
+  nlist_bins_type bins;
+
+  ncluster = (natom + NLIST_CLUSTER_SIZE - 1)/NLIST_CLUSTER_SIZE;
+  topo_start = NULL;
+  if (topo != NULL) {
+    topo_start = nlist_topology_start(topo, ntopo, natom);
+    if (topo_start == NULL) return -1;
+  }
+  wpos = malloc(3*natom*sizeof(double));
+  cpos = calloc(3*ncluster, sizeof(double));
+  crad = calloc(ncluster, sizeof(double));
+  if ((wpos == NULL) || (cpos == NULL) || (crad == NULL) ||
+      (nlist_clusters_init(pos, unitcell, natom, clusters, wrap, wpos) != 0)) {
+    free(wpos);
+    free(cpos);
+    free(crad);
+    free(topo_start);
+    return -1;
+  }
+  // The center and the radius of each cluster.
+  rcmax = 0.0;
+  for (c=0; c<ncluster; c++) {
+    for (i=0; i<NLIST_CLUSTER_SIZE; i++) {
+      a = clusters[NLIST_CLUSTER_SIZE*c+i];
+      if (a < 0) break;
+      for (k=0; k<3; k++) cpos[3*c+k] += wpos[3*a+k];
+    }
+    for (k=0; k<3; k++) cpos[3*c+k] /= i;
+    for (i=0; i<NLIST_CLUSTER_SIZE; i++) {
+      a = clusters[NLIST_CLUSTER_SIZE*c+i];
+      if (a < 0) break;
+      d = sqrt((wpos[3*a  ] - cpos[3*c  ])*(wpos[3*a  ] - cpos[3*c  ]) +
+               (wpos[3*a+1] - cpos[3*c+1])*(wpos[3*a+1] - cpos[3*c+1]) +
+               (wpos[3*a+2] - cpos[3*c+2])*(wpos[3*a+2] - cpos[3*c+2]));
+      if (d > crad[c]) crad[c] = d;
+    }
+    if (crad[c] > rcmax) rcmax = crad[c];
+  }
+  if (nlist_bins_init(&bins, cpos, rcut + 2*rcmax, unitcell, ncluster) != 0) {
+    free(wpos);
+    free(cpos);
+    free(crad);
+    free(topo_start);
+    return -1;
+  }
+#ifdef _OPENMP
+  nthread = omp_get_max_threads();
+#else
+  nthread = 1;
+#endif
+  nblock = 8*nthread;
+  if (nblock > ncluster) nblock = ncluster;
+  if (nblock < 1) nblock = 1;
+  (*blocks).nblock = nblock;
+  (*blocks).row_size = sizeof(neigh_tile_type);
+  (*blocks).nrow = calloc(nblock, sizeof(long));
+  (*blocks).rows = calloc(nblock, sizeof(char*));
+  if (((*blocks).nrow == NULL) || ((*blocks).rows == NULL)) {
+    nlist_bins_free(&bins);
+    free(wpos);
+    free(cpos);
+    free(crad);
+    free(topo_start);
+    return -1;
+  }
+
+  #pragma omp parallel private(c, iblock, ntile, block_size, scratch, scratch_size, rows, new_rows)
+  {
+    scratch_size = 64;
+    scratch = malloc(scratch_size*sizeof(neigh_tile_type));
+    #pragma omp for schedule(dynamic, 1)
+    for (iblock=0; iblock<nblock; iblock++) {
+      if (scratch == NULL) {
+        (*blocks).nrow[iblock] = -1;
+        continue;
+      }
+      block_size = 0;
+      rows = NULL;
+      for (c=(ncluster*iblock)/nblock; c<(ncluster*(iblock+1))/nblock; c++) {
+        ntile = nlist_scan_cluster(pos, wpos, rcut, unitcell, &bins, cpos, crad, clusters, topo, topo_start, c, &scratch, &scratch_size);
+        if (ntile < 0) {
+          (*blocks).nrow[iblock] = -1;
+          break;
+        }
+        if ((*blocks).nrow[iblock] + ntile > block_size) {
+          block_size = 2*block_size + ntile;
+          new_rows = realloc(rows, block_size*sizeof(neigh_tile_type));
+          if (new_rows == NULL) {
+            (*blocks).nrow[iblock] = -1;
+            break;
+          }
+          rows = new_rows;
+        }
+        memcpy(rows + (*blocks).nrow[iblock]*sizeof(neigh_tile_type), scratch, ntile*sizeof(neigh_tile_type));
+        (*blocks).nrow[iblock] += ntile;
+      }
+      (*blocks).rows[iblock] = rows;
+    }
+    free(scratch);
+  }
+  nlist_bins_free(&bins);
+  free(wpos);
+  free(cpos);
+  free(crad);
+  free(topo_start);
+
+  total = 0;
+  for (iblock=0; iblock<nblock; iblock++) {
+    if ((*blocks).nrow[iblock] < 0) return -1;
+    total += (*blocks).nrow[iblock];
+  }
+  return total;
+}
+
+
+int nlist_partition_low(void *neighs, long nneigh, int compact, double *pos,
+                        cell_type *unitcell, double *shells, long nshell,
+                        long *ends) {
+  // Reorders the rows into distance shells: rows with a distance below
+  // shells[0] come first, followed by the rows below shells[1], etc. The
+  // shells must be sorted in increasing order. Rows beyond the last shell are
+  // put in the last shell. The partitioning is stable, such that the rows in
+  // the central image remain sorted within each shell. On return, ends[i] is
+  // the number of rows in shells 0 to i. Returns -1 when memory allocation
+  // failed.
+  long i, ishell, row_size;
+  long shift[3];
+  double d, delta[3];
+  long *offsets;
+  int *shell;
+  char *tmp;
+  neigh_row_type *full;
+  neigh_compact_row_type *comp;
+
+  if (compact) {
+    row_size = sizeof(neigh_compact_row_type);
+  } else {
+    row_size = sizeof(neigh_row_type);
+  }
+  full = (neigh_row_type*)neighs;
+  comp = (neigh_compact_row_type*)neighs;
+  shell = malloc((nneigh+1)*sizeof(int));
+  offsets = calloc(nshell, sizeof(long));
+  tmp = malloc((nneigh+1)*row_size);
+  if ((shell == NULL) || (offsets == NULL) || (tmp == NULL)) {
+    free(shell);
+    free(offsets);
+    free(tmp);
+    return -1;
+  }
+
+  // Assign a shell to each row and count the rows in each shell.
+  for (ishell=0; ishell<nshell; ishell++) ends[ishell] = 0;
+  for (i=0; i<nneigh; i++) {
+    if (compact) {
+      delta[0] = pos[3*comp[i].b  ] - pos[3*comp[i].a  ];
+      delta[1] = pos[3*comp[i].b+1] - pos[3*comp[i].a+1];
+      delta[2] = pos[3*comp[i].b+2] - pos[3*comp[i].a+2];
+      shift[0] = comp[i].s0;
+      shift[1] = comp[i].s1;
+      shift[2] = comp[i].s2;
+      cell_add_vec(delta, unitcell, shift);
+      d = sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]);
+    } else {
+      d = full[i].d;
+    }
+    ishell = 0;
+    while ((ishell < nshell-1) && (d >= shells[ishell])) ishell++;
+    shell[i] = ishell;
+    ends[ishell]++;
+  }
+
+  // Convert the counts into offsets and cumulative counts.
+  for (ishell=1; ishell<nshell; ishell++) {
+    offsets[ishell] = ends[ishell-1];
+    ends[ishell] += ends[ishell-1];
+  }
+
+  // Stable scatter into the temporary array and copy back.
+  for (i=0; i<nneigh; i++) {
+    memcpy(tmp + offsets[shell[i]]*row_size, (char*)neighs + i*row_size, row_size);
+    offsets[shell[i]]++;
+  }
+  memcpy(neighs, tmp, nneigh*row_size);
+
+  free(shell);
+  free(offsets);
+  free(tmp);
+  return 0;
+}
@@ -31,16 +31,84 @@ typedef struct {
     long a, b;
     double d;
     double dx, dy, dz;
-    long r0, r1, r2;
+    int r0, r1, r2;
+    signed char nbond;
 } neigh_row_type;
 
-int nlist_build_low(double *pos, double rcut, long *rmax, cell_type *unitcell,
-                    long *nlist_status, neigh_row_type *neighs, long pos_size,
+// The nbond field is only set when a topology table is passed to the binned
+// build. It is the number of bonds (1 to 4) between the atoms of pairs in the
+// central image, or zero otherwise, and selects the scaling of the pair. The
+// image shifts and nbond share the last eight bytes of the 64-byte row.
+
+// Compact rows only store the atom indexes and the image shifts relative to
+// the raw atomic positions. The relative vectors and distances are computed
+// on the fly by the pair potentials. The central flag is set for pairs in the
+// central (minimum image) cell, which are subject to scalings.
+typedef struct {
+  int a, b;
+  short s0, s1, s2;
+  signed char central;
+  signed char nbond;
+} neigh_compact_row_type;
+
+// In the tiled format, the atoms are grouped into clusters of
+// NLIST_CLUSTER_SIZE spatially close atoms and each row (tile) contains a
+// pair of clusters. Bit NLIST_CLUSTER_SIZE*i+j of mask is set when the pair
+// of the i-th atom of cluster ci and the j-th atom of cluster cj must be
+// computed. The relative vector of such a pair is wpos[b] - wpos[a] + s.R,
+// where wpos are the positions wrapped into the central cell at the time of
+// the build. The central and nbond fields have the same meaning as in the
+// other formats, for each pair in the tile.
+#define NLIST_CLUSTER_SIZE 4
+#define NLIST_TILE_SIZE (NLIST_CLUSTER_SIZE*NLIST_CLUSTER_SIZE)
+#if NLIST_TILE_SIZE > 16
+#error "The mask and central fields of neigh_tile_type hold at most 16 bits."
+#endif
+
+typedef struct {
+  int ci, cj;
+  short s0, s1, s2;
+  unsigned short mask;
+  unsigned short central;
+  signed char nbond[NLIST_TILE_SIZE];
+} neigh_tile_type;
+
+int nlist_build_low(double *pos, double rcut, long *images, long nimage,
+                    cell_type *unitcell, long *nlist_status, neigh_row_type *neighs, long pos_size,
                     long nneigh);
 
+typedef struct {
+  long nblock;
+  long row_size;
+  long *nrow;
+  char **rows;
+} nlist_blocks_type;
+
+nlist_blocks_type* nlist_blocks_new(void);
+void nlist_blocks_free(nlist_blocks_type *blocks);
+long nlist_build_binned_low(double *pos, double rcut, long *rmax,
+                            cell_type *unitcell, long natom, int compact,
+                            long *topo, long ntopo,
+                            nlist_blocks_type *blocks);
+void nlist_blocks_merge(nlist_blocks_type *blocks, void *neighs);
+
+long nlist_build_tiles_low(double *pos, double rcut, cell_type *unitcell,
+                           long natom, long *topo, long ntopo,
+                           long *clusters, long *wrap,
+                           nlist_blocks_type *blocks);
+
 void nlist_recompute_low(double *pos, double *pos_old, cell_type* unitcell,
                          neigh_row_type *neighs, long nneigh);
 
+int nlist_partition_low(void *neighs, long nneigh, int compact, double *pos,
+                        cell_type *unitcell, double *shells, long nshell,
+                        long *ends);
+
+double nlist_displacement_low(double *pos, double *pos_old, long natom);
+
+long nlist_images_low(cell_type *unitcell, double rcut, long *rmax,
+                      long *images);
+
 int nlist_inc_r(cell_type *unitcell, long *r, long *rmax);
 
 #endif
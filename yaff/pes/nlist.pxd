@@ -26,17 +26,59 @@
 cimport cell
 
 cdef extern from "nlist.h":
+    enum: NLIST_CLUSTER_SIZE
+    enum: NLIST_TILE_SIZE
+
     ctypedef struct neigh_row_type:
         long a, b
         double d
         double dx, dy, dz
-        long r0, r1, r2
+        int r0, r1, r2
+        signed char nbond
+
+    ctypedef struct neigh_compact_row_type:
+        int a, b
+        short s0, s1, s2
+        signed char central
+        signed char nbond
 
-    bint nlist_build_low(double *pos, double rcut, long *rmax,
+    ctypedef struct neigh_tile_type:
+        int ci, cj
+        short s0, s1, s2
+        unsigned short mask
+        unsigned short central
+        signed char nbond[NLIST_TILE_SIZE]
+
+    bint nlist_build_low(double *pos, double rcut, long *images, long nimage,
                          cell.cell_type* cell, long *nlist_status,
                          neigh_row_type *neighs, long pos_size, long nneigh)
 
+    ctypedef struct nlist_blocks_type:
+        pass
+
+    nlist_blocks_type* nlist_blocks_new()
+    void nlist_blocks_free(nlist_blocks_type *blocks)
+    long nlist_build_binned_low(double *pos, double rcut, long *rmax,
+                                cell.cell_type* cell, long natom, bint compact,
+                                long *topo, long ntopo,
+                                nlist_blocks_type *blocks) nogil
+    void nlist_blocks_merge(nlist_blocks_type *blocks, void *neighs) nogil
+    long nlist_build_tiles_low(double *pos, double rcut,
+                               cell.cell_type* cell, long natom,
+                               long *topo, long ntopo,
+                               long *clusters, long *wrap,
+                               nlist_blocks_type *blocks) nogil
+
     void nlist_recompute_low(double *pos, double *pos_old, cell.cell_type*
                              unitcell, neigh_row_type *neighs, long nneigh)
 
+    int nlist_partition_low(void *neighs, long nneigh, bint compact,
+                            double *pos, cell.cell_type* unitcell,
+                            double *shells, long nshell, long *ends)
+
+    double nlist_displacement_low(double *pos, double *pos_old, long natom)
+
+    long nlist_images_low(cell.cell_type *unitcell, double rcut, long *rmax,
+                          long *images)
+
     bint nlist_inc_r(cell.cell_type *unitcell, long *r, long *rmax)
@@ -35,17 +35,50 @@
 
    The ``NeighborList`` object contains algorithms to detect whether a full rebuild
    of the neighbor list is required, or whether a recomputation of the distances
-   and relative vectors is sufficient.
+   and relative vectors is sufficient. A rebuild is needed as soon as the sum of
+   the two largest atomic displacements, since the last rebuild, exceeds the
+   skin. Optionally, the skin is tuned automatically to minimize the time spent
+   on neighbor list updates.
+
+   When the ``ForcePartPair`` objects use different cutoffs, the rows are
+   partitioned into distance shells after every rebuild, such that each pair
+   potential only visits the leading part of the neighbor list that contains
+   all pairs within its own cutoff. (See ``NeighborList.get_nneigh``.)
+
+   The ``ForcePartPair`` objects also register their ``Scalings`` with the
+   neighbor list. Pairs that are excluded by all of them (scale 0.0) are left
+   out. For the other pairs in the central image, the number of bonds between
+   both atoms is stored in the neighbor list, such that each pair potential can
+   look up its scaling factor directly, without searching the scaling table.
+
+   A full rebuild uses a cell list (binning of the atoms in fractional
+   coordinates) by default, such that its cost scales linearly with the number
+   of atoms. The original algorithm, which loops over all pairs of atoms and all
+   relevant periodic images, is still available for testing purposes.
+
+   Optionally, the neighbor list can be stored in a compact format, which only
+   contains atom indexes and image shifts. The relative vectors and distances
+   are then computed on the fly in the pair potentials. This saves memory
+   bandwidth and makes the recomputation of the neighbor list redundant.
+
+   Finally, the neighbor list can be stored in a tiled format. The atoms are
+   then grouped into clusters of four nearby atoms and each row contains a
+   pair of clusters with a mask of the atom pairs to be computed. The pair
+   potentials evaluate such a tile as a dense 4x4 block.
 '''
 
 
 from __future__ import division
 
+import time
+
 import numpy as np
 
 from yaff.log import log, timer
-from yaff.pes.ext import neigh_dtype, nlist_status_init, nlist_status_finish, \
-    nlist_build, nlist_recompute
+from yaff.pes.ext import neigh_dtype, neigh_compact_dtype, neigh_tile_dtype, \
+    nlist_status_init, nlist_status_finish, nlist_build, nlist_build_binned, \
+    nlist_build_tiles, nlist_recompute, nlist_images, nlist_cluster_size, \
+    nlist_partition, nlist_displacement
 
 
 __all__ = ['NeighborList']
@@ -54,7 +87,8 @@ __all__ = ['NeighborList']
 class NeighborList(object):
     '''Algorithms to keep track of all pair distances below a given rcut
     '''
-    def __init__(self, system, skin=0):
+    def __init__(self, system, skin=0, binning=True, compact=False, auto_skin=False,
+                 tiled=False):
         """
            **Arguments:**
 
@@ -64,11 +98,11 @@ class NeighborList(object):
            **Optional arguments:**
 
            skin
-                A margin added to the rcut parameter. Only when atoms are
-                displaced by half this distance, the neighbor list is rebuilt
-                from scratch. In the other case, the distances of the known
-                pairs are just recomputed. If set to zero, the default, the
-                neighbor list is rebuilt at each update.
+                A margin added to the rcut parameter. Only when the sum of the
+                two largest atomic displacements exceeds this distance, the
+                neighbor list is rebuilt from scratch. In the other case, the
+                distances of the known pairs are just recomputed. If set to
+                zero, the default, the neighbor list is rebuilt at each update.
 
                 A reasonable skin setting can drastically improve the
                 performance of the neighbor list updates. For example, when
@@ -76,25 +110,151 @@ class NeighborList(object):
                 reasonable. If the skin is set too large, the updates will
                 become very inefficient. Some tuning of ``rcut`` and ``skin``
                 may be beneficial.
+
+           binning
+                When True, the default, a rebuild of the neighbor list is
+                carried out with a cell list, whose cost scales linearly with
+                the number of atoms. When False, all pairs of atoms are
+                considered, which scales quadratically. Both algorithms
+                produce the same pairs.
+
+           compact
+                When True, the neighbor list only stores the atom indexes and
+                the image shifts of each pair (datatype
+                ``neigh_compact_dtype``). The relative vectors and distances
+                are computed by the pair potentials. This requires
+                ``binning=True``.
+
+           auto_skin
+                When True, the skin is adjusted at every rebuild, based on the
+                measured cost of rebuilds and recomputations and on the rate
+                at which the atoms move. The skin argument is then only used
+                as initial value. When it is zero, ``0.1*rcut`` is used as
+                initial value.
+
+           tiled
+                When True, the neighbor list is stored as a list of tiles
+                (datatype ``neigh_tile_dtype``), i.e. pairs of clusters of
+                four atoms. The clusters and the wrapping of the atoms into
+                the cell are stored in the ``clusters`` and ``wrap``
+                attributes. The ``nneigh`` attribute is then the number of
+                tiles. This requires ``binning=True`` and ``compact=False``.
         """
         if skin < 0:
             raise ValueError('The skin parameter must be positive.')
+        if compact and not binning:
+            raise ValueError('A compact neighbor list can only be built with binning.')
+        if tiled and (compact or not binning):
+            raise ValueError('A tiled neighbor list can only be built with binning and without the compact format.')
         self.system = system
         self.skin = skin
+        self.binning = binning
+        self.compact = compact
+        self.tiled = tiled
+        self.auto_skin = auto_skin
         self.rcut = 0.0
+        self.rcuts = []
+        self.scalings = []
+        self.topology = None
         # the neighborlist:
-        self.neighs = np.empty(10, dtype=neigh_dtype)
+        if compact:
+            self.neighs = np.empty(10, dtype=neigh_compact_dtype)
+        elif tiled:
+            self.neighs = np.empty(10, dtype=neigh_tile_dtype)
+        else:
+            self.neighs = np.empty(10, dtype=neigh_dtype)
         self.nneigh = 0
+        self.clusters = None
+        self.wrap = None
+        self._topo = None
+        self.shell_rcuts = np.zeros(0, float)
+        self.shell_ends = np.zeros(0, int)
         self.rmax = None
+        self.images = None
+        self.nimage_pruned = 0
         # for skin algorithm:
         self._pos_old = None
         self.rebuild_next = False
+        # statistics, also used to tune the skin:
+        self.nrebuild = 0
+        self.nrecompute = 0
+        self._displacement = 0.0
+        self._cycle_nrecompute = 0
+        self._cycle_time_rebuild = 0.0
+        self._cycle_time_recompute = 0.0
 
     def request_rcut(self, rcut):
-        """Make sure the internal rcut parameter is at least is high as rcut."""
+        """Make sure the internal rcut parameter is at least is high as rcut.
+
+           All requested cutoffs are kept. After each rebuild, the neighbor
+           list is partitioned into shells according to these cutoffs.
+        """
         self.rcut = max(self.rcut, rcut)
+        if rcut not in self.rcuts:
+            self.rcuts.append(rcut)
+            self.rcuts.sort()
         self.update_rmax()
 
+    def request_scalings(self, scalings):
+        """Register the scalings of a pair potential that uses this neighbor list
+
+           **Arguments:**
+
+           scalings
+                A Scalings instance.
+
+           Pairs that have a zero scaling in all registered Scalings objects
+           are left out of the neighbor list. For the remaining pairs in the
+           central image, the number of bonds is stored in the ``nbond`` field.
+           This is only done when the neighbor list is built with binning.
+        """
+        if not any(scalings is other for other in self.scalings):
+            self.scalings.append(scalings)
+            self._topo = None
+            self.rebuild_next = True
+
+    def _get_topo(self):
+        '''Internal method that returns the topology table for the binned build.
+
+           Each row contains the atom indexes of a pair in one of the scaling
+           tables and the number of bonds, or -1 for pairs that are excluded
+           by all scaling tables.
+        '''
+        if len(self.scalings) == 0:
+            return None
+        if self._topo is None:
+            stab = np.concatenate([scalings.stab for scalings in self.scalings])
+            keys, indexes = np.unique(stab['a']*self.system.natom + stab['b'], return_index=True)
+            topo = np.zeros((len(keys), 3), int)
+            topo[:,0] = stab['a'][indexes]
+            topo[:,1] = stab['b'][indexes]
+            topo[:,2] = stab['nbond'][indexes]
+            all_scales = np.array([
+                [1.0, scalings.scale1, scalings.scale2, scalings.scale3, scalings.scale4]
+                for scalings in self.scalings
+            ])
+            excluded = (all_scales == 0.0).all(axis=0)
+            topo[excluded[topo[:,2]],2] = -1
+            self._topo = topo
+        return self._topo
+
+    def get_nneigh(self, rcut):
+        '''Return the number of leading rows that contain all pairs within rcut
+
+           **Arguments:**
+
+           rcut
+                A cutoff that is not larger than the internal rcut parameter.
+
+           Pair potentials with a cutoff rcut only need to visit these rows,
+           which may be much fewer than ``nneigh`` when a few pair potentials
+           use a large cutoff.
+        '''
+        for shell_rcut, shell_end in zip(self.shell_rcuts, self.shell_ends):
+            if rcut <= shell_rcut:
+                return shell_end
+        return self.nneigh
+
     def update_rmax(self):
         """Recompute the ``rmax`` attribute.
 
@@ -106,9 +266,18 @@ class NeighborList(object):
 
            Updating ``rmax`` may be necessary for two reasons: (i) the cutoff
            has changed, and (ii) the cell vectors have changed.
+
+           The periodic images within this range that cannot contain any pair
+           closer than ``rcut+skin`` are pruned. The remaining images are
+           stored in the ``images`` attribute and the number of pruned images
+           in ``nimage_pruned``. (This is most effective for skewed cells.)
         """
+        if self.auto_skin and self.skin == 0:
+            self.skin = 0.1*self.rcut
         # determine the number of periodic images
         self.rmax = np.ceil((self.rcut+self.skin)/self.system.cell.rspacings-0.5).astype(int)
+        self.images = nlist_images(self.system.cell, self.rcut+self.skin, self.rmax)
+        self.nimage_pruned = (np.prod(2*self.rmax+1) + 1)//2 - len(self.images)
         if log.do_high:
             if len(self.rmax) == 1:
                 log('rmax a       = %i' % tuple(self.rmax))
@@ -116,6 +285,8 @@ class NeighborList(object):
                 log('rmax a,b     = %i,%i' % tuple(self.rmax))
             elif len(self.rmax) == 3:
                 log('rmax a,b,c   = %i,%i,%i' % tuple(self.rmax))
+            if len(self.rmax) > 0:
+                log('images       = %i (%i pruned)' % (len(self.images), self.nimage_pruned))
         # Request a rebuild of the neighborlist because there is no simple way
         # to figure out whether an update is sufficient.
         self.rebuild_next = True
@@ -133,42 +304,106 @@ class NeighborList(object):
         '''
         with log.section('NLIST'), timer.section('Nlists'):
             assert self.rcut > 0
+            time0 = time.time()
 
             if self._need_rebuild():
+                if self.nrebuild > 0 and log.do_high:
+                    log('Rebuild %i after %i recomputes, displacement %s, skin %s' % (
+                        self.nrebuild, self._cycle_nrecompute,
+                        log.length(self._displacement), log.length(self.skin)
+                    ))
+                if self.auto_skin and not self.rebuild_next:
+                    self._tune_skin()
                 # *rebuild* the entire neighborlist
                 if self.system.cell.volume != 0:
                     if self.system.natom/self.system.cell.volume > 10:
                         raise ValueError('Atom density too high')
-                # 1) make an initial status object for the neighbor list algorithm
-                status = nlist_status_init(self.rmax)
-                # 2) a loop of consecutive update/allocate calls
-                last_start = 0
-                while True:
-                    done = nlist_build(
-                        self.system.pos, self.rcut + self.skin, self.rmax,
-                        self.system.cell, status, self.neighs[last_start:]
-                    )
-                    if done:
-                        break
-                    last_start = len(self.neighs)
-                    new_neighs = np.empty((len(self.neighs)*3)//2, dtype=neigh_dtype)
-                    new_neighs[:last_start] = self.neighs
-                    self.neighs = new_neighs
-                    del new_neighs
-                # 3) get the number of neighbors in the list.
-                self.nneigh = nlist_status_finish(status)
+                if self.binning:
+                    self._build_binned()
+                else:
+                    self._build_sextuple()
+                self._partition()
                 if log.do_debug:
                     log('Rebuilt, size = %i' % self.nneigh)
-                # 4) store the current state to check in future calls if we
-                #    need to do a rebuild or a recompute.
+                # Store the current state to check in future calls if we
+                # need to do a rebuild or a recompute.
                 self._checkpoint()
                 self.rebuild_next = False
+                self.nrebuild += 1
+                self._cycle_nrecompute = 0
+                self._cycle_time_rebuild = time.time() - time0
+                self._cycle_time_recompute = 0.0
             else:
-                # just *recompute* the deltas and the distance in the
-                # neighborlist
-                nlist_recompute(self.system.pos, self._pos_old, self.system.cell, self.neighs[:self.nneigh])
-                if log.do_debug:
-                    log('Recomputed')
+                if self.compact or self.tiled:
+                    # The pair potentials compute the relative vectors and the
+                    # distances on the fly.
+                    if log.do_debug:
+                        log('Nothing to recompute')
+                else:
+                    # just *recompute* the deltas and the distance in the
+                    # neighborlist
+                    nlist_recompute(self.system.pos, self._pos_old, self.system.cell, self.neighs[:self.nneigh])
+                    if log.do_debug:
+                        log('Recomputed')
+                self.nrecompute += 1
+                self._cycle_nrecompute += 1
+                self._cycle_time_recompute += time.time() - time0
+
+    def _build_binned(self):
+        '''Internal method to rebuild the neighbor list with a cell list.'''
+        self.topology = self._get_topo()
+        if self.tiled:
+            natom = self.system.natom
+            if self.wrap is None or len(self.wrap) != natom:
+                ncluster = (natom + nlist_cluster_size - 1)//nlist_cluster_size
+                self.clusters = np.zeros((ncluster, nlist_cluster_size), int)
+                self.wrap = np.zeros((natom, 3), int)
+            self.neighs, self.nneigh = nlist_build_tiles(
+                self.system.pos, self.rcut + self.skin, self.system.cell,
+                self.neighs, self.clusters, self.wrap, self.topology
+            )
+            return
+        self.neighs, self.nneigh = nlist_build_binned(
+            self.system.pos, self.rcut + self.skin, self.rmax,
+            self.system.cell, self.neighs, self.topology
+        )
+
+    def _build_sextuple(self):
+        '''Internal method to rebuild the neighbor list with a loop over all pairs.'''
+        self.topology = None
+        # 1) make an initial status object for the neighbor list algorithm
+        status = nlist_status_init(self.rmax)
+        # 2) a loop of consecutive update/allocate calls
+        last_start = 0
+        while True:
+            done = nlist_build(
+                self.system.pos, self.rcut + self.skin, self.rmax,
+                self.system.cell, status, self.neighs[last_start:],
+                self.images
+            )
+            if done:
+                break
+            last_start = len(self.neighs)
+            new_neighs = np.empty((len(self.neighs)*3)//2, dtype=neigh_dtype)
+            new_neighs[:last_start] = self.neighs
+            self.neighs = new_neighs
+            del new_neighs
+        # 3) get the number of neighbors in the list.
+        self.nneigh = nlist_status_finish(status)
+
+    def _partition(self):
+        '''Internal method to partition the rows after a rebuild.'''
+        if len(self.rcuts) > 1 and not self.tiled:
+            # The skin is added to the shells because the list is only rebuilt
+            # when the displacements exceed the skin.
+            self.shell_rcuts = np.array(self.rcuts)
+            self.shell_ends = nlist_partition(
+                self.neighs[:self.nneigh], self.system.pos, self.system.cell,
+                self.shell_rcuts + self.skin
+            )
+            if log.do_debug:
+                for shell_rcut, shell_end in zip(self.shell_rcuts, self.shell_ends):
+                    log('Rows within %s: %i' % (log.length(shell_rcut), shell_end))
 
     def _checkpoint(self):
         '''Internal method called after a neighborlist rebuild.'''
@@ -184,13 +419,47 @@ class NeighborList(object):
         if self.skin <= 0 or self._pos_old is None or self.rebuild_next:
             return True
         else:
-            # Compute an upper bound for the maximum relative displacement.
-            disp = np.sqrt(((self.system.pos - self._pos_old)**2).sum(axis=1).max())
-            disp *= 2*(self.rmax.max()+1)
+            # Compute an upper bound for the maximum change of a distance.
+            self._displacement = nlist_displacement(self.system.pos, self._pos_old)
             if log.do_debug:
-                log('Maximum relative displacement %s      Skin %s' % (log.length(disp), log.length(self.skin)))
+                log('Maximum relative displacement %s      Skin %s' % (log.length(self._displacement), log.length(self.skin)))
             # Compare with skin parameter
-            return disp >= self.skin
+            return self._displacement >= self.skin
+
+    def _tune_skin(self):
+        '''Internal method that adjusts the skin before a rebuild.
+
+           The cost of rebuilds and recomputations is assumed to be
+           proportional to the number of pairs, i.e. to ``(rcut+skin)**3``.
+           (In the compact and tiled formats, the cost of a step without rebuild does not
+           depend on the skin.) The number of steps between two rebuilds is
+           assumed to be proportional to the skin, using the rate at which the
+           displacements grew during the last cycle. The new skin minimizes
+           the average time per step within a window around the current skin.
+        '''
+        nstep = self._cycle_nrecompute + 1
+        if self._cycle_nrecompute == 0:
+            # Rebuilt at every step. The skin is far too small.
+            new_skin = 2*self.skin
+        else:
+            rate = self._displacement/nstep
+            time_rebuild = self._cycle_time_rebuild
+            time_recompute = self._cycle_time_recompute/self._cycle_nrecompute
+            skins = np.linspace(0.5, 2.0, 61)*self.skin
+            scale = ((self.rcut + skins)/(self.rcut + self.skin))**3
+            nsteps = np.maximum(1.0, skins/max(rate, 1e-10*self.skin))
+            if self.compact or self.tiled:
+                costs = (scale*time_rebuild + (nsteps-1)*time_recompute)/nsteps
+            else:
+                costs = scale*(time_rebuild + (nsteps-1)*time_recompute)/nsteps
+            # Damped update to avoid oscillations due to timing noise.
+            new_skin = np.sqrt(self.skin*skins[costs.argmin()])
+        new_skin = min(max(new_skin, 0.01*self.rcut), 0.5*self.rcut)
+        if new_skin != self.skin:
+            if log.do_high:
+                log('Skin changed from %s to %s' % (log.length(self.skin), log.length(new_skin)))
+            self.skin = new_skin
+            self.update_rmax()
 
 
     def to_dictionary(self):
@@ -198,6 +467,10 @@ class NeighborList(object):
 
            This is slow. Use this method for debugging only!
         """
+        if self.compact:
+            return self._compact_to_dictionary()
+        if self.tiled:
+            return self._tiles_to_dictionary()
         dictionary = {}
         for i in range(self.nneigh):
             key = (
@@ -211,6 +484,83 @@ class NeighborList(object):
             dictionary[key] = value
         return dictionary
 
+    def _compact_to_dictionary(self):
+        '''Internal method to transform a compact neighbor list into a dictionary.
+
+           The keys and values are the same as for the full neighbor list.
+        '''
+        dictionary = {}
+        cell = self.system.cell
+        nvec = cell.nvec
+        for i in range(self.nneigh):
+            a = self.neighs[i]['a']
+            b = self.neighs[i]['b']
+            s = np.array([self.neighs[i]['s0'], self.neighs[i]['s1'], self.neighs[i]['s2']], int)
+            delta = self.system.pos[b] - self.system.pos[a]
+            if nvec > 0:
+                cell.add_vec(delta, s[:nvec])
+            # Derive the image index relative to the minimum image convention.
+            if a >= b:
+                delta0 = self.system.pos[b] - self.system.pos[a]
+                cell.mic(delta0)
+            else:
+                delta0 = self.system.pos[a] - self.system.pos[b]
+                cell.mic(delta0)
+                delta0 *= -1
+            r = np.zeros(3, int)
+            r[:nvec] = np.floor(np.dot(cell.gvecs, delta - delta0) + 0.5)
+            key = (a, b, r[0], r[1], r[2])
+            value = np.array([np.linalg.norm(delta), delta[0], delta[1], delta[2]])
+            dictionary[key] = value
+        return dictionary
+
+    def _tiles_to_dictionary(self):
+        '''Internal method to transform a tiled neighbor list into a dictionary.
+
+           The keys and values are the same as for the full neighbor list. The
+           atoms of each pair are swapped when needed to obtain the same keys.
+        '''
+        dictionary = {}
+        cell = self.system.cell
+        nvec = cell.nvec
+        for i in range(self.nneigh):
+            tile = self.neighs[i]
+            s = np.array([tile['s0'], tile['s1'], tile['s2']], int)
+            for bit in range(nlist_cluster_size**2):
+                if not (tile['mask'] >> bit) & 1:
+                    continue
+                a = self.clusters[tile['ci'], bit//nlist_cluster_size]
+                b = self.clusters[tile['cj'], bit%nlist_cluster_size]
+                delta = self.system.pos[b] - self.system.pos[a]
+                if nvec > 0:
+                    cell.add_vec(delta, (self.wrap[b] - self.wrap[a] + s)[:nvec])
+                for sign in 1, -1:
+                    # Derive the image index relative to the minimum image
+                    # convention, as in _compact_to_dictionary.
+                    if a >= b:
+                        delta0 = self.system.pos[b] - self.system.pos[a]
+                        cell.mic(delta0)
+                    else:
+                        delta0 = self.system.pos[a] - self.system.pos[b]
+                        cell.mic(delta0)
+                        delta0 *= -1
+                    r = np.zeros(3, int)
+                    r[:nvec] = np.floor(np.dot(cell.gvecs, delta - delta0) + 0.5)
+                    central = (r == 0).all()
+                    if (central and a > b) or (not central and self._in_half(r)):
+                        break
+                    a, b, delta = b, a, -delta
+                key = (a, b, r[0], r[1], r[2])
+                value = np.array([np.linalg.norm(delta), delta[0], delta[1], delta[2]])
+                dictionary[key] = value
+        return dictionary
+
+    def _in_half(self, r):
+        '''Internal method, True if r is in the half set of images visited by nlist_inc_r.'''
+        for k in reversed(range(3)):
+            if r[k] != 0:
+                return r[k] > 0
+        return False
 
     def check(self):
         """Perform a slow internal consistency test.
@@ -218,12 +568,23 @@ class NeighborList(object):
            Use this for debugging only. It is assumed that self.rmax is set correctly.
         """
         # 0) Some initial tests
-        assert (
-            (self.neighs['a'][:self.nneigh] > self.neighs['b'][:self.nneigh]) |
-            (self.neighs['r0'][:self.nneigh] != 0) |
-            (self.neighs['r1'][:self.nneigh] != 0) |
-            (self.neighs['r2'][:self.nneigh] != 0)
-        ).all()
+        if self.tiled:
+            # The order of the atoms in a tile is arbitrary. The keys are
+            # normalized by to_dictionary.
+            pass
+        else:
+            if self.compact:
+                central = self.neighs['central'][:self.nneigh] != 0
+            else:
+                central = (
+                    (self.neighs['r0'][:self.nneigh] == 0) &
+                    (self.neighs['r1'][:self.nneigh] == 0) &
+                    (self.neighs['r2'][:self.nneigh] == 0)
+                )
+            assert (
+                (self.neighs['a'][:self.nneigh] > self.neighs['b'][:self.nneigh]) |
+                ~central
+            ).all()
         # A) transform the current nlist into a set
         actual = self.to_dictionary()
         # B) Define loops of cell vectors
@@ -261,13 +622,18 @@ class NeighborList(object):
 
         # C) Compute the nlists the slow way
         validation = {}
+        excluded = set()
+        if self.topology is not None:
+            for a, b, code in self.topology:
+                if code < 0:
+                    excluded.add((a, b))
         nvec = self.system.cell.nvec
         for r0, r1, r2 in rloops():
             for a in range(self.system.natom):
                 for b in range(a+1):
                     if r0!=0 or r1!=0 or r2!=0:
                         signs = [1, -1]
-                    elif a > b:
+                    elif a > b and (a, b) not in excluded:
                         signs = [1]
                     else:
                         continue
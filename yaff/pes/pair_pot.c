@@ -24,17 +24,46 @@
 
 #include <math.h>
 #include <stdlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "constants.h"
 #include "pair_pot.h"
 #include "slater.h"
 
 
+// The batch kernels are compiled for several instruction sets. The best
+// version for the CPU is selected at run time, with a generic fallback.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define PAIR_POT_SIMD __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define PAIR_POT_SIMD
+#endif
+
+// The minimum number of neighbor list records per thread.
+#define PAIR_POT_CHUNK_MIN 1024
+
+typedef struct {
+  long n;
+  long center[PAIR_POT_BATCH_SIZE];
+  long other[PAIR_POT_BATCH_SIZE];
+  double d[PAIR_POT_BATCH_SIZE];
+  double delta[3*PAIR_POT_BATCH_SIZE];
+  double s[PAIR_POT_BATCH_SIZE];
+  double v[PAIR_POT_BATCH_SIZE];
+  double g[PAIR_POT_BATCH_SIZE];
+} pair_batch_type;
+
+
 pair_pot_type* pair_pot_new(void) {
   pair_pot_type* result;
   result = malloc(sizeof(pair_pot_type));
   if (result != NULL) {
     (*result).pair_data = NULL;
     (*result).pair_fn = NULL;
+    (*result).pair_batch_fn = NULL;
+    (*result).pair_batch_fn_mixed = NULL;
+    (*result).mixed = 0;
     (*result).rcut = 0.0;
     (*result).trunc_scheme = NULL;
   }
@@ -49,6 +78,21 @@ int pair_pot_ready(pair_pot_type *pair_pot) {
   return (*pair_pot).pair_data != NULL && (*pair_pot).pair_fn != NULL;
 }
 
+int pair_pot_batched(pair_pot_type *pair_pot) {
+  return (*pair_pot).pair_batch_fn != NULL;
+}
+
+int pair_pot_get_mixed(pair_pot_type *pair_pot) {
+  return (*pair_pot).mixed;
+}
+
+int pair_pot_set_mixed(pair_pot_type *pair_pot, int mixed) {
+  // Only potentials with a mixed precision batch kernel can be switched.
+  // Returns the precision mode in use afterwards.
+  (*pair_pot).mixed = mixed && ((*pair_pot).pair_batch_fn_mixed != NULL);
+  return (*pair_pot).mixed;
+}
+
 double pair_pot_get_rcut(pair_pot_type *pair_pot) {
   return (*pair_pot).rcut;
 }
@@ -62,6 +106,24 @@ void pair_pot_set_trunc_scheme(pair_pot_type *pair_pot, trunc_scheme_type *trunc
 }
 
 double get_scaling(scaling_row_type *stab, long a, long b, long *row, long size) {
+  long lo, hi, mid;
+  // The pairs are normally visited in increasing order of (a, b), such that
+  // the scalings table can be traversed only once. When the neighbor list is
+  // partitioned into distance shells, this order restarts at the beginning of
+  // each shell. In that case, the row is located again with bisection.
+  if ((*row > 0) && ((stab[*row-1].a > a) || ((stab[*row-1].a == a) && (stab[*row-1].b >= b)))) {
+    lo = 0;
+    hi = *row - 1;
+    while (lo < hi) {
+      mid = (lo + hi)/2;
+      if ((stab[mid].a < a) || ((stab[mid].a == a) && (stab[mid].b < b))) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    *row = lo;
+  }
   if (*row >= size) return 1.0;
   while (stab[*row].a < a) {
     (*row)++;
@@ -80,24 +142,324 @@ double get_scaling(scaling_row_type *stab, long a, long b, long *row, long size)
 }
 
 
-double pair_pot_compute(neigh_row_type *neighs,
-                        long nneigh, scaling_row_type *stab,
-                        long nstab, pair_pot_type *pair_pot,
-                        double *gpos, double* vtens) {
+static double pair_pot_compute_row(pair_pot_type *pair_pot, long center_index,
+                                   long other_index, double d, double *delta,
+                                   double s, double *gpos, double* vtens) {
+  // Computes the (scaled) contribution of a single pair to the energy and,
+  // optionally, adds its contribution to gpos and vtens.
+  double v, vg, h, hg;
+  double vg_cart[3];
+  if ((gpos==NULL) && (vtens==NULL)) {
+    // Call the potential function without g argument.
+    v = (*pair_pot).pair_fn((*pair_pot).pair_data, center_index, other_index, d, delta, NULL, NULL);
+    // If a truncation scheme is defined, apply it.
+    if (((*pair_pot).trunc_scheme!=NULL) && (v!=0.0)) {
+      v *= (*(*pair_pot).trunc_scheme).trunc_fn(d, (*pair_pot).rcut, (*(*pair_pot).trunc_scheme).par, NULL);
+    }
+  } else {
+    // Call the potential function with vg argument.
+    // vg_cart contains the (partial) derivatives of the pair potential to
+    // cartesian coordinates. Implicit dependence (through d) of the
+    // pair potential on cartesian coordinates is captured by vg.
+    vg_cart[0] = 0.0; //vg_cart is reset here because not all pair_fn set it.
+    vg_cart[1] = 0.0;
+    vg_cart[2] = 0.0;
+    // vg is the derivative of the pair potential to d divided by the distance.
+    v = (*pair_pot).pair_fn((*pair_pot).pair_data, center_index, other_index, d, delta, &vg, vg_cart);
+    // If a truncation scheme is defined, apply it.
+    // TODO: include vg_cart (not necessary as long as the truncation scheme only depends on distance)
+    if (((*pair_pot).trunc_scheme!=NULL) && ((v!=0.0) || (vg!=0.0))) {
+      // hg is (a pointer to) the derivative of the truncation function.
+      h = (*(*pair_pot).trunc_scheme).trunc_fn(d,    (*pair_pot).rcut, (*(*pair_pot).trunc_scheme).par, &hg);
+      // chain rule:
+      vg = vg*h + v*hg/d;
+      vg_cart[0] = vg_cart[0]*h;
+      vg_cart[1] = vg_cart[1]*h;
+      vg_cart[2] = vg_cart[2]*h;
+      v *= h;
+    }
+    //printf("C %3i %3i %10.7f %3.1f %10.3e\n", center_index, other_index, d, s, s*v);
+    vg *= s;
+    vg_cart[0] *= s;
+    vg_cart[1] *= s;
+    vg_cart[2] *= s;
+    if (gpos!=NULL) {
+      h = delta[0]*vg;
+      gpos[3*other_index  ] += h + vg_cart[0];
+      gpos[3*center_index   ] -= h + vg_cart[0];
+      h = delta[1]*vg;
+      gpos[3*other_index+1] += h + vg_cart[1];
+      gpos[3*center_index +1] -= h + vg_cart[1];
+      h = delta[2]*vg;
+      gpos[3*other_index+2] += h + vg_cart[2];
+      gpos[3*center_index +2] -= h + vg_cart[2];
+    }
+    if (vtens!=NULL) {
+      vtens[0] += delta[0]*(delta[0]*vg+vg_cart[0]);
+      vtens[4] += delta[1]*(delta[1]*vg+vg_cart[1]);
+      vtens[8] += delta[2]*(delta[2]*vg+vg_cart[2]);
+      //h = delta[0]*(delta[1]*vg+vg_cart[1]);
+      vtens[1] += delta[0]*(delta[1]*vg+vg_cart[1]);
+      vtens[3] += delta[1]*(delta[0]*vg+vg_cart[0]);
+      //h = delta[0]*(delta[2]*vg+vg_cart[2]);
+      vtens[2] += delta[0]*(delta[2]*vg+vg_cart[2]);
+      vtens[6] += delta[2]*(delta[0]*vg+vg_cart[0]);
+      //h = delta[1]*(delta[2]*vg+vg_cart[2]);
+      vtens[5] += delta[1]*(delta[2]*vg+vg_cart[2]);
+      vtens[7] += delta[2]*(delta[1]*vg+vg_cart[1]);
+    }
+  }
+  return s*v;
+}
+
+
+static double pair_pot_flush(pair_pot_type *pair_pot, pair_batch_type *batch,
+                             double *gpos, double* vtens) {
+  // Computes all pairs in the batch with the batch kernel and adds their
+  // (scaled) contributions to gpos and vtens. The batch is emptied. Batch
+  // kernels are only used for potentials that only depend on the distance.
+  long i, center_index, other_index;
+  double v, vg, h, hg, energy;
+  double *delta;
+  if ((*batch).n == 0) return 0.0;
+  if ((*pair_pot).mixed) {
+    (*pair_pot).pair_batch_fn_mixed((*pair_pot).pair_data, (*batch).n, (*batch).center, (*batch).other, (*batch).d, (*batch).v, (*batch).g);
+  } else {
+    (*pair_pot).pair_batch_fn((*pair_pot).pair_data, (*batch).n, (*batch).center, (*batch).other, (*batch).d, (*batch).v, (*batch).g);
+  }
+  energy = 0.0;
+  for (i=0; i<(*batch).n; i++) {
+    v = (*batch).v[i];
+    vg = (*batch).g[i];
+    if (((*pair_pot).trunc_scheme!=NULL) && ((v!=0.0) || (vg!=0.0))) {
+      h = (*(*pair_pot).trunc_scheme).trunc_fn((*batch).d[i], (*pair_pot).rcut, (*(*pair_pot).trunc_scheme).par, &hg);
+      vg = vg*h + v*hg/(*batch).d[i];
+      v *= h;
+    }
+    energy += (*batch).s[i]*v;
+    vg *= (*batch).s[i];
+    delta = (*batch).delta + 3*i;
+    center_index = (*batch).center[i];
+    other_index = (*batch).other[i];
+    if (gpos!=NULL) {
+      h = delta[0]*vg;
+      gpos[3*other_index  ] += h;
+      gpos[3*center_index ] -= h;
+      h = delta[1]*vg;
+      gpos[3*other_index+1] += h;
+      gpos[3*center_index+1] -= h;
+      h = delta[2]*vg;
+      gpos[3*other_index+2] += h;
+      gpos[3*center_index+2] -= h;
+    }
+    if (vtens!=NULL) {
+      vtens[0] += delta[0]*delta[0]*vg;
+      vtens[4] += delta[1]*delta[1]*vg;
+      vtens[8] += delta[2]*delta[2]*vg;
+      h = delta[0]*delta[1]*vg;
+      vtens[1] += h;
+      vtens[3] += h;
+      h = delta[0]*delta[2]*vg;
+      vtens[2] += h;
+      vtens[6] += h;
+      h = delta[1]*delta[2]*vg;
+      vtens[5] += h;
+      vtens[7] += h;
+    }
+  }
+  (*batch).n = 0;
+  return energy;
+}
+
+
+static inline int pair_pot_push(pair_batch_type *batch, long center_index,
+                                long other_index, double d, double *delta,
+                                double s) {
+  // Appends a pair to the batch and returns 1 when the batch is full.
+  long n;
+  n = (*batch).n;
+  (*batch).center[n] = center_index;
+  (*batch).other[n] = other_index;
+  (*batch).d[n] = d;
+  (*batch).delta[3*n  ] = delta[0];
+  (*batch).delta[3*n+1] = delta[1];
+  (*batch).delta[3*n+2] = delta[2];
+  (*batch).s[n] = s;
+  (*batch).n = n + 1;
+  return (*batch).n == PAIR_POT_BATCH_SIZE;
+}
+
+
+static double pair_pot_add_pair(pair_pot_type *pair_pot, pair_batch_type *batch,
+                                long center_index, long other_index, double d,
+                                double *delta, double s, double *gpos,
+                                double* vtens) {
+  // Adds a pair to the batch when the pair potential has a batch kernel and
+  // returns the energy of the batch when it is full. Otherwise, the pair is
+  // computed right away, also when batch is NULL. pair_pot_flush must be
+  // called after the last pair.
+  if (((*pair_pot).pair_batch_fn == NULL) || (batch == NULL)) {
+    return pair_pot_compute_row(pair_pot, center_index, other_index, d, delta, s, gpos, vtens);
+  }
+  if (pair_pot_push(batch, center_index, other_index, d, delta, s)) {
+    return pair_pot_flush(pair_pot, batch, gpos, vtens);
+  }
+  return 0.0;
+}
+
+
+static double pair_pot_eval(pair_pot_type *pair_pot, long center_index,
+                            long other_index, double d, double *delta,
+                            double *g) {
+  // Computes the truncated pair potential and, optionally, its derivative
+  // towards d divided by d. Contributions through g_cart are discarded, so
+  // this is only correct for potentials that only depend on the distance.
+  double v, h, hg;
+  double g_cart[3];
+  v = (*pair_pot).pair_fn((*pair_pot).pair_data, center_index, other_index, d, delta, g, g_cart);
+  if ((*pair_pot).trunc_scheme!=NULL) {
+    h = (*(*pair_pot).trunc_scheme).trunc_fn(d, (*pair_pot).rcut, (*(*pair_pot).trunc_scheme).par, &hg);
+    if (g!=NULL) *g = (*g)*h + v*hg/d;
+    v *= h;
+  }
+  return v;
+}
+
+
+void pair_pot_sample(pair_pot_type *pair_pot, long *centers, long *others,
+                     double *distances, long n, double *energies,
+                     double *derivatives) {
+  // Evaluates the truncated pair potential and its derivative towards the
+  // distance for a list of pairs, placed along the x-axis.
+  long i;
+  double g;
+  double delta[3];
+  for (i=0; i<n; i++) {
+    delta[0] = distances[i];
+    delta[1] = 0.0;
+    delta[2] = 0.0;
+    energies[i] = pair_pot_eval(pair_pot, centers[i], others[i], distances[i], delta, &g);
+    derivatives[i] = g*distances[i];
+  }
+}
+
+
+typedef struct {
+  // The arguments of the compute functions that are shared by all threads.
+  void *neighs;
+  double *pos;
+  cell_type *unitcell;
+  long *clusters;
+  long *wrap;
+  scaling_row_type *stab;
+  long nstab;
+  double *scales;
+  pair_pot_type **pair_pots;
+  long npot;
+  int format;
+  // Only used by pair_pot_compute_lambdas.
+  long *group;
+  double lambda;
+  long nlambda;
+  double *lambdas;
+  double sc_alpha;
+  double sc_sigma6;
+} pair_pot_args_type;
+
+typedef void (*pair_pot_range_fn_type)(pair_pot_args_type*, long, long, double*, double*, double*);
+
+
+static void pair_pot_parallel(pair_pot_range_fn_type range_fn,
+                              pair_pot_args_type *args, long n, long natom,
+                              long nenergy, double *energies, double *gpos,
+                              double* vtens) {
+  // Calls range_fn for consecutive chunks of the n neighbor list records.
+  // Each chunk has its own energies, gpos and vtens accumulators, which are
+  // added in the order of the chunks afterwards. The number of chunks only
+  // depends on n and on the maximum number of threads, not on the order in
+  // which the threads finish, such that the results are reproducible bitwise
+  // without atomic updates. When memory allocation fails, or when there are
+  // not enough records, everything is computed in a single chunk.
+  long i, ichunk, nchunk;
+  double *chunk_energies, *chunk_gpos, *chunk_vtens;
+  for (i=0; i<nenergy; i++) energies[i] = 0.0;
+#ifdef _OPENMP
+  nchunk = omp_get_max_threads();
+#else
+  nchunk = 1;
+#endif
+  if (nchunk > n/PAIR_POT_CHUNK_MIN) nchunk = n/PAIR_POT_CHUNK_MIN;
+  if (nchunk > 1) {
+    chunk_energies = calloc(nchunk*nenergy, sizeof(double));
+    chunk_gpos = NULL;
+    if (gpos != NULL) chunk_gpos = calloc(nchunk*3*natom, sizeof(double));
+    chunk_vtens = NULL;
+    if (vtens != NULL) chunk_vtens = calloc(nchunk*9, sizeof(double));
+    if ((chunk_energies != NULL) && ((gpos == NULL) || (chunk_gpos != NULL)) &&
+        ((vtens == NULL) || (chunk_vtens != NULL))) {
+      #pragma omp parallel for schedule(static, 1)
+      for (ichunk=0; ichunk<nchunk; ichunk++) {
+        range_fn(args, (n*ichunk)/nchunk, (n*(ichunk+1))/nchunk,
+          chunk_energies + nenergy*ichunk,
+          (gpos == NULL) ? NULL : chunk_gpos + 3*natom*ichunk,
+          (vtens == NULL) ? NULL : chunk_vtens + 9*ichunk);
+      }
+      // Reduction in a fixed order.
+      for (ichunk=0; ichunk<nchunk; ichunk++) {
+        for (i=0; i<nenergy; i++) energies[i] += chunk_energies[nenergy*ichunk+i];
+      }
+      if (gpos != NULL) {
+        #pragma omp parallel for private(ichunk)
+        for (i=0; i<3*natom; i++) {
+          for (ichunk=0; ichunk<nchunk; ichunk++) gpos[i] += chunk_gpos[3*natom*ichunk+i];
+        }
+      }
+      if (vtens != NULL) {
+        for (ichunk=0; ichunk<nchunk; ichunk++) {
+          for (i=0; i<9; i++) vtens[i] += chunk_vtens[9*ichunk+i];
+        }
+      }
+      free(chunk_energies);
+      free(chunk_gpos);
+      free(chunk_vtens);
+      return;
+    }
+    free(chunk_energies);
+    free(chunk_gpos);
+    free(chunk_vtens);
+  }
+  range_fn(args, 0, n, energies, gpos, vtens);
+}
+
+
+static void pair_pot_compute_range(pair_pot_args_type *args, long begin,
+                                   long end, double *energies, double *gpos,
+                                   double* vtens) {
+  // When scales is not NULL, the scaling of each pair is scales[nbond], where
+  // nbond is taken from the neighbor list. Otherwise, the scalings of the
+  // pairs in the central image are looked up in stab.
   long i, srow, center_index, other_index;
-  double s, energy, v, vg, h, hg;
-  double delta[3], vg_cart[3];
+  double s, energy;
+  double delta[3];
+  neigh_row_type *neighs;
+  pair_pot_type *pair_pot;
+  pair_batch_type batch;
+  neighs = (*args).neighs;
+  pair_pot = (*args).pair_pots[0];
+  batch.n = 0;
   energy = 0.0;
   // Reset the row counter for the scaling.
   srow = 0;
   // Compute the interactions.
-  for (i=0; i<nneigh; i++) {
+  for (i=begin; i<end; i++) {
     // Find the scale
     if (neighs[i].d < (*pair_pot).rcut) {
       center_index = neighs[i].a;
       other_index = neighs[i].b;
-      if ((neighs[i].r0 == 0) && (neighs[i].r1 == 0) && (neighs[i].r2 == 0)) {
-        s = get_scaling(stab, center_index, other_index, &srow, nstab);
+      if ((*args).scales != NULL) {
+        s = (*args).scales[neighs[i].nbond];
+      } else if ((neighs[i].r0 == 0) && (neighs[i].r1 == 0) && (neighs[i].r2 == 0)) {
+        s = get_scaling((*args).stab, center_index, other_index, &srow, (*args).nstab);
       } else {
         s = 1.0;
       }
@@ -107,94 +469,857 @@ double pair_pot_compute(neigh_row_type *neighs,
         delta[0] = neighs[i].dx;
         delta[1] = neighs[i].dy;
         delta[2] = neighs[i].dz;
-        if ((gpos==NULL) && (vtens==NULL)) {
-          // Call the potential function without g argument.
-          v = (*pair_pot).pair_fn((*pair_pot).pair_data, center_index, other_index, neighs[i].d, delta, NULL, NULL);
-          // If a truncation scheme is defined, apply it.
-          if (((*pair_pot).trunc_scheme!=NULL) && (v!=0.0)) {
-            v *= (*(*pair_pot).trunc_scheme).trunc_fn(neighs[i].d, (*pair_pot).rcut, (*(*pair_pot).trunc_scheme).par, NULL);
+        energy += pair_pot_add_pair(pair_pot, &batch, center_index, other_index, neighs[i].d, delta, s, gpos, vtens);
+      }
+    }
+  }
+  energy += pair_pot_flush(pair_pot, &batch, gpos, vtens);
+  energies[0] = energy;
+}
+
+
+// Specialized kernels for the standard neighbor list. The generic code above
+// tests for the truncation scheme and for the requested output in the inner
+// loop and calls the pair and truncation functions through pointers. The
+// functions below take these as compile-time constants instead: they are
+// always inlined in a variant for each combination of pair potential,
+// truncation scheme and output, in which the tests are folded away and the
+// calls become direct (and usually inlined) calls. The variant is selected
+// once per call of pair_pot_compute. Pair potentials without variants use the
+// generic code.
+
+#ifdef __GNUC__
+#define PAIR_POT_INLINE static inline __attribute__((always_inline))
+#else
+#define PAIR_POT_INLINE static inline
+#endif
+
+#define PAIR_POT_TRUNC_NONE 0
+#define PAIR_POT_TRUNC_HAMMER 1
+#define PAIR_POT_TRUNC_SWITCH3 2
+#define PAIR_POT_NTRUNC 3
+
+#define PAIR_POT_OUTPUT_ENERGY 0 // energy
+#define PAIR_POT_OUTPUT_GPOS 1   // energy and gpos
+#define PAIR_POT_OUTPUT_VTENS 2  // energy, gpos and vtens
+#define PAIR_POT_NOUTPUT 3
+
+
+PAIR_POT_INLINE double pair_pot_kernel_trunc(int trunc, double d, double rcut,
+                                             double par, double *g) {
+  if (trunc == PAIR_POT_TRUNC_HAMMER) return hammer_inline(d, rcut, par, g);
+  return switch3_inline(d, rcut, par, g);
+}
+
+
+PAIR_POT_INLINE void pair_pot_kernel_add(int output, long center_index,
+                                         long other_index, double *delta,
+                                         double vg, double *vg_cart,
+                                         double *gpos, double *vtens) {
+  // Adds the contribution of a single pair to gpos and vtens. vg and vg_cart
+  // are already scaled. Same as in pair_pot_compute_row.
+  double h;
+  h = delta[0]*vg;
+  gpos[3*other_index  ] += h + vg_cart[0];
+  gpos[3*center_index ] -= h + vg_cart[0];
+  h = delta[1]*vg;
+  gpos[3*other_index+1] += h + vg_cart[1];
+  gpos[3*center_index+1] -= h + vg_cart[1];
+  h = delta[2]*vg;
+  gpos[3*other_index+2] += h + vg_cart[2];
+  gpos[3*center_index+2] -= h + vg_cart[2];
+  if (output == PAIR_POT_OUTPUT_VTENS) {
+    vtens[0] += delta[0]*(delta[0]*vg+vg_cart[0]);
+    vtens[4] += delta[1]*(delta[1]*vg+vg_cart[1]);
+    vtens[8] += delta[2]*(delta[2]*vg+vg_cart[2]);
+    vtens[1] += delta[0]*(delta[1]*vg+vg_cart[1]);
+    vtens[3] += delta[1]*(delta[0]*vg+vg_cart[0]);
+    vtens[2] += delta[0]*(delta[2]*vg+vg_cart[2]);
+    vtens[6] += delta[2]*(delta[0]*vg+vg_cart[0]);
+    vtens[5] += delta[1]*(delta[2]*vg+vg_cart[2]);
+    vtens[7] += delta[2]*(delta[1]*vg+vg_cart[1]);
+  }
+}
+
+
+PAIR_POT_INLINE double pair_pot_kernel_row(pair_fn_type pair_fn, int trunc,
+                                           int output, void *pair_data,
+                                           double rcut, double par,
+                                           long center_index, long other_index,
+                                           double d, double *delta, double s,
+                                           double *gpos, double *vtens) {
+  // Specialized version of pair_pot_compute_row.
+  double v, vg, h, hg;
+  double vg_cart[3];
+  if (output == PAIR_POT_OUTPUT_ENERGY) {
+    v = pair_fn(pair_data, center_index, other_index, d, delta, NULL, NULL);
+    if ((trunc != PAIR_POT_TRUNC_NONE) && (v!=0.0)) {
+      v *= pair_pot_kernel_trunc(trunc, d, rcut, par, NULL);
+    }
+    return s*v;
+  }
+  vg_cart[0] = 0.0;
+  vg_cart[1] = 0.0;
+  vg_cart[2] = 0.0;
+  v = pair_fn(pair_data, center_index, other_index, d, delta, &vg, vg_cart);
+  if ((trunc != PAIR_POT_TRUNC_NONE) && ((v!=0.0) || (vg!=0.0))) {
+    h = pair_pot_kernel_trunc(trunc, d, rcut, par, &hg);
+    vg = vg*h + v*hg/d;
+    vg_cart[0] = vg_cart[0]*h;
+    vg_cart[1] = vg_cart[1]*h;
+    vg_cart[2] = vg_cart[2]*h;
+    v *= h;
+  }
+  vg *= s;
+  vg_cart[0] *= s;
+  vg_cart[1] *= s;
+  vg_cart[2] *= s;
+  pair_pot_kernel_add(output, center_index, other_index, delta, vg, vg_cart, gpos, vtens);
+  return s*v;
+}
+
+
+PAIR_POT_INLINE double pair_pot_kernel_flush(pair_batch_fn_type batch_fn,
+                                             int trunc, int output,
+                                             void *pair_data, double rcut,
+                                             double par, pair_batch_type *batch,
+                                             double *gpos, double *vtens) {
+  // Specialized version of pair_pot_flush.
+  long i;
+  double v, vg, h, hg, energy;
+  double vg_cart[3];
+  if ((*batch).n == 0) return 0.0;
+  batch_fn(pair_data, (*batch).n, (*batch).center, (*batch).other, (*batch).d, (*batch).v, (*batch).g);
+  vg_cart[0] = 0.0;
+  vg_cart[1] = 0.0;
+  vg_cart[2] = 0.0;
+  energy = 0.0;
+  for (i=0; i<(*batch).n; i++) {
+    v = (*batch).v[i];
+    vg = (*batch).g[i];
+    if ((trunc != PAIR_POT_TRUNC_NONE) && ((v!=0.0) || (vg!=0.0))) {
+      h = pair_pot_kernel_trunc(trunc, (*batch).d[i], rcut, par, &hg);
+      vg = vg*h + v*hg/(*batch).d[i];
+      v *= h;
+    }
+    energy += (*batch).s[i]*v;
+    if (output != PAIR_POT_OUTPUT_ENERGY) {
+      pair_pot_kernel_add(output, (*batch).center[i], (*batch).other[i],
+        (*batch).delta + 3*i, (*batch).s[i]*vg, vg_cart, gpos, vtens);
+    }
+  }
+  (*batch).n = 0;
+  return energy;
+}
+
+
+PAIR_POT_INLINE void pair_pot_kernel_range(pair_fn_type pair_fn,
+                                           pair_batch_fn_type batch_fn,
+                                           int trunc, int output,
+                                           pair_pot_args_type *args,
+                                           long begin, long end,
+                                           double *energies, double *gpos,
+                                           double* vtens) {
+  // Specialized version of pair_pot_compute_range. When batch_fn is not NULL,
+  // it is used instead of pair_fn.
+  long i, srow, center_index, other_index;
+  double s, energy, rcut, par;
+  double delta[3];
+  void *pair_data;
+  neigh_row_type *neighs;
+  pair_pot_type *pair_pot;
+  pair_batch_type batch;
+  neighs = (*args).neighs;
+  pair_pot = (*args).pair_pots[0];
+  pair_data = (*pair_pot).pair_data;
+  rcut = (*pair_pot).rcut;
+  par = 0.0;
+  if (trunc != PAIR_POT_TRUNC_NONE) par = (*(*pair_pot).trunc_scheme).par;
+  batch.n = 0;
+  energy = 0.0;
+  srow = 0;
+  for (i=begin; i<end; i++) {
+    if (neighs[i].d < rcut) {
+      center_index = neighs[i].a;
+      other_index = neighs[i].b;
+      if ((*args).scales != NULL) {
+        s = (*args).scales[neighs[i].nbond];
+      } else if ((neighs[i].r0 == 0) && (neighs[i].r1 == 0) && (neighs[i].r2 == 0)) {
+        s = get_scaling((*args).stab, center_index, other_index, &srow, (*args).nstab);
+      } else {
+        s = 1.0;
+      }
+      if (s > 0.0) {
+        delta[0] = neighs[i].dx;
+        delta[1] = neighs[i].dy;
+        delta[2] = neighs[i].dz;
+        if (batch_fn != NULL) {
+          if (pair_pot_push(&batch, center_index, other_index, neighs[i].d, delta, s)) {
+            energy += pair_pot_kernel_flush(batch_fn, trunc, output, pair_data, rcut, par, &batch, gpos, vtens);
           }
         } else {
-          // Call the potential function with vg argument.
-          // vg_cart contains the (partial) derivatives of the pair potential to
-          // cartesian coordinates. Implicit dependence (through d) of the
-          // pair potential on cartesian coordinates is captured by vg.
-          vg_cart[0] = 0.0; //vg_cart is reset here because not all pair_fn set it.
-          vg_cart[1] = 0.0;
-          vg_cart[2] = 0.0;
-          // vg is the derivative of the pair potential to d divided by the distance.
-          v = (*pair_pot).pair_fn((*pair_pot).pair_data, center_index, other_index, neighs[i].d, delta, &vg, vg_cart);
-          // If a truncation scheme is defined, apply it.
-          // TODO: include vg_cart (not necessary as long as the truncation scheme only depends on distance)
-          if (((*pair_pot).trunc_scheme!=NULL) && ((v!=0.0) || (vg!=0.0))) {
-            // hg is (a pointer to) the derivative of the truncation function.
-            h = (*(*pair_pot).trunc_scheme).trunc_fn(neighs[i].d,    (*pair_pot).rcut, (*(*pair_pot).trunc_scheme).par, &hg);
-            // chain rule:
-            vg = vg*h + v*hg/neighs[i].d;
-            vg_cart[0] = vg_cart[0]*h;
-            vg_cart[1] = vg_cart[1]*h;
-            vg_cart[2] = vg_cart[2]*h;
-            v *= h;
+          energy += pair_pot_kernel_row(pair_fn, trunc, output, pair_data, rcut, par, center_index, other_index, neighs[i].d, delta, s, gpos, vtens);
+        }
+      }
+    }
+  }
+  if (batch_fn != NULL) {
+    energy += pair_pot_kernel_flush(batch_fn, trunc, output, pair_data, rcut, par, &batch, gpos, vtens);
+  }
+  energies[0] = energy;
+}
+
+
+// Generates one variant of pair_pot_kernel_range.
+#define PAIR_POT_KERNEL(name, pair_fn, batch_fn, trunc, output) \
+  static void name(pair_pot_args_type *args, long begin, long end, \
+                   double *energies, double *gpos, double* vtens) { \
+    pair_pot_kernel_range(pair_fn, batch_fn, trunc, output, args, begin, end, energies, gpos, vtens); \
+  }
+
+// Generates all variants for one pair potential and a table
+// pair_pot_kernels_<pot>[trunc][output] with pointers to these variants.
+#define PAIR_POT_KERNELS(pot, pair_fn, batch_fn) \
+  PAIR_POT_KERNEL(pair_pot_kernel_##pot##_none_energy, pair_fn, batch_fn, PAIR_POT_TRUNC_NONE, PAIR_POT_OUTPUT_ENERGY) \
+  PAIR_POT_KERNEL(pair_pot_kernel_##pot##_none_gpos, pair_fn, batch_fn, PAIR_POT_TRUNC_NONE, PAIR_POT_OUTPUT_GPOS) \
+  PAIR_POT_KERNEL(pair_pot_kernel_##pot##_none_vtens, pair_fn, batch_fn, PAIR_POT_TRUNC_NONE, PAIR_POT_OUTPUT_VTENS) \
+  PAIR_POT_KERNEL(pair_pot_kernel_##pot##_hammer_energy, pair_fn, batch_fn, PAIR_POT_TRUNC_HAMMER, PAIR_POT_OUTPUT_ENERGY) \
+  PAIR_POT_KERNEL(pair_pot_kernel_##pot##_hammer_gpos, pair_fn, batch_fn, PAIR_POT_TRUNC_HAMMER, PAIR_POT_OUTPUT_GPOS) \
+  PAIR_POT_KERNEL(pair_pot_kernel_##pot##_hammer_vtens, pair_fn, batch_fn, PAIR_POT_TRUNC_HAMMER, PAIR_POT_OUTPUT_VTENS) \
+  PAIR_POT_KERNEL(pair_pot_kernel_##pot##_switch3_energy, pair_fn, batch_fn, PAIR_POT_TRUNC_SWITCH3, PAIR_POT_OUTPUT_ENERGY) \
+  PAIR_POT_KERNEL(pair_pot_kernel_##pot##_switch3_gpos, pair_fn, batch_fn, PAIR_POT_TRUNC_SWITCH3, PAIR_POT_OUTPUT_GPOS) \
+  PAIR_POT_KERNEL(pair_pot_kernel_##pot##_switch3_vtens, pair_fn, batch_fn, PAIR_POT_TRUNC_SWITCH3, PAIR_POT_OUTPUT_VTENS) \
+  static pair_pot_range_fn_type pair_pot_kernels_##pot[PAIR_POT_NTRUNC][PAIR_POT_NOUTPUT] = { \
+    {pair_pot_kernel_##pot##_none_energy, pair_pot_kernel_##pot##_none_gpos, pair_pot_kernel_##pot##_none_vtens}, \
+    {pair_pot_kernel_##pot##_hammer_energy, pair_pot_kernel_##pot##_hammer_gpos, pair_pot_kernel_##pot##_hammer_vtens}, \
+    {pair_pot_kernel_##pot##_switch3_energy, pair_pot_kernel_##pot##_switch3_gpos, pair_pot_kernel_##pot##_switch3_vtens}, \
+  };
+
+PAIR_POT_KERNELS(lj, pair_fn_lj, pair_batch_fn_lj)
+PAIR_POT_KERNELS(mm3, pair_fn_mm3, pair_batch_fn_mm3)
+PAIR_POT_KERNELS(grimme, pair_fn_grimme, NULL)
+PAIR_POT_KERNELS(exprep, pair_fn_exprep, pair_batch_fn_exprep)
+PAIR_POT_KERNELS(ljcross, pair_fn_ljcross, NULL)
+PAIR_POT_KERNELS(dampdisp, pair_fn_dampdisp, pair_batch_fn_dampdisp)
+PAIR_POT_KERNELS(ei, pair_fn_ei, pair_batch_fn_ei)
+PAIR_POT_KERNELS(dsf, pair_fn_dsf, pair_batch_fn_dsf)
+PAIR_POT_KERNELS(tabulated, pair_fn_tabulated, NULL)
+PAIR_POT_KERNELS(lj_mixed, pair_fn_lj, pair_batch_fn_lj_mixed)
+PAIR_POT_KERNELS(mm3_mixed, pair_fn_mm3, pair_batch_fn_mm3_mixed)
+PAIR_POT_KERNELS(exprep_mixed, pair_fn_exprep, pair_batch_fn_exprep_mixed)
+PAIR_POT_KERNELS(ei_mixed, pair_fn_ei, pair_batch_fn_ei_mixed)
+
+typedef struct {
+  pair_fn_type pair_fn;
+  int mixed;
+  pair_pot_range_fn_type (*kernels)[PAIR_POT_NOUTPUT];
+} pair_pot_kernel_entry_type;
+
+static pair_pot_kernel_entry_type pair_pot_kernel_entries[] = {
+  {pair_fn_lj, 0, pair_pot_kernels_lj},
+  {pair_fn_mm3, 0, pair_pot_kernels_mm3},
+  {pair_fn_grimme, 0, pair_pot_kernels_grimme},
+  {pair_fn_exprep, 0, pair_pot_kernels_exprep},
+  {pair_fn_ljcross, 0, pair_pot_kernels_ljcross},
+  {pair_fn_dampdisp, 0, pair_pot_kernels_dampdisp},
+  {pair_fn_ei, 0, pair_pot_kernels_ei},
+  {pair_fn_dsf, 0, pair_pot_kernels_dsf},
+  {pair_fn_tabulated, 0, pair_pot_kernels_tabulated},
+  {pair_fn_lj, 1, pair_pot_kernels_lj_mixed},
+  {pair_fn_mm3, 1, pair_pot_kernels_mm3_mixed},
+  {pair_fn_exprep, 1, pair_pot_kernels_exprep_mixed},
+  {pair_fn_ei, 1, pair_pot_kernels_ei_mixed},
+  {NULL, 0, NULL},
+};
+
+
+static pair_pot_range_fn_type (*pair_pot_kernels(pair_pot_type *pair_pot))[PAIR_POT_NOUTPUT] {
+  // Returns the table with variants for the pair potential, or NULL.
+  long i;
+  for (i=0; pair_pot_kernel_entries[i].pair_fn != NULL; i++) {
+    if ((pair_pot_kernel_entries[i].pair_fn == (*pair_pot).pair_fn) &&
+        (pair_pot_kernel_entries[i].mixed == (*pair_pot).mixed)) {
+      return pair_pot_kernel_entries[i].kernels;
+    }
+  }
+  return NULL;
+}
+
+
+static int pair_pot_trunc_kind(pair_pot_type *pair_pot) {
+  // Returns the truncation scheme as one of the PAIR_POT_TRUNC_* constants,
+  // or -1 for an unknown truncation function.
+  if ((*pair_pot).trunc_scheme == NULL) return PAIR_POT_TRUNC_NONE;
+  if ((*(*pair_pot).trunc_scheme).trunc_fn == hammer) return PAIR_POT_TRUNC_HAMMER;
+  if ((*(*pair_pot).trunc_scheme).trunc_fn == switch3) return PAIR_POT_TRUNC_SWITCH3;
+  return -1;
+}
+
+
+int pair_pot_specialized(pair_pot_type *pair_pot) {
+  return (pair_pot_kernels(pair_pot) != NULL) && (pair_pot_trunc_kind(pair_pot) >= 0);
+}
+
+
+static pair_pot_range_fn_type pair_pot_select_range(pair_pot_type *pair_pot,
+                                                    double *gpos, double *vtens) {
+  // Returns the specialized variant for the pair potential, its truncation
+  // scheme and the requested output. Falls back to the generic code.
+  int trunc, output;
+  pair_pot_range_fn_type (*kernels)[PAIR_POT_NOUTPUT];
+  kernels = pair_pot_kernels(pair_pot);
+  trunc = pair_pot_trunc_kind(pair_pot);
+  if ((kernels == NULL) || (trunc < 0)) return pair_pot_compute_range;
+  if (gpos == NULL) {
+    // The virial tensor without gradient is not specialized.
+    if (vtens != NULL) return pair_pot_compute_range;
+    output = PAIR_POT_OUTPUT_ENERGY;
+  } else if (vtens == NULL) {
+    output = PAIR_POT_OUTPUT_GPOS;
+  } else {
+    output = PAIR_POT_OUTPUT_VTENS;
+  }
+  return kernels[trunc][output];
+}
+
+
+double pair_pot_compute(neigh_row_type *neighs,
+                        long nneigh, scaling_row_type *stab,
+                        long nstab, double *scales, pair_pot_type *pair_pot,
+                        long natom, double *gpos, double* vtens) {
+  // The neighbor list is divided over the threads. natom is only used when
+  // gpos is not NULL. A specialized kernel is used when available.
+  double energy;
+  pair_pot_args_type args;
+  args.neighs = neighs;
+  args.stab = stab;
+  args.nstab = nstab;
+  args.scales = scales;
+  args.pair_pots = &pair_pot;
+  args.npot = 1;
+  pair_pot_parallel(pair_pot_select_range(pair_pot, gpos, vtens), &args, nneigh, natom, 1, &energy, gpos, vtens);
+  return energy;
+}
+
+
+static double pair_pot_softcore(pair_pot_type *pair_pot, long center_index,
+                                long other_index, double d, double *delta,
+                                double lambda, double sc_alpha,
+                                double sc_sigma6, double *g) {
+  // Computes the soft-core version of the pair potential:
+  //   E = lambda*V(r)*h(d) with r**6 = sc_alpha*sc_sigma**6*(1-lambda) + d**6,
+  // where h is the truncation function. When g is not NULL, the derivative
+  // towards d divided by d is stored in g. Only correct for potentials that
+  // only depend on the distance.
+  double d6, r6, r, v, vg, h, hg;
+  double g_cart[3];
+  if (lambda == 0.0) {
+    if (g != NULL) *g = 0.0;
+    return 0.0;
+  }
+  d6 = d*d*d;
+  d6 *= d6;
+  r6 = sc_alpha*sc_sigma6*(1.0-lambda) + d6;
+  r = pow(r6, 1.0/6.0);
+  v = (*pair_pot).pair_fn((*pair_pot).pair_data, center_index, other_index, r, delta, (g == NULL) ? NULL : &vg, g_cart);
+  h = 1.0;
+  hg = 0.0;
+  if ((*pair_pot).trunc_scheme != NULL) {
+    h = (*(*pair_pot).trunc_scheme).trunc_fn(d, (*pair_pot).rcut, (*(*pair_pot).trunc_scheme).par, (g == NULL) ? NULL : &hg);
+  }
+  if (g != NULL) {
+    // dr/dd = d**5/r**5 and vg is the derivative towards r divided by r.
+    *g = lambda*(vg*d6/(d*d)/(r*r*r*r)*h + v*hg/d);
+  }
+  return lambda*v*h;
+}
+
+
+static void pair_pot_add_gradient(long center_index, long other_index,
+                                  double *delta, double vg, double *gpos,
+                                  double *vtens) {
+  // Adds the contribution of a pair, whose energy only depends on the
+  // distance, to gpos and vtens. vg is the derivative towards the distance
+  // divided by the distance.
+  double h;
+  if (gpos != NULL) {
+    h = delta[0]*vg;
+    gpos[3*other_index  ] += h;
+    gpos[3*center_index ] -= h;
+    h = delta[1]*vg;
+    gpos[3*other_index+1] += h;
+    gpos[3*center_index+1] -= h;
+    h = delta[2]*vg;
+    gpos[3*other_index+2] += h;
+    gpos[3*center_index+2] -= h;
+  }
+  if (vtens != NULL) {
+    vtens[0] += delta[0]*delta[0]*vg;
+    vtens[4] += delta[1]*delta[1]*vg;
+    vtens[8] += delta[2]*delta[2]*vg;
+    h = delta[0]*delta[1]*vg;
+    vtens[1] += h;
+    vtens[3] += h;
+    h = delta[0]*delta[2]*vg;
+    vtens[2] += h;
+    vtens[6] += h;
+    h = delta[1]*delta[2]*vg;
+    vtens[5] += h;
+    vtens[7] += h;
+  }
+}
+
+
+static void pair_pot_compute_lambdas_range(pair_pot_args_type *args,
+                                           long begin, long end,
+                                           double *energies, double *gpos,
+                                           double* vtens) {
+  // Pairs with one atom in the group are coupled through the soft-core
+  // potential. energies[0] is the energy at the current lambda and
+  // energies[1+k] is the energy at lambdas[k].
+  long i, k, srow, center_index, other_index;
+  double s, d, g, energy, energy_coupled;
+  double delta[3];
+  neigh_row_type *neighs;
+  pair_pot_type *pair_pot;
+  neighs = (*args).neighs;
+  pair_pot = (*args).pair_pots[0];
+  energy = 0.0;
+  energy_coupled = 0.0;
+  srow = 0;
+  for (i=begin; i<end; i++) {
+    d = neighs[i].d;
+    if (d < (*pair_pot).rcut) {
+      center_index = neighs[i].a;
+      other_index = neighs[i].b;
+      if ((*args).scales != NULL) {
+        s = (*args).scales[neighs[i].nbond];
+      } else if ((neighs[i].r0 == 0) && (neighs[i].r1 == 0) && (neighs[i].r2 == 0)) {
+        s = get_scaling((*args).stab, center_index, other_index, &srow, (*args).nstab);
+      } else {
+        s = 1.0;
+      }
+      if (s > 0.0) {
+        delta[0] = neighs[i].dx;
+        delta[1] = neighs[i].dy;
+        delta[2] = neighs[i].dz;
+        if ((*args).group[center_index] == (*args).group[other_index]) {
+          energy += pair_pot_compute_row(pair_pot, center_index, other_index, d, delta, s, gpos, vtens);
+        } else {
+          if ((gpos == NULL) && (vtens == NULL)) {
+            energy_coupled += s*pair_pot_softcore(pair_pot, center_index, other_index, d, delta, (*args).lambda, (*args).sc_alpha, (*args).sc_sigma6, NULL);
+          } else {
+            energy_coupled += s*pair_pot_softcore(pair_pot, center_index, other_index, d, delta, (*args).lambda, (*args).sc_alpha, (*args).sc_sigma6, &g);
+            pair_pot_add_gradient(center_index, other_index, delta, s*g, gpos, vtens);
           }
-          //printf("C %3i %3i (% 3i % 3i % 3i) %10.7f %3.1f %10.3e\n", center_index, other_index, neighs[i].r0, neighs[i].r1, neighs[i].r2, neighs[i].d, s, s*v);
-          vg *= s;
-          vg_cart[0] *= s;
-          vg_cart[1] *= s;
-          vg_cart[2] *= s;
-          if (gpos!=NULL) {
-            h = neighs[i].dx*vg;
-            gpos[3*other_index  ] += h + vg_cart[0];
-            gpos[3*center_index   ] -= h + vg_cart[0];
-            h = neighs[i].dy*vg;
-            gpos[3*other_index+1] += h + vg_cart[1];
-            gpos[3*center_index +1] -= h + vg_cart[1];
-            h = neighs[i].dz*vg;
-            gpos[3*other_index+2] += h + vg_cart[2];
-            gpos[3*center_index +2] -= h + vg_cart[2];
+          for (k=0; k<(*args).nlambda; k++) {
+            energies[1+k] += s*pair_pot_softcore(pair_pot, center_index, other_index, d, delta, (*args).lambdas[k], (*args).sc_alpha, (*args).sc_sigma6, NULL);
           }
-          if (vtens!=NULL) {
-            vtens[0] += neighs[i].dx*(neighs[i].dx*vg+vg_cart[0]);
-            vtens[4] += neighs[i].dy*(neighs[i].dy*vg+vg_cart[1]);
-            vtens[8] += neighs[i].dz*(neighs[i].dz*vg+vg_cart[2]);
-            //h = neighs[i].dx*(neighs[i].dy*vg+vg_cart[1]);
-            vtens[1] += neighs[i].dx*(neighs[i].dy*vg+vg_cart[1]);
-            vtens[3] += neighs[i].dy*(neighs[i].dx*vg+vg_cart[0]);
-            //h = neighs[i].dx*(neighs[i].dz*vg+vg_cart[2]);
-            vtens[2] += neighs[i].dx*(neighs[i].dz*vg+vg_cart[2]);
-            vtens[6] += neighs[i].dz*(neighs[i].dx*vg+vg_cart[0]);
-            //h = neighs[i].dy*(neighs[i].dz*vg+vg_cart[2]);
-            vtens[5] += neighs[i].dy*(neighs[i].dz*vg+vg_cart[2]);
-            vtens[7] += neighs[i].dz*(neighs[i].dy*vg+vg_cart[1]);
+        }
+      }
+    }
+  }
+  energies[0] = energy + energy_coupled;
+  for (k=0; k<(*args).nlambda; k++) {
+    energies[1+k] += energy;
+  }
+}
+
+
+double pair_pot_compute_lambdas(neigh_row_type *neighs, long nneigh,
+                                scaling_row_type *stab, long nstab,
+                                double *scales, pair_pot_type *pair_pot,
+                                long *group, double lambda, long nlambda,
+                                double *lambdas, double sc_alpha,
+                                double sc_sigma, double *energies, long natom,
+                                double *gpos, double* vtens) {
+  // Computes a pair potential in which the interactions between the atoms
+  // with a non-zero group and the other atoms are coupled with a parameter
+  // lambda, through a soft-core potential. (See pair_pot_softcore.) The
+  // energy, gpos and vtens are computed for the given lambda. In the same
+  // loop over the neighbor list, the energies for all values in lambdas are
+  // computed. The energies array has nlambda+1 elements: the first is the
+  // energy for lambda, the following are the energies for lambdas. Returns
+  // the energy for lambda.
+  pair_pot_args_type args;
+  args.neighs = neighs;
+  args.stab = stab;
+  args.nstab = nstab;
+  args.scales = scales;
+  args.pair_pots = &pair_pot;
+  args.npot = 1;
+  args.group = group;
+  args.lambda = lambda;
+  args.nlambda = nlambda;
+  args.lambdas = lambdas;
+  args.sc_alpha = sc_alpha;
+  args.sc_sigma6 = sc_sigma*sc_sigma*sc_sigma;
+  args.sc_sigma6 *= args.sc_sigma6;
+  pair_pot_parallel(pair_pot_compute_lambdas_range, &args, nneigh, natom, nlambda+1, energies, gpos, vtens);
+  return energies[0];
+}
+
+static void pair_pot_compute_compact_range(pair_pot_args_type *args,
+                                           long begin, long end,
+                                           double *energies, double *gpos,
+                                           double* vtens) {
+  // Same as pair_pot_compute_range, except that the relative vectors and
+  // distances are computed on the fly from the atomic positions.
+  long i, srow, center_index, other_index;
+  long shift[3];
+  double s, d, energy;
+  double delta[3];
+  double *pos;
+  neigh_compact_row_type *neighs;
+  pair_pot_type *pair_pot;
+  pair_batch_type batch;
+  neighs = (*args).neighs;
+  pos = (*args).pos;
+  pair_pot = (*args).pair_pots[0];
+  batch.n = 0;
+  energy = 0.0;
+  // Reset the row counter for the scaling.
+  srow = 0;
+  // Compute the interactions.
+  for (i=begin; i<end; i++) {
+    center_index = neighs[i].a;
+    other_index = neighs[i].b;
+    delta[0] = pos[3*other_index  ] - pos[3*center_index  ];
+    delta[1] = pos[3*other_index+1] - pos[3*center_index+1];
+    delta[2] = pos[3*other_index+2] - pos[3*center_index+2];
+    shift[0] = neighs[i].s0;
+    shift[1] = neighs[i].s1;
+    shift[2] = neighs[i].s2;
+    cell_add_vec(delta, (*args).unitcell, shift);
+    d = sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]);
+    if (d < (*pair_pot).rcut) {
+      // Find the scale
+      if ((*args).scales != NULL) {
+        s = (*args).scales[neighs[i].nbond];
+      } else if (neighs[i].central) {
+        s = get_scaling((*args).stab, center_index, other_index, &srow, (*args).nstab);
+      } else {
+        s = 1.0;
+      }
+      // If the scale is non-zero, compute the contribution.
+      if (s > 0.0) {
+        energy += pair_pot_add_pair(pair_pot, &batch, center_index, other_index, d, delta, s, gpos, vtens);
+      }
+    }
+  }
+  energy += pair_pot_flush(pair_pot, &batch, gpos, vtens);
+  energies[0] = energy;
+}
+
+
+double pair_pot_compute_compact(neigh_compact_row_type *neighs,
+                                long nneigh, double *pos, cell_type *unitcell,
+                                scaling_row_type *stab, long nstab,
+                                double *scales, pair_pot_type *pair_pot,
+                                long natom, double *gpos, double* vtens) {
+  // Same as pair_pot_compute, for a neighbor list in the compact format.
+  double energy;
+  pair_pot_args_type args;
+  args.neighs = neighs;
+  args.pos = pos;
+  args.unitcell = unitcell;
+  args.stab = stab;
+  args.nstab = nstab;
+  args.scales = scales;
+  args.pair_pots = &pair_pot;
+  args.npot = 1;
+  pair_pot_parallel(pair_pot_compute_compact_range, &args, nneigh, natom, 1, &energy, gpos, vtens);
+  return energy;
+}
+
+static void pair_pot_tile_positions(neigh_tile_type *tile, long *clusters,
+                                    long *wrap, double *pos,
+                                    cell_type *unitcell, double *pos_i,
+                                    double *pos_j) {
+  // Computes the positions of the atoms in both clusters of a tile, such that
+  // the relative vector of a pair is simply pos_j - pos_i.
+  long j, k, index;
+  long shift[3];
+  for (j=0; j<NLIST_CLUSTER_SIZE; j++) {
+    index = clusters[NLIST_CLUSTER_SIZE*(*tile).ci+j];
+    if (index >= 0) {
+      for (k=0; k<3; k++) pos_i[3*j+k] = pos[3*index+k];
+      cell_add_vec(pos_i + 3*j, unitcell, wrap + 3*index);
+    }
+    index = clusters[NLIST_CLUSTER_SIZE*(*tile).cj+j];
+    if (index >= 0) {
+      shift[0] = wrap[3*index  ] + (*tile).s0;
+      shift[1] = wrap[3*index+1] + (*tile).s1;
+      shift[2] = wrap[3*index+2] + (*tile).s2;
+      for (k=0; k<3; k++) pos_j[3*j+k] = pos[3*index+k];
+      cell_add_vec(pos_j + 3*j, unitcell, shift);
+    }
+  }
+}
+
+
+static void pair_pot_compute_tiles_range(pair_pot_args_type *args, long begin,
+                                         long end, double *energies,
+                                         double *gpos, double* vtens) {
+  // Same as pair_pot_compute_range, for a neighbor list in the tiled format.
+  // The positions of the atoms in both clusters of a tile are computed first.
+  // Then all pairs in the tile whose bit in the mask is set are visited.
+  long i, j, k, bit, srow, center_index, other_index;
+  double s, d, energy;
+  double delta[3];
+  double pos_i[3*NLIST_CLUSTER_SIZE], pos_j[3*NLIST_CLUSTER_SIZE];
+  long *clusters;
+  neigh_tile_type *tiles;
+  pair_pot_type *pair_pot;
+  pair_batch_type batch;
+  tiles = (*args).neighs;
+  clusters = (*args).clusters;
+  pair_pot = (*args).pair_pots[0];
+  batch.n = 0;
+  energy = 0.0;
+  // Reset the row counter for the scaling.
+  srow = 0;
+  for (i=begin; i<end; i++) {
+    pair_pot_tile_positions(tiles + i, clusters, (*args).wrap, (*args).pos, (*args).unitcell, pos_i, pos_j);
+    for (bit=0; bit<NLIST_TILE_SIZE; bit++) {
+      if (!(tiles[i].mask & (1 << bit))) continue;
+      j = bit/NLIST_CLUSTER_SIZE;
+      k = bit%NLIST_CLUSTER_SIZE;
+      center_index = clusters[NLIST_CLUSTER_SIZE*tiles[i].ci+j];
+      other_index = clusters[NLIST_CLUSTER_SIZE*tiles[i].cj+k];
+      delta[0] = pos_j[3*k  ] - pos_i[3*j  ];
+      delta[1] = pos_j[3*k+1] - pos_i[3*j+1];
+      delta[2] = pos_j[3*k+2] - pos_i[3*j+2];
+      d = sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]);
+      if (d < (*pair_pot).rcut) {
+        // Find the scale
+        if ((*args).scales != NULL) {
+          s = (*args).scales[tiles[i].nbond[bit]];
+        } else if (tiles[i].central & (1 << bit)) {
+          // The scaling table only contains pairs with a > b.
+          if (center_index > other_index) {
+            s = get_scaling((*args).stab, center_index, other_index, &srow, (*args).nstab);
+          } else {
+            s = get_scaling((*args).stab, other_index, center_index, &srow, (*args).nstab);
           }
+        } else {
+          s = 1.0;
+        }
+        // If the scale is non-zero, compute the contribution.
+        if (s > 0.0) {
+          energy += pair_pot_add_pair(pair_pot, &batch, center_index, other_index, d, delta, s, gpos, vtens);
+        }
+      }
+    }
+  }
+  energy += pair_pot_flush(pair_pot, &batch, gpos, vtens);
+  energies[0] = energy;
+}
+
+
+double pair_pot_compute_tiles(neigh_tile_type *tiles, long ntile,
+                              long *clusters, long *wrap, double *pos,
+                              cell_type *unitcell, scaling_row_type *stab,
+                              long nstab, double *scales,
+                              pair_pot_type *pair_pot, long natom,
+                              double *gpos, double* vtens) {
+  // Same as pair_pot_compute, for a neighbor list in the tiled format.
+  double energy;
+  pair_pot_args_type args;
+  args.neighs = tiles;
+  args.pos = pos;
+  args.unitcell = unitcell;
+  args.clusters = clusters;
+  args.wrap = wrap;
+  args.stab = stab;
+  args.nstab = nstab;
+  args.scales = scales;
+  args.pair_pots = &pair_pot;
+  args.npot = 1;
+  pair_pot_parallel(pair_pot_compute_tiles_range, &args, ntile, natom, 1, &energy, gpos, vtens);
+  return energy;
+}
+
+static void pair_pot_compute_fused_row(pair_pot_type **pair_pots, long npot,
+                                       pair_batch_type *batches,
+                                       double *scales, long nbond,
+                                       long center_index, long other_index,
+                                       double d, double *delta,
+                                       double *energies, double *gpos,
+                                       double* vtens) {
+  // Adds the contributions of all pair potentials to a single pair.
+  long k;
+  double s;
+  for (k=0; k<npot; k++) {
+    if (d < (*pair_pots[k]).rcut) {
+      s = scales[5*k+nbond];
+      if (s > 0.0) {
+        energies[k] += pair_pot_add_pair(pair_pots[k], (batches == NULL) ? NULL : batches + k, center_index, other_index, d, delta, s, gpos, vtens);
+      }
+    }
+  }
+}
+
+
+static void pair_pot_compute_fused_range(pair_pot_args_type *args, long begin,
+                                         long end, double *energies,
+                                         double *gpos, double* vtens) {
+  // Computes all pair potentials for the records begin to end. See
+  // pair_pot_compute_fused.
+  long i, j, k, bit, npot, center_index, other_index;
+  long shift[3];
+  double d, rcut;
+  double delta[3];
+  double pos_i[3*NLIST_CLUSTER_SIZE], pos_j[3*NLIST_CLUSTER_SIZE];
+  double *pos, *scales;
+  long *clusters;
+  pair_pot_type **pair_pots;
+  neigh_row_type *rows;
+  neigh_compact_row_type *compact_rows;
+  neigh_tile_type *tiles;
+  pair_batch_type *batches;
+
+  pos = (*args).pos;
+  scales = (*args).scales;
+  clusters = (*args).clusters;
+  pair_pots = (*args).pair_pots;
+  npot = (*args).npot;
+  // Without memory for the batches, all pairs are computed one by one.
+  batches = malloc(npot*sizeof(pair_batch_type));
+  rcut = 0.0;
+  for (k=0; k<npot; k++) {
+    energies[k] = 0.0;
+    if (batches != NULL) batches[k].n = 0;
+    if ((*pair_pots[k]).rcut > rcut) rcut = (*pair_pots[k]).rcut;
+  }
+  if ((*args).format == 0) {
+    rows = (*args).neighs;
+    for (i=begin; i<end; i++) {
+      if (rows[i].d < rcut) {
+        delta[0] = rows[i].dx;
+        delta[1] = rows[i].dy;
+        delta[2] = rows[i].dz;
+        pair_pot_compute_fused_row(pair_pots, npot, batches, scales, rows[i].nbond, rows[i].a, rows[i].b, rows[i].d, delta, energies, gpos, vtens);
+      }
+    }
+  } else if ((*args).format == 1) {
+    compact_rows = (*args).neighs;
+    for (i=begin; i<end; i++) {
+      center_index = compact_rows[i].a;
+      other_index = compact_rows[i].b;
+      delta[0] = pos[3*other_index  ] - pos[3*center_index  ];
+      delta[1] = pos[3*other_index+1] - pos[3*center_index+1];
+      delta[2] = pos[3*other_index+2] - pos[3*center_index+2];
+      shift[0] = compact_rows[i].s0;
+      shift[1] = compact_rows[i].s1;
+      shift[2] = compact_rows[i].s2;
+      cell_add_vec(delta, (*args).unitcell, shift);
+      d = sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]);
+      if (d < rcut) {
+        pair_pot_compute_fused_row(pair_pots, npot, batches, scales, compact_rows[i].nbond, center_index, other_index, d, delta, energies, gpos, vtens);
+      }
+    }
+  } else {
+    tiles = (*args).neighs;
+    for (i=begin; i<end; i++) {
+      pair_pot_tile_positions(tiles + i, clusters, (*args).wrap, pos, (*args).unitcell, pos_i, pos_j);
+      for (bit=0; bit<NLIST_TILE_SIZE; bit++) {
+        if (!(tiles[i].mask & (1 << bit))) continue;
+        j = bit/NLIST_CLUSTER_SIZE;
+        k = bit%NLIST_CLUSTER_SIZE;
+        center_index = clusters[NLIST_CLUSTER_SIZE*tiles[i].ci+j];
+        other_index = clusters[NLIST_CLUSTER_SIZE*tiles[i].cj+k];
+        delta[0] = pos_j[3*k  ] - pos_i[3*j  ];
+        delta[1] = pos_j[3*k+1] - pos_i[3*j+1];
+        delta[2] = pos_j[3*k+2] - pos_i[3*j+2];
+        d = sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]);
+        if (d < rcut) {
+          pair_pot_compute_fused_row(pair_pots, npot, batches, scales, tiles[i].nbond[bit], center_index, other_index, d, delta, energies, gpos, vtens);
         }
-        energy += s*v;
       }
     }
   }
+  if (batches != NULL) {
+    for (k=0; k<npot; k++) {
+      energies[k] += pair_pot_flush(pair_pots[k], batches + k, gpos, vtens);
+    }
+  }
+  free(batches);
+}
+
+
+double pair_pot_compute_fused(void *neighs, long nneigh, int format,
+                              double *pos, cell_type *unitcell,
+                              long *clusters, long *wrap,
+                              pair_pot_type **pair_pots, long npot,
+                              double *scales, double *energies, long natom,
+                              double *gpos, double* vtens) {
+  // Computes several pair potentials in a single loop over the neighbor list,
+  // such that each row is only loaded once. The format of the neighbor list
+  // is 0 (neigh_row_type), 1 (neigh_compact_row_type) or 2 (neigh_tile_type).
+  // The latter two formats require pos and unitcell, the tiled format also
+  // requires clusters and wrap. The scales array contains five scaling
+  // factors for each pair potential, which are selected with the nbond field
+  // of the rows. The energy of each pair potential is stored in energies and
+  // the contributions to gpos and vtens are added together. Returns the
+  // total energy.
+  long k;
+  double energy;
+  pair_pot_args_type args;
+  args.neighs = neighs;
+  args.pos = pos;
+  args.unitcell = unitcell;
+  args.clusters = clusters;
+  args.wrap = wrap;
+  args.scales = scales;
+  args.pair_pots = pair_pots;
+  args.npot = npot;
+  args.format = format;
+  pair_pot_parallel(pair_pot_compute_fused_range, &args, nneigh, natom, npot, energies, gpos, vtens);
+  energy = 0.0;
+  for (k=0; k<npot; k++) energy += energies[k];
   return energy;
 }
 
+
 void pair_data_free(pair_pot_type *pair_pot) {
   free((*pair_pot).pair_data);
   (*pair_pot).pair_data = NULL;
   (*pair_pot).pair_fn = NULL;
+  (*pair_pot).pair_batch_fn = NULL;
 }
 
 
 
-void pair_data_lj_init(pair_pot_type *pair_pot, double *sigma, double *epsilon) {
+void pair_data_lj_init(pair_pot_type *pair_pot, double *sigma, double *epsilon, long nclass, long *class_ids, double *table) {
+  // When table is not NULL, it contains the mixed parameters for each pair of
+  // classes of atoms with identical parameters.
   pair_data_lj_type *pair_data;
   pair_data = malloc(sizeof(pair_data_lj_type));
   (*pair_pot).pair_data = pair_data;
   if (pair_data != NULL) {
     (*pair_pot).pair_fn = pair_fn_lj;
+    (*pair_pot).pair_batch_fn = pair_batch_fn_lj;
+    (*pair_pot).pair_batch_fn_mixed = pair_batch_fn_lj_mixed;
     (*pair_data).sigma = sigma;
     (*pair_data).epsilon = epsilon;
+    (*pair_data).nclass = nclass;
+    (*pair_data).class_ids = class_ids;
+    (*pair_data).table = table;
   }
 }
 
 double pair_fn_lj(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart) {
+  long i;
   double sigma, epsilon, x;
+  pair_data_lj_type *pd;
+  pd = (pair_data_lj_type*)pair_data;
+  if ((*pd).table != NULL) {
+    i = 2*((*pd).class_ids[center_index]*(*pd).nclass + (*pd).class_ids[other_index]);
+    sigma = (*pd).table[i];
+    epsilon = (*pd).table[i+1];
+    goto compute;
+  }
   sigma = 0.5*(
     (*(pair_data_lj_type*)pair_data).sigma[center_index]+
     (*(pair_data_lj_type*)pair_data).sigma[other_index]
@@ -210,6 +1335,7 @@ double pair_fn_lj(void *pair_data, long center_index, long other_index, double d
     (*(pair_data_lj_type*)pair_data).epsilon[center_index]*
     (*(pair_data_lj_type*)pair_data).epsilon[other_index]
   );
+compute:
   x = sigma/d;
   x *= x;
   x *= x*x;
@@ -219,25 +1345,99 @@ double pair_fn_lj(void *pair_data, long center_index, long other_index, double d
   return 4.0*epsilon*(x*(x-1.0));
 }
 
+PAIR_POT_SIMD
+void pair_batch_fn_lj(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g) {
+  long i, j;
+  double x;
+  double sigma[PAIR_POT_BATCH_SIZE], epsilon[PAIR_POT_BATCH_SIZE];
+  pair_data_lj_type *pd;
+  pd = (pair_data_lj_type*)pair_data;
+  // Gather the parameters first, such that the second loop vectorizes.
+  if ((*pd).table != NULL) {
+    for (i=0; i<n; i++) {
+      j = 2*((*pd).class_ids[centers[i]]*(*pd).nclass + (*pd).class_ids[others[i]]);
+      sigma[i] = (*pd).table[j];
+      epsilon[i] = (*pd).table[j+1];
+    }
+  } else {
+    for (i=0; i<n; i++) {
+      sigma[i] = 0.5*((*pd).sigma[centers[i]] + (*pd).sigma[others[i]]);
+      epsilon[i] = sqrt((*pd).epsilon[centers[i]]*(*pd).epsilon[others[i]]);
+    }
+  }
+  for (i=0; i<n; i++) {
+    x = sigma[i]/d[i];
+    x *= x;
+    x *= x*x;
+    g[i] = 24.0*epsilon[i]/d[i]/d[i]*x*(1.0-2.0*x);
+    v[i] = 4.0*epsilon[i]*(x*(x-1.0));
+  }
+}
+
+PAIR_POT_SIMD
+void pair_batch_fn_lj_mixed(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g) {
+  // Same as pair_batch_fn_lj, with the arithmetic in single precision.
+  long i, j;
+  float x, di;
+  float sigma[PAIR_POT_BATCH_SIZE], epsilon[PAIR_POT_BATCH_SIZE];
+  pair_data_lj_type *pd;
+  pd = (pair_data_lj_type*)pair_data;
+  if ((*pd).table != NULL) {
+    for (i=0; i<n; i++) {
+      j = 2*((*pd).class_ids[centers[i]]*(*pd).nclass + (*pd).class_ids[others[i]]);
+      sigma[i] = (*pd).table[j];
+      epsilon[i] = (*pd).table[j+1];
+    }
+  } else {
+    for (i=0; i<n; i++) {
+      sigma[i] = 0.5*((*pd).sigma[centers[i]] + (*pd).sigma[others[i]]);
+      epsilon[i] = sqrt((*pd).epsilon[centers[i]]*(*pd).epsilon[others[i]]);
+    }
+  }
+  for (i=0; i<n; i++) {
+    di = d[i];
+    x = sigma[i]/di;
+    x *= x;
+    x *= x*x;
+    g[i] = 24.0f*epsilon[i]/di/di*x*(1.0f-2.0f*x);
+    v[i] = 4.0f*epsilon[i]*(x*(x-1.0f));
+  }
+}
+
 
 
 
-void pair_data_mm3_init(pair_pot_type *pair_pot, double *sigma, double *epsilon, int *onlypauli) {
+void pair_data_mm3_init(pair_pot_type *pair_pot, double *sigma, double *epsilon, int *onlypauli, long nclass, long *class_ids, double *table) {
   pair_data_mm3_type *pair_data;
   pair_data = malloc(sizeof(pair_data_mm3_type));
   (*pair_pot).pair_data = pair_data;
   if (pair_data != NULL) {
     (*pair_pot).pair_fn = pair_fn_mm3;
+    (*pair_pot).pair_batch_fn = pair_batch_fn_mm3;
+    (*pair_pot).pair_batch_fn_mixed = pair_batch_fn_mm3_mixed;
     (*pair_data).sigma = sigma;
     (*pair_data).epsilon = epsilon;
     (*pair_data).onlypauli = onlypauli;
+    (*pair_data).nclass = nclass;
+    (*pair_data).class_ids = class_ids;
+    (*pair_data).table = table;
   }
 }
 
 double pair_fn_mm3(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart) {
 // E = epsilon*[1.84e5*exp(-12.0*R/sigma) - 2.25(sigma/R)^6]
+  long i;
   double sigma, epsilon, x, exponent;
   int onlypauli;
+  pair_data_mm3_type *pd;
+  pd = (pair_data_mm3_type*)pair_data;
+  if ((*pd).table != NULL) {
+    i = 3*((*pd).class_ids[center_index]*(*pd).nclass + (*pd).class_ids[other_index]);
+    sigma = (*pd).table[i];
+    epsilon = (*pd).table[i+1];
+    onlypauli = (int)(*pd).table[i+2];
+    goto compute;
+  }
   sigma = (
     (*(pair_data_mm3_type*)pair_data).sigma[center_index]+
     (*(pair_data_mm3_type*)pair_data).sigma[other_index]
@@ -250,6 +1450,7 @@ double pair_fn_mm3(void *pair_data, long center_index, long other_index, double
     (*(pair_data_mm3_type*)pair_data).onlypauli[center_index]+
     (*(pair_data_mm3_type*)pair_data).onlypauli[other_index]
   );
+compute:
   x = sigma/d;
   exponent = 1.84e5*exp(-12.0/x);
   if (onlypauli == 0) {
@@ -267,9 +1468,75 @@ double pair_fn_mm3(void *pair_data, long center_index, long other_index, double
   }
 }
 
+PAIR_POT_SIMD
+void pair_batch_fn_mm3(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g) {
+  long i, j;
+  double x, exponent;
+  double sigma[PAIR_POT_BATCH_SIZE], epsilon[PAIR_POT_BATCH_SIZE], disp[PAIR_POT_BATCH_SIZE];
+  pair_data_mm3_type *pd;
+  pd = (pair_data_mm3_type*)pair_data;
+  // Gather the parameters first. The onlypauli flags are turned into a
+  // factor for the dispersion term, to avoid branches in the second loop.
+  if ((*pd).table != NULL) {
+    for (i=0; i<n; i++) {
+      j = 3*((*pd).class_ids[centers[i]]*(*pd).nclass + (*pd).class_ids[others[i]]);
+      sigma[i] = (*pd).table[j];
+      epsilon[i] = (*pd).table[j+1];
+      disp[i] = ((*pd).table[j+2] == 0.0) ? 1.0 : 0.0;
+    }
+  } else {
+    for (i=0; i<n; i++) {
+      sigma[i] = (*pd).sigma[centers[i]] + (*pd).sigma[others[i]];
+      epsilon[i] = sqrt((*pd).epsilon[centers[i]]*(*pd).epsilon[others[i]]);
+      disp[i] = ((*pd).onlypauli[centers[i]] + (*pd).onlypauli[others[i]] == 0) ? 1.0 : 0.0;
+    }
+  }
+  for (i=0; i<n; i++) {
+    x = sigma[i]/d[i];
+    exponent = 1.84e5*exp(-12.0/x);
+    x *= x;
+    x *= 2.25*x*x*disp[i];
+    g[i] = epsilon[i]/d[i]*(-12.0/sigma[i]*exponent+6.0/d[i]*x);
+    v[i] = epsilon[i]*(exponent-x);
+  }
+}
+
+PAIR_POT_SIMD
+void pair_batch_fn_mm3_mixed(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g) {
+  // Same as pair_batch_fn_mm3, with the arithmetic in single precision.
+  long i, j;
+  float x, exponent, di;
+  float sigma[PAIR_POT_BATCH_SIZE], epsilon[PAIR_POT_BATCH_SIZE], disp[PAIR_POT_BATCH_SIZE];
+  pair_data_mm3_type *pd;
+  pd = (pair_data_mm3_type*)pair_data;
+  if ((*pd).table != NULL) {
+    for (i=0; i<n; i++) {
+      j = 3*((*pd).class_ids[centers[i]]*(*pd).nclass + (*pd).class_ids[others[i]]);
+      sigma[i] = (*pd).table[j];
+      epsilon[i] = (*pd).table[j+1];
+      disp[i] = ((*pd).table[j+2] == 0.0) ? 1.0f : 0.0f;
+    }
+  } else {
+    for (i=0; i<n; i++) {
+      sigma[i] = (*pd).sigma[centers[i]] + (*pd).sigma[others[i]];
+      epsilon[i] = sqrt((*pd).epsilon[centers[i]]*(*pd).epsilon[others[i]]);
+      disp[i] = ((*pd).onlypauli[centers[i]] + (*pd).onlypauli[others[i]] == 0) ? 1.0f : 0.0f;
+    }
+  }
+  for (i=0; i<n; i++) {
+    di = d[i];
+    x = sigma[i]/di;
+    exponent = 1.84e5f*expf(-12.0f/x);
+    x *= x;
+    x *= 2.25f*x*x*disp[i];
+    g[i] = epsilon[i]/di*(-12.0f/sigma[i]*exponent+6.0f/di*x);
+    v[i] = epsilon[i]*(exponent-x);
+  }
+}
+
 
 
-void pair_data_grimme_init(pair_pot_type *pair_pot, double *r0, double *c6) {
+void pair_data_grimme_init(pair_pot_type *pair_pot, double *r0, double *c6, long nclass, long *class_ids, double *table) {
   pair_data_grimme_type *pair_data;
   pair_data = malloc(sizeof(pair_data_grimme_type));
   (*pair_pot).pair_data = pair_data;
@@ -277,12 +1544,24 @@ void pair_data_grimme_init(pair_pot_type *pair_pot, double *r0, double *c6) {
     (*pair_pot).pair_fn = pair_fn_grimme;
     (*pair_data).r0 = r0;
     (*pair_data).c6 = c6;
+    (*pair_data).nclass = nclass;
+    (*pair_data).class_ids = class_ids;
+    (*pair_data).table = table;
   }
 }
 
 double pair_fn_grimme(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart) {
 // E = -1.1*damp(r)*c6/r**6 met damp(r)=1.0/(1.0+exp(-20*(r/r0-1.0))) [Grimme2006]
+  long i;
   double r0, c6, exponent, f, d6, e;
+  pair_data_grimme_type *pd;
+  pd = (pair_data_grimme_type*)pair_data;
+  if ((*pd).table != NULL) {
+    i = 2*((*pd).class_ids[center_index]*(*pd).nclass + (*pd).class_ids[other_index]);
+    r0 = (*pd).table[i];
+    c6 = (*pd).table[i+1];
+    goto compute;
+  }
   r0 = (
     (*(pair_data_grimme_type*)pair_data).r0[center_index]+
     (*(pair_data_grimme_type*)pair_data).r0[other_index]
@@ -291,6 +1570,7 @@ double pair_fn_grimme(void *pair_data, long center_index, long other_index, doub
     (*(pair_data_grimme_type*)pair_data).c6[center_index]*
     (*(pair_data_grimme_type*)pair_data).c6[other_index]
   );
+compute:
   exponent = exp(-20.0*(d/r0-1.0));
   f = 1.0/(1.0+exponent);
   d6 = d*d*d;
@@ -304,16 +1584,17 @@ double pair_fn_grimme(void *pair_data, long center_index, long other_index, doub
 
 
 
-void pair_data_exprep_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *amp_cross, double *b_cross) {
+void pair_data_exprep_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *cross) {
   pair_data_exprep_type *pair_data;
   pair_data = malloc(sizeof(pair_data_exprep_type));
   (*pair_pot).pair_data = pair_data;
   if (pair_data != NULL) {
     (*pair_pot).pair_fn = pair_fn_exprep;
+    (*pair_pot).pair_batch_fn = pair_batch_fn_exprep;
+    (*pair_pot).pair_batch_fn_mixed = pair_batch_fn_exprep_mixed;
     (*pair_data).nffatype = nffatype;
     (*pair_data).ffatype_ids = ffatype_ids;
-    (*pair_data).amp_cross = amp_cross;
-    (*pair_data).b_cross = b_cross;
+    (*pair_data).cross = cross;
   }
 }
 
@@ -323,9 +1604,9 @@ double pair_fn_exprep(void *pair_data, long center_index, long other_index, doub
   pair_data_exprep_type *pd;
   pd = (pair_data_exprep_type*)pair_data;
   i = (*pd).ffatype_ids[center_index]*(*pd).nffatype + (*pd).ffatype_ids[other_index];
-  amp = (*pd).amp_cross[i];
+  amp = (*pd).cross[2*i];
   if (amp==0.0) goto bail;
-  b = (*pd).b_cross[i];
+  b = (*pd).cross[2*i+1];
   if (b==0.0) goto bail;
   e = amp*exp(-b*d);
   if (g != NULL) *g = -e*b/d;
@@ -335,7 +1616,50 @@ bail:
   return 0.0;
 }
 
-void pair_data_qmdffrep_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *amp_cross, double *b_cross) {
+PAIR_POT_SIMD
+void pair_batch_fn_exprep(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g) {
+  long i, j;
+  double e;
+  double amp[PAIR_POT_BATCH_SIZE], b[PAIR_POT_BATCH_SIZE];
+  pair_data_exprep_type *pd;
+  pd = (pair_data_exprep_type*)pair_data;
+  for (i=0; i<n; i++) {
+    j = (*pd).ffatype_ids[centers[i]]*(*pd).nffatype + (*pd).ffatype_ids[others[i]];
+    amp[i] = (*pd).cross[2*j];
+    b[i] = (*pd).cross[2*j+1];
+  }
+  for (i=0; i<n; i++) {
+    e = amp[i]*exp(-b[i]*d[i]);
+    // Pairs without a repulsion have b equal to zero.
+    if (b[i]==0.0) e = 0.0;
+    g[i] = -e*b[i]/d[i];
+    v[i] = e;
+  }
+}
+
+PAIR_POT_SIMD
+void pair_batch_fn_exprep_mixed(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g) {
+  // Same as pair_batch_fn_exprep, with the arithmetic in single precision.
+  long i, j;
+  float e, di;
+  float amp[PAIR_POT_BATCH_SIZE], b[PAIR_POT_BATCH_SIZE];
+  pair_data_exprep_type *pd;
+  pd = (pair_data_exprep_type*)pair_data;
+  for (i=0; i<n; i++) {
+    j = (*pd).ffatype_ids[centers[i]]*(*pd).nffatype + (*pd).ffatype_ids[others[i]];
+    amp[i] = (*pd).cross[2*j];
+    b[i] = (*pd).cross[2*j+1];
+  }
+  for (i=0; i<n; i++) {
+    di = d[i];
+    e = amp[i]*expf(-b[i]*di);
+    if (b[i]==0.0f) e = 0.0f;
+    g[i] = -e*b[i]/di;
+    v[i] = e;
+  }
+}
+
+void pair_data_qmdffrep_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *cross) {
   pair_data_qmdffrep_type *pair_data;
   pair_data = malloc(sizeof(pair_data_qmdffrep_type));
   (*pair_pot).pair_data = pair_data;
@@ -343,8 +1667,7 @@ void pair_data_qmdffrep_init(pair_pot_type *pair_pot, long nffatype, long* ffaty
     (*pair_pot).pair_fn = pair_fn_qmdffrep;
     (*pair_data).nffatype = nffatype;
     (*pair_data).ffatype_ids = ffatype_ids;
-    (*pair_data).amp_cross = amp_cross;
-    (*pair_data).b_cross = b_cross;
+    (*pair_data).cross = cross;
   }
 }
 
@@ -354,9 +1677,9 @@ double pair_fn_qmdffrep(void *pair_data, long center_index, long other_index, do
   pair_data_qmdffrep_type *pd;
   pd = (pair_data_qmdffrep_type*)pair_data;
   i = (*pd).ffatype_ids[center_index]*(*pd).nffatype + (*pd).ffatype_ids[other_index];
-  amp = (*pd).amp_cross[i];
+  amp = (*pd).cross[2*i];
   if (amp==0.0) goto bail;
-  b = (*pd).b_cross[i];
+  b = (*pd).cross[2*i+1];
   if (b==0.0) goto bail;
   e = amp/d*exp(-b*d);
   if (g != NULL) *g = -(b+1/d)*e/d;
@@ -366,7 +1689,7 @@ bail:
   return 0.0;
 }
 
-void pair_data_ljcross_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *eps_cross, double *sig_cross) {
+void pair_data_ljcross_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *cross) {
   pair_data_ljcross_type *pair_data;
   pair_data = malloc(sizeof(pair_data_ljcross_type));
   (*pair_pot).pair_data = pair_data;
@@ -374,8 +1697,7 @@ void pair_data_ljcross_init(pair_pot_type *pair_pot, long nffatype, long* ffatyp
     (*pair_pot).pair_fn = pair_fn_ljcross;
     (*pair_data).nffatype = nffatype;
     (*pair_data).ffatype_ids = ffatype_ids;
-    (*pair_data).eps_cross = eps_cross;
-    (*pair_data).sig_cross = sig_cross;
+    (*pair_data).cross = cross;
   }
 }
 
@@ -387,8 +1709,8 @@ double pair_fn_ljcross(void *pair_data, long center_index, long other_index, dou
   pair_data_ljcross_type *pd;
   pd = (pair_data_ljcross_type*)pair_data;
   i = (*pd).ffatype_ids[center_index]*(*pd).nffatype + (*pd).ffatype_ids[other_index];
-  epsilon = (*pd).eps_cross[i];
-  sigma = (*pd).sig_cross[i];
+  epsilon = (*pd).cross[2*i];
+  sigma = (*pd).cross[2*i+1];
   x = sigma/d;
   x *= x;
   x *= x*x;
@@ -400,17 +1722,17 @@ double pair_fn_ljcross(void *pair_data, long center_index, long other_index, dou
 
 
 
-void pair_data_dampdisp_init(pair_pot_type *pair_pot, long nffatype, long power, long* ffatype_ids, double *cn_cross, double *b_cross) {
+void pair_data_dampdisp_init(pair_pot_type *pair_pot, long nffatype, long power, long* ffatype_ids, double *cross) {
   pair_data_dampdisp_type *pair_data;
   pair_data = malloc(sizeof(pair_data_dampdisp_type));
   (*pair_pot).pair_data = pair_data;
   if (pair_data != NULL) {
     (*pair_pot).pair_fn = pair_fn_dampdisp;
+    (*pair_pot).pair_batch_fn = pair_batch_fn_dampdisp;
     (*pair_data).nffatype = nffatype;
     (*pair_data).power = power;
     (*pair_data).ffatype_ids = ffatype_ids;
-    (*pair_data).cn_cross = cn_cross;
-    (*pair_data).b_cross = b_cross;
+    (*pair_data).cross = cross;
   }
 }
 
@@ -442,9 +1764,9 @@ double pair_fn_dampdisp(void *pair_data, long center_index, long other_index, do
   pd = (pair_data_dampdisp_type*)pair_data;
   i = (*pd).ffatype_ids[center_index]*(*pd).nffatype + (*pd).ffatype_ids[other_index];
   power = (*pd).power;
-  cn = (*pd).cn_cross[i];
+  cn = (*pd).cross[2*i];
   if (cn==0.0) return 0.0;
-  b = (*pd).b_cross[i];
+  b = (*pd).cross[2*i+1];
   if (b==0.0) {
     // without damping
     disp = 1.0;
@@ -468,8 +1790,36 @@ double pair_fn_dampdisp(void *pair_data, long center_index, long other_index, do
   }
 }
 
+PAIR_POT_SIMD
+void pair_batch_fn_dampdisp(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g) {
+  long i, j, power;
+  double damp, gdamp, disp;
+  double cn[PAIR_POT_BATCH_SIZE], b[PAIR_POT_BATCH_SIZE];
+  pair_data_dampdisp_type *pd;
+  pd = (pair_data_dampdisp_type*)pair_data;
+  power = (*pd).power;
+  for (i=0; i<n; i++) {
+    j = (*pd).ffatype_ids[centers[i]]*(*pd).nffatype + (*pd).ffatype_ids[others[i]];
+    cn[i] = (*pd).cross[2*j];
+    b[i] = (*pd).cross[2*j+1];
+  }
+  for (i=0; i<n; i++) {
+    damp = tang_toennies(b[i]*d[i], power, &gdamp);
+    // Without damping when b is zero.
+    if (b[i]==0.0) {
+      damp = 1.0;
+      gdamp = 0.0;
+    }
+    disp = 1.0;
+    for (j=0;j<power;j++) { disp *= d[i]; }
+    disp = -cn[i]/disp;
+    g[i] = (gdamp*b[i]-power/d[i]*damp)*disp/d[i];
+    v[i] = damp*disp;
+  }
+}
+
 
-void pair_data_disp68bjdamp_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *c6_cross, double *c8_cross, double *R_cross, double c6_scale, double c8_scale, double bj_a, double bj_b) {
+void pair_data_disp68bjdamp_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *cross, double c6_scale, double c8_scale, double bj_a, double bj_b) {
   pair_data_disp68bjdamp_type *pair_data;
   pair_data = malloc(sizeof(pair_data_disp68bjdamp_type));
   (*pair_pot).pair_data = pair_data;
@@ -477,9 +1827,7 @@ void pair_data_disp68bjdamp_init(pair_pot_type *pair_pot, long nffatype, long* f
     (*pair_pot).pair_fn = pair_fn_disp68bjdamp;
     (*pair_data).nffatype = nffatype;
     (*pair_data).ffatype_ids = ffatype_ids;
-    (*pair_data).c6_cross = c6_cross;
-    (*pair_data).c8_cross = c8_cross;
-    (*pair_data).R_cross = R_cross;
+    (*pair_data).cross = cross;
     (*pair_data).c6_scale = c6_scale;
     (*pair_data).c8_scale = c8_scale;
     (*pair_data).bj_a = bj_a;
@@ -494,9 +1842,9 @@ double pair_fn_disp68bjdamp(void *pair_data, long center_index, long other_index
   pair_data_disp68bjdamp_type *pd;
   pd = (pair_data_disp68bjdamp_type*)pair_data;
   i = (*pd).ffatype_ids[center_index]*(*pd).nffatype + (*pd).ffatype_ids[other_index];
-  c6 = (*pd).c6_cross[i];
-  c8 = (*pd).c8_cross[i];
-  R  = (*pd).bj_a * (*pd).R_cross[i] + (*pd).bj_b;
+  c6 = (*pd).cross[3*i];
+  c8 = (*pd).cross[3*i+1];
+  R  = (*pd).bj_a * (*pd).cross[3*i+2] + (*pd).bj_b;
   // Compute succesive powers of distance and R
   R2 = R*R;
   R4 = R2*R2;
@@ -538,6 +1886,8 @@ void pair_data_ei_init(pair_pot_type *pair_pot, double *charges, double alpha, d
   (*pair_pot).pair_data = pair_data;
   if (pair_data != NULL) {
     (*pair_pot).pair_fn = pair_fn_ei;
+    (*pair_pot).pair_batch_fn = pair_batch_fn_ei;
+    (*pair_pot).pair_batch_fn_mixed = pair_batch_fn_ei_mixed;
     (*pair_data).charges = charges;
     (*pair_data).alpha = alpha;
     (*pair_data).dielectric = dielectric;
@@ -587,6 +1937,90 @@ double pair_fn_ei(void *pair_data, long center_index, long other_index, double d
   return pot;
 }
 
+PAIR_POT_SIMD
+void pair_batch_fn_ei(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g) {
+  long i;
+  double alpha, pot, x, y;
+  double qprod[PAIR_POT_BATCH_SIZE], r_ab[PAIR_POT_BATCH_SIZE];
+  pair_data_ei_type *pd;
+  pd = (pair_data_ei_type*)pair_data;
+  alpha = (*pd).alpha;
+  for (i=0; i<n; i++) {
+    qprod[i] = (*pd).charges[centers[i]]*(*pd).charges[others[i]]/(*pd).dielectric;
+    r_ab[i] = sqrt((*pd).radii[centers[i]]*(*pd).radii[centers[i]] + (*pd).radii[others[i]]*(*pd).radii[others[i]]);
+  }
+  // Same cases as in pair_fn_ei.
+  if (alpha > 0) {
+    for (i=0; i<n; i++) {
+      x = alpha*d[i];
+      if (r_ab[i] > 0) {
+        y = d[i]/r_ab[i];
+        pot = qprod[i]/d[i]*(erfc(x) - erfc(y));
+        g[i] = (M_TWO_DIV_SQRT_PI*(exp(-y*y)/r_ab[i] - exp(-x*x)*alpha)*qprod[i] - pot)/(d[i]*d[i]);
+      } else {
+        pot = qprod[i]*erfc(x)/d[i];
+        g[i] = (-M_TWO_DIV_SQRT_PI*alpha*exp(-x*x)*qprod[i] - pot)/(d[i]*d[i]);
+      }
+      v[i] = pot;
+    }
+  } else {
+    for (i=0; i<n; i++) {
+      if (r_ab[i] > 0) {
+        y = d[i]/r_ab[i];
+        pot = qprod[i]/d[i]*erf(y);
+        g[i] = (M_TWO_DIV_SQRT_PI/r_ab[i]*exp(-y*y)*qprod[i]-pot)/(d[i]*d[i]);
+      } else {
+        pot = qprod[i]/d[i];
+        g[i] = -pot/(d[i]*d[i]);
+      }
+      v[i] = pot;
+    }
+  }
+}
+
+PAIR_POT_SIMD
+void pair_batch_fn_ei_mixed(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g) {
+  // Same as pair_batch_fn_ei, with the arithmetic in single precision.
+  long i;
+  float alpha, pot, x, y, di;
+  float qprod[PAIR_POT_BATCH_SIZE], r_ab[PAIR_POT_BATCH_SIZE];
+  pair_data_ei_type *pd;
+  pd = (pair_data_ei_type*)pair_data;
+  alpha = (*pd).alpha;
+  for (i=0; i<n; i++) {
+    qprod[i] = (*pd).charges[centers[i]]*(*pd).charges[others[i]]/(*pd).dielectric;
+    r_ab[i] = sqrt((*pd).radii[centers[i]]*(*pd).radii[centers[i]] + (*pd).radii[others[i]]*(*pd).radii[others[i]]);
+  }
+  if (alpha > 0) {
+    for (i=0; i<n; i++) {
+      di = d[i];
+      x = alpha*di;
+      if (r_ab[i] > 0) {
+        y = di/r_ab[i];
+        pot = qprod[i]/di*(erfcf(x) - erfcf(y));
+        g[i] = ((float)M_TWO_DIV_SQRT_PI*(expf(-y*y)/r_ab[i] - expf(-x*x)*alpha)*qprod[i] - pot)/(di*di);
+      } else {
+        pot = qprod[i]*erfcf(x)/di;
+        g[i] = (-(float)M_TWO_DIV_SQRT_PI*alpha*expf(-x*x)*qprod[i] - pot)/(di*di);
+      }
+      v[i] = pot;
+    }
+  } else {
+    for (i=0; i<n; i++) {
+      di = d[i];
+      if (r_ab[i] > 0) {
+        y = di/r_ab[i];
+        pot = qprod[i]/di*erff(y);
+        g[i] = ((float)M_TWO_DIV_SQRT_PI/r_ab[i]*expf(-y*y)*qprod[i]-pot)/(di*di);
+      } else {
+        pot = qprod[i]/di;
+        g[i] = -pot/(di*di);
+      }
+      v[i] = pot;
+    }
+  }
+}
+
 double pair_data_ei_get_alpha(pair_pot_type *pair_pot) {
   return (*(pair_data_ei_type*)((*pair_pot).pair_data)).alpha;
 }
@@ -596,6 +2030,68 @@ double pair_data_ei_get_dielectric(pair_pot_type *pair_pot) {
 }
 
 
+void pair_data_dsf_init(pair_pot_type *pair_pot, double *charges, double alpha, double dielectric) {
+  // The cutoff of pair_pot must be set first.
+  double rcut, x;
+  pair_data_dsf_type *pair_data;
+  pair_data = malloc(sizeof(pair_data_dsf_type));
+  (*pair_pot).pair_data = pair_data;
+  if (pair_data != NULL) {
+    (*pair_pot).pair_fn = pair_fn_dsf;
+    (*pair_pot).pair_batch_fn = pair_batch_fn_dsf;
+    (*pair_data).charges = charges;
+    (*pair_data).alpha = alpha;
+    (*pair_data).dielectric = dielectric;
+    rcut = (*pair_pot).rcut;
+    x = alpha*rcut;
+    (*pair_data).eshift = erfc(x)/rcut;
+    (*pair_data).fshift = (erfc(x)/rcut + M_TWO_DIV_SQRT_PI*alpha*exp(-x*x))/rcut;
+    (*pair_data).rcut = rcut;
+  }
+}
+
+double pair_fn_dsf(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart) {
+  double qprod, x, erfcx;
+  pair_data_dsf_type *pd;
+  pd = (pair_data_dsf_type*)pair_data;
+  qprod = (*pd).charges[center_index]*(*pd).charges[other_index]/(*pd).dielectric;
+  x = (*pd).alpha*d;
+  erfcx = erfc(x);
+  if (g != NULL) *g = qprod*((*pd).fshift - erfcx/(d*d) - M_TWO_DIV_SQRT_PI*(*pd).alpha*exp(-x*x)/d)/d;
+  return qprod*(erfcx/d - (*pd).eshift + (*pd).fshift*(d - (*pd).rcut));
+}
+
+PAIR_POT_SIMD
+void pair_batch_fn_dsf(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g) {
+  long i;
+  double alpha, eshift, fshift, rcut, x, erfcx;
+  double qprod[PAIR_POT_BATCH_SIZE];
+  pair_data_dsf_type *pd;
+  pd = (pair_data_dsf_type*)pair_data;
+  alpha = (*pd).alpha;
+  eshift = (*pd).eshift;
+  fshift = (*pd).fshift;
+  rcut = (*pd).rcut;
+  for (i=0; i<n; i++) {
+    qprod[i] = (*pd).charges[centers[i]]*(*pd).charges[others[i]]/(*pd).dielectric;
+  }
+  for (i=0; i<n; i++) {
+    x = alpha*d[i];
+    erfcx = erfc(x);
+    v[i] = qprod[i]*(erfcx/d[i] - eshift + fshift*(d[i] - rcut));
+    g[i] = qprod[i]*(fshift - erfcx/(d[i]*d[i]) - M_TWO_DIV_SQRT_PI*alpha*exp(-x*x)/d[i])/d[i];
+  }
+}
+
+double pair_data_dsf_get_alpha(pair_pot_type *pair_pot) {
+  return (*(pair_data_dsf_type*)((*pair_pot).pair_data)).alpha;
+}
+
+double pair_data_dsf_get_dielectric(pair_pot_type *pair_pot) {
+  return (*(pair_data_dsf_type*)((*pair_pot).pair_data)).dielectric;
+}
+
+
 void pair_data_eidip_init(pair_pot_type *pair_pot, double *charges, double *dipoles, double alpha, double *radii, double *radii2) {
   pair_data_eidip_type *pair_data;
   pair_data = malloc(sizeof(pair_data_eidip_type));
@@ -718,7 +2214,10 @@ double pair_data_eidip_get_alpha(pair_pot_type *pair_pot) {
   return (*(pair_data_eidip_type*)((*pair_pot).pair_data)).alpha;
 }
 
-void pair_data_eislater1s1scorr_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double *slater1s_Z) {
+void pair_data_eislater1s1scorr_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double *slater1s_Z, long nclass, long *class_ids, double *class_widths, slater_coeffs_type *table) {
+  // When table is not NULL, the width-dependent coefficients are computed
+  // here for each pair of classes of atoms with identical Slater widths.
+  long i, j;
   pair_data_eislater1s1scorr_type *pair_data;
   pair_data = malloc(sizeof(pair_data_eislater1s1scorr_type));
   (*pair_pot).pair_data = pair_data;
@@ -727,10 +2226,30 @@ void pair_data_eislater1s1scorr_init(pair_pot_type *pair_pot, double *slater1s_w
       (*pair_data).widths = slater1s_widths;
       (*pair_data).N = slater1s_N;
       (*pair_data).Z = slater1s_Z;
+      (*pair_data).nclass = nclass;
+      (*pair_data).class_ids = class_ids;
+      (*pair_data).table = table;
+      if (table != NULL) {
+        for (i=0; i<nclass; i++) {
+          for (j=0; j<nclass; j++) {
+            slaterei_0_0_coeffs(&table[i*nclass+j], class_widths[i], class_widths[j]);
+          }
+        }
+      }
   }
 }
 
 double pair_fn_eislater1s1scorr(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart) {
+  pair_data_eislater1s1scorr_type *pd;
+  pd = (pair_data_eislater1s1scorr_type*)pair_data;
+  if ((*pd).table != NULL) {
+    return slater_eval(
+      &(*pd).table[(*pd).class_ids[center_index]*(*pd).nclass + (*pd).class_ids[other_index]],
+      (*pd).N[center_index], (*pd).Z[center_index],
+      (*pd).N[other_index], (*pd).Z[other_index],
+      d, g
+    );
+  }
   return slaterei_0_0(
     (*(pair_data_eislater1s1scorr_type*)pair_data).widths[center_index],
     (*(pair_data_eislater1s1scorr_type*)pair_data).widths[other_index],
@@ -743,7 +2262,19 @@ double pair_fn_eislater1s1scorr(void *pair_data, long center_index, long other_i
 }
 
 
-void pair_data_eislater1sp1spcorr_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double *slater1s_Z, double *slater1p_widths, double *slater1p_N, double *slater1p_Z) {
+// The kinds of radial functions in the table of eislater1sp1spcorr
+#define SLATER_KIND_0_0 0
+#define SLATER_KIND_1_0 1
+#define SLATER_KIND_1_1 2
+#define SLATER_KIND_1_1_KRONECKER 3
+
+void pair_data_eislater1sp1spcorr_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double *slater1s_Z, double *slater1p_widths, double *slater1p_N, double *slater1p_Z, long nclass, long *class_ids_s, long *class_ids_p, double *class_widths, slater_coeffs_type *table) {
+  // When table is not NULL, the width-dependent coefficients are computed
+  // here for each kind of radial function and for each pair of classes of
+  // sites with identical Slater widths. The 1s and 1p sites share the same
+  // classes.
+  long i, j;
+  double a, b;
   pair_data_eislater1sp1spcorr_type *pair_data;
   pair_data = malloc(sizeof(pair_data_eislater1sp1spcorr_type));
   (*pair_pot).pair_data = pair_data;
@@ -755,81 +2286,124 @@ void pair_data_eislater1sp1spcorr_init(pair_pot_type *pair_pot, double *slater1s
       (*pair_data).widthsp = slater1p_widths;
       (*pair_data).Np = slater1p_N;
       (*pair_data).Zp = slater1p_Z;
+      (*pair_data).nclass = nclass;
+      (*pair_data).class_ids_s = class_ids_s;
+      (*pair_data).class_ids_p = class_ids_p;
+      (*pair_data).table = table;
+      if (table != NULL) {
+        for (i=0; i<nclass; i++) {
+          for (j=0; j<nclass; j++) {
+            a = class_widths[i];
+            b = class_widths[j];
+            slaterei_0_0_coeffs(&table[(SLATER_KIND_0_0*nclass + i)*nclass + j], a, b);
+            slaterei_1_0_coeffs(&table[(SLATER_KIND_1_0*nclass + i)*nclass + j], a, b);
+            slaterei_1_1_coeffs(&table[(SLATER_KIND_1_1*nclass + i)*nclass + j], a, b);
+            slaterei_1_1_kronecker_coeffs(&table[(SLATER_KIND_1_1_KRONECKER*nclass + i)*nclass + j], a, b);
+          }
+        }
+      }
+  }
+}
+
+static slater_coeffs_type *pair_data_eislater1sp1spcorr_coeffs(pair_data_eislater1sp1spcorr_type *pd, long kind, long index_a, int p_a, long index_b, int p_b, slater_coeffs_type *work) {
+  // Return the coefficients of a radial function between sites a and b. The
+  // index of a site refers to the 1s arrays, or to the 1p arrays when p is
+  // non-zero. Without a table, the coefficients are computed in work.
+  double a, b;
+  if ((*pd).table != NULL) {
+    return &(*pd).table[(
+      kind*(*pd).nclass + (p_a ? (*pd).class_ids_p : (*pd).class_ids_s)[index_a]
+    )*(*pd).nclass + (p_b ? (*pd).class_ids_p : (*pd).class_ids_s)[index_b]];
+  }
+  a = (p_a ? (*pd).widthsp : (*pd).widthss)[index_a];
+  b = (p_b ? (*pd).widthsp : (*pd).widthss)[index_b];
+  switch (kind) {
+    case SLATER_KIND_0_0: slaterei_0_0_coeffs(work, a, b); break;
+    case SLATER_KIND_1_0: slaterei_1_0_coeffs(work, a, b); break;
+    case SLATER_KIND_1_1: slaterei_1_1_coeffs(work, a, b); break;
+    default: slaterei_1_1_kronecker_coeffs(work, a, b);
   }
+  return work;
 }
 
 double pair_fn_eislater1sp1spcorr(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart) {
   long i,j;
-  double a,Na,Za,b,Nb,Zb;
+  double Na,Za,Nb,Zb;
   double pot = 0.0;
   double pot_tmp, sg;
+  slater_coeffs_type work;
+  slater_coeffs_type *c;
+  pair_data_eislater1sp1spcorr_type *pd;
+  pd = (pair_data_eislater1sp1spcorr_type*)pair_data;
   // Monopole-Monopole interaction
-  a  = (*(pair_data_eislater1sp1spcorr_type*)pair_data).widthss[center_index];
-  Na = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Ns[center_index];
-  Za = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Zs[center_index];
-  b  = (*(pair_data_eislater1sp1spcorr_type*)pair_data).widthss[other_index];
-  Nb = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Ns[other_index];
-  Zb = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Zs[other_index];
-  pot += slaterei_0_0(a,b,Na,Za,Nb,Zb,d,g);
+  Na = (*pd).Ns[center_index];
+  Za = (*pd).Zs[center_index];
+  Nb = (*pd).Ns[other_index];
+  Zb = (*pd).Zs[other_index];
+  c = pair_data_eislater1sp1spcorr_coeffs(pd, SLATER_KIND_0_0, center_index, 0, other_index, 0, &work);
+  pot += slater_eval(c,Na,Za,Nb,Zb,d,g);
 
   // Monopole-Dipole interactions
   for (i=0;i<3;i++) {
-    a  = (*(pair_data_eislater1sp1spcorr_type*)pair_data).widthss[center_index];
-    Na = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Ns[center_index];
-    Za = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Zs[center_index];
-    b  = (*(pair_data_eislater1sp1spcorr_type*)pair_data).widthsp[3*other_index + i];
-    Nb = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Np[3*other_index + i];
-    Zb = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Zp[3*other_index + i];
+    Na = (*pd).Ns[center_index];
+    Za = (*pd).Zs[center_index];
+    Nb = (*pd).Np[3*other_index + i];
+    Zb = (*pd).Zp[3*other_index + i];
+    c = pair_data_eislater1sp1spcorr_coeffs(pd, SLATER_KIND_1_0, 3*other_index + i, 1, center_index, 0, &work);
     if ( g != NULL ) {
-      sg = 0.0;
-      pot_tmp = slaterei_1_0(b,a,Nb,Zb,Na,Za,d,&sg);
+      pot_tmp = slater_eval(c,Nb,Zb,Na,Za,d,&sg);
       *g += -delta[i]*sg;
       g_cart[i] += -pot_tmp;
-    } else pot_tmp = slaterei_1_0(b,a,Nb,Zb,Na,Za,d,NULL);
+    } else pot_tmp = slater_eval(c,Nb,Zb,Na,Za,d,NULL);
     pot += -delta[i]*pot_tmp;
   }
   // Dipole-Monopole interactions
   for (i=0;i<3;i++) {
-    a  = (*(pair_data_eislater1sp1spcorr_type*)pair_data).widthsp[3*center_index+i];
-    Na = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Np[3*center_index+i];
-    Za = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Zp[3*center_index+i];
-    b  = (*(pair_data_eislater1sp1spcorr_type*)pair_data).widthss[other_index];
-    Nb = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Ns[other_index];
-    Zb = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Zs[other_index];
+    Na = (*pd).Np[3*center_index+i];
+    Za = (*pd).Zp[3*center_index+i];
+    Nb = (*pd).Ns[other_index];
+    Zb = (*pd).Zs[other_index];
+    c = pair_data_eislater1sp1spcorr_coeffs(pd, SLATER_KIND_1_0, 3*center_index + i, 1, other_index, 0, &work);
     if ( g != NULL ) {
-      sg = 0.0;
-      pot_tmp = slaterei_1_0(a,b,Na,Za,Nb,Zb,d,&sg);
+      pot_tmp = slater_eval(c,Na,Za,Nb,Zb,d,&sg);
       *g += delta[i]*sg;
       g_cart[i] += pot_tmp;
-    } else pot_tmp = slaterei_1_0(a,b,Na,Za,Nb,Zb,d,NULL);
+    } else pot_tmp = slater_eval(c,Na,Za,Nb,Zb,d,NULL);
     pot += delta[i]*pot_tmp;
   }
   // Dipole-Dipole interactions
   for (i=0;i<3;i++) {
     for (j=0;j<3;j++) {
-      a  = (*(pair_data_eislater1sp1spcorr_type*)pair_data).widthsp[3*center_index + i];
-      Na = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Np[3*center_index + i];
-      Za = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Zp[3*center_index + i];
-      b  = (*(pair_data_eislater1sp1spcorr_type*)pair_data).widthsp[3*other_index + j];
-      Nb = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Np[3*other_index + j];
-      Zb = (*(pair_data_eislater1sp1spcorr_type*)pair_data).Zp[3*other_index + j];
-
+      Na = (*pd).Np[3*center_index + i];
+      Za = (*pd).Zp[3*center_index + i];
+      Nb = (*pd).Np[3*other_index + j];
+      Zb = (*pd).Zp[3*other_index + j];
+      c = pair_data_eislater1sp1spcorr_coeffs(pd, SLATER_KIND_1_1, 3*center_index + i, 1, 3*other_index + j, 1, &work);
       if ( g != NULL ) {
-        sg = 0.0;
-        pot_tmp = slaterei_1_1(a,b,Na,Za,Nb,Zb,d,&sg);
+        pot_tmp = slater_eval(c,Na,Za,Nb,Zb,d,&sg);
         *g += -delta[i]*delta[j]*sg;
         g_cart[i] += -delta[j]*pot_tmp;
         g_cart[j] += -delta[i]*pot_tmp;
-      } else pot_tmp = slaterei_1_1(a,b,Na,Za,Nb,Zb,d,NULL);
+      } else pot_tmp = slater_eval(c,Na,Za,Nb,Zb,d,NULL);
       pot += -delta[i]*delta[j]*pot_tmp;
-      if (i==j) pot += slaterei_1_1_kronecker(a,b,Na,Za,Nb,Zb,d,g);
+      if (i==j) {
+        c = pair_data_eislater1sp1spcorr_coeffs(pd, SLATER_KIND_1_1_KRONECKER, 3*center_index + i, 1, 3*other_index + j, 1, &work);
+        if ( g != NULL ) {
+          pot += slater_eval(c,Na,Za,Nb,Zb,d,&sg);
+          *g += sg;
+        } else pot += slater_eval(c,Na,Za,Nb,Zb,d,NULL);
+      }
     }
   }
   return pot;
 }
 
 
-void pair_data_olpslater1s1s_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double ex_scale, double corr_a, double corr_b, double corr_c ) {
+void pair_data_olpslater1s1s_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double ex_scale, double corr_a, double corr_b, double corr_c, long nclass, long *class_ids, double *class_widths, slater_coeffs_type *table) {
+  // When table is not NULL, the width-dependent coefficients, multiplied by
+  // ex_scale, are computed here for each pair of classes of atoms with
+  // identical Slater widths.
+  long i, j;
   pair_data_olpslater1s1s_type *pair_data;
   pair_data = malloc(sizeof(pair_data_olpslater1s1s_type));
   (*pair_pot).pair_data = pair_data;
@@ -841,6 +2415,17 @@ void pair_data_olpslater1s1s_init(pair_pot_type *pair_pot, double *slater1s_widt
     (*pair_data).corr_a = corr_a;
     (*pair_data).corr_b = corr_b;
     (*pair_data).corr_c = corr_c;
+    (*pair_data).nclass = nclass;
+    (*pair_data).class_ids = class_ids;
+    (*pair_data).table = table;
+    if (table != NULL) {
+      for (i=0; i<nclass; i++) {
+        for (j=0; j<nclass; j++) {
+          slaterolp_0_0_coeffs(&table[i*nclass+j], class_widths[i], class_widths[j]);
+          slater_coeffs_scale(&table[i*nclass+j], ex_scale);
+        }
+      }
+    }
   }
 }
 
@@ -848,21 +2433,35 @@ void pair_data_olpslater1s1s_init(pair_pot_type *pair_pot, double *slater1s_widt
 double pair_fn_olpslater1s1s(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart) {
   double a, b, Na, Nb;
   double pot = 0.0;
-  a  = (*(pair_data_olpslater1s1s_type*)pair_data).widths[center_index];
-  b  = (*(pair_data_olpslater1s1s_type*)pair_data).widths[other_index];
+  pair_data_olpslater1s1s_type *pd;
+  pd = (pair_data_olpslater1s1s_type*)pair_data;
   Na = (*(pair_data_olpslater1s1s_type*)pair_data).N[center_index];
   Nb = (*(pair_data_olpslater1s1s_type*)pair_data).N[other_index];
-  // Overlap between unit Slater densities
-  pot += slaterolp_0_0(a, b, d, g);
-  // Multiply with scaling factor and populations
-  pot *= Na*Nb*(*(pair_data_olpslater1s1s_type*)pair_data).ex_scale;
-  if (g != NULL) *g *= Na*Nb*(*(pair_data_olpslater1s1s_type*)pair_data).ex_scale;
+  if ((*pd).table != NULL) {
+    // Overlap, multiplied with the scaling factor and populations
+    pot = slater_eval(
+      &(*pd).table[(*pd).class_ids[center_index]*(*pd).nclass + (*pd).class_ids[other_index]],
+      Na, 0.0, Nb, 0.0, d, g
+    );
+  } else {
+    a  = (*(pair_data_olpslater1s1s_type*)pair_data).widths[center_index];
+    b  = (*(pair_data_olpslater1s1s_type*)pair_data).widths[other_index];
+    // Overlap between unit Slater densities
+    pot += slaterolp_0_0(a, b, d, g);
+    // Multiply with scaling factor and populations
+    pot *= Na*Nb*(*(pair_data_olpslater1s1s_type*)pair_data).ex_scale;
+    if (g != NULL) *g *= Na*Nb*(*(pair_data_olpslater1s1s_type*)pair_data).ex_scale;
+  }
   // Apply corrections to the overlap expression
   double ca = (*(pair_data_olpslater1s1s_type*)pair_data).corr_a;
   double cb = (*(pair_data_olpslater1s1s_type*)pair_data).corr_b;
   double cc = (*(pair_data_olpslater1s1s_type*)pair_data).corr_c;
   if ( cc != 0.0 ) pot *= 1.0 + cc*(Na+Nb);
-  if ( ca != 0.0 ) pot *= 1.0 - exp(ca-cb*d/sqrt(a*b));
+  if ( ca != 0.0 ) {
+    a  = (*(pair_data_olpslater1s1s_type*)pair_data).widths[center_index];
+    b  = (*(pair_data_olpslater1s1s_type*)pair_data).widths[other_index];
+    pot *= 1.0 - exp(ca-cb*d/sqrt(a*b));
+  }
   if (g != NULL) {
     if ( cc != 0.0 ) *g *= 1.0 + cc*(Na+Nb);
     if ( ca != 0.0 ) {
@@ -890,7 +2489,11 @@ double pair_data_olpslater1s1s_get_corr_c(pair_pot_type *pair_pot) {
 }
 
 
-void pair_data_chargetransferslater1s1s_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double ct_scale, double width_power) {
+void pair_data_chargetransferslater1s1s_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double ct_scale, double width_power, long nclass, long *class_ids, double *class_widths, slater_coeffs_type *table) {
+  // When table is not NULL, the width-dependent coefficients, multiplied by
+  // -ct_scale and the power of the widths, are computed here for each pair of
+  // classes of atoms with identical Slater widths.
+  long i, j;
   pair_data_chargetransferslater1s1s_type *pair_data;
   pair_data = malloc(sizeof(pair_data_chargetransferslater1s1s_type));
   (*pair_pot).pair_data = pair_data;
@@ -900,6 +2503,17 @@ void pair_data_chargetransferslater1s1s_init(pair_pot_type *pair_pot, double *sl
     (*pair_data).N = slater1s_N;
     (*pair_data).ct_scale = ct_scale;
     (*pair_data).width_power = width_power;
+    (*pair_data).nclass = nclass;
+    (*pair_data).class_ids = class_ids;
+    (*pair_data).table = table;
+    if (table != NULL) {
+      for (i=0; i<nclass; i++) {
+        for (j=0; j<nclass; j++) {
+          slaterolp_0_0_coeffs(&table[i*nclass+j], class_widths[i], class_widths[j]);
+          slater_coeffs_scale(&table[i*nclass+j], -ct_scale*pow(1.0/class_widths[i]/class_widths[j], width_power));
+        }
+      }
+    }
   }
 }
 
@@ -907,6 +2521,14 @@ void pair_data_chargetransferslater1s1s_init(pair_pot_type *pair_pot, double *sl
 double pair_fn_chargetransferslater1s1s(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart) {
   double a, b, Na, Nb, fac;
   double pot = 0.0;
+  pair_data_chargetransferslater1s1s_type *pd;
+  pd = (pair_data_chargetransferslater1s1s_type*)pair_data;
+  if ((*pd).table != NULL) {
+    return slater_eval(
+      &(*pd).table[(*pd).class_ids[center_index]*(*pd).nclass + (*pd).class_ids[other_index]],
+      (*pd).N[center_index], 0.0, (*pd).N[other_index], 0.0, d, g
+    );
+  }
   a  = (*(pair_data_olpslater1s1s_type*)pair_data).widths[center_index];
   b  = (*(pair_data_olpslater1s1s_type*)pair_data).widths[other_index];
   Na = (*(pair_data_olpslater1s1s_type*)pair_data).N[center_index];
@@ -937,3 +2559,56 @@ double pair_data_chargetransferslater1s1s_get_ct_scale(pair_pot_type *pair_pot)
 double pair_data_chargetransferslater1s1s_get_width_power(pair_pot_type *pair_pot) {
   return (*(pair_data_chargetransferslater1s1s_type*)((*pair_pot).pair_data)).width_power;
 }
+
+
+void pair_data_tabulated_init(pair_pot_type *pair_pot, pair_pot_type *source, long nffatype, long *ffatype_ids, long *table_index, long npoint, double rmin, double *tables) {
+  pair_data_tabulated_type *pair_data;
+  pair_data = malloc(sizeof(pair_data_tabulated_type));
+  (*pair_pot).pair_data = pair_data;
+  if (pair_data != NULL) {
+    (*pair_pot).pair_fn = pair_fn_tabulated;
+    (*pair_data).source = source;
+    (*pair_data).nffatype = nffatype;
+    (*pair_data).ffatype_ids = ffatype_ids;
+    (*pair_data).table_index = table_index;
+    (*pair_data).npoint = npoint;
+    (*pair_data).rmin = rmin;
+    (*pair_data).h = ((*source).rcut - rmin)/(npoint - 1);
+    (*pair_data).tables = tables;
+  }
+}
+
+double pair_fn_tabulated(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart) {
+  long i;
+  double t, v0, v1, m0, m1, c2, c3;
+  double *row;
+  pair_data_tabulated_type *pd;
+  pd = (pair_data_tabulated_type*)pair_data;
+  // Short distances are not tabulated. The original potential is used.
+  if (d < (*pd).rmin) return pair_pot_eval((*pd).source, center_index, other_index, d, delta, g);
+  i = (*pd).table_index[(*pd).ffatype_ids[center_index]*(*pd).nffatype + (*pd).ffatype_ids[other_index]];
+  // Locate the grid interval and the fractional position t in [0,1].
+  t = (d - (*pd).rmin)/(*pd).h;
+  row = (*pd).tables + 2*i*(*pd).npoint;
+  i = (long)t;
+  if (i > (*pd).npoint - 2) i = (*pd).npoint - 2;
+  t -= i;
+  row += 2*i;
+  // Cubic Hermite interpolation of the energy and its derivative.
+  v0 = row[0];
+  m0 = row[1]*(*pd).h;
+  v1 = row[2];
+  m1 = row[3]*(*pd).h;
+  c2 = 3.0*(v1 - v0) - 2.0*m0 - m1;
+  c3 = 2.0*(v0 - v1) + m0 + m1;
+  if (g != NULL) *g = (m0 + t*(2.0*c2 + 3.0*t*c3))/((*pd).h*d);
+  return v0 + t*(m0 + t*(c2 + t*c3));
+}
+
+long pair_data_tabulated_get_npoint(pair_pot_type *pair_pot) {
+  return (*(pair_data_tabulated_type*)((*pair_pot).pair_data)).npoint;
+}
+
+double pair_data_tabulated_get_rmin(pair_pot_type *pair_pot) {
+  return (*(pair_data_tabulated_type*)((*pair_pot).pair_data)).rmin;
+}
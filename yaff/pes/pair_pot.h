@@ -30,11 +30,22 @@
 #include "slater.h"
 
 
+// Batch kernels (pair_batch_fn_type) compute the energies and the
+// derivatives towards the distance divided by the distance for at most
+// PAIR_POT_BATCH_SIZE pairs at once. Some potentials also have a mixed
+// precision batch kernel, which does the arithmetic in single precision. Its
+// results are still accumulated in double precision.
+#define PAIR_POT_BATCH_SIZE 64
+
 typedef double (*pair_fn_type)(void*, long, long, double, double*, double*, double*);
+typedef void (*pair_batch_fn_type)(void*, long, long*, long*, double*, double*, double*);
 
 typedef struct {
   void *pair_data;
   pair_fn_type pair_fn;
+  pair_batch_fn_type pair_batch_fn;
+  pair_batch_fn_type pair_batch_fn_mixed;
+  int mixed;
   double rcut;
   trunc_scheme_type *trunc_scheme;
 } pair_pot_type;
@@ -49,6 +60,10 @@ typedef struct {
 pair_pot_type* pair_pot_new(void);
 void pair_pot_free(pair_pot_type *pair_pot);
 int pair_pot_ready(pair_pot_type *pair_pot);
+int pair_pot_batched(pair_pot_type *pair_pot);
+int pair_pot_specialized(pair_pot_type *pair_pot);
+int pair_pot_get_mixed(pair_pot_type *pair_pot);
+int pair_pot_set_mixed(pair_pot_type *pair_pot, int mixed);
 double pair_pot_get_rcut(pair_pot_type *pair_pot);
 void pair_pot_set_rcut(pair_pot_type *pair_pot, double rcut);
 void pair_pot_set_trunc_scheme(pair_pot_type *pair_pot, trunc_scheme_type *trunc_sceme);
@@ -56,69 +71,113 @@ void pair_data_free(pair_pot_type *pair_pot);
 
 double pair_pot_compute(neigh_row_type *neighs,
                         long nneigh, scaling_row_type *scaling,
-                        long scaling_size, pair_pot_type *pair_pot,
-                        double *gpos, double* vtens);
+                        long scaling_size, double *scales,
+                        pair_pot_type *pair_pot, long natom, double *gpos,
+                        double* vtens);
+
+double pair_pot_compute_compact(neigh_compact_row_type *neighs,
+                                long nneigh, double *pos, cell_type *unitcell,
+                                scaling_row_type *stab, long nstab,
+                                double *scales, pair_pot_type *pair_pot,
+                                long natom, double *gpos, double* vtens);
+
+double pair_pot_compute_tiles(neigh_tile_type *tiles, long ntile,
+                              long *clusters, long *wrap, double *pos,
+                              cell_type *unitcell, scaling_row_type *stab,
+                              long nstab, double *scales,
+                              pair_pot_type *pair_pot, long natom,
+                              double *gpos, double* vtens);
+
+double pair_pot_compute_lambdas(neigh_row_type *neighs, long nneigh,
+                                scaling_row_type *stab, long nstab,
+                                double *scales, pair_pot_type *pair_pot,
+                                long *group, double lambda, long nlambda,
+                                double *lambdas, double sc_alpha,
+                                double sc_sigma, double *energies, long natom,
+                                double *gpos, double* vtens);
+double pair_pot_compute_fused(void *neighs, long nneigh, int format,
+                              double *pos, cell_type *unitcell,
+                              long *clusters, long *wrap,
+                              pair_pot_type **pair_pots, long npot,
+                              double *scales, double *energies, long natom,
+                              double *gpos, double* vtens);
+
+void pair_pot_sample(pair_pot_type *pair_pot, long *centers, long *others,
+                     double *distances, long n, double *energies,
+                     double *derivatives);
 
 
 typedef struct {
   double *sigma;
   double *epsilon;
+  long nclass;
+  long *class_ids;
+  double *table; // (sigma, epsilon) interleaved for each pair of classes
 } pair_data_lj_type;
 
-void pair_data_lj_init(pair_pot_type *pair_pot, double *sigma, double *epsilon);
+void pair_data_lj_init(pair_pot_type *pair_pot, double *sigma, double *epsilon, long nclass, long *class_ids, double *table);
 double pair_fn_lj(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
+void pair_batch_fn_lj(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g);
+void pair_batch_fn_lj_mixed(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g);
 
 
 typedef struct {
   double *sigma;
   double *epsilon;
   int *onlypauli;
+  long nclass;
+  long *class_ids;
+  double *table; // (sigma, epsilon, onlypauli) interleaved for each pair of classes
 } pair_data_mm3_type;
 
-void pair_data_mm3_init(pair_pot_type *pair_pot, double *sigma, double *epsilon, int *onlypauli);
+void pair_data_mm3_init(pair_pot_type *pair_pot, double *sigma, double *epsilon, int *onlypauli, long nclass, long *class_ids, double *table);
 double pair_fn_mm3(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
+void pair_batch_fn_mm3(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g);
+void pair_batch_fn_mm3_mixed(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g);
 
 
 typedef struct {
   double *r0;
   double *c6;
+  long nclass;
+  long *class_ids;
+  double *table; // (r0, c6) interleaved for each pair of classes
 } pair_data_grimme_type;
 
-void pair_data_grimme_init(pair_pot_type *pair_pot, double *r0, double *c6);
+void pair_data_grimme_init(pair_pot_type *pair_pot, double *r0, double *c6, long nclass, long *class_ids, double *table);
 double pair_fn_grimme(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
 
 
 typedef struct {
   long nffatype;
   long *ffatype_ids;
-  double *amp_cross;
-  double *b_cross;
+  double *cross; // (amp, b) interleaved for each pair of atom types
 } pair_data_exprep_type;
 
-void pair_data_exprep_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *amp_cross, double *b_cross);
+void pair_data_exprep_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *cross);
 double pair_fn_exprep(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
+void pair_batch_fn_exprep(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g);
+void pair_batch_fn_exprep_mixed(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g);
 
 
 typedef struct {
   long nffatype;
   long *ffatype_ids;
-  double *amp_cross;
-  double *b_cross;
+  double *cross; // (amp, b) interleaved for each pair of atom types
 } pair_data_qmdffrep_type;
 
-void pair_data_qmdffrep_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *amp_cross, double *b_cross);
+void pair_data_qmdffrep_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *cross);
 double pair_fn_qmdffrep(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
 
 
 typedef struct {
   long nffatype;
   long *ffatype_ids;
-  double *eps_cross;
-  double *sig_cross;
+  double *cross; // (eps, sig) interleaved for each pair of atom types
 } pair_data_ljcross_type;
 
 
-void pair_data_ljcross_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *eps_cross, double *sig_cross);
+void pair_data_ljcross_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *cross);
 double pair_fn_ljcross(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
 
 
@@ -126,27 +185,25 @@ typedef struct {
   long nffatype;
   long power;
   long *ffatype_ids;
-  double *cn_cross;
-  double *b_cross;
+  double *cross; // (cn, b) interleaved for each pair of atom types
 } pair_data_dampdisp_type;
 
-void pair_data_dampdisp_init(pair_pot_type *pair_pot, long nffatype, long power, long* ffatype_ids, double *cn_cross, double *b_cross);
+void pair_data_dampdisp_init(pair_pot_type *pair_pot, long nffatype, long power, long* ffatype_ids, double *cross);
 double pair_fn_dampdisp(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
+void pair_batch_fn_dampdisp(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g);
 
 
 typedef struct {
   long nffatype;
   long *ffatype_ids;
-  double *c6_cross;
-  double *c8_cross;
-  double *R_cross;
+  double *cross; // (c6, c8, R) interleaved for each pair of atom types
   double c6_scale;
   double c8_scale;
   double bj_a;
   double bj_b;
 } pair_data_disp68bjdamp_type;
 
-void pair_data_disp68bjdamp_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *c6_cross, double *c8_cross, double *R_cross, double c6_scale, double c8_scale, double bj_a, double bj_b);
+void pair_data_disp68bjdamp_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *cross, double c6_scale, double c8_scale, double bj_a, double bj_b);
 double pair_fn_disp68bjdamp(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
 double pair_data_disp68bjdamp_get_c6_scale(pair_pot_type *pair_pot);
 double pair_data_disp68bjdamp_get_c8_scale(pair_pot_type *pair_pot);
@@ -163,10 +220,28 @@ typedef struct {
 
 void pair_data_ei_init(pair_pot_type *pair_pot, double *charges, double alpha, double dielectric, double *radii);
 double pair_fn_ei(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
+void pair_batch_fn_ei(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g);
+void pair_batch_fn_ei_mixed(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g);
 double pair_data_ei_get_alpha(pair_pot_type *pair_pot);
 double pair_data_ei_get_dielectric(pair_pot_type *pair_pot);
 
 
+typedef struct {
+  double *charges;
+  double alpha;
+  double dielectric;
+  double rcut;
+  double eshift;  // erfc(alpha*rcut)/rcut
+  double fshift;  // minus the derivative of erfc(alpha*d)/d at rcut
+} pair_data_dsf_type;
+
+void pair_data_dsf_init(pair_pot_type *pair_pot, double *charges, double alpha, double dielectric);
+double pair_fn_dsf(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
+void pair_batch_fn_dsf(void *pair_data, long n, long *centers, long *others, double *d, double *v, double *g);
+double pair_data_dsf_get_alpha(pair_pot_type *pair_pot);
+double pair_data_dsf_get_dielectric(pair_pot_type *pair_pot);
+
+
 typedef struct {
   double *charges;
   double *dipoles;
@@ -187,9 +262,13 @@ typedef struct {
   double *Np;
   double *Zp;
   double *widthsp;
+  long nclass;
+  long *class_ids_s;
+  long *class_ids_p;
+  slater_coeffs_type *table; // for 0_0, 1_0, 1_1 and 1_1_kronecker, for each pair of width classes
 } pair_data_eislater1sp1spcorr_type;
 
-void pair_data_eislater1sp1spcorr_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double *slater1s_Z, double *slater1p_widths, double *slater1p_N, double *slater1p_Z);
+void pair_data_eislater1sp1spcorr_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double *slater1s_Z, double *slater1p_widths, double *slater1p_N, double *slater1p_Z, long nclass, long *class_ids_s, long *class_ids_p, double *class_widths, slater_coeffs_type *table);
 double pair_fn_eislater1sp1spcorr(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
 
 
@@ -197,9 +276,12 @@ typedef struct {
   double *N;
   double *Z;
   double *widths;
+  long nclass;
+  long *class_ids;
+  slater_coeffs_type *table; // for each pair of width classes
 } pair_data_eislater1s1scorr_type;
 
-void pair_data_eislater1s1scorr_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double *slater1s_Z);
+void pair_data_eislater1s1scorr_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double *slater1s_Z, long nclass, long *class_ids, double *class_widths, slater_coeffs_type *table);
 double pair_fn_eislater1s1scorr(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
 
 
@@ -210,9 +292,12 @@ typedef struct {
   double corr_a;
   double corr_b;
   double corr_c;
+  long nclass;
+  long *class_ids;
+  slater_coeffs_type *table; // for each pair of width classes, including ex_scale
 } pair_data_olpslater1s1s_type;
 
-void pair_data_olpslater1s1s_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double ex_scale, double corr_a, double corr_b, double corr_c);
+void pair_data_olpslater1s1s_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double ex_scale, double corr_a, double corr_b, double corr_c, long nclass, long *class_ids, double *class_widths, slater_coeffs_type *table);
 double pair_fn_olpslater1s1s(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
 double pair_data_olpslater1s1s_get_ex_scale(pair_pot_type *pair_pot);
 double pair_data_olpslater1s1s_get_corr_a(pair_pot_type *pair_pot);
@@ -225,10 +310,30 @@ typedef struct {
   double *widths;
   double ct_scale;
   double width_power;
+  long nclass;
+  long *class_ids;
+  slater_coeffs_type *table; // for each pair of width classes, including ct_scale and the width power
 } pair_data_chargetransferslater1s1s_type;
 
-void pair_data_chargetransferslater1s1s_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double ct_scale, double width_power);
+void pair_data_chargetransferslater1s1s_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double ct_scale, double width_power, long nclass, long *class_ids, double *class_widths, slater_coeffs_type *table);
 double pair_fn_chargetransferslater1s1s(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
 double pair_data_chargetransferslater1s1s_get_ct_scale(pair_pot_type *pair_pot);
 double pair_data_chargetransferslater1s1s_get_width_power(pair_pot_type *pair_pot);
+
+
+typedef struct {
+  pair_pot_type *source;
+  long nffatype;
+  long *ffatype_ids;
+  long *table_index;
+  long npoint;
+  double rmin;
+  double h;
+  double *tables;
+} pair_data_tabulated_type;
+
+void pair_data_tabulated_init(pair_pot_type *pair_pot, pair_pot_type *source, long nffatype, long *ffatype_ids, long *table_index, long npoint, double rmin, double *tables);
+double pair_fn_tabulated(void *pair_data, long center_index, long other_index, double d, double *delta, double *g, double *g_cart);
+long pair_data_tabulated_get_npoint(pair_pot_type *pair_pot);
+double pair_data_tabulated_get_rmin(pair_pot_type *pair_pot);
 #endif
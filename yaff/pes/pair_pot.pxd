@@ -24,6 +24,7 @@
 
 
 cimport numpy as np
+cimport cell
 cimport nlist
 cimport truncation
 cimport slater
@@ -40,6 +41,10 @@ cdef extern from "pair_pot.h":
     pair_pot_type* pair_pot_new()
     void pair_pot_free(pair_pot_type *pair_pot)
     bint pair_pot_ready(pair_pot_type *pair_pot)
+    bint pair_pot_batched(pair_pot_type *pair_pot)
+    bint pair_pot_specialized(pair_pot_type *pair_pot)
+    bint pair_pot_get_mixed(pair_pot_type *pair_pot)
+    bint pair_pot_set_mixed(pair_pot_type *pair_pot, bint mixed)
     double pair_pot_get_rcut(pair_pot_type *pair_pot)
     void pair_pot_set_rcut(pair_pot_type *pair_pot, double rcut)
     void pair_pot_set_trunc_scheme(pair_pot_type *pair_pot, truncation.trunc_scheme_type *trunc_sceme)
@@ -47,24 +52,60 @@ cdef extern from "pair_pot.h":
 
     double pair_pot_compute(nlist.neigh_row_type* neighs, long nneigh,
                             scaling_row_type* scaling, long scaling_size,
-                            pair_pot_type* pair_pot, double *gpos,
-                            double* vtens)
+                            double *scales, pair_pot_type* pair_pot,
+                            long natom, double *gpos, double* vtens) nogil
 
-    void pair_data_lj_init(pair_pot_type *pair_pot, double *sigma, double *epsilon)
+    double pair_pot_compute_compact(nlist.neigh_compact_row_type* neighs,
+                                    long nneigh, double *pos,
+                                    cell.cell_type* unitcell,
+                                    scaling_row_type* scaling, long scaling_size,
+                                    double *scales, pair_pot_type* pair_pot,
+                                    long natom, double *gpos, double* vtens) nogil
 
-    void pair_data_mm3_init(pair_pot_type *pair_pot, double *sigma, double *epsilon, int *onlypauli)
+    double pair_pot_compute_lambdas(nlist.neigh_row_type* neighs, long nneigh,
+                                    scaling_row_type* scaling, long scaling_size,
+                                    double *scales, pair_pot_type* pair_pot,
+                                    long *group, double lam, long nlambda,
+                                    double *lambdas, double sc_alpha,
+                                    double sc_sigma, double *energies,
+                                    long natom, double *gpos,
+                                    double* vtens) nogil
 
-    void pair_data_grimme_init(pair_pot_type *pair_pot, double *r0, double *c6)
+    double pair_pot_compute_fused(void *neighs, long nneigh, int format,
+                                  double *pos, cell.cell_type* unitcell,
+                                  long *clusters, long *wrap,
+                                  pair_pot_type **pair_pots, long npot,
+                                  double *scales, double *energies,
+                                  long natom, double *gpos,
+                                  double* vtens) nogil
 
-    void pair_data_exprep_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *amp_cross, double *b_cross)
+    double pair_pot_compute_tiles(nlist.neigh_tile_type* tiles, long ntile,
+                                  long *clusters, long *wrap, double *pos,
+                                  cell.cell_type* unitcell,
+                                  scaling_row_type* scaling, long scaling_size,
+                                  double *scales, pair_pot_type* pair_pot,
+                                  long natom, double *gpos,
+                                  double* vtens) nogil
 
-    void pair_data_qmdffrep_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *amp_cross, double *b_cross)
+    void pair_pot_sample(pair_pot_type *pair_pot, long *centers, long *others,
+                         double *distances, long n, double *energies,
+                         double *derivatives)
 
-    void pair_data_ljcross_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *eps_cross, double *sig_cross)
+    void pair_data_lj_init(pair_pot_type *pair_pot, double *sigma, double *epsilon, long nclass, long *class_ids, double *table)
 
-    void pair_data_dampdisp_init(pair_pot_type *pair_pot, long nffatype, long power, long* ffatype_ids, double *cn_cross, double *b_cross)
+    void pair_data_mm3_init(pair_pot_type *pair_pot, double *sigma, double *epsilon, int *onlypauli, long nclass, long *class_ids, double *table)
 
-    void pair_data_disp68bjdamp_init(pair_pot_type *pair_pot, long nffatype, long* ffaype_ids, double *c6_cross, double *c8_cross, double *R_cross, double c6_scale, double c8_scale, double bj_a, double bj_b)
+    void pair_data_grimme_init(pair_pot_type *pair_pot, double *r0, double *c6, long nclass, long *class_ids, double *table)
+
+    void pair_data_exprep_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *cross)
+
+    void pair_data_qmdffrep_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *cross)
+
+    void pair_data_ljcross_init(pair_pot_type *pair_pot, long nffatype, long* ffatype_ids, double *cross)
+
+    void pair_data_dampdisp_init(pair_pot_type *pair_pot, long nffatype, long power, long* ffatype_ids, double *cross)
+
+    void pair_data_disp68bjdamp_init(pair_pot_type *pair_pot, long nffatype, long* ffaype_ids, double *cross, double c6_scale, double c8_scale, double bj_a, double bj_b)
     double pair_data_disp68bjdamp_get_c6_scale(pair_pot_type *pair_pot)
     double pair_data_disp68bjdamp_get_c8_scale(pair_pot_type *pair_pot)
     double pair_data_disp68bjdamp_get_bj_a(pair_pot_type *pair_pot)
@@ -74,19 +115,27 @@ cdef extern from "pair_pot.h":
     double pair_data_ei_get_alpha(pair_pot_type *pair_pot)
     double pair_data_ei_get_dielectric(pair_pot_type *pair_pot)
 
+    void pair_data_dsf_init(pair_pot_type *pair_pot, double *charges, double alpha, double dielectric)
+    double pair_data_dsf_get_alpha(pair_pot_type *pair_pot)
+    double pair_data_dsf_get_dielectric(pair_pot_type *pair_pot)
+
     void pair_data_eidip_init(pair_pot_type *pair_pot, double *charges, double *dipoles, double alpha, double *radii, double *radii2)
     double pair_data_eidip_get_alpha(pair_pot_type *pair_pot)
 
-    void pair_data_eislater1s1scorr_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double *slater1s_Z)
+    void pair_data_eislater1s1scorr_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double *slater1s_Z, long nclass, long *class_ids, double *class_widths, slater.slater_coeffs_type *table)
 
-    void pair_data_eislater1sp1spcorr_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double *slater1s_Z, double *slater1p_widths, double *slater1p_N, double *slater1p_Z)
+    void pair_data_eislater1sp1spcorr_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double *slater1s_Z, double *slater1p_widths, double *slater1p_N, double *slater1p_Z, long nclass, long *class_ids_s, long *class_ids_p, double *class_widths, slater.slater_coeffs_type *table)
 
-    void pair_data_olpslater1s1s_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double ex_scale, double corr_a, double corr_b, double corr_c)
+    void pair_data_olpslater1s1s_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double ex_scale, double corr_a, double corr_b, double corr_c, long nclass, long *class_ids, double *class_widths, slater.slater_coeffs_type *table)
     double pair_data_olpslater1s1s_get_ex_scale(pair_pot_type *pair_pot)
     double pair_data_olpslater1s1s_get_corr_a(pair_pot_type *pair_pot)
     double pair_data_olpslater1s1s_get_corr_b(pair_pot_type *pair_pot)
     double pair_data_olpslater1s1s_get_corr_c(pair_pot_type *pair_pot)
 
-    void pair_data_chargetransferslater1s1s_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double ct_scale, double width_power)
+    void pair_data_chargetransferslater1s1s_init(pair_pot_type *pair_pot, double *slater1s_widths, double *slater1s_N, double ct_scale, double width_power, long nclass, long *class_ids, double *class_widths, slater.slater_coeffs_type *table)
     double pair_data_chargetransferslater1s1s_get_ct_scale(pair_pot_type *pair_pot)
     double pair_data_chargetransferslater1s1s_get_width_power(pair_pot_type *pair_pot)
+
+    void pair_data_tabulated_init(pair_pot_type *pair_pot, pair_pot_type *source, long nffatype, long *ffatype_ids, long *table_index, long npoint, double rmin, double *tables)
+    long pair_data_tabulated_get_npoint(pair_pot_type *pair_pot)
+    double pair_data_tabulated_get_rmin(pair_pot_type *pair_pot)
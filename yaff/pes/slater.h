@@ -21,12 +21,44 @@
 //
 // --
 
+#ifndef YAFF_SLATER_H
+#define YAFF_SLATER_H
+
 #include <stdlib.h>
 #include <math.h>
 #include "constants.h"
 
+// The largest number of polynomial coefficients in a radial Slater function.
+#define SLATER_NPOLY 10
+
+// The part of a radial Slater function that only depends on the two widths a
+// and b. The radial function is
+//   [exp(-d/a)*(Na*Zb*P1(d) + Na*Nb*P3a(d)) + exp(-d/b)*(Za*Nb*P2(d) + Na*Nb*P3b(d))]/d^n
+// where P1, P2, P3a and P3b are polynomials in d of degree deg.
+typedef struct {
+  double ia;   // 1/a
+  double ib;   // 1/b
+  long n;
+  long deg;
+  int expb;    // zero when all terms with exp(-d/b) vanish
+  double p1[SLATER_NPOLY];
+  double p2[SLATER_NPOLY];
+  double p3a[SLATER_NPOLY];
+  double p3b[SLATER_NPOLY];
+} slater_coeffs_type;
+
+void slaterei_0_0_coeffs(slater_coeffs_type *c, double a, double b);
+void slaterei_1_0_coeffs(slater_coeffs_type *c, double a, double b);
+void slaterei_1_1_coeffs(slater_coeffs_type *c, double a, double b);
+void slaterei_1_1_kronecker_coeffs(slater_coeffs_type *c, double a, double b);
+void slaterolp_0_0_coeffs(slater_coeffs_type *c, double a, double b);
+void slater_coeffs_scale(slater_coeffs_type *c, double fac);
+double slater_eval(slater_coeffs_type *c, double Na, double Za, double Nb, double Zb, double d, double *g);
+
 double slaterei_0_0(double a, double b, double Na, double Za, double Nb, double Zb, double d, double *g);
 double slaterei_1_0(double a, double b, double Na, double Za, double Nb, double Zb, double d, double *g);
 double slaterei_1_1(double a, double b, double Na, double Za, double Nb, double Zb, double d, double *g);
 double slaterei_1_1_kronecker(double a, double b, double Na, double Za, double Nb, double Zb, double d, double *g);
 double slaterolp_0_0(double a, double b, double d, double *g);
+
+#endif
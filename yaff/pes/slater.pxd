@@ -28,6 +28,17 @@ cimport nlist
 cimport truncation
 
 cdef extern from "slater.h":
+    ctypedef struct slater_coeffs_type:
+        double ia
+        double ib
+
+    void slaterei_0_0_coeffs(slater_coeffs_type *c, double a, double b)
+    void slaterei_1_0_coeffs(slater_coeffs_type *c, double a, double b)
+    void slaterei_1_1_coeffs(slater_coeffs_type *c, double a, double b)
+    void slaterei_1_1_kronecker_coeffs(slater_coeffs_type *c, double a, double b)
+    void slaterolp_0_0_coeffs(slater_coeffs_type *c, double a, double b)
+    double slater_eval(slater_coeffs_type *c, double Na, double Za, double Nb, double Zb, double d, double *g)
+
     double slaterei_0_0(double a, double b, double Na, double Za, double Nb, double Zb, double d, double *g)
     double slaterei_1_0(double a, double b, double Na, double Za, double Nb, double Zb, double d, double *g)
     double slaterei_1_1(double a, double b, double Na, double Za, double Nb, double Zb, double d, double *g)
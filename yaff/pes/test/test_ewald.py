@@ -26,8 +26,15 @@
 from __future__ import division
 from __future__ import print_function
 
+import os
+import subprocess
+import sys
+from io import BytesIO
+
 import numpy as np
 
+from molmod import angstrom
+
 from yaff import *
 
 from yaff.test.common import get_system_water32, get_system_quartz
@@ -204,6 +211,109 @@ def test_ewald_gpos_vtens_reci_quartz():
         check_vtens_part(system, part_ewald_reci)
 
 
+def test_ewald_reci_direct_sum_quartz():
+    # compare with a straightforward evaluation of the structure factors
+    system = get_system_quartz()
+    system.pos += np.random.randint(-3, 4, (system.natom, 1))*system.cell.rvecs[0]
+    alpha = 0.2
+    gcut = alpha/0.3
+    part_ewald_reci = ForcePartEwaldReciprocal(system, alpha, gcut=gcut)
+    gpos = np.zeros(system.pos.shape)
+    energy = part_ewald_reci.compute(gpos)
+    gmax = part_ewald_reci.gmax
+    energy_ref = 0.0
+    gpos_ref = np.zeros(system.pos.shape)
+    for g0 in range(-gmax[0], gmax[0]+1):
+        for g1 in range(-gmax[1], gmax[1]+1):
+            for g2 in range(-gmax[2], gmax[2]+1):
+                g = np.dot([g0, g1, g2], system.cell.gvecs)
+                ksq = 4*np.pi**2*np.dot(g, g)
+                if ksq == 0 or ksq > 4*np.pi**2*gcut**2:
+                    continue
+                x = 2*np.pi*np.dot(system.pos, g)
+                sfac = (system.charges*np.exp(1j*x)).sum()
+                fac = 2*np.pi/system.cell.volume*np.exp(-0.25*ksq/alpha**2)/ksq
+                energy_ref += fac*abs(sfac)**2
+                tmp = system.charges*(np.cos(x)*sfac.imag - np.sin(x)*sfac.real)
+                gpos_ref += 4*np.pi*fac*np.outer(tmp, g)
+    assert abs(energy - energy_ref) < 1e-10*abs(energy_ref)
+    assert abs(gpos - gpos_ref).max() < 1e-10*abs(gpos_ref).max()
+
+
+def _compute_ewald_reci_threads(nthread):
+    # Compute the reciprocal term in a fresh interpreter, because the number of
+    # OpenMP threads is fixed when the runtime starts.
+    script = (
+        'import sys\n'
+        'import numpy as np\n'
+        'from yaff import ForcePartEwaldReciprocal\n'
+        'from yaff.test.common import get_system_water32\n'
+        'system = get_system_water32().supercell(2, 2, 2)\n'
+        'part = ForcePartEwaldReciprocal(system, 0.2, gcut=0.2/0.5, dielectric=1.4)\n'
+        'nrow = len(set(zip(part.kvecs["g0"], part.kvecs["g1"])))\n'
+        'gpos = np.zeros(system.pos.shape)\n'
+        'vtens = np.zeros((3, 3))\n'
+        'energy = part.compute(gpos, vtens)\n'
+        'result = np.concatenate([[nrow*system.natom, energy], gpos.ravel(), vtens.ravel()])\n'
+        'np.save(sys.stdout.buffer, result)\n'
+    )
+    env = dict(os.environ)
+    env['OMP_NUM_THREADS'] = str(nthread)
+    return np.load(BytesIO(subprocess.check_output([sys.executable, '-c', script], env=env)))
+
+
+def test_ewald_reci_chunks_water32():
+    # With several threads, the rows of k-vectors are distributed over chunks
+    # that are reduced afterwards. The results must agree with a single chunk.
+    result1 = _compute_ewald_reci_threads(1)
+    # At least four chunks of EWALD_CHUNK_MIN (4096) atom-rows.
+    assert result1[0] >= 4*4096
+    for nthread in 2, 4:
+        result = _compute_ewald_reci_threads(nthread)
+        assert abs(result[1] - result1[1]) < 1e-12*abs(result1[1])
+        assert abs(result[2:-9] - result1[2:-9]).max() < 1e-12*abs(result1[2:-9]).max()
+        assert abs(result[-9:] - result1[-9:]).max() < 1e-12*abs(result1[-9:]).max()
+
+
+def test_ewald_kvecs_quartz():
+    system = get_system_quartz()
+    alpha = 0.2
+    gcut = alpha/0.5
+    part_ewald_reci = ForcePartEwaldReciprocal(system, alpha, gcut=gcut)
+    kvecs = part_ewald_reci.kvecs
+    gmax = part_ewald_reci.gmax
+    # compare with all k-vectors within the cutoff
+    gs = np.array([
+        [g0, g1, g2]
+        for g0 in range(-gmax[0], gmax[0]+1)
+        for g1 in range(-gmax[1], gmax[1]+1)
+        for g2 in range(-gmax[2], gmax[2]+1)
+    ])
+    ks = 2*np.pi*np.dot(gs, system.cell.gvecs)
+    ksq = (ks**2).sum(axis=1)
+    mask = (ksq > 0) & (ksq <= (2*np.pi*gcut)**2)
+    assert 2*len(kvecs) == mask.sum()
+    gs_table = np.array([kvecs['g0'], kvecs['g1'], kvecs['g2']]).T
+    ks_table = np.array([kvecs['k0'], kvecs['k1'], kvecs['k2']]).T
+    assert abs(np.dot(gs_table, 2*np.pi*system.cell.gvecs) - ks_table).max() < 1e-10
+    ksq_table = (ks_table**2).sum(axis=1)
+    prefac = 4*np.pi/system.cell.volume*np.exp(-0.25*ksq_table/alpha**2)/ksq_table
+    assert abs(kvecs['prefac'] - prefac).max() < 1e-10*prefac.max()
+    # the table is refreshed when the cell changes
+    energy1 = part_ewald_reci.compute()
+    system.cell.update_rvecs(system.cell.rvecs*1.01)
+    energy2 = part_ewald_reci.compute()
+    assert abs(kvecs['k0'] - part_ewald_reci.kvecs['k0']*1.01).max() < 1e-10
+    assert energy1 != energy2
+    # the table is refreshed when alpha or gcut change
+    for name, value in ('alpha', 0.3), ('gcut', 0.3/0.5):
+        setattr(part_ewald_reci, name, value)
+        energy3 = part_ewald_reci.compute()
+        reference = ForcePartEwaldReciprocal(system, part_ewald_reci.alpha, gcut=part_ewald_reci.gcut)
+        assert (part_ewald_reci.gmax == reference.gmax).all()
+        assert energy3 == reference.compute()
+
+
 def test_ewald_reci_volchange_quartz():
     system = get_system_quartz()
     dielectric = 1.2
@@ -225,6 +335,45 @@ def test_ewald_reci_volchange_quartz():
         assert abs(energy1 - energy2) < 1e-5*abs(energy1)
 
 
+def check_pme_reci(system, alpha, dielectric=1.0):
+    part_ewald_reci = ForcePartEwaldReciprocal(system, alpha, gcut=alpha/0.3, dielectric=dielectric)
+    gpos1 = np.zeros(system.pos.shape)
+    energy1 = part_ewald_reci.compute(gpos1)
+    part_pme = ForcePartPME(system, alpha, gcut=alpha/0.5, dielectric=dielectric, order=8)
+    gpos2 = np.zeros(system.pos.shape)
+    energy2 = part_pme.compute(gpos2)
+    assert abs(energy1 - energy2) < 1e-6*abs(energy1)
+    assert abs(gpos1 - gpos2).max() < 1e-4*abs(gpos1).max()
+
+
+def test_pme_reci_water32():
+    system = get_system_water32()
+    for alpha in 0.05, 0.1, 0.2:
+        check_pme_reci(system, alpha, 1.4)
+
+
+def test_pme_reci_quartz():
+    system = get_system_quartz().supercell(2, 2, 2)
+    for alpha in 0.1, 0.2, 0.5:
+        check_pme_reci(system, alpha)
+
+
+def test_pme_gpos_vtens_water32():
+    system = get_system_water32()
+    for alpha in 0.05, 0.1, 0.2:
+        part_pme = ForcePartPME(system, alpha, gcut=alpha/0.75, dielectric=1.4)
+        check_gpos_part(system, part_pme)
+        check_vtens_part(system, part_pme)
+
+
+def test_pme_gpos_vtens_quartz():
+    system = get_system_quartz()
+    for alpha in 0.1, 0.2, 0.5:
+        part_pme = ForcePartPME(system, alpha, gcut=alpha/0.5)
+        check_gpos_part(system, part_pme)
+        check_vtens_part(system, part_pme)
+
+
 def test_ewald_corr_quartz():
     from scipy.special import erf
     system = get_system_quartz().supercell(2, 2, 2)
@@ -244,6 +393,39 @@ def test_ewald_corr_quartz():
         assert abs(energy1 - energy2) < 1e-10
 
 
+def test_dsf_corr_quartz():
+    from scipy.special import erf, erfc
+    system = get_system_quartz().supercell(2, 2, 2)
+    rcut = 8.0*angstrom
+    for alpha in 0.05, 0.1, 0.2:
+        scalings = Scalings(system, np.random.uniform(0.1, 0.9), np.random.uniform(0.1, 0.9), np.random.uniform(0.1, 0.9))
+        part_dsf_corr = ForcePartDSFCorrection(system, alpha, rcut, scalings)
+        energy1 = part_dsf_corr.compute()
+        eshift = erfc(alpha*rcut)/rcut
+        fshift = eshift/rcut + 2*alpha/np.sqrt(np.pi)*np.exp(-(alpha*rcut)**2)/rcut
+        # self-interaction corrections
+        energy2 = -(0.5*eshift + alpha/np.sqrt(np.pi))*(system.charges**2).sum()
+        # corrections from scaled interactions within the cutoff
+        for i0, i1, scale, nbond in scalings.stab:
+            delta = system.pos[i0] - system.pos[i1]
+            system.cell.mic(delta)
+            d = np.linalg.norm(delta)
+            if d >= rcut:
+                continue
+            pot = -erf(alpha*d)/d - eshift + fshift*(d - rcut)
+            energy2 += pot*(1-scale)*system.charges[i0]*system.charges[i1]
+        assert abs(energy1 - energy2) < 1e-10
+
+
+def test_dsf_gpos_vtens_corr_water32():
+    system = get_system_water32()
+    scalings = Scalings(system, 0.0, 0.0, 0.5)
+    for alpha in 0.05, 0.1, 0.2:
+        part_dsf_corr = ForcePartDSFCorrection(system, alpha, 9.0*angstrom, scalings, dielectric=0.8)
+        check_gpos_part(system, part_dsf_corr)
+        check_vtens_part(system, part_dsf_corr)
+
+
 def test_ewald_gpos_vtens_corr_water32():
     system = get_system_water32()
     scalings = Scalings(system, 0.0, 0.0, 0.5)
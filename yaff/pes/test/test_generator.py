@@ -34,6 +34,8 @@ from yaff import *
 from yaff.log import log
 
 from yaff.test.common import get_system_water32, get_system_glycine, get_system_formaldehyde
+from yaff.pes.test.common import check_gpos_part, check_vtens_part, check_gpos_ff, \
+    check_vtens_ff
 
 
 def test_generator_water32_bondharm():
@@ -691,6 +693,107 @@ def test_generator_water32_fixq():
     assert abs(energy - energy2) < 1e-3
 
 
+def test_generator_water32_fixq_pme():
+    system = get_system_water32()
+    fn_pars = pkg_resources.resource_filename(__name__, '../../data/test/parameters_water_fixq.txt')
+    ff = ForceField.generate(system, fn_pars)
+    ff2 = ForceField.generate(system, fn_pars, reci_ei='pme')
+    assert len(ff2.parts) == 4
+    assert isinstance(ff2.part_ewald_reci, ForcePartPME)
+    assert ff2.part_ewald_reci.alpha == ff2.part_pair_ei.pair_pot.alpha
+    energy = ff.part_ewald_reci.compute()
+    energy2 = ff2.part_ewald_reci.compute()
+    assert abs(energy - energy2) < 1e-4*abs(energy)
+
+
+def test_generator_water32_fixq_dsf():
+    system = get_system_water32()
+    fn_pars = pkg_resources.resource_filename(__name__, '../../data/test/parameters_water_fixq.txt')
+    ff2 = ForceField.generate(system, fn_pars, rcut=12.0*angstrom, alpha_scale=3.0, reci_ei='dsf')
+    assert len(ff2.parts) == 2
+    assert isinstance(ff2.part_pair_dsf.pair_pot, PairPotDSF)
+    assert isinstance(ff2.part_dsf_cor, ForcePartDSFCorrection)
+    assert ff2.part_pair_dsf.pair_pot.alpha == 3.0/(12.0*angstrom)
+    assert ff2.part_dsf_cor.alpha == ff2.part_pair_dsf.pair_pot.alpha
+    # Compare with an Ewald summation of the same point charges
+    alpha = ff2.part_dsf_cor.alpha
+    scalings = Scalings(system, 0.0, 0.0, 1.0)
+    nlist = NeighborList(system)
+    part_pair = ForcePartPair(system, nlist, scalings, PairPotEI(system.charges, alpha, 12.0*angstrom))
+    parts = [
+        part_pair, ForcePartEwaldReciprocal(system, alpha, gcut=1.5*alpha),
+        ForcePartEwaldCorrection(system, alpha, scalings),
+    ]
+    ff = ForceField(system, parts, nlist)
+    energy = ff.compute()
+    energy2 = ff2.compute()
+    assert abs(energy - energy2) < 1e-2*abs(energy)
+
+
+def test_generator_glycine_fixq_dsf():
+    system = get_system_glycine()
+    fn_pars = pkg_resources.resource_filename(__name__, '../../data/test/parameters_glycine_fixq.txt')
+    ff = ForceField.generate(system, fn_pars, rcut=6.0*angstrom, alpha_scale=2.0, reci_ei='dsf')
+    assert len(ff.parts) == 2
+    assert isinstance(ff.part_pair_dsf.pair_pot, PairPotDSF)
+    assert isinstance(ff.part_dsf_cor, ForcePartDSFCorrection)
+    assert ff.part_pair_dsf.pair_pot.alpha == 2.0/(6.0*angstrom)
+    assert ff.part_dsf_cor.alpha == ff.part_pair_dsf.pair_pot.alpha
+    assert ff.part_dsf_cor.rcut == 6.0*angstrom
+    # The correction must also be consistent for 0D systems.
+    check_gpos_part(system, ff.part_dsf_cor)
+    check_vtens_part(system, ff.part_dsf_cor)
+    check_gpos_ff(ff)
+    check_vtens_ff(ff)
+
+
+def test_generator_glycine_fixq_fmm():
+    system = get_system_glycine()
+    fn_pars = pkg_resources.resource_filename(__name__, '../../data/test/parameters_glycine_fixq.txt')
+    ff = ForceField.generate(system, fn_pars, reci_ei='fmm', fmm_order=1, fmm_theta=1e-3)
+    assert len(ff.parts) == 1
+    part_ei_fmm = ff.part_ei_fmm
+    assert isinstance(part_ei_fmm, ForcePartEIFMM)
+    assert part_ei_fmm.order == 1
+    assert part_ei_fmm.theta == 1e-3
+    # Compare with point charges without cutoff. The small opening angle
+    # makes the tree code exact for such a small molecule.
+    scalings = Scalings(system, 0.0, 0.0, 1.0)
+    nlist = NeighborList(system)
+    pair_pot = PairPotEI(system.charges, 0.0, 100.0*angstrom)
+    part_pair = ForcePartPair(system, nlist, scalings, pair_pot)
+    ff2 = ForceField(system, [part_pair], nlist)
+    energy = ff.compute()
+    energy2 = ff2.compute()
+    assert abs(energy - energy2) < 1e-10
+
+
+def test_tune_ewald_water32():
+    system = get_system_water32()
+    fn_pars = pkg_resources.resource_filename(__name__, '../../data/test/parameters_water_fixq.txt')
+    ff_ref = ForceField.generate(system, fn_pars, rcut=40.0, alpha_scale=6.0, gcut_scale=1.5)
+    gpos_ref = np.zeros(system.pos.shape)
+    ff_ref.compute(gpos_ref)
+    force_error = 1e-4
+    rcuts = np.array([8.0, 10.0])*angstrom
+    ff_args = tune_ewald(system, force_error, rcuts, nrep=1, skin=1.0)
+    assert isinstance(ff_args, FFArgs)
+    assert ff_args.rcut in rcuts
+    assert ff_args.skin == 1.0
+    alpha = ff_args.alpha_scale/ff_args.rcut
+    gcut = ff_args.gcut_scale*alpha
+    error_real, error_reci = estimate_ewald_errors(system, alpha, ff_args.rcut, gcut)
+    assert abs(error_real - force_error/np.sqrt(2)) < 1e-3*force_error
+    assert abs(error_reci - force_error/np.sqrt(2)) < 1e-3*force_error
+    # the actual error must be below the target
+    parameters = Parameters.from_file(fn_pars)
+    apply_generators(system, parameters, ff_args)
+    ff = ForceField(system, ff_args.parts, ff_args.nlist)
+    gpos = np.zeros(system.pos.shape)
+    ff.compute(gpos)
+    assert np.sqrt(((gpos - gpos_ref)**2).sum()/system.natom) < force_error
+
+
 def test_generator_glycine_fixq():
     system = get_system_glycine()
     fn_pars = pkg_resources.resource_filename(__name__, '../../data/test/parameters_glycine_fixq.txt')
@@ -822,3 +925,160 @@ def test_generator_formaldehyde_oopangle():
     assert (part_valence.vlist.vtab['kind'][0:3] == 5).all()
     assert abs(part_valence.vlist.vtab['par0'] - 1.0*kjmol).all() < 1e-10
     assert part_valence.vlist.nv == 3
+
+
+def check_generator_atom_order(system, fn_pars, **kwargs):
+    ff1 = ForceField.generate(system, fn_pars, **kwargs)
+    ff2 = ForceField.generate(system, fn_pars, atom_order='morton', **kwargs)
+    assert ff1.permutation is None
+    assert sorted(ff2.permutation) == list(range(system.natom))
+    assert (ff2.permutation != np.arange(system.natom)).any()
+    assert abs(ff2.internal_system.pos - system.pos[ff2.permutation]).max() == 0.0
+    for i in range(2):
+        gpos1 = np.zeros(system.pos.shape, float)
+        vtens1 = np.zeros((3, 3), float)
+        energy1 = ff1.compute(gpos1, vtens1)
+        gpos2 = np.zeros(system.pos.shape, float)
+        vtens2 = np.zeros((3, 3), float)
+        energy2 = ff2.compute(gpos2, vtens2)
+        assert abs(energy1 - energy2) < 1e-10*abs(energy1)
+        assert abs(gpos1 - gpos2).max() < 1e-10*abs(gpos1).max()
+        assert abs(vtens1 - vtens2).max() < 1e-10*abs(vtens1).max()
+        # Displace the atoms and compare again.
+        pos = system.pos + np.random.normal(0, 0.01, system.pos.shape)
+        ff1.update_pos(pos)
+        ff2.update_pos(pos)
+
+
+def test_generator_water32_atom_order():
+    system = get_system_water32().supercell(2, 2, 1)
+    fn_pars = pkg_resources.resource_filename(__name__, '../../data/test/parameters_water.txt')
+    check_generator_atom_order(system, fn_pars, rcut=6*angstrom, alpha_scale=2.8, gcut_scale=1.0)
+    assert system.charges is not None
+
+
+def test_generator_glycine_atom_order():
+    system = get_system_glycine()
+    fn_pars = pkg_resources.resource_filename(__name__, '../../data/test/parameters_glycine_fixq.txt')
+    check_generator_atom_order(system, fn_pars)
+
+
+def test_generator_water32_atom_order_nobonds():
+    system = get_system_water32().supercell(2, 2, 1)
+    system = System(
+        numbers=system.numbers, pos=system.pos, ffatypes=system.ffatypes,
+        ffatype_ids=system.ffatype_ids, rvecs=system.cell.rvecs,
+    )
+    assert system.bonds is None
+    fn_pars = pkg_resources.resource_filename(__name__, '../../data/test/parameters_water_lj.txt')
+    parameters = Parameters.from_file(fn_pars)
+    # Without bonds, the non-bonding interactions can not be scaled.
+    scale = parameters['LJ']['SCALE']
+    scale.lines = [(counter, data.split()[0] + ' 1.0') for counter, data in scale.lines]
+    check_generator_atom_order(system, parameters, rcut=6*angstrom)
+    ff = ForceField.generate(system, parameters, rcut=6*angstrom, atom_order='morton')
+    assert ff.internal_system.bonds is None
+
+
+def test_get_morton_order():
+    system = get_system_water32().supercell(3, 3, 3)
+    permutation = get_morton_order(system)
+    assert sorted(permutation) == list(range(system.natom))
+    # Consecutive atoms in the new order should be much closer than in the
+    # order of the supercell.
+    def mean_distance(pos):
+        result = 0.0
+        for i in range(len(pos) - 1):
+            delta = pos[i+1] - pos[i]
+            system.cell.mic(delta)
+            result += np.linalg.norm(delta)
+        return result/(len(pos) - 1)
+    assert mean_distance(system.pos[permutation]) < mean_distance(system.pos)
+
+
+def test_generator_water32_fused_pair():
+    system = get_system_water32()
+    fn_pars = pkg_resources.resource_filename(__name__, '../../data/test/parameters_water.txt')
+    ff1 = ForceField.generate(system, fn_pars, rcut=9*angstrom)
+    ff2 = ForceField.generate(system, fn_pars, rcut=9*angstrom, fused_pair=True)
+    npair = len([part for part in ff1.parts if isinstance(part, ForcePartPair)])
+    assert npair > 1
+    assert len(ff2.parts) == len(ff1.parts) - npair + 1
+    assert isinstance(ff2.part_pair_composite, ForcePartPairComposite)
+    assert ff2.part_pair_ei in ff2.part_pair_composite.parts
+    gpos1 = np.zeros(system.pos.shape, float)
+    vtens1 = np.zeros((3, 3), float)
+    energy1 = ff1.compute(gpos1, vtens1)
+    gpos2 = np.zeros(system.pos.shape, float)
+    vtens2 = np.zeros((3, 3), float)
+    energy2 = ff2.compute(gpos2, vtens2)
+    assert abs(energy1 - energy2) < 1e-10*abs(energy1)
+    assert abs(gpos1 - gpos2).max() < 1e-10*abs(gpos1).max()
+    assert abs(vtens1 - vtens2).max() < 1e-10*abs(vtens1).max()
+    # The energies of the individual pair potentials are still available.
+    for part1 in ff1.parts:
+        part2 = getattr(ff2, 'part_%s' % part1.name)
+        assert abs(part1.energy - part2.energy) <= 1e-10*abs(part1.energy)
+
+
+def test_generator_water32_tabulate_pair():
+    system = get_system_water32()
+    fn_pars = pkg_resources.resource_filename(__name__, '../../data/test/parameters_water.txt')
+    ff1 = ForceField.generate(system, fn_pars, rcut=9*angstrom)
+    ff2 = ForceField.generate(system, fn_pars, rcut=9*angstrom, tabulate_pair=1e-9)
+    assert isinstance(ff2.part_pair_ei.pair_pot, PairPotTabulated)
+    assert ff2.part_pair_ei.pair_pot.source.alpha == ff1.part_pair_ei.pair_pot.alpha
+    gpos1 = np.zeros(system.pos.shape, float)
+    vtens1 = np.zeros((3, 3), float)
+    energy1 = ff1.compute(gpos1, vtens1)
+    gpos2 = np.zeros(system.pos.shape, float)
+    vtens2 = np.zeros((3, 3), float)
+    energy2 = ff2.compute(gpos2, vtens2)
+    assert abs(energy1 - energy2) < 1e-6*abs(energy1)
+    assert abs(gpos1 - gpos2).max() < 1e-6*abs(gpos1).max()
+    assert abs(vtens1 - vtens2).max() < 1e-6*abs(vtens1).max()
+
+
+def test_generator_water32_tabulate_pair_get_part():
+    system = get_system_water32()
+    fn_pars = pkg_resources.resource_filename(__name__, '../../data/test/parameters_water.txt')
+    ff_args = FFArgs(rcut=9*angstrom, tabulate_pair=1e-9)
+    apply_generators(system, Parameters.from_file(fn_pars), ff_args)
+    # The tabulated parts are still found by the class of the original pair
+    # potential.
+    for PairPotClass in PairPotEI, PairPotExpRep, PairPotDampDisp:
+        part = ff_args.get_part_pair(PairPotClass)
+        assert isinstance(part.pair_pot, PairPotTabulated)
+        assert isinstance(part.pair_pot.source, PairPotClass)
+    assert ff_args.get_part_pair(PairPotLJ) is None
+    # Hence, no second set of electrostatic parts is added.
+    nparts = len(ff_args.parts)
+    part_pair_ei = ff_args.get_part_pair(PairPotEI)
+    ff_args.add_electrostatic_parts(system, part_pair_ei.scalings, 1.0)
+    assert len(ff_args.parts) == nparts
+
+
+def test_generator_water32_mixed_precision():
+    system = get_system_water32()
+    fn_pars = pkg_resources.resource_filename(__name__, '../../data/test/parameters_water.txt')
+    ff = ForceField.generate(system, fn_pars, rcut=9*angstrom, mixed_precision=True)
+    assert ff.part_pair_ei.pair_pot.mixed
+    result = compare_mixed_precision(ff)
+    assert ff.part_pair_ei.pair_pot.mixed
+    assert abs(result['energy_error'][0]) < 1e-5*abs(result['energy'][0])
+    assert result['force_rmsd'][0] < 1e-4*result['force_rms'][0]
+    assert result['force_maxerr'][0] > 0
+    # Compare with a force field in double precision, on several frames.
+    ff_double = ForceField.generate(system, fn_pars, rcut=9*angstrom)
+    assert not ff_double.part_pair_ei.pair_pot.mixed
+    frames = system.pos + np.random.normal(0, 0.01*angstrom, (3,) + system.pos.shape)
+    pos = system.pos.copy()
+    result = compare_mixed_precision(ff_double, frames)
+    assert not ff_double.part_pair_ei.pair_pot.mixed
+    assert (system.pos == pos).all()
+    assert result['energy'].shape == (3,)
+    for iframe in range(3):
+        ff_double.update_pos(frames[iframe])
+        assert abs(ff_double.compute() - result['energy'][iframe]) < 1e-10*abs(result['energy'][iframe])
+    assert (result['force_rmsd'] < 1e-4*result['force_rms']).all()
+    assert (result['vtens_maxerr'] > 0).all()
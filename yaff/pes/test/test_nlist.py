@@ -25,9 +25,14 @@
 
 from __future__ import division
 
+import os
 import random
+import subprocess
+import sys
+
 import numpy as np
 from nose.plugins.skip import SkipTest
+from nose.tools import assert_raises
 
 from molmod import angstrom
 
@@ -263,43 +268,131 @@ def test_nlist_inc_r0():
     assert (r == np.array([], dtype=int)).all()
 
 
-def check_nlist_skin(system, rcut, skin):
-    nlist1 = NeighborList(system, skin)
+def get_system_skewed():
+    # A strongly skewed cell, similar to those of some MOFs.
+    rvecs = np.array([
+        [10.0, 0.0, 0.0],
+        [9.0, 3.0, 0.0],
+        [8.5, 2.5, 4.0],
+    ])*angstrom
+    numbers = np.ones(40, int)
+    pos = np.dot(np.random.uniform(0, 1, (40, 3)), rvecs)
+    return System(numbers, pos, rvecs=rvecs)
+
+
+def test_nlist_images_skewed():
+    system = get_system_skewed()
+    cell = system.cell
+    rcut = 6*angstrom
+    rmax = np.ceil(rcut/cell.rspacings-0.5).astype(int)
+    images = nlist_images(cell, rcut, rmax)
+    assert (images[0] == 0).all()
+    # Compare with a scan of the fractional coordinates of the minimum image.
+    grid = np.array(np.meshgrid(*([np.linspace(-0.5, 0.5, 11)]*3))).reshape(3, -1).T
+    r = np.zeros(3, int)
+    kept = [tuple(image) for image in images[1:]]
+    nimage = 0
+    while nlist_inc_r(cell, r, rmax):
+        dmin = np.sqrt((np.dot(grid + r, cell.rvecs)**2).sum(axis=1)).min()
+        if tuple(r) in kept:
+            assert tuple(r) == kept[nimage]
+            nimage += 1
+            # The grid is coarse, so only a loose check is possible here.
+            assert dmin < rcut + 0.5*cell.rvecs.max()
+        else:
+            assert dmin >= rcut
+    assert nimage == len(kept)
+    assert len(images) < (np.prod(2*rmax+1) + 1)//2
+
+
+def test_nlist_images_nvec0():
+    system = get_system_glycine()
+    images = nlist_images(system.cell, 5*angstrom, system.cell.rspacings.astype(int))
+    assert images.shape == (1, 3)
+    assert (images == 0).all()
+
+
+def check_nlist_pruned(system, rcut):
+    nlist = NeighborList(system, binning=False)
+    nlist.request_rcut(rcut)
+    nlist.update()
+    assert nlist.nimage_pruned > 0
+    # Build the same neighbor list with all images.
+    images = [np.zeros(3, int)]
+    r = np.zeros(3, int)
+    while nlist_inc_r(system.cell, r, nlist.rmax):
+        images.append(r.copy())
+    images = np.array(images)
+    assert len(images) == len(nlist.images) + nlist.nimage_pruned
+    status = nlist_status_init(nlist.rmax)
+    neighs = np.empty(nlist.nneigh + 10, dtype=neigh_dtype)
+    assert nlist_build(system.pos, rcut, nlist.rmax, system.cell, status, neighs, images)
+    assert nlist_status_finish(status) == nlist.nneigh
+    assert (neighs[:nlist.nneigh] == nlist.neighs[:nlist.nneigh]).all()
+    nlist.check()
+
+
+def test_nlist_pruned_skewed_6A():
+    check_nlist_pruned(get_system_skewed(), 6*angstrom)
+
+
+def test_nlist_pruned_quartz_20A():
+    check_nlist_pruned(get_system_quartz(), 20*angstrom)
+
+
+def test_nlist_binning_skewed_6A():
+    check_nlist_binning(get_system_skewed(), 6*angstrom)
+
+
+def check_nlist_superset(nlist1, nlist2):
+    '''Check that all pairs in nlist2 are also present in nlist1
+
+       The image labels (r0, r1, r2) of the two lists may differ when the
+       atoms moved after the rebuild of nlist1, so the pairs are matched by
+       their atom indexes and relative vectors instead.
+    '''
+    lookup = {}
+    for (a, b, r0, r1, r2), value in nlist1.to_dictionary().items():
+        if a < b:
+            a, b, value = b, a, value*np.array([1, -1, -1, -1])
+        lookup.setdefault((a, b), []).append(value)
+    for (a, b, r0, r1, r2), value in nlist2.to_dictionary().items():
+        if a < b:
+            a, b, value = b, a, value*np.array([1, -1, -1, -1])
+        found = False
+        for value1 in lookup.get((a, b), []):
+            if a == b and abs(value1 + value*np.array([-1, 1, 1, 1])).max() < 1e-8:
+                found = True
+            elif abs(value1 - value).max() < 1e-8:
+                found = True
+        assert found
+
+
+def check_nlist_skin(system, rcut, skin, compact=False):
+    nlist1 = NeighborList(system, skin, compact=compact)
     nlist1.request_rcut(rcut)
     nlist1.update()
     # Displace all atoms with a random vector the rebuild is not triggered
     for i in range(system.natom):
         vec = np.random.normal(-1, 1, 3)
-        vec *= 0.45/(nlist1.rmax.max()+1)*skin/np.linalg.norm(vec)
+        vec *= 0.45*skin/np.linalg.norm(vec)
         system.pos[i] += vec
     assert not nlist1._need_rebuild()
     nlist1.update()
+    assert nlist1.nrebuild == 1
+    assert nlist1.nrecompute == 1
 
     nlist2 = NeighborList(system)
     nlist2.request_rcut(rcut)
+    nlist2.update()
 
     # Check if all distances present in nlist2 are also present in nlist1.
-    lookup = {}
-    for row in nlist1.neighs[:nlist1.nneigh]:
-        key = row['a'], row['b'], row['r0'], row['r1'], row['r2']
-        value = row['d'], row['dx'], row['dy'], row['dz']
-        lookup[key] = value
-
-    for row in nlist2.neighs[:nlist2.nneigh]:
-        key = row['a'], row['b'], row['r0'], row['r1'], row['r2']
-        value = lookup.get(key)
-        assert value is not None
-        d, dx, dy, dz = value
-
-        assert abs(d - row['d']) < 1e-8
-        assert abs(dx - row['dx']) < 1e-8
-        assert abs(dy - row['dy']) < 1e-8
-        assert abs(dz - row['dz']) < 1e-8
+    check_nlist_superset(nlist1, nlist2)
 
     # Displace all atoms with a random vector the rebuild is triggered.
     for i in range(system.natom):
         vec = np.random.normal(-1, 1, 3)
-        vec *= 0.55/(nlist1.rmax.max()+1)*skin/np.linalg.norm(vec)
+        vec *= 0.55*skin/np.linalg.norm(vec)
         system.pos[i] += vec
     assert nlist1._need_rebuild()
 
@@ -317,3 +410,378 @@ def test_nlist_water32_6A_skin3A():
 def test_nlist_water32_10A_skin2A():
     system = get_system_water32()
     check_nlist_skin(system, 10*angstrom, 2*angstrom)
+
+
+def test_nlist_water32_6A_skin3A_compact():
+    system = get_system_water32()
+    check_nlist_skin(system, 6*angstrom, 3*angstrom, compact=True)
+
+
+def test_nlist_displacement():
+    pos_old = np.random.normal(0, 1, (10, 3))
+    pos = pos_old.copy()
+    assert nlist_displacement(pos, pos_old) == 0.0
+    pos[3, 0] += 0.3
+    assert abs(nlist_displacement(pos, pos_old) - 0.3) < 1e-10
+    pos[7, 1] -= 0.5
+    pos[2, 2] += 0.1
+    assert abs(nlist_displacement(pos, pos_old) - 0.8) < 1e-10
+
+
+def test_nlist_auto_skin():
+    system = get_system_water32()
+    nlist = NeighborList(system, auto_skin=True)
+    nlist.request_rcut(6*angstrom)
+    assert nlist.skin == 0.6*angstrom
+    nlist.update()
+    vel = np.random.normal(0, 1, system.pos.shape)
+    vel *= 0.01*angstrom/np.sqrt((vel**2).sum(axis=1)).max()
+    for i in range(200):
+        system.pos += vel
+        nlist.update()
+        assert nlist.skin >= 0.06*angstrom
+        assert nlist.skin <= 3*angstrom
+    assert nlist.nrebuild + nlist.nrecompute == 201
+    assert nlist.nrebuild > 1
+    # After all these updates, the neighbor list must still be correct.
+    nlist2 = NeighborList(system)
+    nlist2.request_rcut(6*angstrom)
+    nlist2.update()
+    check_nlist_superset(nlist, nlist2)
+
+
+def check_nlist_binning(system, rcut):
+    nlist1 = NeighborList(system, binning=True)
+    nlist1.request_rcut(rcut)
+    nlist1.update()
+    nlist2 = NeighborList(system, binning=False)
+    nlist2.request_rcut(rcut)
+    nlist2.update()
+    assert nlist1.nneigh == nlist2.nneigh
+    # The same rows must be present, with exactly the same relative vectors.
+    dict1 = nlist1.to_dictionary()
+    dict2 = nlist2.to_dictionary()
+    assert len(dict1) == nlist1.nneigh
+    for key, value in dict2.items():
+        assert (dict1[key] == value).all()
+    # The pairs in the central image must be sorted lexicographically, which
+    # is assumed by the scaling algorithm in the pair potentials.
+    neighs = nlist1.neighs[:nlist1.nneigh]
+    central = neighs[(neighs['r0'] == 0) & (neighs['r1'] == 0) & (neighs['r2'] == 0)]
+    assert (central['a'] > central['b']).all()
+    keys = central['a']*system.natom + central['b']
+    assert (keys[1:] > keys[:-1]).all()
+
+
+def test_nlist_binning_water32_4A():
+    check_nlist_binning(get_system_water32(), 4*angstrom)
+
+
+def test_nlist_binning_water32_9A():
+    check_nlist_binning(get_system_water32(), 9*angstrom)
+
+
+def test_nlist_binning_graphene8_9A():
+    check_nlist_binning(get_system_graphene8(), 9*angstrom)
+
+
+def test_nlist_binning_polyethylene4_9A():
+    check_nlist_binning(get_system_polyethylene4(), 9*angstrom)
+
+
+def test_nlist_binning_quartz_4A():
+    check_nlist_binning(get_system_quartz(), 4*angstrom)
+
+
+def test_nlist_binning_quartz_20A():
+    check_nlist_binning(get_system_quartz(), 20*angstrom)
+
+
+def test_nlist_binning_glycine_3A():
+    check_nlist_binning(get_system_glycine(), 3*angstrom)
+
+
+def test_nlist_binning_water32_supercell_5A():
+    system = get_system_water32().supercell(2, 2, 1)
+    check_nlist_binning(system, 5*angstrom)
+
+
+def test_nlist_binning_reproducible():
+    system = get_system_water32().supercell(2, 2, 2)
+    nlist = NeighborList(system)
+    nlist.request_rcut(7*angstrom)
+    nlist.update()
+    neighs = nlist.neighs[:nlist.nneigh].copy()
+    # The second rebuild reuses the neighs array and must give exactly the
+    # same rows in the same order.
+    nlist.update_rmax()
+    nlist.update()
+    assert nlist.nneigh == len(neighs)
+    assert (nlist.neighs[:nlist.nneigh] == neighs).all()
+
+
+def _hash_nlist_rows(nthread):
+    # Build the neighbor list in a fresh interpreter, because the number of
+    # OpenMP threads is fixed when the runtime starts. The fields are hashed
+    # one by one because the padding bytes of the rows are not initialized.
+    script = (
+        'import hashlib\n'
+        'from molmod import angstrom\n'
+        'from yaff import NeighborList\n'
+        'from yaff.test.common import get_system_water32\n'
+        'system = get_system_water32().supercell(2, 2, 2)\n'
+        'nlist = NeighborList(system)\n'
+        'nlist.request_rcut(7*angstrom)\n'
+        'nlist.update()\n'
+        'neighs = nlist.neighs[:nlist.nneigh]\n'
+        'for name in neighs.dtype.names:\n'
+        '    print(name, hashlib.sha1(neighs[name].copy().tobytes()).hexdigest())\n'
+    )
+    env = dict(os.environ)
+    env['OMP_NUM_THREADS'] = str(nthread)
+    return subprocess.check_output([sys.executable, '-c', script], env=env)
+
+
+def test_nlist_binning_reproducible_threads():
+    # The rows must not depend on the number of threads used by the build.
+    reference = _hash_nlist_rows(1)
+    for nthread in 2, 3, 8:
+        assert _hash_nlist_rows(nthread) == reference
+
+
+def test_nlist_row_size():
+    # The image shifts and nbond are narrowed such that a row fits in one
+    # cache line.
+    assert neigh_dtype.itemsize == 64
+    assert neigh_dtype['r0'] == np.intc
+    assert neigh_dtype['nbond'] == np.int8
+
+
+def check_nlist_compact(system, rcut):
+    nlist1 = NeighborList(system, compact=True)
+    nlist1.request_rcut(rcut)
+    nlist1.update()
+    nlist1.check()
+    assert nlist1.neighs.dtype == neigh_compact_dtype
+    nlist2 = NeighborList(system)
+    nlist2.request_rcut(rcut)
+    nlist2.update()
+    assert nlist1.nneigh == nlist2.nneigh
+    # The same pairs must be present in the same order.
+    neighs1 = nlist1.neighs[:nlist1.nneigh]
+    neighs2 = nlist2.neighs[:nlist2.nneigh]
+    assert (neighs1['a'] == neighs2['a']).all()
+    assert (neighs1['b'] == neighs2['b']).all()
+    central = (neighs2['r0'] == 0) & (neighs2['r1'] == 0) & (neighs2['r2'] == 0)
+    assert ((neighs1['central'] != 0) == central).all()
+    dict1 = nlist1.to_dictionary()
+    dict2 = nlist2.to_dictionary()
+    for key, value in dict2.items():
+        assert abs(dict1[key] - value).max() < 1e-10
+
+
+def test_nlist_compact_water32_9A():
+    check_nlist_compact(get_system_water32(), 9*angstrom)
+
+
+def test_nlist_compact_graphene8_9A():
+    check_nlist_compact(get_system_graphene8(), 9*angstrom)
+
+
+def test_nlist_compact_polyethylene4_9A():
+    check_nlist_compact(get_system_polyethylene4(), 9*angstrom)
+
+
+def test_nlist_compact_quartz_20A():
+    check_nlist_compact(get_system_quartz(), 20*angstrom)
+
+
+def test_nlist_compact_glycine_9A():
+    check_nlist_compact(get_system_glycine(), 9*angstrom)
+
+
+def test_nlist_compact_displaced():
+    # Atoms outside the central cell give non-zero image shifts.
+    system = get_system_water32()
+    system.pos[::3] += system.cell.rvecs[0]
+    system.pos[1::3] -= 2*system.cell.rvecs[2]
+    check_nlist_compact(system, 6*angstrom)
+
+
+def test_nlist_compact_requires_binning():
+    system = get_system_water32()
+    with assert_raises(ValueError):
+        NeighborList(system, binning=False, compact=True)
+
+
+def check_nlist_partition(system, rcuts, skin=0, compact=False):
+    nlist = NeighborList(system, skin, compact=compact)
+    for rcut in rcuts:
+        nlist.request_rcut(rcut)
+    nlist.update()
+    nlist.check()
+    assert (nlist.shell_rcuts == sorted(rcuts)).all()
+    assert nlist.shell_ends[-1] == nlist.nneigh
+    # All pairs within each cutoff must come first.
+    dists = np.array([value[0] for value in nlist.to_dictionary().values()])
+    neighs = nlist.neighs[:nlist.nneigh]
+    for rcut in rcuts:
+        nneigh = nlist.get_nneigh(rcut)
+        assert nneigh == (dists < rcut + skin).sum()
+        if not compact:
+            assert (neighs['d'][:nneigh] < rcut + skin).all()
+            assert (neighs['d'][nneigh:] >= rcut + skin).all()
+    # The central pairs within each shell must be sorted.
+    start = 0
+    for end in nlist.shell_ends:
+        shell = neighs[start:end]
+        if compact:
+            central = shell['central'] != 0
+        else:
+            central = (shell['r0'] == 0) & (shell['r1'] == 0) & (shell['r2'] == 0)
+        keys = shell['a'][central]*system.natom + shell['b'][central]
+        assert (keys[1:] > keys[:-1]).all()
+        start = end
+
+
+def test_nlist_partition_water32():
+    check_nlist_partition(get_system_water32(), [4*angstrom, 9*angstrom, 6*angstrom])
+
+
+def test_nlist_partition_water32_skin():
+    check_nlist_partition(get_system_water32(), [4*angstrom, 9*angstrom], 1*angstrom)
+
+
+def test_nlist_partition_quartz_compact():
+    check_nlist_partition(get_system_quartz(), [5*angstrom, 12*angstrom], compact=True)
+
+
+def test_nlist_partition_glycine():
+    check_nlist_partition(get_system_glycine(), [2*angstrom, 4*angstrom])
+
+
+def check_nlist_topology(system, rcut, compact=False, tiled=False):
+    nlist = NeighborList(system, compact=compact, tiled=tiled)
+    nlist.request_rcut(rcut)
+    scalings1 = Scalings(system, 0.0, 0.0, 0.5)
+    scalings2 = Scalings(system, 0.0, 0.3, 1.0)
+    nlist.request_scalings(scalings1)
+    nlist.request_scalings(scalings2)
+    nlist.request_scalings(scalings1)
+    assert len(nlist.scalings) == 2
+    nlist.update()
+    # The check method skips the excluded (1-2) pairs.
+    nlist.check()
+    # All 1-2 pairs are excluded, the 1-3 and 1-4 pairs get a bond count.
+    neighs = nlist.neighs[:nlist.nneigh]
+    if tiled:
+        neighs = get_tile_rows(nlist)
+    if compact or tiled:
+        central = neighs['central'] != 0
+    else:
+        central = (neighs['r0'] == 0) & (neighs['r1'] == 0) & (neighs['r2'] == 0)
+    assert (neighs['nbond'][~central] == 0).all()
+    nbonds = {}
+    for a, b, nbond in zip(neighs['a'][central], neighs['b'][central], neighs['nbond'][central]):
+        nbonds[(a, b)] = nbond
+    for i0 in range(system.natom):
+        for i1 in range(i0):
+            if i1 in system.neighs1[i0]:
+                assert (i0, i1) not in nbonds
+            elif i1 in system.neighs2[i0]:
+                assert nbonds.get((i0, i1), 2) == 2
+            elif i1 in system.neighs3[i0]:
+                assert nbonds.get((i0, i1), 3) == 3
+            else:
+                assert nbonds.get((i0, i1), 0) == 0
+
+
+def test_nlist_topology_water32_9A():
+    check_nlist_topology(get_system_water32(), 9*angstrom)
+
+
+def test_nlist_topology_glycine_9A():
+    check_nlist_topology(get_system_glycine(), 9*angstrom)
+
+
+def test_nlist_topology_water32_6A_compact():
+    check_nlist_topology(get_system_water32(), 6*angstrom, compact=True)
+
+
+def test_nlist_topology_water32_6A_tiled():
+    check_nlist_topology(get_system_water32(), 6*angstrom, tiled=True)
+
+
+def test_nlist_topology_glycine_9A_tiled():
+    check_nlist_topology(get_system_glycine(), 9*angstrom, tiled=True)
+
+
+def get_tile_rows(nlist):
+    # Returns the pairs in the tiles as rows in the compact format, with the
+    # highest atom index first.
+    rows = []
+    for tile in nlist.neighs[:nlist.nneigh]:
+        for bit in range(nlist_cluster_size**2):
+            if (tile['mask'] >> bit) & 1:
+                a = nlist.clusters[tile['ci'], bit//nlist_cluster_size]
+                b = nlist.clusters[tile['cj'], bit%nlist_cluster_size]
+                central = (tile['central'] >> bit) & 1
+                rows.append((max(a, b), min(a, b), 0, 0, 0, central, tile['nbond'][bit]))
+    return np.array(rows, dtype=neigh_compact_dtype)
+
+
+def check_nlist_tiles(system, rcut, skin=0):
+    nlist1 = NeighborList(system, skin=skin)
+    nlist1.request_rcut(rcut)
+    nlist1.update()
+    nlist2 = NeighborList(system, skin=skin, tiled=True)
+    nlist2.request_rcut(rcut)
+    nlist2.update()
+    nlist2.check()
+    # Each atom belongs to exactly one cluster.
+    atoms = nlist2.clusters.ravel()
+    assert sorted(atoms[atoms >= 0]) == list(range(system.natom))
+    assert (atoms[system.natom:] == -1).all()
+    # The tiles contain exactly the same pairs as the other formats.
+    dict1 = nlist1.to_dictionary()
+    dict2 = nlist2.to_dictionary()
+    assert len(dict1) == len(dict2)
+    for key, value in dict1.items():
+        assert abs(dict2[key] - value).max() < 1e-10
+    assert nlist2.nneigh < nlist1.nneigh
+
+
+def test_nlist_tiles_water32_4A():
+    check_nlist_tiles(get_system_water32(), 4*angstrom)
+
+
+def test_nlist_tiles_water32_9A_skin():
+    check_nlist_tiles(get_system_water32(), 9*angstrom, 2*angstrom)
+
+
+def test_nlist_tiles_graphene8_9A():
+    check_nlist_tiles(get_system_graphene8(), 9*angstrom)
+
+
+def test_nlist_tiles_polyethylene4_9A():
+    check_nlist_tiles(get_system_polyethylene4(), 9*angstrom)
+
+
+def test_nlist_tiles_quartz_20A():
+    check_nlist_tiles(get_system_quartz(), 20*angstrom)
+
+
+def test_nlist_tiles_glycine_9A():
+    check_nlist_tiles(get_system_glycine(), 9*angstrom)
+
+
+def test_nlist_tiles_skewed_6A():
+    check_nlist_tiles(get_system_skewed(), 6*angstrom)
+
+
+def test_nlist_tiles_options():
+    system = get_system_water32()
+    with assert_raises(ValueError):
+        NeighborList(system, tiled=True, compact=True)
+    with assert_raises(ValueError):
+        NeighborList(system, tiled=True, binning=False)
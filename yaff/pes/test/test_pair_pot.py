@@ -26,6 +26,11 @@
 from __future__ import division
 from __future__ import print_function
 
+import os
+import subprocess
+import sys
+from io import BytesIO
+
 import pkg_resources
 import numpy as np
 from scipy.special import erfc, erf
@@ -304,6 +309,33 @@ def test_pair_pot_ei_water32_14A_gaussiancharges():
     check_pair_pot_water32(system, nlist, scalings, part_pair, pair_fn, 1e-12, rmax=1)
 
 
+def get_part_water32_14A_dsf():
+    # Initialize system, nlist and scaling
+    system = get_system_water32()
+    nlist = NeighborList(system)
+    scalings = Scalings(system, 0.0, 0.5, 1.0)
+    dielectric = 1.2
+    # Create the pair_pot and part_pair
+    rcut = 14*angstrom
+    alpha = 3.0/rcut
+    pair_pot = PairPotDSF(system.charges, alpha, rcut, dielectric=dielectric)
+    assert pair_pot.alpha == alpha
+    assert pair_pot.dielectric == dielectric
+    part_pair = ForcePartPair(system, nlist, scalings, pair_pot)
+    # The pair function
+    eshift = erfc(alpha*rcut)/rcut
+    fshift = eshift/rcut + 2*alpha/np.sqrt(np.pi)*np.exp(-(alpha*rcut)**2)/rcut
+    def pair_fn(i, j, d, delta):
+        pot = erfc(alpha*d)/d - eshift + fshift*(d - rcut)
+        return system.charges[i]*system.charges[j]*pot/dielectric
+    return system, nlist, scalings, part_pair, pair_fn
+
+
+def test_pair_pot_dsf_water32_14A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_dsf()
+    check_pair_pot_water32(system, nlist, scalings, part_pair, pair_fn, 1e-12, rmax=1)
+
+
 def get_part_water32_14A_eidip():
     # Initialize system, nlist and scaling
     system = get_system_water32()
@@ -1169,6 +1201,12 @@ def test_gpos_vtens_pair_pot_ei_water32_14A_gaussiancharges():
     check_vtens_part(system, part_pair, nlist)
 
 
+def test_gpos_vtens_pair_pot_dsf_water32_14A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_dsf()
+    check_gpos_part(system, part_pair, nlist)
+    check_vtens_part(system, part_pair, nlist)
+
+
 #
 # Caffeine derivative tests
 #
@@ -1246,6 +1284,39 @@ def test_gpos_vtens_pot_4113_01WaterWater_olpslater1s1s():
     check_vtens_part(system, part_pair, nlist)
 
 
+def test_gpos_olpslater1s1s_taylor():
+    # Slater widths that differ by less than 0.025 use the Taylor expansion
+    # of the overlap in the difference of the widths. The derivative of the
+    # second-order term used to lack a division by the distance, which is only
+    # visible for different widths and distances away from one bohr.
+    for width0, width1 in (1.2, 1.224), (0.9, 0.88):
+        for d in 2.5, 4.0:
+            system = System(
+                numbers=np.array([8, 8]), pos=np.array([[0.0, 0.0, 0.0], [0.3, 0.4, d]]),
+                radii=np.array([width0, width1]), valence_charges=np.array([-1.5, -2.0]),
+                bonds=np.zeros((0, 2), int),
+            )
+            nlist = NeighborList(system)
+            scalings = Scalings(system)
+            pair_pot = PairPotOlpSlater1s1s(system.radii, system.valence_charges, 1.0, 20*angstrom)
+            part_pair = ForcePartPair(system, nlist, scalings, pair_pot)
+            nlist.update()
+            gpos = np.zeros(system.pos.shape, float)
+            part_pair.compute(gpos)
+            pos = system.pos.copy()
+            eps = 1e-5
+            for k in range(3):
+                energies = []
+                for sign in 1, -1:
+                    system.pos[:] = pos
+                    system.pos[1, k] += sign*eps
+                    nlist.update()
+                    energies.append(part_pair.compute())
+                system.pos[:] = pos
+                numerical = (energies[0] - energies[1])/(2*eps)
+                assert abs(gpos[1, k] - numerical) < 1e-8*abs(gpos[1]).max()
+
+
 def test_gpos_vtens_pot_4113_01WaterWater_disp68bjdamp():
     system, nlist, scalings, part_pair, pair_fn = get_part_4113_01WaterWater_disp68bjdamp()
     check_gpos_part(system, part_pair, nlist)
@@ -1423,3 +1494,731 @@ def test_pair_pot_eislater1sp1spcorr():
     # Check gradient and virial tensor
     check_gpos_part(system, part_pair, nlist)
     check_vtens_part(system, part_pair, nlist, symm_vtens=False)
+
+
+#
+# Compact neighbor lists
+#
+
+
+def check_pair_pot_compact(system, nlist, scalings, part_pair):
+    # Results with the compact neighbor list must match the full one.
+    nlist.update()
+    nlist_compact = NeighborList(system, compact=True)
+    nlist_compact.request_rcut(nlist.rcut)
+    nlist_compact.update()
+    pair_pot = part_pair.pair_pot
+    gpos1 = np.zeros(system.pos.shape, float)
+    vtens1 = np.zeros((3, 3), float)
+    energy1 = pair_pot.compute(nlist.neighs, scalings.stab, gpos1, vtens1, nlist.nneigh)
+    gpos2 = np.zeros(system.pos.shape, float)
+    vtens2 = np.zeros((3, 3), float)
+    energy2 = pair_pot.compute(nlist_compact.neighs, scalings.stab, gpos2, vtens2,
+                               nlist_compact.nneigh, system.pos, system.cell)
+    assert abs(energy1 - energy2) < 1e-10*abs(energy1)
+    assert abs(gpos1 - gpos2).max() < 1e-10*abs(gpos1).max()
+    assert abs(vtens1 - vtens2).max() < 1e-10*abs(vtens1).max()
+    # Also go through the ForcePartPair with a compact list.
+    part_compact = ForcePartPair(system, nlist_compact, scalings, pair_pot)
+    assert abs(part_compact.compute() - energy1) < 1e-10*abs(energy1)
+
+
+def test_pair_pot_compact_lj_water32_9A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_9A_lj()
+    check_pair_pot_compact(system, nlist, scalings, part_pair)
+
+
+def test_pair_pot_compact_ei_water32_14A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_ei()
+    check_pair_pot_compact(system, nlist, scalings, part_pair)
+
+
+def test_pair_pot_compact_eidip_water32_14A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_eidip()
+    check_pair_pot_compact(system, nlist, scalings, part_pair)
+
+
+def test_pair_pot_compact_mm3_caffeine_15A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_caffeine_mm3_15A()
+    check_pair_pot_compact(system, nlist, scalings, part_pair)
+
+
+#
+# Neighbor lists partitioned into shells
+#
+
+
+def test_pair_pot_lj_water32_shells():
+    # A short-range part that shares the neighbor list with a long-range part
+    # must give the same result as with its own neighbor list.
+    system, nlist1, scalings, part_pair1, pair_fn = get_part_water32_9A_lj()
+    nlist2 = NeighborList(system)
+    part_pair2 = ForcePartPair(system, nlist2, scalings, part_pair1.pair_pot)
+    pair_pot_ei = PairPotEI(system.charges, 0.3, 14*angstrom)
+    part_ei = ForcePartPair(system, nlist2, scalings, pair_pot_ei)
+    nlist1.update()
+    nlist2.update()
+    assert nlist2.get_nneigh(9*angstrom) < nlist2.nneigh
+    gpos1 = np.zeros(system.pos.shape, float)
+    vtens1 = np.zeros((3, 3), float)
+    energy1 = part_pair1.compute(gpos1, vtens1)
+    gpos2 = np.zeros(system.pos.shape, float)
+    vtens2 = np.zeros((3, 3), float)
+    energy2 = part_pair2.compute(gpos2, vtens2)
+    assert abs(energy1 - energy2) < 1e-10*abs(energy1)
+    assert abs(gpos1 - gpos2).max() < 1e-10*abs(gpos1).max()
+    assert abs(vtens1 - vtens2).max() < 1e-10*abs(vtens1).max()
+    # The long-range part visits both shells, which restarts the traversal of
+    # the scalings table.
+    nlist3 = NeighborList(system)
+    part_ei3 = ForcePartPair(system, nlist3, scalings, pair_pot_ei)
+    nlist3.update()
+    energy3 = part_ei3.compute()
+    assert abs(part_ei.compute() - energy3) < 1e-10*abs(energy3)
+
+
+#
+# Scalings stored in the neighbor list
+#
+
+
+def check_pair_pot_topology(system, nlist, scalings, part_pair):
+    # The bond counts in the neighbor list must give the same result as the
+    # lookup in the scaling table.
+    nlist.update()
+    assert nlist.topology is not None
+    pair_pot = part_pair.pair_pot
+    nlist_plain = NeighborList(system, binning=False)
+    nlist_plain.request_rcut(nlist.rcut)
+    nlist_plain.update()
+    assert nlist_plain.topology is None
+    gpos1 = np.zeros(system.pos.shape, float)
+    vtens1 = np.zeros((3, 3), float)
+    energy1 = pair_pot.compute(nlist_plain.neighs, scalings.stab, gpos1, vtens1, nlist_plain.nneigh)
+    gpos2 = np.zeros(system.pos.shape, float)
+    vtens2 = np.zeros((3, 3), float)
+    energy2 = part_pair.compute(gpos2, vtens2)
+    assert abs(energy1 - energy2) < 1e-10*abs(energy1)
+    assert abs(gpos1 - gpos2).max() < 1e-10*abs(gpos1).max()
+    assert abs(vtens1 - vtens2).max() < 1e-10*abs(vtens1).max()
+    # The excluded pairs are not present in the neighbor list.
+    assert nlist.nneigh < nlist_plain.nneigh
+
+
+def test_pair_pot_topology_lj_water32_9A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_9A_lj()
+    check_pair_pot_topology(system, nlist, scalings, part_pair)
+
+
+def test_pair_pot_topology_ei_water32_14A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_ei()
+    check_pair_pot_topology(system, nlist, scalings, part_pair)
+
+
+def test_pair_pot_topology_mm3_caffeine_15A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_caffeine_mm3_15A()
+    check_pair_pot_topology(system, nlist, scalings, part_pair)
+
+
+def test_pair_pot_topology_mixed_caffeine():
+    # Two parts with different scalings share the same neighbor list.
+    system = get_system_caffeine()
+    nlist = NeighborList(system, compact=True)
+    scalings1 = Scalings(system, 0.0, 0.0, 0.5)
+    scalings2 = Scalings(system, 0.0, 0.4, 0.8)
+    charges = np.random.uniform(-1, 1, system.natom)
+    pair_pot1 = PairPotEI(charges, 0.0, 10*angstrom)
+    pair_pot2 = PairPotEI(charges, 0.0, 10*angstrom)
+    part_pair1 = ForcePartPair(system, nlist, scalings1, pair_pot1)
+    part_pair2 = ForcePartPair(system, nlist, scalings2, pair_pot2)
+    check_pair_pot_topology(system, nlist, scalings1, part_pair1)
+    check_pair_pot_topology(system, nlist, scalings2, part_pair2)
+
+
+def check_pair_pot_tiles(system, nlist, scalings, part_pair):
+    # The tiled neighbor list must give the same result as the default one.
+    gpos1 = np.zeros(system.pos.shape, float)
+    vtens1 = np.zeros((3, 3), float)
+    energy1 = part_pair.compute(gpos1, vtens1)
+    nlist_tiled = NeighborList(system, tiled=True)
+    part_tiled = ForcePartPair(system, nlist_tiled, scalings, part_pair.pair_pot)
+    nlist_tiled.update()
+    gpos2 = np.zeros(system.pos.shape, float)
+    vtens2 = np.zeros((3, 3), float)
+    energy2 = part_tiled.compute(gpos2, vtens2)
+    assert abs(energy1 - energy2) < 1e-10*abs(energy1)
+    assert abs(gpos1 - gpos2).max() < 1e-10*abs(gpos1).max()
+    assert abs(vtens1 - vtens2).max() < 1e-10*abs(vtens1).max()
+    # Also with a lookup of the scalings in the scaling table.
+    gpos3 = np.zeros(system.pos.shape, float)
+    vtens3 = np.zeros((3, 3), float)
+    energy3 = part_pair.pair_pot.compute(
+        nlist_tiled.neighs, scalings.stab, gpos3, vtens3, nlist_tiled.nneigh,
+        system.pos, system.cell, None, nlist_tiled.clusters, nlist_tiled.wrap
+    )
+    assert abs(energy1 - energy3) < 1e-10*abs(energy1)
+    assert abs(gpos1 - gpos3).max() < 1e-10*abs(gpos1).max()
+    assert abs(vtens1 - vtens3).max() < 1e-10*abs(vtens1).max()
+
+
+def test_pair_pot_tiles_lj_water32_9A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_9A_lj()
+    nlist.update()
+    check_pair_pot_tiles(system, nlist, scalings, part_pair)
+
+
+def test_pair_pot_tiles_ei_water32_14A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_ei()
+    nlist.update()
+    check_pair_pot_tiles(system, nlist, scalings, part_pair)
+
+
+def test_pair_pot_tiles_eidip_water32_14A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_eidip()
+    nlist.update()
+    check_pair_pot_tiles(system, nlist, scalings, part_pair)
+
+
+def test_pair_pot_tiles_mm3_caffeine_15A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_caffeine_mm3_15A()
+    nlist.update()
+    check_pair_pot_tiles(system, nlist, scalings, part_pair)
+
+
+def check_pair_pot_composite(nlist_kwargs):
+    system = get_system_water32()
+    nlist = NeighborList(system, **nlist_kwargs)
+    scalings1 = Scalings(system, 0.0, 0.5, 1.0)
+    scalings2 = Scalings(system, 0.5, 1.0, 1.0)
+    sigmas = np.where(system.numbers == 8, 3.15*angstrom, 0.4*angstrom)
+    epsilons = np.where(system.numbers == 8, 0.15*kcalmol, 0.04*kcalmol)
+    parts = [
+        ForcePartPair(system, nlist, scalings1, PairPotEI(system.charges, 5.5/(12*angstrom), 12*angstrom)),
+        ForcePartPair(system, nlist, scalings2, PairPotLJ(sigmas, epsilons, 7*angstrom, Switch3(2*angstrom))),
+        ForcePartPair(system, nlist, scalings1, PairPotMM3(sigmas, epsilons, np.zeros(system.natom, np.int32), 9*angstrom, Switch3(2*angstrom))),
+    ]
+    nlist.update()
+    # Reference results from the separate parts
+    gpos1 = np.zeros(system.pos.shape, float)
+    vtens1 = np.zeros((3, 3), float)
+    energies1 = [part.compute(gpos1, vtens1) for part in parts]
+    part_composite = ForcePartPairComposite(system, nlist, parts)
+    gpos2 = np.zeros(system.pos.shape, float)
+    vtens2 = np.zeros((3, 3), float)
+    energy2 = part_composite.compute(gpos2, vtens2)
+    assert abs(sum(energies1) - energy2) < 1e-10*abs(energy2)
+    for part, energy1 in zip(parts, energies1):
+        assert abs(part.energy - energy1) < 1e-10*abs(energy1)
+    assert abs(gpos1 - gpos2).max() < 1e-10*abs(gpos1).max()
+    assert abs(vtens1 - vtens2).max() < 1e-10*abs(vtens1).max()
+    check_gpos_part(system, part_composite, nlist)
+    check_vtens_part(system, part_composite, nlist)
+
+
+def test_pair_pot_composite_water32():
+    check_pair_pot_composite({})
+
+
+def test_pair_pot_composite_water32_compact():
+    check_pair_pot_composite({'compact': True})
+
+
+def test_pair_pot_composite_water32_tiled():
+    check_pair_pot_composite({'tiled': True})
+
+
+def test_pair_pot_composite_water32_nobinning():
+    check_pair_pot_composite({'binning': False})
+
+
+def test_pair_pot_composite_errors():
+    system = get_system_water32()
+    nlist1 = NeighborList(system)
+    nlist2 = NeighborList(system)
+    scalings = Scalings(system)
+    part1 = ForcePartPair(system, nlist1, scalings, PairPotEI(system.charges, 0.0, 7*angstrom))
+    part2 = ForcePartPair(system, nlist2, scalings, PairPotEI(system.charges, 0.0, 7*angstrom))
+    with assert_raises(ValueError):
+        ForcePartPairComposite(system, nlist1, [part1, part2])
+    with assert_raises(TypeError):
+        ForcePartPairComposite(system, nlist1, [part1, ForcePartValence(system)])
+
+
+def check_pair_pot_batched(system, nlist, part_pair):
+    # The batch kernel must agree with the scalar pair function.
+    assert part_pair.pair_pot.batched
+    nlist.update()
+    scalings = Scalings(system, 1.0, 1.0, 1.0)
+    nneigh = nlist.nneigh
+    gpos1 = np.zeros(system.pos.shape, float)
+    vtens1 = np.zeros((3, 3), float)
+    energy1 = part_pair.pair_pot.compute(nlist.neighs, scalings.stab, gpos1, vtens1, nneigh)
+    neighs = nlist.neighs[:nneigh]
+    neighs = neighs[neighs['d'] < part_pair.pair_pot.rcut]
+    energies, derivatives = part_pair.pair_pot.sample(neighs['a'].copy(), neighs['b'].copy(), neighs['d'].copy())
+    energy2 = energies.sum()
+    assert abs(energy1 - energy2) < 1e-10*abs(energy2)
+    # The gradient and the virial follow from the derivatives towards the
+    # distance and the relative vectors.
+    deltas = np.array([neighs['dx'], neighs['dy'], neighs['dz']]).T
+    gdeltas = (derivatives/neighs['d']).reshape(-1, 1)*deltas
+    gpos2 = np.zeros(system.pos.shape, float)
+    np.add.at(gpos2, neighs['b'], gdeltas)
+    np.add.at(gpos2, neighs['a'], -gdeltas)
+    vtens2 = np.dot(deltas.T, gdeltas)
+    assert abs(gpos1 - gpos2).max() < 1e-10*abs(gpos2).max()
+    assert abs(vtens1 - vtens2).max() < 1e-10*abs(vtens2).max()
+
+
+def test_pair_pot_batched_lj_water32_9A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_9A_lj()
+    check_pair_pot_batched(system, nlist, part_pair)
+
+
+def test_pair_pot_batched_mm3_caffeine_15A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_caffeine_mm3_15A()
+    check_pair_pot_batched(system, nlist, part_pair)
+
+
+def test_pair_pot_batched_ei_water32_14A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_ei(np.random.uniform(0.5, 1.0, 96))
+    check_pair_pot_batched(system, nlist, part_pair)
+
+
+def test_pair_pot_batched_exprep_caffeine_5A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_caffeine_exprep_5A(1, 0.0, 1, 0.0)
+    check_pair_pot_batched(system, nlist, part_pair)
+
+
+def test_pair_pot_batched_dampdisp_caffeine_9A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_caffeine_dampdisp_9A()
+    check_pair_pot_batched(system, nlist, part_pair)
+
+
+def test_pair_pot_batched_unsupported():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_eidip()
+    assert not part_pair.pair_pot.batched
+    system, nlist, scalings, part_pair, pair_fn = get_part_caffeine_ljcross_9A()
+    assert not part_pair.pair_pot.batched
+
+
+def check_pair_pot_specialized(system, pair_pot):
+    # The specialized kernels for the standard neighbor list must agree with
+    # the generic code for the compact neighbor list, for every output.
+    assert pair_pot.specialized
+    scalings = Scalings(system, 0.0, 0.5, 1.0)
+    nlist = NeighborList(system)
+    nlist.request_rcut(pair_pot.rcut)
+    nlist.update()
+    nlist_compact = NeighborList(system, compact=True)
+    nlist_compact.request_rcut(pair_pot.rcut)
+    nlist_compact.update()
+    def compute(nlist, gpos, vtens):
+        return pair_pot.compute(
+            nlist.neighs, scalings.stab, gpos, vtens, nlist.nneigh,
+            system.pos, system.cell)
+    gpos_ref = np.zeros(system.pos.shape, float)
+    vtens_ref = np.zeros((3, 3), float)
+    energy_ref = compute(nlist_compact, gpos_ref, vtens_ref)
+    for with_gpos, with_vtens in (False, False), (True, False), (True, True), (False, True):
+        gpos = np.zeros(system.pos.shape, float) if with_gpos else None
+        vtens = np.zeros((3, 3), float) if with_vtens else None
+        energy = compute(nlist, gpos, vtens)
+        assert abs(energy - energy_ref) < 1e-10*abs(energy_ref)
+        if with_gpos:
+            assert abs(gpos - gpos_ref).max() < 1e-10*abs(gpos_ref).max()
+        if with_vtens:
+            assert abs(vtens - vtens_ref).max() < 1e-10*abs(vtens_ref).max()
+
+
+def test_pair_pot_specialized():
+    system = get_system_water32()
+    sigmas = np.where(system.numbers == 8, 3.15*angstrom, 0.4*angstrom)
+    epsilons = np.where(system.numbers == 8, 0.15*kcalmol, 0.05*kcalmol)
+    for tr in None, Hammer(1.0), Switch3(2.0*angstrom):
+        check_pair_pot_specialized(system, PairPotLJ(sigmas, epsilons, 7*angstrom, tr))
+        check_pair_pot_specialized(system, PairPotGrimme(sigmas, epsilons, 7*angstrom, tr))
+        check_pair_pot_specialized(system, PairPotEI(system.charges, 0.2, 7*angstrom, tr))
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_eidip()
+    assert not part_pair.pair_pot.specialized
+
+
+def check_pair_pot_mixed(system, nlist, scalings, part_pair, eps):
+    # The mixed precision kernels must agree with double precision, up to the
+    # precision of single-precision arithmetic.
+    nlist.update()
+    pair_pot = part_pair.pair_pot
+    assert not pair_pot.mixed
+    results = []
+    for mixed in False, True:
+        assert pair_pot.set_mixed(mixed) == mixed
+        assert pair_pot.mixed == mixed
+        gpos = np.zeros(system.pos.shape, float)
+        vtens = np.zeros((3, 3), float)
+        energy = part_pair.compute(gpos, vtens)
+        results.append((energy, gpos, vtens))
+    (energy0, gpos0, vtens0), (energy1, gpos1, vtens1) = results
+    assert energy0 != energy1
+    assert abs(energy0 - energy1) < eps*abs(energy0)
+    assert abs(gpos0 - gpos1).max() < eps*abs(gpos0).max()
+    assert abs(vtens0 - vtens1).max() < eps*abs(vtens0).max()
+    pair_pot.set_mixed(False)
+
+
+def test_pair_pot_mixed_lj_water32_9A():
+    check_pair_pot_mixed(*get_part_water32_9A_lj()[:4], eps=1e-5)
+
+
+def test_pair_pot_mixed_mm3_caffeine_15A():
+    check_pair_pot_mixed(*get_part_caffeine_mm3_15A()[:4], eps=1e-5)
+
+
+def test_pair_pot_mixed_exprep_caffeine_5A():
+    check_pair_pot_mixed(*get_part_caffeine_exprep_5A(1, 0.0, 1, 0.0)[:4], eps=1e-5)
+
+
+def test_pair_pot_mixed_ei_water32_14A():
+    check_pair_pot_mixed(*get_part_water32_14A_ei(np.random.uniform(0.5, 1.0, 96))[:4], eps=1e-5)
+
+
+def test_pair_pot_mixed_unsupported():
+    system, nlist, scalings, part_pair, pair_fn = get_part_caffeine_ljcross_9A()
+    assert not part_pair.pair_pot.set_mixed(True)
+    assert not part_pair.pair_pot.mixed
+
+
+def check_pair_pot_lambda(system, nlist, scalings, part_pair):
+    # Soft-core coupling of the first water molecules with the rest.
+    lambdas = np.array([0.0, 0.3, 0.7, 1.0])
+    group = np.arange(6)
+    part_lambda = ForcePartPairLambda(system, nlist, scalings, part_pair.pair_pot, group, lambdas)
+    nlist.update()
+    # With full coupling, the original energy is recovered.
+    gpos0 = np.zeros(system.pos.shape, float)
+    energy0 = part_pair.compute(gpos0)
+    gpos1 = np.zeros(system.pos.shape, float)
+    energy1 = part_lambda.compute(gpos1)
+    assert abs(energy0 - energy1) < 1e-10*abs(energy0)
+    assert abs(gpos0 - gpos1).max() < 1e-10*abs(gpos0).max()
+    assert abs(part_lambda.lambda_energies[-1] - energy0) < 1e-10*abs(energy0)
+    # The energies for all lambdas agree with separate computations.
+    lambda_energies = part_lambda.lambda_energies.copy()
+    for lam, lambda_energy in zip(lambdas, lambda_energies):
+        part_lambda.set_lambda(lam)
+        assert abs(part_lambda.compute() - lambda_energy) < 1e-10*abs(lambda_energy)
+    assert lambda_energies[0] != lambda_energies[1]
+    # Without coupling, the group does not interact with the other atoms.
+    mask = np.ones(system.natom, bool)
+    mask[group] = False
+    part_lambda.set_lambda(0.0)
+    gpos2 = np.zeros(system.pos.shape, float)
+    part_lambda.compute(gpos2)
+    assert abs(gpos2[group].sum(axis=0)).max() < 1e-10*abs(gpos0).max()
+    # Consistency of the derivatives at an intermediate lambda.
+    part_lambda.set_lambda(0.4)
+    check_gpos_part(system, part_lambda, nlist)
+    check_vtens_part(system, part_lambda, nlist)
+
+
+def test_pair_pot_lambda_lj_water32_9A():
+    check_pair_pot_lambda(*get_part_water32_9A_lj()[:4])
+
+
+def test_pair_pot_lambda_mm3_water32_9A():
+    check_pair_pot_lambda(*get_part_water32_9A_mm3()[:4])
+
+
+def test_pair_pot_lambda_ei_water32_14A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_ei()
+    part_pair = ForcePartPair(system, nlist, scalings, PairPotEI(system.charges, 0.0, 14*angstrom))
+    check_pair_pot_lambda(system, nlist, scalings, part_pair)
+
+
+def test_pair_pot_lambda_errors():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_eidip()
+    with assert_raises(TypeError):
+        ForcePartPairLambda(system, nlist, scalings, part_pair.pair_pot, [0, 1, 2], [0.0, 1.0])
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_ei()
+    with assert_raises(ValueError):
+        ForcePartPairLambda(system, nlist, scalings, part_pair.pair_pot, [0, 1, 2], [0.0, 1.0])
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_9A_lj()
+    nlist = NeighborList(system, compact=True)
+    with assert_raises(ValueError):
+        ForcePartPairLambda(system, nlist, scalings, part_pair.pair_pot, [0, 1, 2], [0.0, 1.0])
+
+
+def check_pair_pot_mixing_table(get_part):
+    # The mixed parameters tabulated for each pair of parameter classes must
+    # give the same results as mixing the per-atom parameters on the fly.
+    import yaff.pes.ext
+    results = []
+    max_mixing_classes = yaff.pes.ext._max_mixing_classes
+    for max_classes in max_mixing_classes, 0:
+        yaff.pes.ext._max_mixing_classes = max_classes
+        try:
+            system, nlist, scalings, part_pair, pair_fn = get_part()
+        finally:
+            yaff.pes.ext._max_mixing_classes = max_mixing_classes
+        nlist.update()
+        gpos = np.zeros(system.pos.shape, float)
+        vtens = np.zeros((3, 3), float)
+        energy = part_pair.compute(gpos, vtens)
+        results.append((energy, gpos, vtens))
+    assert results[0][0] == results[1][0]
+    assert (results[0][1] == results[1][1]).all()
+    assert (results[0][2] == results[1][2]).all()
+
+
+def test_pair_pot_mixing_table_lj_water32_9A():
+    check_pair_pot_mixing_table(get_part_water32_9A_lj)
+
+
+def test_pair_pot_mixing_table_mm3_caffeine_15A():
+    check_pair_pot_mixing_table(get_part_caffeine_mm3_15A)
+
+
+def test_pair_pot_mixing_table_grimme():
+    import yaff.pes.ext
+    r0 = np.random.choice([1.2, 1.5, 1.8], 20)
+    c6 = np.random.choice([10.0, 20.0], 20)
+    centers, others = np.triu_indices(20, 1)
+    distances = np.random.uniform(1.0, 5.0, len(centers))
+    pair_pot1 = PairPotGrimme(r0, c6, 15*angstrom)
+    max_mixing_classes = yaff.pes.ext._max_mixing_classes
+    yaff.pes.ext._max_mixing_classes = 0
+    try:
+        pair_pot2 = PairPotGrimme(r0, c6, 15*angstrom)
+    finally:
+        yaff.pes.ext._max_mixing_classes = max_mixing_classes
+    energies1, derivatives1 = pair_pot1.sample(centers, others, distances)
+    energies2, derivatives2 = pair_pot2.sample(centers, others, distances)
+    assert (energies1 == energies2).all()
+    assert (derivatives1 == derivatives2).all()
+
+
+def test_pair_pot_mixing_parameters_readonly():
+    # The mixed parameters are tabulated at construction, so changing the
+    # per-atom parameters afterwards must not be possible.
+    sigmas = np.array([2.0, 3.0])
+    epsilons = np.array([0.1, 0.2])
+    pair_pots = [
+        PairPotLJ(sigmas, epsilons, 15*angstrom),
+        PairPotMM3(sigmas, epsilons, np.zeros(2, dtype=np.intc), 15*angstrom),
+    ]
+    for pair_pot in pair_pots:
+        for array in pair_pot.sigmas, pair_pot.epsilons:
+            with assert_raises(ValueError):
+                array[0] = 1.0
+    with assert_raises(ValueError):
+        pair_pots[1].onlypaulis[0] = 1
+    pair_pot = PairPotGrimme(sigmas, epsilons, 15*angstrom)
+    for array in pair_pot.r0, pair_pot.c6:
+        with assert_raises(ValueError):
+            array[0] = 1.0
+    # The arrays given to the constructor are copied, so changing them
+    # afterwards must not affect the results.
+    pair_pots.append(pair_pot)
+    centers = np.array([0])
+    others = np.array([1])
+    distances = np.array([4.0])
+    results = [pair_pot.sample(centers, others, distances) for pair_pot in pair_pots]
+    sigmas[:] = 1.0
+    epsilons[:] = 1.0
+    for pair_pot, (energies, derivatives) in zip(pair_pots, results):
+        energies_after, derivatives_after = pair_pot.sample(centers, others, distances)
+        assert (energies == energies_after).all()
+        assert (derivatives == derivatives_after).all()
+
+
+def check_pair_pot_slater_table(get_part):
+    # The coefficients tabulated for each pair of Slater widths must give the
+    # same results as computing them for every pair of atoms.
+    import yaff.pes.ext
+    results = []
+    max_slater_classes = yaff.pes.ext._max_slater_classes
+    for max_classes in max_slater_classes, 0:
+        yaff.pes.ext._max_slater_classes = max_classes
+        try:
+            system, nlist, scalings, part_pair, pair_fn = get_part()
+        finally:
+            yaff.pes.ext._max_slater_classes = max_slater_classes
+        nlist.update()
+        gpos = np.zeros(system.pos.shape, float)
+        vtens = np.zeros((3, 3), float)
+        energy = part_pair.compute(gpos, vtens)
+        results.append((energy, gpos, vtens))
+    assert abs(results[0][0] - results[1][0]) < 1e-12*abs(results[1][0])
+    assert abs(results[0][1] - results[1][1]).max() < 1e-12*abs(results[1][1]).max()
+    assert abs(results[0][2] - results[1][2]).max() < 1e-12*abs(results[1][2]).max()
+
+
+def test_pair_pot_slater_table_eislater1s1scorr():
+    check_pair_pot_slater_table(get_part_4113_01WaterWater_eislater1s1scorr)
+
+
+def test_pair_pot_slater_table_olpslater1s1s():
+    check_pair_pot_slater_table(get_part_4113_01WaterWater_olpslater1s1s)
+
+
+def test_pair_pot_slater_table_chargetransferslater1s1s():
+    check_pair_pot_slater_table(get_part_4113_01WaterWater_chargetransferslater1s1s)
+
+
+def test_pair_pot_slater_table_eislater1sp1spcorr():
+    def get_part():
+        system = System(np.array([1, 8, 1]), np.array([[0.0, 0.0, 0.0], [0.4, 0.7, 0.5], [1.9, 0.3, 0.6]]), bonds=np.array([]))
+        nlist = NeighborList(system)
+        scalings = Scalings(system, 0.0, 0.0, 0.0)
+        N1s = np.array([0.5, 2.0, 0.4])
+        N1p = np.array([[0.9, 4.0, 3.0], [1.2, 1.1, 0.45], [0.3, 0.2, 0.1]])
+        Z1s = np.array([2.0, 8.0, 1.0])
+        Z1p = np.array([[2.0, 0.0, 3.0], [3.0, 4.0, 6.0], [1.0, 0.5, 0.2]])
+        # Equal widths for two atoms, nearly equal and different 1p widths.
+        a1s = np.array([0.5, 0.6, 0.5])
+        a1p = np.array([[0.5, 0.51, 0.7], [0.6, 0.6, 0.6], [0.5, 0.51, 0.7]])
+        pair_pot = PairPotEiSlater1sp1spCorr(a1s, N1s, Z1s, a1p, N1p, Z1p, 20*angstrom)
+        part_pair = ForcePartPair(system, nlist, scalings, pair_pot)
+        return system, nlist, scalings, part_pair, None
+    check_pair_pot_slater_table(get_part)
+
+
+def test_pair_pot_cross_interleaved():
+    system, nlist, scalings, part_pair, pair_fn = get_part_caffeine_dampdisp_9A()
+    pair_pot = part_pair.pair_pot
+    # The cross parameters are views on one interleaved table.
+    assert pair_pot.cn_cross.shape == pair_pot.b_cross.shape
+    assert (pair_pot.cn_cross == pair_pot.cn_cross.T).all()
+    assert (pair_pot.b_cross == pair_pot.b_cross.T).all()
+    assert pair_pot.cn_cross.strides[1] == 2*pair_pot.cn_cross.itemsize
+
+
+def _compute_pair_pot_threads(nthread):
+    # Compute the electrostatic pair term in a fresh interpreter, because the
+    # number of OpenMP threads is fixed when the runtime starts. The term is
+    # computed twice to check that the results are reproducible bitwise.
+    script = (
+        'import sys\n'
+        'import numpy as np\n'
+        'from molmod import angstrom\n'
+        'from yaff import NeighborList, Scalings, ForcePartPair, PairPotEI\n'
+        'from yaff.test.common import get_system_water32\n'
+        'system = get_system_water32().supercell(2, 2, 2)\n'
+        'nlist = NeighborList(system)\n'
+        'scalings = Scalings(system, 0.0, 0.5, 1.0)\n'
+        'part = ForcePartPair(system, nlist, scalings, PairPotEI(system.charges, 0.0, 9*angstrom))\n'
+        'nlist.update()\n'
+        'results = []\n'
+        'for irep in range(2):\n'
+        '    gpos = np.zeros(system.pos.shape)\n'
+        '    vtens = np.zeros((3, 3))\n'
+        '    energy = part.compute(gpos, vtens)\n'
+        '    results.append(np.concatenate([[nlist.get_nneigh(9*angstrom), energy], gpos.ravel(), vtens.ravel()]))\n'
+        'assert (results[0] == results[1]).all()\n'
+        'np.save(sys.stdout.buffer, results[0])\n'
+    )
+    env = dict(os.environ)
+    env['OMP_NUM_THREADS'] = str(nthread)
+    return np.load(BytesIO(subprocess.check_output([sys.executable, '-c', script], env=env)))
+
+
+def test_pair_pot_threads_reproducible():
+    # With several threads, the neighbor list is split into chunks, each with
+    # its own gpos and vtens, which are added in a fixed order. Repeated
+    # computations must give identical results, and the results must agree
+    # with a single chunk.
+    result1 = _compute_pair_pot_threads(1)
+    # At least four chunks of PAIR_POT_CHUNK_MIN (1024) pairs.
+    assert result1[0] >= 4*1024
+    for nthread in 2, 4:
+        result = _compute_pair_pot_threads(nthread)
+        assert result[0] == result1[0]
+        assert abs(result[1] - result1[1]) < 1e-12*abs(result1[1])
+        assert abs(result[2:-9] - result1[2:-9]).max() < 1e-12*abs(result1[2:-9]).max()
+        assert abs(result[-9:] - result1[-9:]).max() < 1e-12*abs(result1[-9:]).max()
+    # The result must not depend on the format of the neighbor list.
+    system = get_system_water32().supercell(2, 2, 2)
+    scalings = Scalings(system, 0.0, 0.5, 1.0)
+    nlist_compact = NeighborList(system, compact=True)
+    part_compact = ForcePartPair(system, nlist_compact, scalings, PairPotEI(system.charges, 0.0, 9*angstrom))
+    nlist_compact.update()
+    gpos_compact = np.zeros(system.pos.shape, float)
+    energy_compact = part_compact.compute(gpos_compact)
+    energy = result1[1]
+    gpos = result1[2:-9].reshape(-1, 3)
+    assert abs(gpos.sum(axis=0)).max() < 1e-10*abs(gpos).max()
+    assert abs(energy - energy_compact) < 1e-10*abs(energy)
+    assert abs(gpos - gpos_compact).max() < 1e-10*abs(gpos).max()
+
+
+def check_pair_pot_tabulated(system, nlist, scalings, part_pair, tolerance=1e-9):
+    # The tabulated potential must reproduce the original one.
+    nlist.update()
+    pair_pot = PairPotTabulated(part_pair.pair_pot, system.ffatype_ids, tolerance)
+    assert pair_pot.name == part_pair.pair_pot.name
+    assert pair_pot.rcut == part_pair.pair_pot.rcut
+    assert pair_pot.get_truncation() is part_pair.pair_pot.get_truncation()
+    part_tab = ForcePartPair(system, nlist, scalings, pair_pot)
+    gpos1 = np.zeros(system.pos.shape, float)
+    vtens1 = np.zeros((3, 3), float)
+    energy1 = part_pair.compute(gpos1, vtens1)
+    gpos2 = np.zeros(system.pos.shape, float)
+    vtens2 = np.zeros((3, 3), float)
+    energy2 = part_tab.compute(gpos2, vtens2)
+    assert abs(energy1 - energy2) < 1e-6*abs(energy1)
+    assert abs(gpos1 - gpos2).max() < 1e-6*abs(gpos1).max()
+    assert abs(vtens1 - vtens2).max() < 1e-6*abs(vtens1).max()
+    # The interpolated derivatives must be consistent with the energy.
+    check_gpos_part(system, part_tab, nlist)
+    check_vtens_part(system, part_tab, nlist)
+
+
+def test_pair_pot_tabulated_lj_water32_9A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_9A_lj()
+    check_pair_pot_tabulated(system, nlist, scalings, part_pair)
+
+
+def test_pair_pot_tabulated_ei_water32_14A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_ei()
+    check_pair_pot_tabulated(system, nlist, scalings, part_pair)
+
+
+def test_pair_pot_tabulated_exprep_caffeine_5A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_caffeine_exprep_5A(0, 0.0, 0, 0.0)
+    check_pair_pot_tabulated(system, nlist, scalings, part_pair)
+
+
+def test_pair_pot_tabulated_dampdisp_caffeine_9A():
+    system, nlist, scalings, part_pair, pair_fn = get_part_caffeine_dampdisp_9A()
+    check_pair_pot_tabulated(system, nlist, scalings, part_pair)
+
+
+def test_pair_pot_tabulated_sample():
+    system, nlist, scalings, part_pair, pair_fn = get_part_caffeine_dampdisp_9A()
+    pair_pot = PairPotTabulated(part_pair.pair_pot, system.ffatype_ids, 1e-10)
+    assert pair_pot.npoint > 17
+    centers = np.random.randint(system.natom, size=100)
+    others = np.random.randint(system.natom, size=100)
+    distances = np.random.uniform(0.5, pair_pot.rcut, 100)
+    e1, g1 = part_pair.pair_pot.sample(centers, others, distances)
+    e2, g2 = pair_pot.sample(centers, others, distances)
+    assert abs(e1 - e2).max() < 1e-10*max(1.0, abs(e1).max())
+    assert abs(g1 - g2).max() < 1e-10*max(1.0, abs(g1).max())
+    # Below rmin, the original potential is used.
+    mask = distances < pair_pot.rmin
+    assert (e1[mask] == e2[mask]).all()
+
+
+def test_pair_pot_tabulated_errors():
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_eidip()
+    with assert_raises(TypeError):
+        PairPotTabulated(part_pair.pair_pot, system.ffatype_ids)
+    system, nlist, scalings, part_pair, pair_fn = get_part_water32_14A_ei()
+    # Charges that differ between atoms of the same type can not be tabulated.
+    charges = system.charges + np.random.uniform(-0.1, 0.1, system.natom)
+    pair_pot = PairPotEI(charges, part_pair.pair_pot.alpha, part_pair.pair_pot.rcut)
+    with assert_raises(ValueError):
+        PairPotTabulated(pair_pot, system.ffatype_ids)
+    with assert_raises(ValueError):
+        PairPotTabulated(part_pair.pair_pot, system.ffatype_ids, rmin=2*part_pair.pair_pot.rcut)
+    with assert_raises(ValueError):
+        PairPotTabulated(part_pair.pair_pot, system.ffatype_ids, 1e-15, npoint_max=100)
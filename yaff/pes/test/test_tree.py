@@ -0,0 +1,122 @@
+# -*- coding: utf-8 -*-
+# YAFF is yet another force-field code.
+# Copyright (C) 2011 Toon Verstraelen <Toon.Verstraelen@UGent.be>,
+# Louis Vanduyfhuys <Louis.Vanduyfhuys@UGent.be>, Center for Molecular Modeling
+# (CMM), Ghent University, Ghent, Belgium; all rights reserved unless otherwise
+# stated.
+#
+# This file is part of YAFF.
+#
+# YAFF is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 3
+# of the License, or (at your option) any later version.
+#
+# YAFF is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, see <http://www.gnu.org/licenses/>
+#
+# --
+
+
+
+
+from __future__ import division
+
+import numpy as np
+from nose.tools import assert_raises
+
+from molmod import angstrom
+
+from yaff import *
+
+from yaff.test.common import get_system_water32
+from yaff.pes.test.common import check_gpos_part, check_vtens_part
+
+
+def get_system_water_cluster(nrep=1):
+    # A non-periodic copy of (a supercell of) the water box.
+    system = get_system_water32()
+    if nrep > 1:
+        system = system.supercell(nrep, nrep, nrep)
+    return System(
+        numbers=system.numbers, pos=system.pos, ffatypes=system.ffatypes,
+        ffatype_ids=system.ffatype_ids, bonds=system.bonds,
+        charges=system.charges,
+    )
+
+
+def get_part_ei_direct(system, scalings, dielectric=1.0):
+    # Plain real-space electrostatics with a cutoff beyond the cluster size.
+    nlist = NeighborList(system)
+    pair_pot = PairPotEI(system.charges, 0.0, 200*angstrom, dielectric=dielectric)
+    return nlist, ForcePartPair(system, nlist, scalings, pair_pot)
+
+
+def compute_all(system, part, nlist=None):
+    if nlist is not None:
+        nlist.update()
+    gpos = np.zeros(system.pos.shape)
+    vtens = np.zeros((3, 3))
+    energy = part.compute(gpos, vtens)
+    return energy, gpos, vtens
+
+
+def test_ei_fmm_exact_water32():
+    # With a tiny opening angle, all interactions are computed directly.
+    system = get_system_water_cluster()
+    scalings = Scalings(system, 0.0, 0.5, 1.0)
+    for dielectric in 1.0, 1.4:
+        nlist, part_direct = get_part_ei_direct(system, scalings, dielectric)
+        energy1, gpos1, vtens1 = compute_all(system, part_direct, nlist)
+        part_fmm = ForcePartEIFMM(system, scalings, theta=1e-8, dielectric=dielectric)
+        energy2, gpos2, vtens2 = compute_all(system, part_fmm)
+        assert abs(energy1 - energy2) < 1e-10
+        assert abs(gpos1 - gpos2).max() < 1e-10
+        assert abs(vtens1 - vtens2).max() < 1e-10
+
+
+def test_ei_fmm_accuracy_water256():
+    system = get_system_water_cluster(2)
+    scalings = Scalings(system, 0.0, 0.0, 1.0)
+    nlist, part_direct = get_part_ei_direct(system, scalings)
+    energy1, gpos1, vtens1 = compute_all(system, part_direct, nlist)
+    rms = np.sqrt((gpos1**2).mean())
+    errors = []
+    for order in 0, 2, 4, 6:
+        part_fmm = ForcePartEIFMM(system, scalings, order=order, theta=0.5)
+        energy2, gpos2, vtens2 = compute_all(system, part_fmm)
+        errors.append(np.sqrt(((gpos1 - gpos2)**2).mean())/rms)
+    # Higher orders are more accurate.
+    assert errors[0] > errors[1] > errors[2] > errors[3]
+    assert abs(energy1 - energy2) < 1e-4*abs(energy1)
+    assert errors[3] < 1e-2
+    # A smaller opening angle is more accurate.
+    part_fmm = ForcePartEIFMM(system, scalings, order=6, theta=0.25)
+    energy2, gpos2, vtens2 = compute_all(system, part_fmm)
+    assert np.sqrt(((gpos1 - gpos2)**2).mean())/rms < errors[3]
+    assert abs(energy1 - energy2) < 1e-6*abs(energy1)
+
+
+def test_ei_fmm_gpos_vtens_water32():
+    system = get_system_water_cluster()
+    scalings = Scalings(system, 0.0, 0.5, 1.0)
+    part_fmm = ForcePartEIFMM(system, scalings, theta=1e-8, dielectric=0.8)
+    check_gpos_part(system, part_fmm)
+    check_vtens_part(system, part_fmm)
+
+
+def test_ei_fmm_errors():
+    system = get_system_water_cluster()
+    scalings = Scalings(system)
+    with assert_raises(ValueError):
+        ForcePartEIFMM(system, scalings, order=tree_max_order+1)
+    with assert_raises(ValueError):
+        ForcePartEIFMM(system, scalings, theta=1.0)
+    system = get_system_water32()
+    with assert_raises(TypeError):
+        ForcePartEIFMM(system, Scalings(system))
@@ -0,0 +1,447 @@
+// YAFF is yet another force-field code.
+// Copyright (C) 2011 Toon Verstraelen <Toon.Verstraelen@UGent.be>,
+// Louis Vanduyfhuys <Louis.Vanduyfhuys@UGent.be>, Center for Molecular Modeling
+// (CMM), Ghent University, Ghent, Belgium; all rights reserved unless otherwise
+// stated.
+//
+// This file is part of YAFF.
+//
+// YAFF is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// YAFF is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+
+#include <math.h>
+#include <stdlib.h>
+#include "tree.h"
+
+// Nodes with at most this number of atoms are not split further.
+#define TREE_LEAF_SIZE 8
+// Nodes at this depth are never split, e.g. in case of coinciding atoms.
+#define TREE_MAX_DEPTH 32
+// The number of Cartesian powers x^t y^u z^v with t+u+v <= TREE_MAX_ORDER+1.
+#define TREE_MAX_TERM ((TREE_MAX_ORDER+2)*(TREE_MAX_ORDER+3)*(TREE_MAX_ORDER+4)/6)
+
+typedef struct {
+  double box[3];      // center of the cube that is split into octants
+  double half;        // half of the edge of that cube
+  double center[3];   // expansion center, i.e. the average atomic position
+  double radius;      // largest distance of an atom to the expansion center
+  long begin, end;    // range of atoms in the permutation
+  long child, nchild; // children are stored contiguously
+  long depth;
+} tree_node_type;
+
+typedef struct {
+  // The Cartesian powers x^t y^u z^v up to a total degree lmax, sorted by
+  // degree, such that the first nmom of them are the multipole moments.
+  long lmax, nterm, nmom;
+  long tuv[TREE_MAX_TERM][3];
+  long index[TREE_MAX_ORDER+2][TREE_MAX_ORDER+2][TREE_MAX_ORDER+2];
+} tree_terms_type;
+
+typedef struct {
+  long *first;        // partners of atom i: first[i] <= p < first[i+1]
+  long *partner;
+  double *scale;
+} tree_partners_type;
+
+
+static void tree_terms_init(tree_terms_type *terms, long order) {
+  long l, t, u, k;
+  (*terms).lmax = order + 1;
+  k = 0;
+  for (l = 0; l <= (*terms).lmax; l++) {
+    if (l == (*terms).lmax) (*terms).nmom = k;
+    for (t = l; t >= 0; t--) {
+      for (u = l - t; u >= 0; u--) {
+        (*terms).tuv[k][0] = t;
+        (*terms).tuv[k][1] = u;
+        (*terms).tuv[k][2] = l - t - u;
+        (*terms).index[t][u][l-t-u] = k;
+        k++;
+      }
+    }
+  }
+  (*terms).nterm = k;
+}
+
+
+static void tree_derivatives(tree_terms_type *terms, double *delta,
+                             double *deriv) {
+  // Computes all partial derivatives of 1/r at delta, up to the degree lmax,
+  // with the recurrence relations for Hermite Coulomb integrals:
+  //   R(n, t+1, u, v) = t R(n+1, t-1, u, v) + x R(n+1, t, u, v)
+  // where R(n, 0, 0, 0) = (-1)^n (2n-1)!!/r^(2n+1). The derivatives are
+  // R(0, t, u, v).
+  double work[(TREE_MAX_ORDER+2)*TREE_MAX_TERM];
+  double *cur, *prev, r2, r1, base;
+  long n, k, d, nterm, t[3], *tuv;
+
+  r2 = delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2];
+  r1 = 1.0/sqrt(r2);
+  // Start with the highest n, which only has the R(n, 0, 0, 0) term.
+  base = r1;
+  for (n = 1; n <= (*terms).lmax; n++) base *= -(2*n - 1)/r2;
+  prev = NULL;
+  for (n = (*terms).lmax; n >= 0; n--) {
+    cur = (n == 0) ? deriv : work + n*TREE_MAX_TERM;
+    cur[0] = base;
+    // The number of terms with a degree up to lmax - n.
+    d = (*terms).lmax - n;
+    nterm = (d+1)*(d+2)*(d+3)/6;
+    for (k = 1; k < nterm; k++) {
+      tuv = (*terms).tuv[k];
+      t[0] = tuv[0];
+      t[1] = tuv[1];
+      t[2] = tuv[2];
+      // Lower the first nonzero power.
+      d = (t[0] > 0) ? 0 : ((t[1] > 0) ? 1 : 2);
+      t[d]--;
+      cur[k] = delta[d]*prev[(*terms).index[t[0]][t[1]][t[2]]];
+      if (t[d] > 0) {
+        t[d]--;
+        cur[k] += (t[d] + 1)*prev[(*terms).index[t[0]][t[1]][t[2]]];
+      }
+    }
+    base *= -r2/(2*n - 1);
+    prev = cur;
+  }
+}
+
+
+static void tree_node_moments(tree_node_type *node, tree_terms_type *terms,
+                              double *pos, double *charges, long *perm,
+                              double *moments) {
+  // Computes the expansion center, the radius and the multipole moments
+  //   M(t, u, v) = sum_i q_i (-x_i)^t (-y_i)^u (-z_i)^v/(t! u! v!)
+  // of the atoms in a node, with positions relative to the expansion center.
+  long i, k, l;
+  double x[3], r2, power[3][TREE_MAX_ORDER+1];
+  for (k = 0; k < 3; k++) (*node).center[k] = 0.0;
+  for (i = (*node).begin; i < (*node).end; i++) {
+    for (k = 0; k < 3; k++) (*node).center[k] += pos[3*perm[i]+k];
+  }
+  for (k = 0; k < 3; k++) (*node).center[k] /= (*node).end - (*node).begin;
+  (*node).radius = 0.0;
+  for (k = 0; k < (*terms).nmom; k++) moments[k] = 0.0;
+  for (i = (*node).begin; i < (*node).end; i++) {
+    for (k = 0; k < 3; k++) x[k] = pos[3*perm[i]+k] - (*node).center[k];
+    r2 = x[0]*x[0] + x[1]*x[1] + x[2]*x[2];
+    if (r2 > (*node).radius) (*node).radius = r2;
+    // power[k][l] = (-x_k)^l/l!
+    for (k = 0; k < 3; k++) {
+      power[k][0] = 1.0;
+      for (l = 1; l < (*terms).lmax; l++) power[k][l] = -power[k][l-1]*x[k]/l;
+    }
+    for (k = 0; k < (*terms).nmom; k++) {
+      moments[k] += charges[perm[i]]*power[0][(*terms).tuv[k][0]]*
+                    power[1][(*terms).tuv[k][1]]*power[2][(*terms).tuv[k][2]];
+    }
+  }
+  (*node).radius = sqrt((*node).radius);
+}
+
+
+static long tree_build(double *pos, long natom, long *perm,
+                       tree_node_type **nodes) {
+  // Builds an octree in breadth-first order, such that the children of a
+  // node are stored contiguously. Returns the number of nodes or -1 when
+  // memory could not be allocated. The caller must free *nodes.
+  long *octant, *sorted, count[8], offset[8];
+  long inode, nnode, size, i, k, o;
+  double lower[3], upper[3], x;
+  tree_node_type *node, *child, *tmp;
+
+  octant = malloc(2*natom*sizeof(long));
+  size = 64;
+  *nodes = malloc(size*sizeof(tree_node_type));
+  if ((octant == NULL) || (*nodes == NULL)) {
+    free(octant);
+    return -1;
+  }
+  sorted = octant + natom;
+  for (i = 0; i < natom; i++) perm[i] = i;
+
+  // The root is the smallest cube that contains all atoms.
+  for (k = 0; k < 3; k++) {
+    lower[k] = pos[k];
+    upper[k] = pos[k];
+  }
+  for (i = 1; i < natom; i++) {
+    for (k = 0; k < 3; k++) {
+      x = pos[3*i+k];
+      if (x < lower[k]) lower[k] = x;
+      if (x > upper[k]) upper[k] = x;
+    }
+  }
+  node = *nodes;
+  (*node).half = 0.0;
+  for (k = 0; k < 3; k++) {
+    (*node).box[k] = 0.5*(lower[k] + upper[k]);
+    x = 0.5*(upper[k] - lower[k]);
+    if (x > (*node).half) (*node).half = x;
+  }
+  (*node).begin = 0;
+  (*node).end = natom;
+  (*node).depth = 0;
+  nnode = 1;
+
+  for (inode = 0; inode < nnode; inode++) {
+    node = *nodes + inode;
+    (*node).child = nnode;
+    (*node).nchild = 0;
+    if (((*node).end - (*node).begin <= TREE_LEAF_SIZE) ||
+        ((*node).depth >= TREE_MAX_DEPTH)) continue;
+    // Sort the atoms of the node by octant.
+    for (o = 0; o < 8; o++) count[o] = 0;
+    for (i = (*node).begin; i < (*node).end; i++) {
+      o = 0;
+      for (k = 0; k < 3; k++) {
+        if (pos[3*perm[i]+k] >= (*node).box[k]) o |= 1 << k;
+      }
+      octant[i] = o;
+      count[o]++;
+    }
+    offset[0] = (*node).begin;
+    for (o = 1; o < 8; o++) offset[o] = offset[o-1] + count[o-1];
+    for (i = (*node).begin; i < (*node).end; i++) {
+      sorted[offset[octant[i]]] = perm[i];
+      offset[octant[i]]++;
+    }
+    for (i = (*node).begin; i < (*node).end; i++) perm[i] = sorted[i];
+    // Make room for the children.
+    if (nnode + 8 > size) {
+      size *= 2;
+      tmp = realloc(*nodes, size*sizeof(tree_node_type));
+      if (tmp == NULL) {
+        free(octant);
+        return -1;
+      }
+      *nodes = tmp;
+      node = *nodes + inode;
+    }
+    // Add a child for each octant that contains atoms.
+    for (o = 0; o < 8; o++) {
+      if (count[o] == 0) continue;
+      child = *nodes + nnode;
+      (*child).half = 0.5*(*node).half;
+      for (k = 0; k < 3; k++) {
+        (*child).box[k] = (*node).box[k] + ((o >> k) & 1 ? 1 : -1)*(*child).half;
+      }
+      (*child).end = offset[o];
+      (*child).begin = offset[o] - count[o];
+      (*child).depth = (*node).depth + 1;
+      (*node).nchild++;
+      nnode++;
+    }
+  }
+  free(octant);
+  return nnode;
+}
+
+
+static long tree_partners_init(tree_partners_type *partners,
+                               scaling_row_type *stab, long stab_size,
+                               long natom) {
+  // Converts the table of scaled pairs into a list of partners of each atom.
+  // Returns -1 when memory could not be allocated.
+  long i, a, b;
+  (*partners).first = malloc((natom+1)*sizeof(long));
+  (*partners).partner = malloc((2*stab_size+1)*sizeof(long));
+  (*partners).scale = malloc((2*stab_size+1)*sizeof(double));
+  if (((*partners).first == NULL) || ((*partners).partner == NULL) ||
+      ((*partners).scale == NULL)) return -1;
+  for (i = 0; i <= natom; i++) (*partners).first[i] = 0;
+  for (i = 0; i < stab_size; i++) {
+    (*partners).first[stab[i].a+1]++;
+    (*partners).first[stab[i].b+1]++;
+  }
+  for (i = 0; i < natom; i++) (*partners).first[i+1] += (*partners).first[i];
+  // Fill in the partners, temporarily using first[a] as insertion point.
+  for (i = 0; i < stab_size; i++) {
+    a = stab[i].a;
+    b = stab[i].b;
+    (*partners).partner[(*partners).first[a]] = b;
+    (*partners).scale[(*partners).first[a]] = stab[i].scale;
+    (*partners).first[a]++;
+    (*partners).partner[(*partners).first[b]] = a;
+    (*partners).scale[(*partners).first[b]] = stab[i].scale;
+    (*partners).first[b]++;
+  }
+  for (i = natom; i > 0; i--) (*partners).first[i] = (*partners).first[i-1];
+  (*partners).first[0] = 0;
+  return 0;
+}
+
+
+static void tree_partners_free(tree_partners_type *partners) {
+  free((*partners).first);
+  free((*partners).partner);
+  free((*partners).scale);
+}
+
+
+static void tree_eval(tree_node_type *nodes, double *moments,
+                      tree_terms_type *terms, double *pos, double *charges,
+                      long *perm, long *rank, tree_partners_type *partners,
+                      long iatom, double theta, double *phi, double *field) {
+  // Computes the electrostatic potential and its gradient at atom iatom, due
+  // to all other atoms. Nodes that are small compared to their distance to
+  // the atom, radius < theta*distance, are replaced by their multipole
+  // expansion, unless the direct sum is cheaper. The atom iatom is never part
+  // of such a node because theta < 1.
+  // Nodes with atoms whose interaction with iatom is scaled are always opened,
+  // such that the scaled pairs are computed exactly.
+  long stack[8*(TREE_MAX_DEPTH + 1)];
+  double deriv[TREE_MAX_TERM];
+  long nstack, i, j, k, p, accept, *tuv, (*index)[TREE_MAX_ORDER+2][TREE_MAX_ORDER+2];
+  double delta[3], d2, r1, tmp, fac, *mom;
+  tree_node_type *node;
+
+  index = (*terms).index;
+  *phi = 0.0;
+  for (k = 0; k < 3; k++) field[k] = 0.0;
+  stack[0] = 0;
+  nstack = 1;
+  while (nstack > 0) {
+    nstack--;
+    node = nodes + stack[nstack];
+    for (k = 0; k < 3; k++) delta[k] = pos[3*iatom+k] - (*node).center[k];
+    d2 = delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2];
+    accept = (*node).radius*(*node).radius < theta*theta*d2;
+    for (p = (*partners).first[iatom]; accept && (p < (*partners).first[iatom+1]); p++) {
+      i = rank[(*partners).partner[p]];
+      if ((i >= (*node).begin) && (i < (*node).end)) accept = 0;
+    }
+    if (accept && ((*node).end - (*node).begin > (*terms).nmom)) {
+      // Multipole expansion of the node:
+      //   phi = sum_tuv M(t, u, v) d^(t+u+v)(1/r)/(dx^t dy^u dz^v)
+      tree_derivatives(terms, delta, deriv);
+      mom = moments + stack[nstack]*(*terms).nmom;
+      for (k = 0; k < (*terms).nmom; k++) {
+        tuv = (*terms).tuv[k];
+        *phi += mom[k]*deriv[k];
+        field[0] += mom[k]*deriv[index[tuv[0]+1][tuv[1]][tuv[2]]];
+        field[1] += mom[k]*deriv[index[tuv[0]][tuv[1]+1][tuv[2]]];
+        field[2] += mom[k]*deriv[index[tuv[0]][tuv[1]][tuv[2]+1]];
+      }
+    } else if (accept || ((*node).nchild == 0)) {
+      // Direct summation over the atoms in a leaf, or in a node with fewer
+      // atoms than terms in the expansion.
+      for (i = (*node).begin; i < (*node).end; i++) {
+        j = perm[i];
+        if (j == iatom) continue;
+        fac = 1.0;
+        for (p = (*partners).first[iatom]; p < (*partners).first[iatom+1]; p++) {
+          if ((*partners).partner[p] == j) fac = (*partners).scale[p];
+        }
+        if (fac == 0.0) continue;
+        for (k = 0; k < 3; k++) delta[k] = pos[3*iatom+k] - pos[3*j+k];
+        r1 = 1.0/sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]);
+        *phi += fac*charges[j]*r1;
+        tmp = fac*charges[j]*r1*r1*r1;
+        for (k = 0; k < 3; k++) field[k] -= tmp*delta[k];
+      }
+    } else {
+      for (i = 0; i < (*node).nchild; i++) {
+        stack[nstack] = (*node).child + i;
+        nstack++;
+      }
+    }
+  }
+}
+
+
+double compute_ei_tree(double *pos, double *charges, long natom,
+                       scaling_row_type *stab, long stab_size, long order,
+                       double theta, double dielectric, double *gpos,
+                       double *vtens) {
+  // Computes the electrostatic energy of point charges in a non-periodic
+  // system with a Barnes-Hut tree code. Returns NaN when memory could not be
+  // allocated.
+  long *perm, *rank, nnode, i, k, l;
+  double *work, *moments, *phi, *field, energy, x[3];
+  tree_node_type *nodes;
+  tree_terms_type terms;
+  tree_partners_type partners;
+
+  if (natom == 0) return 0.0;
+  tree_terms_init(&terms, order);
+  perm = malloc(2*natom*sizeof(long));
+  work = malloc(4*natom*sizeof(double));
+  nodes = NULL;
+  moments = NULL;
+  nnode = -1;
+  partners.first = NULL;
+  partners.partner = NULL;
+  partners.scale = NULL;
+  if ((perm != NULL) && (work != NULL) &&
+      (tree_partners_init(&partners, stab, stab_size, natom) == 0)) {
+    nnode = tree_build(pos, natom, perm, &nodes);
+  }
+  if (nnode > 0) {
+    moments = malloc(nnode*terms.nmom*sizeof(double));
+  }
+  if (moments == NULL) {
+    free(nodes);
+    free(perm);
+    free(work);
+    tree_partners_free(&partners);
+    return NAN;
+  }
+  rank = perm + natom;
+  for (i = 0; i < natom; i++) rank[perm[i]] = i;
+
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (i = 0; i < nnode; i++) {
+    tree_node_moments(nodes + i, &terms, pos, charges, perm, moments + i*terms.nmom);
+  }
+
+  // The atoms are independent, and their results are summed afterwards in a
+  // fixed order, such that the result does not depend on the threads.
+  phi = work;
+  field = work + natom;
+  #pragma omp parallel for schedule(dynamic, 64)
+  for (i = 0; i < natom; i++) {
+    tree_eval(nodes, moments, &terms, pos, charges, perm, rank, &partners, i,
+              theta, phi + i, field + 3*i);
+  }
+
+  energy = 0.0;
+  for (i = 0; i < natom; i++) {
+    energy += 0.5*charges[i]*phi[i];
+    if (gpos != NULL) {
+      for (k = 0; k < 3; k++) gpos[3*i+k] += charges[i]*field[3*i+k]/dielectric;
+    }
+    if (vtens != NULL) {
+      // Positions relative to the center of the root, to keep the virial
+      // insensitive to the origin when the forces do not add up to zero.
+      for (k = 0; k < 3; k++) x[k] = pos[3*i+k] - (*nodes).center[k];
+      for (k = 0; k < 3; k++) {
+        for (l = 0; l < 3; l++) {
+          vtens[3*k+l] += charges[i]*field[3*i+k]*x[l]/dielectric;
+        }
+      }
+    }
+  }
+
+  free(moments);
+  free(nodes);
+  free(perm);
+  free(work);
+  tree_partners_free(&partners);
+  return energy/dielectric;
+}
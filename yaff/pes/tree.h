@@ -0,0 +1,39 @@
+// YAFF is yet another force-field code.
+// Copyright (C) 2011 Toon Verstraelen <Toon.Verstraelen@UGent.be>,
+// Louis Vanduyfhuys <Louis.Vanduyfhuys@UGent.be>, Center for Molecular Modeling
+// (CMM), Ghent University, Ghent, Belgium; all rights reserved unless otherwise
+// stated.
+//
+// This file is part of YAFF.
+//
+// YAFF is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// YAFF is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+
+#ifndef YAFF_PES_TREE_H
+#define YAFF_PES_TREE_H
+
+#include "pair_pot.h"
+
+// The highest order of the multipole expansions of the tree nodes.
+#define TREE_MAX_ORDER 8
+
+double compute_ei_tree(double *pos, double *charges, long natom,
+                       scaling_row_type *stab, long stab_size, long order,
+                       double theta, double dielectric, double *gpos,
+                       double *vtens);
+
+#endif
@@ -28,16 +28,7 @@
 
 
 double hammer(double d, double rcut, double tau, double *g) {
-  double result, x;
-  if (d < rcut) {
-    x = d - rcut;
-    result = exp(tau/x);
-    if (g != NULL) *g = -result*tau/x/x;
-  } else {
-    result = 0.0;
-    if (g != NULL) *g = 0.0;
-  }
-  return result;
+  return hammer_inline(d, rcut, tau, g);
 }
 
 trunc_scheme_type* hammer_new(double tau) {
@@ -57,22 +48,7 @@ double hammer_get_tau(trunc_scheme_type *trunc_scheme) {
 
 
 double switch3(double d, double rcut, double width, double *g) {
-  double result, x;
-  if (d < rcut) {
-    x = rcut - d;
-    if (x > width) {
-      result = 1.0;
-      if (g != NULL) *g = 0.0;
-    } else {
-      x /= width;
-      result = (3 - 2*x)*x*x;
-      if (g != NULL) *g = -6*x*(1-x)/width;
-    }
-  } else {
-    result = 0.0;
-    if (g != NULL) *g = 0.0;
-  }
-  return result;
+  return switch3_inline(d, rcut, width, g);
 }
 
 trunc_scheme_type* switch3_new(double width) {
@@ -26,6 +26,10 @@
 #define YAFF_TRUNCATION_H
 
 
+#include <math.h>
+#include <stdlib.h>
+
+
 typedef double (*trunc_fn_type)(double, double, double, double*);
 
 typedef struct {
@@ -33,9 +37,45 @@ typedef struct {
   double par;
 } trunc_scheme_type;
 
+// The truncation functions are defined here, such that they can be inlined in
+// specialized pair potential kernels.
+static inline double hammer_inline(double d, double rcut, double tau, double *g) {
+  double result, x;
+  if (d < rcut) {
+    x = d - rcut;
+    result = exp(tau/x);
+    if (g != NULL) *g = -result*tau/x/x;
+  } else {
+    result = 0.0;
+    if (g != NULL) *g = 0.0;
+  }
+  return result;
+}
+
+static inline double switch3_inline(double d, double rcut, double width, double *g) {
+  double result, x;
+  if (d < rcut) {
+    x = rcut - d;
+    if (x > width) {
+      result = 1.0;
+      if (g != NULL) *g = 0.0;
+    } else {
+      x /= width;
+      result = (3 - 2*x)*x*x;
+      if (g != NULL) *g = -6*x*(1-x)/width;
+    }
+  } else {
+    result = 0.0;
+    if (g != NULL) *g = 0.0;
+  }
+  return result;
+}
+
+double hammer(double d, double rcut, double tau, double *g);
 trunc_scheme_type* hammer_new(double tau);
 double hammer_get_tau(trunc_scheme_type *trunc_scheme);
 
+double switch3(double d, double rcut, double width, double *g);
 trunc_scheme_type* switch3_new(double width);
 double switch3_get_width(trunc_scheme_type *trunc_scheme);
 
@@ -33,14 +33,15 @@ from molmod.units import *
 from yaff import *
 
 from yaff.log import log, timer
-from yaff.pes.ff import ForcePartValence, ForcePartPair
+from yaff.pes.ff import ForcePartValence, ForcePartPair, ForcePartPairComposite, \
+    ForcePartPairLambda
 from yaff.pes.ext import PairPotEI
 
 
 __all__ = [
     'Iterative', 'StateItem', 'AttributeStateItem', 'PosStateItem',
     'DipoleStateItem', 'DipoleVelStateItem', 'VolumeStateItem', 'CellStateItem',
-    'EPotContribStateItem', 'EpotBondsStateItem', 'EpotBendsStateItem',
+    'EPotContribStateItem', 'EPotLambdasStateItem', 'EpotBondsStateItem', 'EpotBendsStateItem',
     'EpotDihedsStateItem', 'Hook',
 ]
 
@@ -228,11 +229,54 @@ class EPotContribStateItem(StateItem):
     def __init__(self):
         StateItem.__init__(self, 'epot_contribs')
 
+    def _iter_parts(self, iterative):
+        # The parts in a composite part are reported separately.
+        for part in iterative.ff.parts:
+            if isinstance(part, ForcePartPairComposite):
+                for sub_part in part.parts:
+                    yield sub_part
+            else:
+                yield part
+
+    def get_value(self, iterative):
+        return np.array([part.energy for part in self._iter_parts(iterative)])
+
+    def iter_attrs(self, iterative):
+        yield 'epot_contrib_names', np.array([part.name for part in self._iter_parts(iterative)], dtype='S')
+
+
+class EPotLambdasStateItem(StateItem):
+    """Keeps track of the potential energy for a series of lambda values.
+
+       All ``ForcePartPairLambda`` objects in the force field must have the
+       same number of lambda values. The k-th element is the total potential
+       energy in which each of these parts uses its k-th lambda value. These
+       are the reduced potentials needed for MBAR, up to a factor 1/kT.
+    """
+    def __init__(self):
+        StateItem.__init__(self, 'epot_lambdas')
+
+    def _iter_parts(self, iterative):
+        for part in iterative.ff.iter_parts_pair():
+            if isinstance(part, ForcePartPairLambda):
+                yield part
+
     def get_value(self, iterative):
-        return np.array([part.energy for part in iterative.ff.parts])
+        parts = list(self._iter_parts(iterative))
+        if len(parts) == 0:
+            raise TypeError('The force field has no ForcePartPairLambda parts.')
+        result = np.zeros(len(parts[0].lambdas)) + iterative.ff.energy
+        for part in parts:
+            if len(part.lambdas) != len(result):
+                raise TypeError('All ForcePartPairLambda parts must have the same number of lambdas.')
+            result += part.lambda_energies - part.energy
+        return result
 
     def iter_attrs(self, iterative):
-        yield 'epot_contrib_names', np.array([part.name for part in iterative.ff.parts], dtype='S')
+        parts = list(self._iter_parts(iterative))
+        yield 'epot_lambdas_names', np.array([part.name for part in parts], dtype='S')
+        yield 'epot_lambdas_values', np.array([part.lambdas for part in parts])
+        yield 'epot_lambdas_current', np.array([part.lam for part in parts])
 
 
 class EpotBondsStateItem(StateItem):
@@ -87,6 +87,29 @@ def test_hdf5():
         assert f['trajectory/counter'][15] == 15
 
 
+def test_hdf5_lambdas():
+    # Couple the first water molecule with a Lennard-Jones term. The
+    # electrostatics use Ewald summation and cannot be coupled.
+    ff = get_ff_water32()
+    system = ff.system
+    sigmas = np.where(system.numbers == 8, 3.15*angstrom, 0.4*angstrom)
+    epsilons = np.where(system.numbers == 8, 0.15*kcalmol, 0.05*kcalmol)
+    pair_pot = PairPotLJ(sigmas, epsilons, 9*angstrom, Switch3(2*angstrom))
+    lambdas = np.array([0.0, 0.5, 1.0])
+    part_lambda = ForcePartPairLambda(
+        system, ff.nlist, Scalings(system, 0.0, 0.0, 1.0), pair_pot,
+        np.arange(3), lambdas)
+    ff = ForceField(system, ff.parts + [part_lambda], ff.nlist)
+    with h5.File('yaff.sampling.test.test_verlet.test_hdf5_lambdas.h5', driver='core', backing_store=False) as f:
+        hdf5 = HDF5Writer(f)
+        nve = VerletIntegrator(ff, 1.0*femtosecond, hooks=hdf5, state=[EPotLambdasStateItem()])
+        nve.run(5)
+        assert f['trajectory/epot_lambdas'].shape == (6, 3)
+        assert (f['trajectory'].attrs['epot_lambdas_values'] == lambdas).all()
+        # At full coupling, the potential energy is recovered.
+        assert abs(f['trajectory/epot_lambdas'][:,2] - f['trajectory/epot'][:]).max() < 1e-10*abs(f['trajectory/epot'][:]).max()
+
+
 def test_hdf5_start():
     with h5.File('yaff.sampling.test.test_verlet.test_hdf5_start.h5', driver='core', backing_store=False) as f:
         hdf5 = HDF5Writer(f, start=2)
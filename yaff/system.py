@@ -1061,6 +1061,8 @@ class System(object):
                 return [self.get_ffatype(i) for i in indexes]
 
         def reduce_bonds(old):
+            if old is None:
+                return None
             translation = dict((iold, inew) for inew, iold in enumerate(indexes))
             new = []
             for old0, old1 in old: